@@ -0,0 +1,848 @@
+//
+//  batch.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "compressed.h"
+#include "markers.h"
+
+#define OUTPUT_SUFFIX ".out"
+
+struct BatchChunk {
+    size_t start;
+    size_t end;
+    char *words;            // converted, one word per line
+    size_t length;
+    int word_count;         // words counted as write_word counts them
+    int first_word;         // number of the first word, from the counts of the chunks before
+    char *rows;             // words laid out in rows
+    size_t rows_length;
+};
+typedef struct BatchChunk BatchChunk;
+
+struct BatchFile {
+    const char *input_path;
+    char *output_path;      // or NULL to write to out_file
+    FILE *out_file;
+    char *text;
+    size_t size;
+    Charset charset;        // detected once for all chunks
+    Vector chunks;          // BatchChunk
+    size_t chunks_left;     // not yet converted, then not yet laid out
+    MorseFeedError error;
+};
+typedef struct BatchFile BatchFile;
+
+typedef enum BatchTaskKind {
+    TASK_READ,              // read the file and split it into chunks
+    TASK_CONVERT,           // convert a chunk to words
+    TASK_LAYOUT             // lay out the words of a chunk in rows
+} BatchTaskKind;
+
+struct BatchTask {
+    BatchTaskKind kind;
+    size_t file;
+    size_t chunk;
+};
+typedef struct BatchTask BatchTask;
+
+struct BatchQueue {
+    pthread_mutex_t mutex;
+    Vector tasks;           // the owner takes from the end, others steal from the start
+};
+typedef struct BatchQueue BatchQueue;
+
+struct BatchPool {
+    BatchQueue *queues;     // one per thread
+    int threads;
+    BatchFile *files;
+    size_t file_count;
+    const MorseFeedParams *mfp;
+    Markers markers;
+    size_t chunk_size;
+    pthread_mutex_t mutex;  // for the counts below, and chunks_left of files
+    pthread_cond_t work;
+    size_t queued;          // tasks in queues
+    size_t unfinished;      // tasks in queues or being done
+};
+typedef struct BatchPool BatchPool;
+
+struct BatchWorker {
+    BatchPool *pool;
+    int index;
+};
+typedef struct BatchWorker BatchWorker;
+
+int compare_strings(const void *a, const void *b);
+int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// Whether a file is one that converting left in the output directory, so is not to be converted.
+bool is_output_file(const char *path, const struct stat *output_dir_info);
+bool is_output_file(const char *path, const struct stat *output_dir_info)
+{
+    size_t length = strlen(path);
+    const char *slash = strrchr(path, '/');
+    char *dir;
+    struct stat info;
+    bool output = false;
+
+    if (output_dir_info != NULL && length > strlen(OUTPUT_SUFFIX) &&
+        strcmp(path + length - strlen(OUTPUT_SUFFIX), OUTPUT_SUFFIX) == 0) {
+        dir = slash == NULL ? strdup(".") : strndup(path, slash - path + 1);
+        output = dir != NULL && stat(dir, &info) == 0 && info.st_dev == output_dir_info->st_dev &&
+            info.st_ino == output_dir_info->st_ino;
+        free(dir);
+    }
+
+    return output;
+}
+
+// Files named, files in directories named, and files matching patterns, in that order. Files
+// found in output_dir that end as output files do are left out, unless named; output_dir can be NULL.
+MorseFeedError collect_inputs(const char **args, int count, const char *output_dir, StringVector *paths)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    struct stat output_info;
+    const struct stat *excluded = output_dir != NULL && stat(output_dir, &output_info) == 0 ? &output_info : NULL;
+
+    for (int k = 0; k < count && error == MF_NO_ERROR; k++) {
+        struct stat info;
+        glob_t matches;
+        size_t first = paths->size;
+
+        if (stat(args[k], &info) == 0 && S_ISDIR(info.st_mode)) {
+            DIR *dir = opendir(args[k]);
+            struct dirent *entry;
+
+            while (dir != NULL && error == MF_NO_ERROR && (entry = readdir(dir)) != NULL) {
+                char *path = NULL;
+
+                if (entry->d_name[0] != '.' && asprintf(&path, "%s/%s", args[k], entry->d_name) < 0) {
+                    error = MF_OUT_OF_MEMORY;
+
+                } else if (path != NULL && stat(path, &info) == 0 && S_ISREG(info.st_mode) &&
+                           !is_output_file(path, excluded) && !string_vector_push(paths, path)) {
+                    error = MF_OUT_OF_MEMORY;
+                }
+
+                free(path);
+            }
+
+            if (dir == NULL) error = MF_INPUT_FILE_OPEN_ERROR;
+            if (dir != NULL) closedir(dir);
+
+            qsort((char **)paths->p + first, paths->size - first, sizeof(char *), compare_strings);
+
+        } else if (strpbrk(args[k], "*?[") != NULL && glob(args[k], 0, NULL, &matches) == 0) {
+            for (size_t m = 0; m < matches.gl_pathc && error == MF_NO_ERROR; m++) {
+                if (stat(matches.gl_pathv[m], &info) == 0 && S_ISREG(info.st_mode) &&
+                    !is_output_file(matches.gl_pathv[m], excluded) && !string_vector_push(paths, matches.gl_pathv[m])) {
+                    error = MF_OUT_OF_MEMORY;
+                }
+            }
+
+            globfree(&matches);
+
+        } else if (!string_vector_push(paths, args[k])) {
+            error = MF_OUT_OF_MEMORY;
+        }
+    }
+
+    return error;
+}
+
+// A chunk ends just after white space, so that no token is split between chunks.
+size_t next_chunk_end(const char *text, size_t start, size_t end, size_t chunk_size)
+{
+    size_t k = chunk_size < end - start ? start + chunk_size : end;
+
+    while (k < end && !isspace((unsigned char)text[k])) k++;
+
+    return k < end ? k + 1 : end;
+}
+
+// The whole name is kept, so that a.txt and a.md are not both converted to a.out.
+char *output_path(const char *output_dir, const char *input_path)
+{
+    const char *name = strrchr(input_path, '/') == NULL ? input_path : strrchr(input_path, '/') + 1;
+    char *path = NULL;
+
+    if (asprintf(&path, "%s/%s" OUTPUT_SUFFIX, output_dir, name) < 0) path = NULL;
+
+    return path;
+}
+
+// False, with the error kept for the file, if the task could not be pushed.
+bool push_task(BatchPool *pool, int index, BatchTaskKind kind, size_t file, size_t chunk);
+bool push_task(BatchPool *pool, int index, BatchTaskKind kind, size_t file, size_t chunk)
+{
+    BatchQueue *queue = &pool->queues[index];
+    BatchTask task = { kind, file, chunk };
+    bool pushed;
+
+    // counted first, so that no thread finds nothing left to do while it is being pushed
+    pthread_mutex_lock(&pool->mutex);
+    pool->unfinished++;
+    pthread_mutex_unlock(&pool->mutex);
+
+    pthread_mutex_lock(&queue->mutex);
+    pushed = vector_push(&queue->tasks, &task);
+    pthread_mutex_unlock(&queue->mutex);
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pushed) {
+        pool->queued++;
+        pthread_cond_signal(&pool->work);
+
+    } else {
+        pool->files[file].error = MF_OUT_OF_MEMORY;
+        pool->unfinished--;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    return pushed;
+}
+
+bool take_task(BatchPool *pool, int index, BatchTask *task);
+bool take_task(BatchPool *pool, int index, BatchTask *task)
+{
+    bool taken = false;
+    bool done = false;
+
+    while (!taken && !done) {
+        for (int k = 0; k < pool->threads && !taken; k++) {
+            BatchQueue *queue = &pool->queues[(index + k) % pool->threads];
+
+            pthread_mutex_lock(&queue->mutex);
+            if (queue->tasks.size > 0) {
+                taken = vector_delete_at(&queue->tasks, k == 0 ? queue->tasks.size - 1 : 0, task);
+            }
+            pthread_mutex_unlock(&queue->mutex);
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        if (taken) {
+            pool->queued--;
+
+        } else {
+            while (pool->queued == 0 && pool->unfinished > 0) pthread_cond_wait(&pool->work, &pool->mutex);
+            done = pool->unfinished == 0;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    return taken;
+}
+
+void finish_task(BatchPool *pool);
+void finish_task(BatchPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    if (--pool->unfinished == 0) pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+// Writes the rows of all chunks in order, with the newline process_and_send ends with.
+void batch_write(BatchFile *file);
+void batch_write(BatchFile *file)
+{
+    MorseFeedError error = file->error;
+    FILE *out_file = file->out_file;
+
+    if (error == MF_NO_ERROR && file->output_path != NULL) {
+        out_file = fopen(file->output_path, "w");
+        if (out_file == NULL) error = MF_OUTPUT_FILE_OPEN_ERROR;
+    }
+
+    for (size_t k = 0; k < file->chunks.size && error == MF_NO_ERROR; k++) {
+        BatchChunk *chunk = (BatchChunk *)file->chunks.p + k;
+
+        if (chunk->rows_length > 0 && fwrite(chunk->rows, 1, chunk->rows_length, out_file) != chunk->rows_length) {
+            error = MF_FILE_WRITE_ERROR;
+        }
+    }
+
+    if (error == MF_NO_ERROR && fprintf(out_file, "\n") < 0) error = MF_FILE_WRITE_ERROR;
+
+    if (file->output_path != NULL && out_file != NULL) {
+        if (fclose(out_file) != 0 && error == MF_NO_ERROR) error = MF_FILE_WRITE_ERROR;
+
+    } else if (out_file != NULL && fflush(out_file) != 0 && error == MF_NO_ERROR) {
+        error = MF_FILE_WRITE_ERROR;
+    }
+
+    for (size_t k = 0; k < file->chunks.size; k++) {
+        free(((BatchChunk *)file->chunks.p)[k].words);
+        free(((BatchChunk *)file->chunks.p)[k].rows);
+    }
+
+    vector_free(&file->chunks);
+    free(file->text);
+    file->text = NULL;
+    file->error = error;
+}
+
+// Pushes a task for each chunk of a file. The chunks whose tasks could not be pushed are counted
+// as done, so that the file is still written, with the error, once the others are.
+void push_chunk_tasks(BatchPool *pool, int index, BatchTaskKind kind, size_t file_index);
+void push_chunk_tasks(BatchPool *pool, int index, BatchTaskKind kind, size_t file_index)
+{
+    BatchFile *file = &pool->files[file_index];
+    size_t count = file->chunks.size;
+    size_t pushed = 0;
+    bool last = false;
+
+    while (pushed < count && push_task(pool, index, kind, file_index, pushed)) pushed++;
+
+    if (pushed < count) {
+        pthread_mutex_lock(&pool->mutex);
+        file->chunks_left -= count - pushed;
+        last = file->chunks_left == 0;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    if (last) batch_write(file);
+}
+
+// Lays out the words of a chunk in rows, numbering them from the counts of the chunks before,
+// as write_word would have with the words of all chunks before it.
+void batch_layout(BatchPool *pool, BatchFile *file, size_t index);
+void batch_layout(BatchPool *pool, BatchFile *file, size_t index)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    BatchChunk *chunk = (BatchChunk *)file->chunks.p + index;
+    int words_per_row = pool->mfp->words_per_row == DEFAULT ? 5 : pool->mfp->words_per_row;
+    int word_count = pool->mfp->word_count;
+    int word_number = chunk->first_word;
+    FILE *rows = NULL;
+    bool last;
+
+    // a chunk after the last word is left out; the first word is always written
+    if (word_count == DEFAULT || chunk->first_word == 0 || chunk->first_word < word_count) {
+        rows = open_memstream(&chunk->rows, &chunk->rows_length);
+        if (rows == NULL) error = MF_OUT_OF_MEMORY;
+    }
+
+    for (char *word = chunk->words; rows != NULL && error == MF_NO_ERROR && word < chunk->words + chunk->length; ) {
+        char *line_end = memchr(word, '\n', chunk->words + chunk->length - word);
+
+        if (line_end != NULL) *line_end = '\0';
+        error = write_word(word, rows, NULL, NULL, words_per_row, &word_number, word_count, false, NULL);
+        word = line_end == NULL ? chunk->words + chunk->length : line_end + 1;
+    }
+
+    if (error == MF_EXIT) error = MF_NO_ERROR;
+    if (rows != NULL && fclose(rows) != 0 && error == MF_NO_ERROR) error = MF_OUT_OF_MEMORY;
+
+    free(chunk->words);
+    chunk->words = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (error != MF_NO_ERROR) file->error = error;
+    last = --file->chunks_left == 0;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (last) batch_write(file);
+}
+
+// Converts a chunk one word per row and counts its words. Once all chunks are converted, the
+// first word number of each is known and their rows can be laid out at the same time.
+void batch_chunk(BatchPool *pool, int index, size_t file_index, size_t chunk_index);
+void batch_chunk(BatchPool *pool, int index, size_t file_index, size_t chunk_index)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    BatchFile *file = &pool->files[file_index];
+    BatchChunk *chunk = (BatchChunk *)file->chunks.p + chunk_index;
+    MorseFeedParams mfp = *pool->mfp;
+    bool last;
+
+    mfp.in_file_name = NULL;
+    mfp.url = NULL;
+    mfp.follow_links = false;
+    mfp.text_after = NULL;
+    mfp.text_before = NULL;
+    mfp.words_per_row = 1;
+    mfp.word_count = DEFAULT;
+    mfp.fork_mbeep = false;
+    mfp.save_and_use_position = false;
+    mfp.show_progress = false;
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.cache_megabytes = DEFAULT;
+    mfp.start_word = DEFAULT;
+    mfp.start_offset = DEFAULT;
+    mfp.start_percent = DEFAULT;
+    mfp.back_paragraphs = DEFAULT;
+    mfp.charset = file->charset;
+
+    mfp.in_file = fmemopen(file->text + chunk->start, chunk->end - chunk->start, "r");
+    mfp.out_file = open_memstream(&chunk->words, &chunk->length);
+    if (mfp.in_file == NULL || mfp.out_file == NULL) error = MF_OUT_OF_MEMORY;
+
+    if (error == MF_NO_ERROR) error = process_and_send(mfp);
+
+    if (mfp.in_file != NULL) fclose(mfp.in_file);
+    if (mfp.out_file != NULL && fclose(mfp.out_file) != 0 && error == MF_NO_ERROR) error = MF_OUT_OF_MEMORY;
+
+    // the newline after the last row is not a word
+    if (error == MF_NO_ERROR && chunk->length > 0) chunk->length--;
+
+    // counted as write_word counts them
+    chunk->word_count = 0;
+    for (char *word = chunk->words; error == MF_NO_ERROR && word < chunk->words + chunk->length; ) {
+        char *line_end = memchr(word, '\n', chunk->words + chunk->length - word);
+        size_t length = (line_end == NULL ? chunk->words + chunk->length : line_end) - word;
+
+        if (length > 0 && !(length == 1 && *word == ' ')) chunk->word_count++;
+        word += length + 1;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if (error != MF_NO_ERROR) file->error = error;
+    last = --file->chunks_left == 0;
+    if (last && file->error == MF_NO_ERROR) file->chunks_left = file->chunks.size;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (last && file->error != MF_NO_ERROR) {
+        batch_write(file);
+
+    } else if (last) {
+        int first_word = 0;
+
+        for (size_t k = 0; k < file->chunks.size; k++) {
+            BatchChunk *next = (BatchChunk *)file->chunks.p + k;
+            next->first_word = first_word;
+            first_word += next->word_count;
+        }
+
+        free(file->text);
+        file->text = NULL;
+
+        push_chunk_tasks(pool, index, TASK_LAYOUT, file_index);
+    }
+}
+
+void batch_read(BatchPool *pool, int index, size_t file_index);
+void batch_read(BatchPool *pool, int index, size_t file_index)
+{
+    BatchFile *file = &pool->files[file_index];
+    FILE *in_file = fopen(file->input_path, "rb");
+    CompressedFormat compressed = in_file != NULL ? compressed_format(in_file) : COMPRESSED_NONE;
+    long size = -1;
+    size_t start = 0;
+    size_t end = 0;
+
+    if (in_file != NULL && compressed == COMPRESSED_NONE && fseek(in_file, 0L, SEEK_END) == 0) size = ftell(in_file);
+    if (size >= 0) file->text = malloc(size + 1);
+
+    if (in_file == NULL) {
+        file->error = MF_INPUT_FILE_OPEN_ERROR;
+
+    } else if (compressed != COMPRESSED_NONE) {
+        BufferStruct text = { NULL, 0, 0 };
+
+        file->error = decompress_read_all(in_file, compressed, &text);
+        file->text = text.p;
+        file->size = text.used > 0 ? text.used - 1 : 0;
+        if (file->text == NULL && file->error == MF_NO_ERROR) file->error = MF_OUT_OF_MEMORY;
+
+    } else if (file->text == NULL) {
+        file->error = size < 0 ? MF_FILE_READ_ERROR : MF_OUT_OF_MEMORY;
+
+    } else {
+        rewind(in_file);
+        file->size = fread(file->text, 1, size, in_file);
+        file->text[file->size] = '\0';
+        if (file->size != (size_t)size) file->error = MF_FILE_READ_ERROR;
+    }
+
+    if (in_file != NULL) fclose(in_file);
+
+    if (file->error == MF_NO_ERROR) {
+        file->charset = pool->mfp->charset != CHARSET_UNKNOWN ? pool->mfp->charset :
+            charset_detect(file->text, file->size, CHARSET_UNKNOWN);
+        markers_find_range(&pool->markers, file->text, file->size, 0, &start, &end);
+    }
+
+    while (file->error == MF_NO_ERROR && start < end) {
+        BatchChunk chunk = { start, next_chunk_end(file->text, start, end, pool->chunk_size), NULL, 0, 0, 0, NULL, 0 };
+
+        if (!vector_push(&file->chunks, &chunk)) file->error = MF_OUT_OF_MEMORY;
+        start = chunk.end;
+    }
+
+    file->chunks_left = file->error == MF_NO_ERROR ? file->chunks.size : 0;
+
+    if (file->chunks_left == 0) {
+        batch_write(file);
+
+    } else {
+        // taken back from the end by this thread, the last chunk first, while others steal from the start
+        push_chunk_tasks(pool, index, TASK_CONVERT, file_index);
+    }
+}
+
+void *batch_worker(void *arg);
+void *batch_worker(void *arg)
+{
+    BatchWorker *worker = (BatchWorker *)arg;
+    BatchPool *pool = worker->pool;
+    BatchTask task;
+
+    while (take_task(pool, worker->index, &task)) {
+        switch (task.kind) {
+            case TASK_READ:     batch_read(pool, worker->index, task.file);                 break;
+            case TASK_CONVERT:  batch_chunk(pool, worker->index, task.file, task.chunk);    break;
+            case TASK_LAYOUT:   batch_layout(pool, &pool->files[task.file], task.chunk);    break;
+        }
+
+        finish_task(pool);
+    }
+
+    return NULL;
+}
+
+int resolve_threads(int threads)
+{
+    if (threads == DEFAULT) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if (threads > BATCH_MAX_THREADS) threads = BATCH_MAX_THREADS;
+
+    return threads;
+}
+
+MorseFeedError pool_open(BatchPool *pool, const MorseFeedParams *mfp, size_t file_count, int threads,
+                         size_t chunk_size);
+MorseFeedError pool_open(BatchPool *pool, const MorseFeedParams *mfp, size_t file_count, int threads,
+                         size_t chunk_size)
+{
+    MorseFeedError error = MF_NO_ERROR;
+
+    pool->threads = threads;
+    pool->file_count = file_count;
+    pool->mfp = mfp;
+    pool->chunk_size = chunk_size;
+    pool->queued = 0;
+    pool->unfinished = 0;
+    pool->files = calloc(file_count + 1, sizeof(BatchFile));
+    pool->queues = calloc(threads, sizeof(BatchQueue));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+
+    if (pool->files == NULL || pool->queues == NULL) error = MF_OUT_OF_MEMORY;
+    if (error == MF_NO_ERROR) error = markers_compile(&pool->markers, mfp->text_after, mfp->text_before);
+
+    for (int k = 0; k < threads && pool->queues != NULL; k++) {
+        pthread_mutex_init(&pool->queues[k].mutex, NULL);
+        pool->queues[k].tasks = vector_create(0, sizeof(BatchTask));
+    }
+
+    for (size_t k = 0; k < file_count && pool->files != NULL; k++) {
+        pool->files[k].chunks = vector_create(0, sizeof(BatchChunk));
+    }
+
+    return error;
+}
+
+// Runs tasks until none are left; this thread is the first worker.
+void pool_run(BatchPool *pool);
+void pool_run(BatchPool *pool)
+{
+    BatchWorker workers[BATCH_MAX_THREADS];
+    pthread_t thread_ids[BATCH_MAX_THREADS];
+    bool started[BATCH_MAX_THREADS] = { false };
+
+    for (int k = 0; k < pool->threads; k++) {
+        workers[k].pool = pool;
+        workers[k].index = k;
+        if (k > 0) started[k] = pthread_create(&thread_ids[k], NULL, batch_worker, &workers[k]) == 0;
+    }
+
+    batch_worker(&workers[0]);
+
+    for (int k = 1; k < pool->threads; k++) {
+        if (started[k]) pthread_join(thread_ids[k], NULL);
+    }
+}
+
+void pool_close(BatchPool *pool);
+void pool_close(BatchPool *pool)
+{
+    for (int k = 0; k < pool->threads && pool->queues != NULL; k++) {
+        pthread_mutex_destroy(&pool->queues[k].mutex);
+        vector_free(&pool->queues[k].tasks);
+    }
+
+    markers_free(&pool->markers);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->work);
+    free(pool->queues);
+    free(pool->files);
+}
+
+MorseFeedError batch_convert(const StringVector *paths, const char *output_dir, const MorseFeedParams *mfp,
+                             int threads, size_t chunk_size)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    BatchPool pool;
+    double start_time = monotonic_seconds();
+    double seconds;
+    size_t converted = 0;
+    double megabytes = 0;
+
+    threads = resolve_threads(threads);
+
+    error = pool_open(&pool, mfp, paths->size, threads, chunk_size);
+    if (error == MF_NO_ERROR && mkdir(output_dir, 0777) != 0 && errno != EEXIST) error = MF_OUTPUT_FILE_OPEN_ERROR;
+
+    for (size_t k = 0; k < pool.file_count && error == MF_NO_ERROR; k++) {
+        BatchFile *file = &pool.files[k];
+
+        file->input_path = string_vector_at((StringVector *)paths, k);
+        file->output_path = output_path(output_dir, file->input_path);
+        file->error = file->output_path == NULL ? MF_OUT_OF_MEMORY : MF_NO_ERROR;
+
+        // spread out at first; after that, threads with nothing left steal
+        push_task(&pool, (int)(k % threads), TASK_READ, k, 0);
+    }
+
+    if (error == MF_NO_ERROR) pool_run(&pool);
+
+    seconds = monotonic_seconds() - start_time;
+
+    for (size_t k = 0; k < pool.file_count && pool.files != NULL; k++) {
+        BatchFile *file = &pool.files[k];
+
+        if (file->error == MF_NO_ERROR) {
+            converted++;
+            megabytes += file->size / 1e6;
+
+        } else {
+            fprintf(stderr, "(could not convert %s: error %d)\n", file->input_path, file->error);
+            if (error == MF_NO_ERROR) error = file->error;
+        }
+
+        free(file->output_path);
+    }
+
+    if (converted > 0) {
+        fprintf(stderr, "(%ld files, %.1f MB in %.2f seconds on %d threads: %.1f files/s, %.1f MB/s)\n",
+                (long)converted, megabytes, seconds, threads,
+                seconds > 0 ? converted / seconds : 0, seconds > 0 ? megabytes / seconds : 0);
+    }
+
+    pool_close(&pool);
+
+    return error;
+}
+
+// Only a plain file large enough to be worth splitting, converted straight to text, is.
+bool can_convert_in_parallel(const MorseFeedParams *mfp, int threads)
+{
+    struct stat info;
+
+    return mfp->in_file_name != NULL && mfp->url == NULL && !mfp->follow_links && !mfp->fork_mbeep &&
+           !mfp->save_and_use_position && !mfp->show_progress && mfp->time_limit_minutes == DEFAULT &&
+           mfp->cache_megabytes == DEFAULT && mfp->start_word == DEFAULT && mfp->start_percent == DEFAULT &&
+           mfp->back_paragraphs == DEFAULT && mfp->tee_files == NULL && mfp->tee_mbeeps == NULL &&
+           resolve_threads(threads) > 1 && stat(mfp->in_file_name, &info) == 0 && S_ISREG(info.st_mode) &&
+           info.st_size >= 2 * BATCH_CHUNK_SIZE;
+}
+
+MorseFeedError convert_in_parallel(const MorseFeedParams *mfp, int threads, size_t chunk_size)
+{
+    MorseFeedError error;
+    BatchPool pool;
+
+    error = pool_open(&pool, mfp, 1, resolve_threads(threads), chunk_size);
+
+    if (error == MF_NO_ERROR) {
+        pool.files[0].input_path = mfp->in_file_name;
+        pool.files[0].out_file = mfp->out_file == NULL ? stdout : mfp->out_file;
+
+        push_task(&pool, 0, TASK_READ, 0, 0);
+        pool_run(&pool);
+
+        error = pool.files[0].error;
+    }
+
+    pool_close(&pool);
+
+    return error;
+}
+
+// Converts one file to a file at out_path on this thread, as --batch would.
+MorseFeedError convert_file(const MorseFeedParams *mfp, const char *input_path, const char *out_path)
+{
+    MorseFeedError error;
+    BatchPool pool;
+
+    error = pool_open(&pool, mfp, 1, 1, BATCH_CHUNK_SIZE);
+
+    if (error == MF_NO_ERROR) {
+        pool.files[0].input_path = input_path;
+        pool.files[0].output_path = (char *)out_path;
+
+        push_task(&pool, 0, TASK_READ, 0, 0);
+        pool_run(&pool);
+
+        error = pool.files[0].error;
+    }
+
+    pool_close(&pool);
+
+    return error;
+}
+
+#if DEBUG
+void batch_tests(void)
+{
+    bool ok = true;
+    const char *text = "one two  three\nfour";
+    const char *sentence = "The \"quick\" brown fox (aged 7) jumps over 12 lazy dogs; what a day! ";
+    const char *inputs[] = { "batch.tmp.d/in.txt" };
+    StringVector paths = string_vector_create(0);
+    MorseFeedParams mfp;
+    FILE *file;
+    char *expected = NULL;
+    size_t expected_length = 0;
+    char actual[65536];
+    size_t actual_length = 0;
+    printf("batch_tests()\n");
+
+    ok &= print_if_fail(next_chunk_end(text, 0, 19, 2) == 4, "FAIL: next_chunk_end (1)");
+    ok &= print_if_fail(next_chunk_end(text, 4, 19, 3) == 8, "FAIL: next_chunk_end (2)");
+    ok &= print_if_fail(next_chunk_end(text, 8, 19, 1) == 15, "FAIL: next_chunk_end (3)");
+    ok &= print_if_fail(next_chunk_end(text, 15, 19, 1) == 19, "FAIL: next_chunk_end (4)");
+    ok &= print_if_fail(next_chunk_end(text, 0, 19, 100) == 19, "FAIL: next_chunk_end (5)");
+
+    memset(&mfp, 0, sizeof(mfp));
+    mfp.words_per_row = 3;
+    mfp.word_count = DEFAULT;
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.max_megabytes = DEFAULT;
+    mfp.crawl_depth = DEFAULT;
+
+    mkdir("batch.tmp.d", 0777);
+    file = fopen(inputs[0], "w");
+    for (int k = 0; file != NULL && k < 200; k++) fprintf(file, "%d %s\n", k, sentence);
+    if (file != NULL) fclose(file);
+
+    // converted whole, as without --batch
+    mfp.in_file = fopen(inputs[0], "r");
+    mfp.out_file = open_memstream(&expected, &expected_length);
+    ok &= print_if_fail(process_and_send(mfp) == MF_NO_ERROR, "FAIL: batch_convert (1)");
+    fclose(mfp.in_file);
+    fclose(mfp.out_file);
+    mfp.in_file = NULL;
+    mfp.out_file = NULL;
+
+    // in many small chunks, on several threads
+    ok &= print_if_fail(collect_inputs(inputs, 1, "batch.tmp.d", &paths) == MF_NO_ERROR && paths.size == 1,
+                        "FAIL: collect_inputs (1)");
+    ok &= print_if_fail(batch_convert(&paths, "batch.tmp.d", &mfp, 4, 50) == MF_NO_ERROR, "FAIL: batch_convert (2)");
+
+    file = fopen("batch.tmp.d/in.txt.out", "r");
+    if (file != NULL) {
+        actual_length = fread(actual, 1, sizeof(actual), file);
+        fclose(file);
+    }
+
+    ok &= print_if_fail(actual_length == expected_length && memcmp(actual, expected, actual_length) == 0,
+                        "FAIL: batch_convert (3)");
+
+    // a single input, stopped part way through a chunk
+    free(expected);
+    expected = NULL;
+    mfp.word_count = 137;
+    mfp.in_file = fopen(inputs[0], "r");
+    mfp.out_file = open_memstream(&expected, &expected_length);
+    ok &= print_if_fail(process_and_send(mfp) == MF_EXIT, "FAIL: convert_in_parallel (1)");
+    fclose(mfp.in_file);
+    fclose(mfp.out_file);
+
+    mfp.in_file = NULL;
+    mfp.in_file_name = inputs[0];
+    mfp.out_file = fmemopen(actual, sizeof(actual), "w");
+    ok &= print_if_fail(convert_in_parallel(&mfp, 4, 50) == MF_NO_ERROR, "FAIL: convert_in_parallel (2)");
+    actual_length = ftell(mfp.out_file);
+    fclose(mfp.out_file);
+    mfp.out_file = NULL;
+
+    ok &= print_if_fail(actual_length == expected_length && memcmp(actual, expected, actual_length) == 0,
+                        "FAIL: convert_in_parallel (3)");
+    ok &= print_if_fail(!can_convert_in_parallel(&mfp, 4), "FAIL: can_convert_in_parallel (1)");
+
+    string_vector_free(&paths);
+    paths = string_vector_create(0);
+    inputs[0] = "batch.tmp.d";
+    // what was converted to the output directory is not converted again
+    ok &= print_if_fail(collect_inputs(inputs, 1, "batch.tmp.d", &paths) == MF_NO_ERROR && paths.size == 1 &&
+                        strcmp(string_vector_at(&paths, 0), "batch.tmp.d/in.txt") == 0, "FAIL: collect_inputs (2)");
+    string_vector_free(&paths);
+    paths = string_vector_create(0);
+    inputs[0] = "batch.tmp.d/*";
+    ok &= print_if_fail(collect_inputs(inputs, 1, "./batch.tmp.d/", &paths) == MF_NO_ERROR && paths.size == 1,
+                        "FAIL: collect_inputs (3)");
+    string_vector_free(&paths);
+    paths = string_vector_create(0);
+    ok &= print_if_fail(collect_inputs(inputs, 1, NULL, &paths) == MF_NO_ERROR && paths.size == 2,
+                        "FAIL: collect_inputs (4)");
+
+    // files of the same stem are not converted to the same file
+    char *a = output_path("out", "dir/a.txt");
+    char *b = output_path("out", "a.md");
+    ok &= print_if_fail(a != NULL && b != NULL && strcmp(a, "out/a.txt.out") == 0 && strcmp(b, "out/a.md.out") == 0,
+                        "FAIL: output_path");
+    free(a);
+    free(b);
+
+    string_vector_free(&paths);
+    free(expected);
+    remove("batch.tmp.d/in.txt");
+    remove("batch.tmp.d/in.txt.out");
+    rmdir("batch.tmp.d");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,60 @@
+//
+//  batch.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef batch_h
+#define batch_h
+
+#include <stddef.h>
+
+#include "morsefeed.h"
+#include "vector.h"
+
+// With --batch, each input file is converted to a file of its whole name with .out added in the
+// output directory, on a pool of threads. Each thread takes tasks from its own queue and, when
+// that is empty, steals from the others. Reading a file is one task; it splits the text at
+// spaces into chunks of about BATCH_CHUNK_SIZE bytes, each converted by another task. The
+// thread that converts the last chunk numbers the words of each from the counts of the chunks
+// before, so that the chunks can be laid out in rows at the same time too. The output is the
+// same as converting the file alone. A single large input file given with -i is converted the
+// same way, to the output file or stdout.
+#define BATCH_CHUNK_SIZE (1 << 20)
+#define BATCH_MAX_THREADS 64
+
+MorseFeedError collect_inputs(const char **args, int count, const char *output_dir, StringVector *paths);
+int resolve_threads(int threads);
+char *output_path(const char *output_dir, const char *input_path);
+size_t next_chunk_end(const char *text, size_t start, size_t end, size_t chunk_size);
+MorseFeedError batch_convert(const StringVector *paths, const char *output_dir, const MorseFeedParams *mfp,
+                             int threads, size_t chunk_size);
+bool can_convert_in_parallel(const MorseFeedParams *mfp, int threads);
+MorseFeedError convert_in_parallel(const MorseFeedParams *mfp, int threads, size_t chunk_size);
+MorseFeedError convert_file(const MorseFeedParams *mfp, const char *input_path, const char *out_path);
+
+#if DEBUG
+void batch_tests(void);
+#endif
+
+#endif /* batch_h */
@@ -0,0 +1,344 @@
+//
+//  boiler.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "boiler.h"
+#include "vector.h"
+
+#define SHINGLE_BASE 1099511628211ULL
+
+struct Paragraph {
+    size_t start;
+    size_t end;
+};
+typedef struct Paragraph Paragraph;
+
+// Open-addressing table from shingle hash to the number of pages it appears on
+struct ShingleCount {
+    uint64_t hash;          // 0 for an empty slot
+    uint32_t pages;
+    uint32_t last_page;
+};
+typedef struct ShingleCount ShingleCount;
+
+struct ShingleTable {
+    ShingleCount *slots;
+    size_t capacity;        // always a power of 2
+    size_t size;
+};
+typedef struct ShingleTable ShingleTable;
+
+ShingleCount *shingle_slot(ShingleTable *table, uint64_t hash);
+ShingleCount *shingle_slot(ShingleTable *table, uint64_t hash)
+{
+    size_t k = hash & (table->capacity - 1);
+
+    while (table->slots[k].hash != 0 && table->slots[k].hash != hash) k = (k + 1) & (table->capacity - 1);
+
+    return &table->slots[k];
+}
+
+// Counts a page for hash, once per page
+bool count_shingle(ShingleTable *table, uint64_t hash, uint32_t page);
+bool count_shingle(ShingleTable *table, uint64_t hash, uint32_t page)
+{
+    ShingleCount *slot;
+
+    // keep load factor at or below 1/2
+    if (2 * (table->size + 1) > table->capacity) {
+        ShingleTable bigger = { NULL, table->capacity == 0 ? 1024 : 2 * table->capacity, 0 };
+
+        bigger.slots = calloc(bigger.capacity, sizeof(ShingleCount));
+        if (bigger.slots == NULL) return false;
+
+        for (size_t k = 0; k < table->capacity; k++) {
+            if (table->slots[k].hash != 0) *shingle_slot(&bigger, table->slots[k].hash) = table->slots[k];
+        }
+
+        bigger.size = table->size;
+        free(table->slots);
+        *table = bigger;
+    }
+
+    slot = shingle_slot(table, hash);
+
+    if (slot->hash == 0) {
+        slot->hash = hash;
+        slot->pages = 1;
+        slot->last_page = page;
+        table->size++;
+
+    } else if (slot->last_page != page) {
+        slot->pages++;
+        slot->last_page = page;
+    }
+
+    return true;
+}
+
+uint32_t shingle_pages(ShingleTable *table, uint64_t hash);
+uint32_t shingle_pages(ShingleTable *table, uint64_t hash)
+{
+    return table->capacity == 0 ? 0 : shingle_slot(table, hash)->pages;
+}
+
+bool is_block_tag(const char *text, size_t length);
+bool is_block_tag(const char *text, size_t length)
+{
+    static const char *names[] = {
+        "p", "div", "br", "li", "ul", "ol", "dl", "dt", "dd", "h1", "h2", "h3", "h4", "h5", "h6",
+        "tr", "table", "section", "article", "header", "footer", "nav", "aside", "main",
+        "blockquote", "pre", "hr", "form", "figure", "figcaption"
+    };
+    size_t name_start = 1;
+    size_t name_length = 0;
+    char name[12];
+
+    while (name_start + name_length < length && name_length < sizeof(name) - 1 &&
+           isalnum((unsigned char)text[name_start + name_length])) {
+        name[name_length] = tolower((unsigned char)text[name_start + name_length]);
+        name_length++;
+    }
+    name[name_length] = '\0';
+
+    for (size_t k = 0; k < sizeof(names) / sizeof(names[0]); k++) {
+        if (strcmp(name, names[k]) == 0) return true;
+    }
+
+    return false;
+}
+
+// Paragraphs start at opening block tags and after blank lines; closing tags stay with the
+// paragraph they close
+bool split_paragraphs(const char *text, size_t start, size_t end, Vector *paragraphs);
+bool split_paragraphs(const char *text, size_t start, size_t end, Vector *paragraphs)
+{
+    bool success = true;
+    Paragraph paragraph = { start, start };
+    size_t newlines = 0;
+
+    for (size_t k = start; k < end && success; k++) {
+        bool boundary = (text[k] == '<' && k + 1 < end && text[k + 1] != '/' && is_block_tag(&text[k], end - k)) ||
+            (newlines >= 2 && !isspace((unsigned char)text[k]));
+
+        if (text[k] == '\n') {
+            newlines++;
+
+        } else if (!isspace((unsigned char)text[k])) {
+            newlines = 0;
+        }
+
+        if (boundary && k > paragraph.start) {
+            paragraph.end = k;
+            success = vector_push(paragraphs, &paragraph);
+            paragraph.start = k;
+        }
+    }
+
+    if (success && end > paragraph.start) {
+        paragraph.end = end;
+        success = vector_push(paragraphs, &paragraph);
+    }
+
+    return success;
+}
+
+// Sets shingles to the hashes of each run of SHINGLE_WORDS words outside tags, or of all the
+// words if there are fewer
+bool paragraph_shingles(const char *text, const Paragraph *paragraph, Vector *shingles);
+bool paragraph_shingles(const char *text, const Paragraph *paragraph, Vector *shingles)
+{
+    bool success = true;
+    uint64_t words[SHINGLE_WORDS];
+    size_t word_count = 0;
+    size_t k = paragraph->start;
+
+    shingles->size = 0;
+
+    while (k < paragraph->end && success) {
+        if (text[k] == '<') {
+            while (k < paragraph->end && text[k] != '>') k++;
+            k++;
+
+        } else if (isspace((unsigned char)text[k])) {
+            k++;
+
+        } else {
+            size_t word_start = k;
+
+            while (k < paragraph->end && text[k] != '<' && !isspace((unsigned char)text[k])) k++;
+
+            words[word_count % SHINGLE_WORDS] = hash_bytes(&text[word_start], k - word_start, 0);
+            word_count++;
+
+            if (word_count >= SHINGLE_WORDS) {
+                uint64_t shingle = 0;
+
+                for (size_t w = word_count - SHINGLE_WORDS; w < word_count; w++) {
+                    shingle = shingle * SHINGLE_BASE + words[w % SHINGLE_WORDS];
+                }
+
+                shingle |= 1;   // never 0
+                success = vector_push(shingles, &shingle);
+            }
+        }
+    }
+
+    if (success && word_count > 0 && word_count < SHINGLE_WORDS) {
+        uint64_t shingle = 0;
+
+        for (size_t w = 0; w < word_count; w++) shingle = shingle * SHINGLE_BASE + words[w];
+
+        shingle |= 1;
+        success = vector_push(shingles, &shingle);
+    }
+
+    return success;
+}
+
+// Removes common paragraphs from the part of each page between its markers, leaving a newline
+// in place of each; returns the number of bytes removed
+size_t remove_boilerplate(BufferStruct *pages, size_t count, const Markers *markers)
+{
+    ShingleTable table = { NULL, 0, 0 };
+    Vector *paragraphs = calloc(count, sizeof(Vector));
+    Vector shingles = vector_create(64, sizeof(uint64_t));
+    size_t *starts = calloc(count, sizeof(size_t));
+    size_t *ends = calloc(count, sizeof(size_t));
+    size_t removed = 0;
+    bool success = paragraphs != NULL && shingles.p != NULL && starts != NULL && ends != NULL && count >= 2;
+
+    // count the pages each shingle is on
+    for (size_t page = 0; page < count && success; page++) {
+        BufferStruct *buffer = &pages[page];
+
+        if (buffer->p == NULL) continue;
+
+        markers_find_range(markers, buffer->p, buffer->used - 1, 0, &starts[page], &ends[page]);
+
+        paragraphs[page] = vector_create(0, sizeof(Paragraph));
+        success = split_paragraphs(buffer->p, starts[page], ends[page], &paragraphs[page]);
+
+        for (size_t k = 0; k < paragraphs[page].size && success; k++) {
+            success = paragraph_shingles(buffer->p, (Paragraph *)paragraphs[page].p + k, &shingles);
+
+            for (size_t s = 0; s < shingles.size && success; s++) {
+                success = count_shingle(&table, ((uint64_t *)shingles.p)[s], (uint32_t)page);
+            }
+        }
+    }
+
+    // remove paragraphs most of whose shingles are on most pages
+    for (size_t page = 0; page < count && success; page++) {
+        BufferStruct *buffer = &pages[page];
+        size_t to;
+
+        if (buffer->p == NULL) continue;
+
+        to = starts[page];
+
+        for (size_t k = 0; k < paragraphs[page].size && success; k++) {
+            Paragraph *paragraph = (Paragraph *)paragraphs[page].p + k;
+            size_t common = 0;
+
+            success = paragraph_shingles(buffer->p, paragraph, &shingles);
+
+            for (size_t s = 0; s < shingles.size; s++) {
+                uint32_t on_pages = shingle_pages(&table, ((uint64_t *)shingles.p)[s]);
+                if (on_pages >= 2 && 2 * on_pages > count) common++;
+            }
+
+            if (shingles.size > 0 && 2 * common >= shingles.size) {
+                buffer->p[to++] = '\n';
+                removed += paragraph->end - paragraph->start - 1;
+
+            } else {
+                memmove(&buffer->p[to], &buffer->p[paragraph->start], paragraph->end - paragraph->start);
+                to += paragraph->end - paragraph->start;
+            }
+        }
+
+        // the rest of the page, with its terminating nul
+        memmove(&buffer->p[to], &buffer->p[ends[page]], buffer->used - ends[page]);
+        buffer->used -= ends[page] - to;
+    }
+
+    for (size_t page = 0; paragraphs != NULL && page < count; page++) vector_free(&paragraphs[page]);
+
+    free(paragraphs);
+    free(starts);
+    free(ends);
+    free(table.slots);
+    vector_free(&shingles);
+
+    return removed;
+}
+
+#if DEBUG
+void boiler_tests(void)
+{
+    bool ok = true;
+    const char *texts[] = {
+        "<html><nav>Home News Sports Weather Contact</nav><p>First article about the river flooding "
+        "in town.</p><footer>Copyright 2021 Example News all rights reserved</footer></html>",
+        "<html><nav>Home News Sports Weather Contact</nav><p>Second article, on the school board "
+        "meeting.</p>\n\nIt went late.<footer>Copyright 2021 Example News all rights reserved</footer></html>",
+        "<html><nav>Home News Sports Weather Contact</nav><p>Third article: a new bakery opens on "
+        "Main Street.</p><footer>Copyright 2022 Example News</footer></html>",
+    };
+    BufferStruct pages[3];
+    Markers markers;
+    printf("boiler_tests()\n");
+
+    for (size_t k = 0; k < 3; k++) {
+        init_buffer(&pages[k], strlen(texts[k]) + 1);
+        strcpy(pages[k].p, texts[k]);
+        pages[k].used = strlen(texts[k]) + 1;
+    }
+
+    markers_compile(&markers, "<html>", "</html>");
+    ok &= print_if_fail(remove_boilerplate(pages, 3, &markers) > 0, "FAIL: remove_boilerplate (1)");
+    ok &= print_if_fail(strcmp(pages[0].p, "<html>\n<p>First article about the river flooding in town.</p>\n</html>") == 0,
+                        "FAIL: remove_boilerplate (2)");
+    ok &= print_if_fail(strstr(pages[1].p, "It went late.") != NULL && strstr(pages[1].p, "Sports") == NULL,
+                        "FAIL: remove_boilerplate (3)");
+    ok &= print_if_fail(strstr(pages[2].p, "Copyright 2022") != NULL, "FAIL: remove_boilerplate (4)");
+    ok &= print_if_fail(pages[0].used == strlen(pages[0].p) + 1, "FAIL: remove_boilerplate (5)");
+
+    // one page alone has nothing in common
+    ok &= print_if_fail(remove_boilerplate(pages, 1, &markers) == 0, "FAIL: remove_boilerplate (6)");
+
+    markers_free(&markers);
+    for (size_t k = 0; k < 3; k++) free_buffer(&pages[k]);
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,677 @@
+//
+//  book.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "book.h"
+#include "compressed.h"
+#include "markers.h"
+#include "state.h"
+#include "tee.h"
+#include "vector.h"
+
+#define BOOK_ALIGN(size) (((size) + 7) & ~(size_t)7)
+#define READ_SIZE 65536
+
+// Words and their source offsets as they are converted, for writing a book.
+struct BookWords {
+    StringMap vocabulary;           // word to index
+    Vector string_offsets;          // uint32_t
+    Vector strings;                 // char
+    Vector words;                   // uint32_t
+    Vector source_offsets;          // uint32_t
+    Vector offset_steps;            // uint32_t, as written
+    Vector offsets;                 // char, as written
+    size_t token_offset;            // of the token being converted
+    bool mem_error;
+};
+typedef struct BookWords BookWords;
+
+// Only a regular file is looked at, so that piped input is left to be read.
+bool is_book(const char *path)
+{
+    char magic[sizeof(BOOK_MAGIC) - 1];
+    struct stat info;
+    FILE *file = stat(path, &info) == 0 && S_ISREG(info.st_mode) ? fopen(path, "rb") : NULL;
+    bool book = file != NULL && fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+        memcmp(magic, BOOK_MAGIC, sizeof(magic)) == 0;
+
+    if (file != NULL) fclose(file);
+
+    return book;
+}
+
+// Reads all of a file or stream, which may not be able to seek.
+MorseFeedError read_whole_file(FILE *file, BufferStruct *buffer)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    size_t count = 1;
+
+    init_buffer(buffer, READ_SIZE);
+    if (buffer->p == NULL) return MF_OUT_OF_MEMORY;
+    buffer->used = 1;
+
+    while (error == MF_NO_ERROR && count > 0) {
+        if (buffer->capacity - buffer->used < READ_SIZE) {
+            char *p = realloc(buffer->p, 2 * buffer->capacity);
+
+            if (p == NULL) {
+                error = MF_OUT_OF_MEMORY;
+
+            } else {
+                buffer->p = p;
+                buffer->capacity *= 2;
+            }
+        }
+
+        if (error == MF_NO_ERROR) {
+            count = fread(buffer->p + buffer->used - 1, 1, READ_SIZE, file);
+            buffer->used += count;
+        }
+    }
+
+    if (error == MF_NO_ERROR && ferror(file)) error = MF_FILE_READ_ERROR;
+    buffer->p[buffer->used - 1] = '\0';
+
+    return error;
+}
+
+bool push_u32(Vector *vector, size_t value, bool *mem_error);
+bool push_u32(Vector *vector, size_t value, bool *mem_error)
+{
+    uint32_t u32 = (uint32_t)value;
+
+    if (value > UINT32_MAX || !vector_push(vector, &u32)) *mem_error = true;
+
+    return !*mem_error;
+}
+
+bool push_varint(Vector *vector, uint64_t value, bool *mem_error);
+bool push_varint(Vector *vector, uint64_t value, bool *mem_error)
+{
+    for (; value >= 0x80 && !*mem_error; value >>= 7) {
+        char byte = (char)((value & 0x7F) | 0x80);
+        if (!vector_push(vector, &byte)) *mem_error = true;
+    }
+
+    if (!*mem_error && !vector_push(vector, &(char){ (char)value })) *mem_error = true;
+
+    return !*mem_error;
+}
+
+bool add_book_word(void *context, char *word, WordRule rule);
+bool add_book_word(void *context, char *word, WordRule rule)
+{
+    BookWords *book_words = (BookWords *)context;
+    size_t index;
+
+    if (!string_map_get(&book_words->vocabulary, word, &index)) {
+        index = book_words->string_offsets.size;
+
+        book_words->mem_error |= !push_u32(&book_words->string_offsets, book_words->strings.size,
+                                           &book_words->mem_error) ||
+            !string_map_put(&book_words->vocabulary, word, index);
+
+        for (const char *c = word; !book_words->mem_error && c <= word + strlen(word); c++) {
+            book_words->mem_error = !vector_push(&book_words->strings, c);
+        }
+    }
+
+    if (index >= BOOK_WORD_TOKEN) book_words->mem_error = true;
+    push_u32(&book_words->words, index | (rule == WORD_ALWAYS ? BOOK_WORD_ALWAYS : 0), &book_words->mem_error);
+    push_u32(&book_words->source_offsets, book_words->token_offset, &book_words->mem_error);
+
+    return !book_words->mem_error;
+}
+
+bool write_padded(FILE *file, const void *p, size_t size);
+bool write_padded(FILE *file, const void *p, size_t size)
+{
+    static const char zeros[8] = { 0 };
+
+    return (size == 0 || fwrite(p, size, 1, file) == 1) &&
+        (BOOK_ALIGN(size) == size || fwrite(zeros, BOOK_ALIGN(size) - size, 1, file) == 1);
+}
+
+// Converts the text between the markers and writes the book to a temporary file, renamed to
+// book_path once it is whole. Tokens are split as the first stage of the pipeline splits them.
+MorseFeedError book_compile(const MorseFeedParams *mfp, const char *book_path)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    BufferStruct text = { NULL, 0, 0 };
+    Markers markers = { { 0 } };
+    BookWords book_words;
+    BookHeader header;
+    bool filter_html = mfp->url != NULL;
+    size_t start = 0;
+    size_t end = 0;
+    char *temp_path = malloc(strlen(book_path) + strlen(".XXXXXX") + 1);
+    FILE *file = NULL;
+    int fd = -1;
+
+    memset(&book_words, 0, sizeof(book_words));
+    book_words.vocabulary = string_map_create(0);
+    book_words.string_offsets = vector_create(0, sizeof(uint32_t));
+    book_words.strings = vector_create(0, sizeof(char));
+    book_words.words = vector_create(0, sizeof(uint32_t));
+    book_words.source_offsets = vector_create(0, sizeof(uint32_t));
+    book_words.offset_steps = vector_create(0, sizeof(uint32_t));
+    book_words.offsets = vector_create(0, sizeof(char));
+
+    if (temp_path == NULL) error = MF_OUT_OF_MEMORY;
+    if (error == MF_NO_ERROR) error = markers_compile(&markers, mfp->text_after, mfp->text_before);
+
+    if (error == MF_NO_ERROR && mfp->url != NULL) {
+        error = url_to_buffer(mfp->url, &text);
+        if (error == MF_NO_ERROR && text.p == NULL) error = MF_URL_READ_ERROR;
+
+    } else if (error == MF_NO_ERROR) {
+        FILE *in_file = mfp->in_file == NULL ? stdin : mfp->in_file;
+        CompressedFormat compressed = compressed_format(in_file);
+
+        if (compressed != COMPRESSED_NONE) {
+            error = decompress_read_all(in_file, compressed, &text);
+
+        } else {
+            error = read_whole_file(in_file, &text);
+        }
+    }
+
+    if (error == MF_NO_ERROR) {
+        markers_find_range(&markers, text.p, text.used - 1, 0, &start, &end);
+        if (end > text.used - 1 || end > UINT32_MAX) error = MF_INVALID_VALUE;
+    }
+
+    if (error == MF_NO_ERROR) {
+        bool excluding_tag = false;
+        char entity[ENTITY_SIZE] = "";
+        char tag[TAG_SIZE] = "";
+        char token[LINE_SIZE + sizeof(uint32_t)];
+        char stripped[STRIPPED_SIZE];
+        size_t position = start;
+        const CharsetBytes *charset = charset_table(mfp->charset != CHARSET_UNKNOWN ? mfp->charset :
+                                                    charset_detect(text.p, text.used - 1, text.charset));
+
+        while (error == MF_NO_ERROR && !book_words.mem_error &&
+               next_token(text.p, end, &position, charset, token, &book_words.token_offset)) {
+            strip_token(token, stripped, filter_html, &excluding_tag, entity, tag);
+            error = convert_token(stripped, add_book_word, &book_words);
+            if (error == MF_EXIT) error = MF_OUT_OF_MEMORY;
+        }
+
+        if (book_words.mem_error) error = MF_OUT_OF_MEMORY;
+    }
+
+    if (error == MF_NO_ERROR) {
+        const uint32_t *offsets = book_words.source_offsets.p;
+        uint32_t *words = book_words.words.p;
+        size_t word = 0;
+
+        for (size_t k = 0; k < book_words.words.size && !book_words.mem_error; k++) {
+            bool step = k % BOOK_OFFSET_STEP == 0;
+
+            if (step) push_u32(&book_words.offset_steps, book_words.offsets.size, &book_words.mem_error);
+            if (k == 0 || offsets[k] != offsets[k - 1]) words[k] |= BOOK_WORD_TOKEN;
+            push_varint(&book_words.offsets, step ? offsets[k] : offsets[k] - offsets[k - 1], &book_words.mem_error);
+        }
+
+        if (book_words.mem_error) error = MF_OUT_OF_MEMORY;
+
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BOOK_MAGIC, sizeof(header.magic));
+        header.word_count = book_words.words.size;
+        header.vocabulary_size = book_words.string_offsets.size;
+        header.strings_size = book_words.strings.size;
+        header.offsets_size = book_words.offsets.size;
+        header.text_start = start;
+        header.text_end = end;
+
+        for (int percent = 0; percent <= 100; percent++) {
+            size_t offset = start + (end - start) * percent / 100;
+
+            while (word < book_words.words.size && offsets[word] < offset) word++;
+            header.percent_words[percent] = (uint32_t)word;
+        }
+    }
+
+    if (error == MF_NO_ERROR) {
+        sprintf(temp_path, "%s.XXXXXX", book_path);
+        fd = mkstemp(temp_path);
+        file = fd < 0 ? NULL : fdopen(fd, "wb");
+        if (file == NULL) error = MF_OUTPUT_FILE_OPEN_ERROR;
+    }
+
+    if (error == MF_NO_ERROR &&
+        (!write_padded(file, &header, sizeof(header)) ||
+         !write_padded(file, book_words.string_offsets.p, book_words.string_offsets.size * sizeof(uint32_t)) ||
+         !write_padded(file, book_words.strings.p, book_words.strings.size) ||
+         !write_padded(file, book_words.words.p, book_words.words.size * sizeof(uint32_t)) ||
+         !write_padded(file, book_words.offset_steps.p, book_words.offset_steps.size * sizeof(uint32_t)) ||
+         !write_padded(file, book_words.offsets.p, book_words.offsets.size))) {
+        error = MF_FILE_WRITE_ERROR;
+    }
+
+    if (file != NULL) {
+        if (fclose(file) != 0 && error == MF_NO_ERROR) error = MF_FILE_WRITE_ERROR;
+
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    if (fd >= 0) {
+        if (error == MF_NO_ERROR && rename(temp_path, book_path) != 0) error = MF_FILE_WRITE_ERROR;
+        if (error != MF_NO_ERROR) remove(temp_path);
+    }
+
+    if (error == MF_NO_ERROR) {
+        fprintf(stderr, "(%ld words, %ld different)\n", (long)book_words.words.size,
+                (long)book_words.string_offsets.size);
+    }
+
+    free(temp_path);
+    free_buffer(&text);
+    markers_free(&markers);
+    string_map_free(&book_words.vocabulary);
+    vector_free(&book_words.string_offsets);
+    vector_free(&book_words.strings);
+    vector_free(&book_words.words);
+    vector_free(&book_words.source_offsets);
+    vector_free(&book_words.offset_steps);
+    vector_free(&book_words.offsets);
+
+    return error;
+}
+
+// What playing reads without checking: the percentage index, the source offsets, and where
+// each step of them starts.
+bool book_checked(const Book *book);
+bool book_checked(const Book *book)
+{
+    const BookHeader *header = book->header;
+    size_t next = 0;
+    uint64_t offset = 0;
+    uint64_t previous = 0;
+
+    for (int percent = 0; percent <= 100; percent++) {
+        if (header->percent_words[percent] > header->word_count ||
+            (percent > 0 && header->percent_words[percent] < header->percent_words[percent - 1])) {
+            return false;
+        }
+    }
+
+    for (size_t k = 0; k < header->word_count; k++) {
+        uint64_t delta;
+
+        if (k % BOOK_OFFSET_STEP == 0) {
+            if (book->offset_steps[k / BOOK_OFFSET_STEP] != next) return false;
+            offset = 0;
+        }
+
+        if (!read_varint(book->offsets, header->offsets_size, &next, &delta)) return false;
+        offset += delta;
+        if (offset < previous || offset > header->text_end) return false;
+        previous = offset;
+    }
+
+    return next == header->offsets_size;
+}
+
+MorseFeedError book_open(Book *book, const char *path)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+
+    memset(book, 0, sizeof(*book));
+
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        error = MF_INPUT_FILE_OPEN_ERROR;
+
+    } else if (info.st_size < (off_t)sizeof(BookHeader)) {
+        error = MF_FILE_READ_ERROR;
+
+    } else {
+        void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (mapped == MAP_FAILED) {
+            error = MF_FILE_READ_ERROR;
+
+        } else {
+            book->mapped = mapped;
+            book->mapped_size = info.st_size;
+        }
+    }
+
+    if (fd >= 0) close(fd);
+
+    if (error == MF_NO_ERROR) {
+        const BookHeader *header = (const BookHeader *)book->mapped;
+        size_t offset = sizeof(BookHeader);
+
+        book->header = header;
+        book->string_offsets = (const uint32_t *)(book->mapped + offset);
+        offset += BOOK_ALIGN(header->vocabulary_size * sizeof(uint32_t));
+        book->strings = book->mapped + offset;
+        offset += BOOK_ALIGN(header->strings_size);
+        book->words = (const uint32_t *)(book->mapped + offset);
+        offset += BOOK_ALIGN(header->word_count * sizeof(uint32_t));
+        book->offset_steps = (const uint32_t *)(book->mapped + offset);
+        offset += BOOK_ALIGN((header->word_count + BOOK_OFFSET_STEP - 1) / BOOK_OFFSET_STEP * sizeof(uint32_t));
+        book->offsets = book->mapped + offset;
+        offset += BOOK_ALIGN(header->offsets_size);
+
+        if (memcmp(header->magic, BOOK_MAGIC, sizeof(header->magic)) != 0 || header->word_count > UINT32_MAX ||
+            header->vocabulary_size > UINT32_MAX || header->strings_size > UINT32_MAX ||
+            header->offsets_size > UINT32_MAX || offset != book->mapped_size ||
+            (header->strings_size > 0 && book->strings[header->strings_size - 1] != '\0') || !book_checked(book)) {
+            error = MF_FILE_READ_ERROR;
+        }
+    }
+
+    if (error != MF_NO_ERROR) book_close(book);
+
+    return error;
+}
+
+// The word, or NULL if the book is damaged.
+const char *book_word(const Book *book, size_t word_index)
+{
+    uint32_t index = book->words[word_index] & ~(BOOK_WORD_ALWAYS | BOOK_WORD_TOKEN);
+
+    if (index >= book->header->vocabulary_size || book->string_offsets[index] >= book->header->strings_size) return NULL;
+
+    return book->strings + book->string_offsets[index];
+}
+
+// The source offset of the token the word came from, read from the start of its step.
+size_t book_source_offset(const Book *book, size_t word_index)
+{
+    size_t next = book->offset_steps[word_index / BOOK_OFFSET_STEP];
+    uint64_t offset = 0;
+    uint64_t delta;
+
+    for (size_t k = word_index - word_index % BOOK_OFFSET_STEP; k <= word_index; k++) {
+        read_varint(book->offsets, book->header->offsets_size, &next, &delta);
+        offset += delta;
+    }
+
+    return offset;
+}
+
+// The word after the last of the token word_index is in.
+size_t book_token_end(const Book *book, size_t word_index)
+{
+    do {
+        word_index++;
+    } while (word_index < book->header->word_count && (book->words[word_index] & BOOK_WORD_TOKEN) == 0);
+
+    return word_index;
+}
+
+// The first word at or after percent of the text.
+size_t book_seek_percent(const Book *book, double percent)
+{
+    const BookHeader *header = book->header;
+    int whole = percent <= 0 ? 0 : percent >= 100 ? 100 : (int)percent;
+    size_t offset = header->text_start + (size_t)((header->text_end - header->text_start) * (percent / 100));
+    size_t low = whole > 0 ? header->percent_words[whole - 1] : 0;
+    size_t high = whole < 100 ? header->percent_words[whole + 1] : header->word_count;
+
+    if (high > header->word_count) high = header->word_count;
+    if (low > high) low = high;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+
+        if (book_source_offset(book, middle) < offset) {
+            low = middle + 1;
+
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+void book_close(Book *book)
+{
+    if (book->mapped != NULL) munmap((void *)book->mapped, book->mapped_size);
+    memset(book, 0, sizeof(*book));
+}
+
+// Plays the words of a book as the pipeline writes converted text, from start_word, from
+// start_percent, from the position saved with -p, or from the start. As there, once writing a
+// word fails, the rest of its token is written only if its WordRule is WORD_ALWAYS. The position
+// saved is the number of words before the first token not heard.
+MorseFeedError book_play(MorseFeedParams mfp, const char *book_path, long start_word, double start_percent)
+{
+    MorseFeedError error;
+    Book book;
+    MbeepSession session;
+    Tee tee;
+    PlaybackState playback;
+    StateJournal journal = { -1, -1 };
+    bool use_key_control = false;
+    int word_number = 0;
+    size_t position = 0;
+    size_t word_index = 0;
+
+    init_playback(&playback, &mfp);
+    init_mbeep_session(&session);
+    tee_init(&tee);
+
+    error = book_open(&book, book_path);
+
+    if (error == MF_NO_ERROR && start_word != DEFAULT) {
+        position = start_word;
+
+    } else if (error == MF_NO_ERROR && start_percent != DEFAULT) {
+        position = book_seek_percent(&book, start_percent);
+
+    } else if (error == MF_NO_ERROR && mfp.save_and_use_position) {
+        error = read_saved_position(mfp.state_path, book_path, &position, NULL);
+    }
+
+    if (error == MF_NO_ERROR) {
+        if (position > book.header->word_count) position = book.header->word_count;
+
+        use_key_control = mfp.fork_mbeep && mfp.in_file != stdin;
+
+        // before rows get their length, which differs between sinks
+        error = tee_open(&tee, &mfp);
+        if (tee.count > 0) playback.tee = &tee;
+    }
+
+    if (error == MF_NO_ERROR) {
+        if (mfp.fork_mbeep) {
+            if (mfp.words_per_row == DEFAULT) mfp.words_per_row = 1;
+            error = begin_fork_mbeep(&session, mfp.freq, mfp.paris_wpm, mfp.codex_wpm,
+                                     mfp.farnsworth_wpm, mfp.word_space_wpm, mfp.print_fcc_wpm,
+                                     mfp.wav_file_name, use_key_control);
+            if (use_key_control) playback.session = &session;
+
+        } else {
+            if (mfp.out_file == NULL) mfp.out_file = stdout;
+            if (mfp.words_per_row == DEFAULT) mfp.words_per_row = 5;
+        }
+    }
+
+    if (error == MF_NO_ERROR) {
+        // offsets are word numbers, so progress is by words
+        playback_set_source(&playback, NULL, position, position, book.header->word_count);
+
+        if (mfp.save_and_use_position && journal_open(&journal, mfp.state_path) == MF_NO_ERROR) {
+            playback.journal = &journal;
+            playback.journal_label = book_path;
+            playback.checkpoint_offset = position;
+        }
+    }
+
+    if (error == MF_NO_ERROR) word_index = position;
+
+    while (error == MF_NO_ERROR && word_index < book.header->word_count) {
+        size_t token_end = book_token_end(&book, word_index);
+
+        for (; word_index < token_end; word_index++) {
+            const char *word = book_word(&book, word_index);
+
+            if (word == NULL) {
+                error = MF_FILE_READ_ERROR;
+
+            } else if ((book.words[word_index] & BOOK_WORD_ALWAYS) != 0 || error == MF_NO_ERROR) {
+                error = write_word((char *)word, mfp.out_file, session.pipe_to_mbeep, session.pipe_from_mbeep,
+                                   mfp.words_per_row, &word_number, mfp.word_count, use_key_control, &playback);
+            }
+        }
+
+        if (error == MF_NO_ERROR) {
+            playback_token_done(&playback, token_end);
+            position = token_end;
+        }
+    }
+
+    // 'n' ends the only page
+    if (error == MF_NEXT) error = MF_NO_ERROR;
+
+    if ((error == MF_NO_ERROR || error == MF_EXIT) && session.pipe_to_mbeep == NULL &&
+        fprintf(mfp.out_file, "\n") < 0) {
+        error = MF_FILE_WRITE_ERROR;
+    }
+
+    if (mfp.fork_mbeep) end_fork_mbeep(&session, playback.quit);
+
+    if (tee.count > 0) {
+        MorseFeedError tee_error = tee_close(&tee, playback.quit);
+
+        if (error == MF_NO_ERROR) error = tee_error;
+        if (mfp.stage_stats) tee_print_stats(&tee);
+    }
+
+    free_playback(&playback);
+
+    if (playback.show_progress) fprintf(stderr, "\n");
+
+    if ((error == MF_NO_ERROR || error == MF_EXIT) && mfp.save_and_use_position) {
+        if (playback.quit) position = playback.heard_offset;
+        if (position >= book.header->word_count) position = 0;
+
+        error = write_saved_position(mfp.state_path, book_path, position, 0);
+    }
+
+    journal_close(&journal);
+    book_close(&book);
+
+    return error;
+}
+
+#if DEBUG
+void book_tests(void)
+{
+    bool ok = true;
+    const char *text = "Tom & Jerry\n\"Caf\xC3\xA9\"  (1907)\nthe end the end";
+    MorseFeedParams mfp;
+    Book book;
+    FILE *file;
+    char output[256];
+    printf("book_tests()\n");
+
+    file = fopen("book.tmp.txt", "w");
+    fputs(text, file);
+    fclose(file);
+
+    memset(&mfp, 0, sizeof(mfp));
+    mfp.words_per_row = 3;
+    mfp.word_count = DEFAULT;
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.paris_wpm = DEFAULT;
+    mfp.codex_wpm = DEFAULT;
+    mfp.farnsworth_wpm = DEFAULT;
+    mfp.word_space_wpm = DEFAULT;
+    mfp.in_file = fopen("book.tmp.txt", "r");
+
+    ok &= print_if_fail(book_compile(&mfp, "book.tmp.mfb") == MF_NO_ERROR, "FAIL: book_compile (1)");
+    fclose(mfp.in_file);
+    mfp.in_file = NULL;
+
+    ok &= print_if_fail(is_book("book.tmp.mfb") && !is_book("book.tmp.txt"), "FAIL: is_book (1)");
+    // opening a pipe would wait for, and then take, what is written to it
+    ok &= print_if_fail(mkfifo("book.tmp.fifo", 0600) == 0 && !is_book("book.tmp.fifo"), "FAIL: is_book (2)");
+    remove("book.tmp.fifo");
+    ok &= print_if_fail(book_open(&book, "book.tmp.mfb") == MF_NO_ERROR, "FAIL: book_open (1)");
+
+    if (book.mapped != NULL) {
+        ok &= print_if_fail(book.header->word_count == 13 && book.header->vocabulary_size == 11 &&
+                            book.header->offsets_size == 13, "FAIL: book_open (2)");
+        ok &= print_if_fail(strcmp(book_word(&book, 1), "andsign") == 0 && book_source_offset(&book, 1) == 4 &&
+                            book_source_offset(&book, 2) == 6, "FAIL: book_word (1)");
+        ok &= print_if_fail(book.words[9] == book.words[11], "FAIL: book_word (2)");
+        ok &= print_if_fail(book_seek_percent(&book, 0) == 0 && book_seek_percent(&book, 45) == 6 &&
+                            book_seek_percent(&book, 50) == 6 && book_seek_percent(&book, 60) == 9 &&
+                            book_seek_percent(&book, 100) == 13, "FAIL: book_seek_percent (1)");
+        book_close(&book);
+    }
+
+    mfp.out_file = fmemopen(output, sizeof(output), "w");
+    ok &= print_if_fail(book_play(mfp, "book.tmp.mfb", DEFAULT, DEFAULT) == MF_NO_ERROR, "FAIL: book_play (1)");
+    fputc('\0', mfp.out_file);
+    fclose(mfp.out_file);
+    ok &= print_if_fail(strcmp(output, "TOM andsign JERRY\nquote CAFe unquote\nopenparen 1907 closeparen\n"
+                               "THE END THE\nEND\n") == 0, "FAIL: book_play (2)");
+
+    mfp.out_file = fmemopen(output, sizeof(output), "w");
+    ok &= print_if_fail(book_play(mfp, "book.tmp.mfb", 9, DEFAULT) == MF_NO_ERROR, "FAIL: book_play (3)");
+    fputc('\0', mfp.out_file);
+    fclose(mfp.out_file);
+    ok &= print_if_fail(strcmp(output, "THE END THE\nEND\n") == 0, "FAIL: book_play (4)");
+
+    // a percentage index past the words is not used
+    file = fopen("book.tmp.mfb", "r+b");
+    if (file != NULL) {
+        uint32_t past = 14;
+        fseek(file, offsetof(BookHeader, percent_words) + 100 * sizeof(uint32_t), SEEK_SET);
+        fwrite(&past, sizeof(past), 1, file);
+        fclose(file);
+    }
+    ok &= print_if_fail(book_open(&book, "book.tmp.mfb") == MF_FILE_READ_ERROR && book.mapped == NULL,
+                        "FAIL: book_open (3)");
+
+    remove("book.tmp.txt");
+    remove("book.tmp.mfb");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
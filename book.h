@@ -0,0 +1,95 @@
+//
+//  book.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef book_h
+#define book_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "morsefeed.h"
+
+// A book compiled with --compile holds the words a text converts to, so that playing it starts
+// at once and can start at any word or percentage of the text. Each distinct word is kept once,
+// in a vocabulary; the words of the text are indexes into it, the first of each token marked.
+// The source offset of the token each word came from is kept as a varint of the difference from
+// the word before, starting again from 0 every BOOK_OFFSET_STEP words, where a table gives the
+// byte it is at, so that most words take a byte. An index of the first word at or after each
+// whole percentage of the text narrows a seek by percentage to one binary search of those
+// offsets. The file is mapped when played, and positions saved with -p are word numbers.
+#define BOOK_MAGIC "MFBOOK2\n"
+#define BOOK_WORD_ALWAYS 0x80000000u     // in words, if the word's WordRule is WORD_ALWAYS
+#define BOOK_WORD_TOKEN 0x40000000u      // in words, if the word is the first of its token
+#define BOOK_OFFSET_STEP 64
+
+struct BookHeader {
+    char magic[8];
+    uint64_t word_count;
+    uint64_t vocabulary_size;
+    uint64_t strings_size;          // bytes of vocabulary words, each ending in a nul
+    uint64_t offsets_size;          // bytes of source offset varints
+    uint64_t text_start;            // of the text converted, in the source
+    uint64_t text_end;
+    uint32_t percent_words[101];    // first word at or after each percentage of the text
+    uint32_t padding;
+    // followed by, each padded to a multiple of 8 bytes:
+    // uint32_t string_offsets[vocabulary_size]
+    // char strings[strings_size]
+    // uint32_t words[word_count], with BOOK_WORD_ALWAYS and BOOK_WORD_TOKEN
+    // uint32_t offset_steps[word_count / BOOK_OFFSET_STEP rounded up], where each step starts
+    // char offsets[offsets_size]
+};
+typedef struct BookHeader BookHeader;
+
+struct Book {
+    const char *mapped;             // NULL if not open
+    size_t mapped_size;
+    const BookHeader *header;
+    const uint32_t *string_offsets;
+    const char *strings;
+    const uint32_t *words;
+    const uint32_t *offset_steps;
+    const char *offsets;
+};
+typedef struct Book Book;
+
+bool is_book(const char *path);
+MorseFeedError read_whole_file(FILE *file, BufferStruct *buffer);
+MorseFeedError book_compile(const MorseFeedParams *mfp, const char *book_path);
+MorseFeedError book_open(Book *book, const char *path);
+const char *book_word(const Book *book, size_t word_index);
+size_t book_source_offset(const Book *book, size_t word_index);
+size_t book_token_end(const Book *book, size_t word_index);
+size_t book_seek_percent(const Book *book, double percent);
+void book_close(Book *book);
+MorseFeedError book_play(MorseFeedParams mfp, const char *book_path, long start_word, double start_percent);
+
+#if DEBUG
+void book_tests(void);
+#endif
+
+#endif /* book_h */
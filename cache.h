@@ -0,0 +1,81 @@
+//
+//  cache.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef cache_h
+#define cache_h
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "morsefeed.h"
+
+// Words converted from a page or file, kept so that converting the same text again with the same
+// options only reads them back. Each entry is named by a hash of the text and of the options that
+// change its words, and holds the records the convert stage of the pipeline passed to the write
+// stage, as the pipeline copies them compactly; entries are mapped to be read back. Entries are
+// in a directory next to the state file; once they take more than the size given with --cache,
+// the least recently used are removed. Hits and misses of all runs are counted in the same
+// directory.
+#define CACHE_SUFFIX ".cache"
+
+struct CacheStats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evicted;
+    size_t entries;
+    size_t bytes;
+};
+typedef struct CacheStats CacheStats;
+
+struct ConvertCache {
+    char *dir;                  // NULL if not used
+    size_t max_bytes;
+    uint64_t key;
+    size_t length;              // of the text
+    size_t start;               // where converting the text began
+    const char *mapped;         // an entry found, or NULL
+    size_t mapped_size;
+    FILE *file;                 // an entry being written, or NULL
+    char *temp_path;
+    CacheStats stats;           // as of cache_finish
+};
+typedef struct ConvertCache ConvertCache;
+
+uint64_t cache_hash(const void *p, size_t length, uint64_t seed);
+MorseFeedError cache_open(ConvertCache *cache, const char *state_path, double megabytes);
+bool cache_find(ConvertCache *cache, const char *text, size_t length, size_t start, bool filter_html, Charset charset,
+                const char **records, size_t *size);
+FILE *cache_begin(ConvertCache *cache);
+MorseFeedError cache_finish(ConvertCache *cache, bool hit, bool complete);
+void cache_print_stats(const ConvertCache *cache, bool hit);
+void cache_close(ConvertCache *cache);
+
+#if DEBUG
+void cache_tests(void);
+#endif
+
+#endif /* cache_h */
@@ -0,0 +1,600 @@
+//
+//  catalog.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "cache.h"
+#include "catalog.h"
+#include "compressed.h"
+
+#define CATALOG_MAGIC "MFCATLG3"
+
+struct CatalogWork {
+    Catalog *catalog;
+    size_t next;                    // file to read next, taken atomically
+};
+typedef struct CatalogWork CatalogWork;
+
+char *catalog_file_path(const char *state_path, const char *dir);
+char *catalog_file_path(const char *state_path, const char *dir)
+{
+    char *path = malloc(strlen(state_path) + strlen(CATALOG_SUFFIX) + 32);
+    char *full_dir = realpath(dir, NULL);
+    const char *name = full_dir != NULL ? full_dir : dir;
+
+    if (path != NULL) {
+        sprintf(path, "%s%s", state_path, CATALOG_SUFFIX);
+
+        if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+            free(path);
+            path = NULL;
+
+        } else {
+            sprintf(path + strlen(path), "/%016llx", (unsigned long long)cache_hash(name, strlen(name), 0));
+        }
+    }
+
+    free(full_dir);
+
+    return path;
+}
+
+void free_catalog_file(CatalogFile *file);
+void free_catalog_file(CatalogFile *file)
+{
+    free(file->path);
+    word_index_free(&file->index);
+}
+
+// Files as last catalogued, in the order they were, which is by path.
+bool read_catalog(Vector *files, const char *path);
+bool read_catalog(Vector *files, const char *path)
+{
+    FILE *in = fopen(path, "r");
+    char magic[8];
+    uint64_t count = 0;
+    bool valid;
+
+    if (in == NULL) return false;
+
+    valid = fread(magic, sizeof(magic), 1, in) == 1 && memcmp(magic, CATALOG_MAGIC, sizeof(magic)) == 0 &&
+            fread(&count, sizeof(count), 1, in) == 1;
+
+    for (uint64_t k = 0; k < count && valid; k++) {
+        CatalogFile file;
+        uint32_t path_length = 0;
+
+        memset(&file, 0, sizeof(file));
+
+        valid = fread(&file.index.header, sizeof(file.index.header), 1, in) == 1 &&
+                fread(file.chars, sizeof(file.chars), 1, in) == 1 &&
+                fread(&path_length, sizeof(path_length), 1, in) == 1 &&
+                file.index.header.step == WORD_INDEX_STEP &&
+                file.index.header.count == (file.index.header.words + WORD_INDEX_STEP - 1) / WORD_INDEX_STEP &&
+                (file.path = malloc(path_length + 1)) != NULL &&
+                fread(file.path, 1, path_length, in) == path_length;
+
+        if (valid) {
+            file.path[path_length] = '\0';
+            file.index.entries = vector_create(file.index.header.count + 1, sizeof(WordIndexEntry));
+            valid = file.index.entries.p != NULL &&
+                    fread(file.index.entries.p, sizeof(WordIndexEntry), file.index.header.count, in) ==
+                        file.index.header.count;
+            file.index.entries.size = file.index.header.count;
+        }
+
+        if (valid) valid = vector_push(files, &file);
+        if (!valid) free_catalog_file(&file);
+    }
+
+    fclose(in);
+
+    return valid;
+}
+
+void write_catalog(const Catalog *catalog, const char *path);
+void write_catalog(const Catalog *catalog, const char *path)
+{
+    char *temp_path = malloc(strlen(path) + strlen(".XXXXXX") + 1);
+    int fd = -1;
+    FILE *out = NULL;
+    const CatalogFile *files = catalog->files.p;
+    uint64_t count = catalog->files.size;
+    bool written = false;
+
+    if (temp_path == NULL) return;
+
+    sprintf(temp_path, "%s.XXXXXX", path);
+    fd = mkstemp(temp_path);
+    if (fd >= 0) out = fdopen(fd, "w");
+
+    if (out != NULL) {
+        written = fwrite(CATALOG_MAGIC, 8, 1, out) == 1 && fwrite(&count, sizeof(count), 1, out) == 1;
+
+        for (size_t k = 0; k < catalog->files.size && written; k++) {
+            uint32_t path_length = (uint32_t)strlen(files[k].path);
+
+            written = fwrite(&files[k].index.header, sizeof(files[k].index.header), 1, out) == 1 &&
+                      fwrite(files[k].chars, sizeof(files[k].chars), 1, out) == 1 &&
+                      fwrite(&path_length, sizeof(path_length), 1, out) == 1 &&
+                      fwrite(files[k].path, 1, path_length, out) == path_length &&
+                      fwrite(files[k].index.entries.p, sizeof(WordIndexEntry), files[k].index.entries.size, out) ==
+                          files[k].index.entries.size;
+        }
+
+        written &= fclose(out) == 0;
+
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    if (fd >= 0 && (!written || rename(temp_path, path) != 0)) remove(temp_path);
+
+    free(temp_path);
+}
+
+int catalog_char(unsigned char c);
+int catalog_char(unsigned char c)
+{
+    int index = -1;
+
+    if (c < 128 && isalpha(c)) {
+        index = tolower(c) - 'a';
+
+    } else if (isdigit(c)) {
+        index = CATALOG_DIGITS + c - '0';
+
+    } else if (c < 128 && ispunct(c)) {
+        index = CATALOG_PUNCTUATION;
+
+    } else if (!isspace(c)) {
+        index = CATALOG_OTHER;
+    }
+
+    return index;
+}
+
+void catalog_read_file(CatalogFile *file);
+void catalog_read_file(CatalogFile *file)
+{
+    FILE *in = fopen(file->path, "r");
+    struct stat info;
+    BufferStruct text = { NULL, 0, 0, CHARSET_UNKNOWN };
+    CompressedFormat compressed = COMPRESSED_NONE;
+    size_t length = 0;
+
+    memset(file->chars, 0, sizeof(file->chars));
+    file->error = MF_NO_ERROR;
+
+    if (in == NULL || fstat(fileno(in), &info) != 0) {
+        file->error = MF_INPUT_FILE_OPEN_ERROR;
+
+    } else if ((compressed = compressed_format(in)) != COMPRESSED_NONE) {
+        // indexed and counted as the text it holds, so --sample starts where the words are
+        file->error = decompress_read_all(in, compressed, &text);
+        length = text.used > 0 ? text.used - 1 : 0;
+
+    } else if ((text.p = malloc(info.st_size + 1)) == NULL) {
+        file->error = MF_OUT_OF_MEMORY;
+
+    } else if (fread(text.p, 1, info.st_size, in) != (size_t)info.st_size) {
+        file->error = MF_FILE_READ_ERROR;
+
+    } else {
+        length = info.st_size;
+    }
+
+    if (file->error == MF_NO_ERROR) {
+        word_index_build(&file->index, text.p, length, charset_detect(text.p, length, CHARSET_UNKNOWN));
+        // but kept for as long as the file on disk is unchanged
+        file->index.header.file_size = info.st_size;
+        file->index.header.modified_seconds = info.st_mtim.tv_sec;
+        file->index.header.modified_nanoseconds = info.st_mtim.tv_nsec;
+        if (file->index.entries.p == NULL) file->error = MF_OUT_OF_MEMORY;
+
+        for (size_t k = 0; k < length; k++) {
+            int index = catalog_char((unsigned char)text.p[k]);
+            if (index >= 0) file->chars[index]++;
+        }
+    }
+
+    if (in != NULL) fclose(in);
+    free(text.p);
+}
+
+void *catalog_worker(void *arg);
+void *catalog_worker(void *arg)
+{
+    CatalogWork *work = arg;
+    CatalogFile *files = work->catalog->files.p;
+    size_t k;
+
+    while ((k = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) < work->catalog->files.size) {
+        if (files[k].updated) catalog_read_file(&files[k]);
+    }
+
+    return NULL;
+}
+
+int compare_catalog_files(const void *a, const void *b);
+int compare_catalog_files(const void *a, const void *b)
+{
+    return strcmp(((const CatalogFile *)a)->path, ((const CatalogFile *)b)->path);
+}
+
+// The files of dir as they are now, read again only where they have changed, and the catalog
+// saved if anything has. With no state file nothing is kept and every file is read.
+MorseFeedError catalog_update(Catalog *catalog, const char *state_path, const char *dir, int threads)
+{
+    MorseFeedError error;
+    StringVector paths = string_vector_create(0);
+    Vector previous = vector_create(0, sizeof(CatalogFile));
+    char *path = state_path != NULL ? catalog_file_path(state_path, dir) : NULL;
+    CatalogWork work = { catalog, 0 };
+    pthread_t workers[BATCH_MAX_THREADS];
+    int started = 0;
+    size_t kept = 0;
+
+    memset(catalog, 0, sizeof(*catalog));
+    catalog->files = vector_create(0, sizeof(CatalogFile));
+
+    error = collect_inputs(&dir, 1, NULL, &paths);
+
+    // one that cannot be read is read again in full
+    if (error == MF_NO_ERROR && path != NULL && !read_catalog(&previous, path)) {
+        vector_each(&previous, (void (*)(void *))free_catalog_file);
+        previous.size = 0;
+    }
+
+    for (size_t k = 0; k < paths.size && error == MF_NO_ERROR; k++) {
+        CatalogFile file;
+        CatalogFile *found;
+        struct stat info;
+
+        memset(&file, 0, sizeof(file));
+        file.path = (char *)string_vector_at(&paths, k);
+        found = previous.size == 0 ? NULL :
+            bsearch(&file, previous.p, previous.size, sizeof(CatalogFile), compare_catalog_files);
+
+        if (found != NULL && stat(file.path, &info) == 0 &&
+            found->index.header.file_size == (uint64_t)info.st_size &&
+            found->index.header.modified_seconds == info.st_mtim.tv_sec &&
+            found->index.header.modified_nanoseconds == info.st_mtim.tv_nsec) {
+            // index taken from the previous catalog
+            file = *found;
+            found->index.entries = vector_create(0, sizeof(WordIndexEntry));
+            kept++;
+
+        } else {
+            file.updated = true;
+            catalog->updated++;
+        }
+
+        file.path = malloc(strlen(string_vector_at(&paths, k)) + 1);
+        if (file.path != NULL) strcpy(file.path, string_vector_at(&paths, k));
+
+        if (file.path == NULL || !vector_push(&catalog->files, &file)) {
+            free_catalog_file(&file);
+            error = MF_OUT_OF_MEMORY;
+        }
+    }
+
+    threads = resolve_threads(threads);
+    if ((size_t)threads > catalog->updated) threads = (int)catalog->updated;
+
+    for ( ; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, catalog_worker, &work) != 0) break;
+    }
+
+    // with no thread started, read here
+    if (started == 0) catalog_worker(&work);
+    for (int k = 0; k < started; k++) pthread_join(workers[k], NULL);
+
+    // files that cannot be read are left out
+    for (size_t k = 0; k < catalog->files.size; ) {
+        CatalogFile *file = (CatalogFile *)catalog->files.p + k;
+
+        if (file->error != MF_NO_ERROR) {
+            free_catalog_file(file);
+            vector_delete_at(&catalog->files, k, NULL);
+
+        } else {
+            catalog->words += file->index.header.words;
+            k++;
+        }
+    }
+
+    if (error == MF_NO_ERROR && path != NULL && (catalog->updated > 0 || kept != previous.size)) {
+        write_catalog(catalog, path);
+    }
+
+    vector_each(&previous, (void (*)(void *))free_catalog_file);
+    vector_free(&previous);
+    string_vector_free(&paths);
+    free(path);
+
+    return error;
+}
+
+// Files, words and how often each character occurs, most often first.
+void catalog_print(const Catalog *catalog, FILE *file)
+{
+    uint64_t counts[CATALOG_CHARS] = { 0 };
+    uint64_t total = 0;
+    int order[CATALOG_CHARS];
+    const CatalogFile *files = catalog->files.p;
+    const char *names = "abcdefghijklmnopqrstuvwxyz0123456789";
+
+    for (size_t k = 0; k < catalog->files.size; k++) {
+        for (int c = 0; c < CATALOG_CHARS; c++) counts[c] += files[k].chars[c];
+    }
+
+    for (int c = 0; c < CATALOG_CHARS; c++) {
+        int k = c;
+
+        total += counts[c];
+
+        // insertion sort, most often first
+        while (k > 0 && counts[order[k - 1]] < counts[c]) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = c;
+    }
+
+    fprintf(file, "%ld files, %llu words, %ld read again\n", (long)catalog->files.size,
+            (unsigned long long)catalog->words, (long)catalog->updated);
+
+    for (int k = 0; k < CATALOG_CHARS && total > 0; k++) {
+        int c = order[k];
+
+        if (counts[c] == 0) break;
+
+        if (c < CATALOG_PUNCTUATION) {
+            fprintf(file, "%c %.2f%%\n", names[c], 100.0 * counts[c] / total);
+
+        } else {
+            fprintf(file, "%s %.2f%%\n", c == CATALOG_PUNCTUATION ? "punctuation" : "other",
+                    100.0 * counts[c] / total);
+        }
+    }
+}
+
+// The file a word numbered from 0 across all files in the catalog is in, and its number there.
+bool catalog_pick(const Catalog *catalog, uint64_t word, size_t *file_index, uint64_t *file_word)
+{
+    const CatalogFile *files = catalog->files.p;
+
+    for (size_t k = 0; k < catalog->files.size; k++) {
+        if (word < files[k].index.header.words) {
+            *file_index = k;
+            *file_word = word;
+            return true;
+        }
+
+        word -= files[k].index.header.words;
+    }
+
+    return false;
+}
+
+// Where in the text of the file the token of the word begins. Only the text from the index entry
+// before the word to the entry after it, and the longest token past that, is read; a compressed
+// file is decompressed up to there, from the nearest restart point with a state file.
+MorseFeedError catalog_locate(const CatalogFile *file, const char *state_path, uint64_t word, uint64_t *offset);
+MorseFeedError catalog_locate(const CatalogFile *file, const char *state_path, uint64_t word, uint64_t *offset)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    const WordIndexEntry *entries = file->index.entries.p;
+    size_t k = word / WORD_INDEX_STEP;
+    uint64_t from;
+    uint64_t to;
+    FILE *in = NULL;
+    FILE *stream = NULL;
+    CompressedFormat compressed = COMPRESSED_NONE;
+    char *text = NULL;
+    size_t length = 0;
+
+    if (k >= file->index.entries.size) return MF_INPUT_FILE_OPEN_ERROR;
+
+    from = entries[k].offset;
+    to = k + 1 < file->index.entries.size ? entries[k + 1].offset + LINE_SIZE : file->index.header.text_length;
+    if (to > file->index.header.text_length) to = file->index.header.text_length;
+
+    in = fopen(file->path, "r");
+    if (in == NULL) error = MF_INPUT_FILE_OPEN_ERROR;
+
+    if (error == MF_NO_ERROR && (compressed = compressed_format(in)) != COMPRESSED_NONE) {
+        error = decompress_open(&stream, in, compressed, state_path, file->path, from);
+
+    } else if (error == MF_NO_ERROR) {
+        stream = in;
+        if (fseeko(in, (off_t)from, SEEK_SET) != 0) error = MF_FILE_READ_ERROR;
+    }
+
+    if (error == MF_NO_ERROR && (text = malloc(to - from + 1)) == NULL) error = MF_OUT_OF_MEMORY;
+
+    if (error == MF_NO_ERROR) {
+        length = fread(text, 1, to - from, stream);
+        *offset = word_index_seek_from(&file->index, text, length, from, word);
+    }
+
+    if (stream != NULL && stream != in) fclose(stream);
+    if (in != NULL) fclose(in);
+    free(text);
+
+    return error;
+}
+
+// Opens a file of dir as input, to be started at a word picked at random from all of them, found
+// from the catalog without reading the file whole. As where the file is started has nothing to do
+// with where it was stopped, no position is saved for it.
+MorseFeedError catalog_sample(const char *dir, MorseFeedParams *mfp, int threads, StringVector *storage)
+{
+    MorseFeedError error = mfp->in_file != NULL ? MF_FILE_ALREADY_OPEN_ERROR : MF_NO_ERROR;
+    Catalog catalog = { { 0 } };
+    size_t file_index = 0;
+    uint64_t word = 0;
+    uint64_t offset = 0;
+    const CatalogFile *file = NULL;
+
+    if (error == MF_NO_ERROR) error = catalog_update(&catalog, mfp->state_path, dir, threads);
+
+    if (error == MF_NO_ERROR) {
+        struct timespec now;
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        srandom((unsigned)(now.tv_sec ^ now.tv_nsec ^ getpid()));
+        word = ((uint64_t)random() << 31 ^ (uint64_t)random()) % (catalog.words > 0 ? catalog.words : 1);
+
+        if (!catalog_pick(&catalog, word, &file_index, &word)) error = MF_INPUT_FILE_OPEN_ERROR;
+    }
+
+    if (error == MF_NO_ERROR) {
+        file = (const CatalogFile *)catalog.files.p + file_index;
+
+        if (!string_vector_push(storage, file->path)) error = MF_OUT_OF_MEMORY;
+    }
+
+    if (error == MF_NO_ERROR) error = catalog_locate(file, mfp->state_path, word, &offset);
+
+    if (error == MF_NO_ERROR) {
+        mfp->in_file_name = string_vector_at(storage, storage->size - 1);
+        mfp->in_file = fopen(mfp->in_file_name, "r");
+        if (mfp->in_file == NULL) error = MF_INPUT_FILE_OPEN_ERROR;
+    }
+
+    if (error == MF_NO_ERROR) {
+        mfp->save_and_use_position = false;
+        mfp->cache_megabytes = DEFAULT;
+        mfp->start_percent = DEFAULT;
+        mfp->back_paragraphs = DEFAULT;
+        fprintf(stderr, "(%s from word %llu)\n", mfp->in_file_name, (unsigned long long)word);
+
+        // the word is counted as -i --start counts it, but the file is not indexed again to find it
+        mfp->start_word = DEFAULT;
+        mfp->start_offset = (long)offset;
+    }
+
+    catalog_free(&catalog);
+
+    return error;
+}
+
+void catalog_free(Catalog *catalog)
+{
+    vector_each(&catalog->files, (void (*)(void *))free_catalog_file);
+    vector_free(&catalog->files);
+}
+
+#if DEBUG
+void catalog_tests(void)
+{
+    bool ok = true;
+    Catalog catalog;
+    FILE *file;
+    size_t file_index = 0;
+    uint64_t word = 0;
+    struct timespec later[2] = { { 0, UTIME_OMIT }, { 1, 0 } };
+    printf("catalog_tests()\n");
+
+    mkdir("catalog.tmp", 0700);
+    file = fopen("catalog.tmp/a.txt", "w");
+    fprintf(file, "One two, three.\n");
+    fclose(file);
+    file = fopen("catalog.tmp/b.txt", "w");
+    for (int k = 0; k < WORD_INDEX_STEP + 10; k++) fprintf(file, "w%d ", k);
+    fclose(file);
+
+    ok &= print_if_fail(catalog_update(&catalog, "state.tmp", "catalog.tmp", 2) == MF_NO_ERROR &&
+                        catalog.files.size == 2 && catalog.updated == 2 && catalog.words == WORD_INDEX_STEP + 13,
+                        "FAIL: catalog_update (1)");
+    ok &= print_if_fail(((CatalogFile *)catalog.files.p)[0].chars['o' - 'a'] == 2 &&
+                        ((CatalogFile *)catalog.files.p)[0].chars[CATALOG_PUNCTUATION] == 2, "FAIL: catalog_update (2)");
+    ok &= print_if_fail(catalog_pick(&catalog, 2, &file_index, &word) && file_index == 0 && word == 2,
+                        "FAIL: catalog_pick (1)");
+    ok &= print_if_fail(catalog_pick(&catalog, 3 + WORD_INDEX_STEP, &file_index, &word) && file_index == 1 &&
+                        word == WORD_INDEX_STEP, "FAIL: catalog_pick (2)");
+    ok &= print_if_fail(!catalog_pick(&catalog, 13 + WORD_INDEX_STEP, &file_index, &word), "FAIL: catalog_pick (3)");
+
+    // found from the index entry before the word
+    uint64_t offset = 0;
+    size_t expected = 0;
+    for (int k = 0; k < WORD_INDEX_STEP + 5; k++) expected += snprintf(NULL, 0, "w%d ", k);
+    ok &= print_if_fail(catalog_locate((CatalogFile *)catalog.files.p + 1, NULL, WORD_INDEX_STEP + 5, &offset) ==
+                        MF_NO_ERROR && offset == expected, "FAIL: catalog_locate (1)");
+    catalog_free(&catalog);
+
+    // only files that have changed are read again
+    ok &= print_if_fail(catalog_update(&catalog, "state.tmp", "catalog.tmp", 2) == MF_NO_ERROR &&
+                        catalog.updated == 0 && catalog.words == WORD_INDEX_STEP + 13 &&
+                        ((CatalogFile *)catalog.files.p)[1].index.entries.size == 2, "FAIL: catalog_update (3)");
+    catalog_free(&catalog);
+    utimensat(AT_FDCWD, "catalog.tmp/a.txt", later, 0);
+    ok &= print_if_fail(catalog_update(&catalog, "state.tmp", "catalog.tmp", 2) == MF_NO_ERROR &&
+                        catalog.updated == 1 && ((CatalogFile *)catalog.files.p)[0].updated, "FAIL: catalog_update (4)");
+    catalog_free(&catalog);
+    remove("catalog.tmp/b.txt");
+    ok &= print_if_fail(catalog_update(&catalog, "state.tmp", "catalog.tmp", 1) == MF_NO_ERROR &&
+                        catalog.updated == 0 && catalog.files.size == 1 && catalog.words == 3, "FAIL: catalog_update (5)");
+    catalog_free(&catalog);
+
+    // a compressed file is indexed and counted as the text it holds
+    file = fopen("catalog.tmp/c.txt.gz", "w");
+    ok &= print_if_fail(write_gzip(file, "Four five six seven", 19), "FAIL: catalog_update (6)");
+    fclose(file);
+    ok &= print_if_fail(catalog_update(&catalog, "state.tmp", "catalog.tmp", 1) == MF_NO_ERROR &&
+                        catalog.updated == 1 && catalog.files.size == 2 && catalog.words == 7 &&
+                        ((CatalogFile *)catalog.files.p)[1].chars['v' - 'a'] == 2, "FAIL: catalog_update (7)");
+    ok &= print_if_fail(catalog_locate((CatalogFile *)catalog.files.p + 1, NULL, 2, &offset) == MF_NO_ERROR &&
+                        offset == 10, "FAIL: catalog_locate (2)");
+
+    char *path = catalog_file_path("state.tmp", "catalog.tmp");
+    remove(path);
+    free(path);
+    rmdir("state.tmp" CATALOG_SUFFIX);
+    remove("catalog.tmp/a.txt");
+    remove("catalog.tmp/c.txt.gz");
+    rmdir("catalog.tmp");
+    catalog_free(&catalog);
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
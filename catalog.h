@@ -0,0 +1,77 @@
+//
+//  catalog.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef catalog_h
+#define catalog_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "morsefeed.h"
+#include "seek.h"
+#include "vector.h"
+
+// A catalog of the files in a directory: for each, the number of words, the offset of every
+// WORD_INDEX_STEP-th word as in the index of seek.h, and how often each kind of character
+// occurs. It is kept in a directory next to the state file and updated each time it is used,
+// reading only the files whose size or modification time has changed, on a number of threads.
+// With --sample, a word is picked at random from all of the files, and the file it is in is
+// started at that word as with --start, found from the index entry before it without reading
+// the rest of the file. Words are counted as they are converted.
+#define CATALOG_SUFFIX ".catalog"
+#define CATALOG_DIGITS 26           // a-z, then 0-9
+#define CATALOG_PUNCTUATION 36
+#define CATALOG_OTHER 37            // other bytes that are not white space
+#define CATALOG_CHARS 38
+
+struct CatalogFile {
+    char *path;
+    WordIndex index;                // with the size and time the file was modified
+    uint32_t chars[CATALOG_CHARS];
+    bool updated;                   // read again this time
+    MorseFeedError error;
+};
+typedef struct CatalogFile CatalogFile;
+
+struct Catalog {
+    Vector files;                   // CatalogFile, by path
+    size_t updated;
+    uint64_t words;
+};
+typedef struct Catalog Catalog;
+
+MorseFeedError catalog_update(Catalog *catalog, const char *state_path, const char *dir, int threads);
+void catalog_print(const Catalog *catalog, FILE *file);
+bool catalog_pick(const Catalog *catalog, uint64_t word, size_t *file_index, uint64_t *file_word);
+MorseFeedError catalog_sample(const char *dir, MorseFeedParams *mfp, int threads, StringVector *storage);
+void catalog_free(Catalog *catalog);
+
+#if DEBUG
+void catalog_tests(void);
+#endif
+
+#endif /* catalog_h */
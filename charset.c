@@ -0,0 +1,626 @@
+//
+//  charset.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "charset.h"
+#include "vector.h"
+
+struct CharsetLabel {
+    const char *label;
+    Charset charset;
+};
+typedef struct CharsetLabel CharsetLabel;
+
+// As a browser takes them, so that ISO-8859-1 and US-ASCII are windows-1252 too
+static const CharsetLabel labels[] = {
+    { "utf-8", CHARSET_UTF8 },
+    { "utf8", CHARSET_UTF8 },
+    { "unicode-1-1-utf-8", CHARSET_UTF8 },
+    { "windows-1252", CHARSET_WINDOWS_1252 },
+    { "cp1252", CHARSET_WINDOWS_1252 },
+    { "x-cp1252", CHARSET_WINDOWS_1252 },
+    { "iso-8859-1", CHARSET_WINDOWS_1252 },
+    { "iso8859-1", CHARSET_WINDOWS_1252 },
+    { "iso_8859-1", CHARSET_WINDOWS_1252 },
+    { "latin1", CHARSET_WINDOWS_1252 },
+    { "l1", CHARSET_WINDOWS_1252 },
+    { "us-ascii", CHARSET_WINDOWS_1252 },
+    { "ascii", CHARSET_WINDOWS_1252 },
+    { "windows-1250", CHARSET_WINDOWS_1250 },
+    { "cp1250", CHARSET_WINDOWS_1250 },
+    { "x-cp1250", CHARSET_WINDOWS_1250 },
+    { "windows-1251", CHARSET_WINDOWS_1251 },
+    { "cp1251", CHARSET_WINDOWS_1251 },
+    { "x-cp1251", CHARSET_WINDOWS_1251 },
+    { "iso-8859-2", CHARSET_ISO_8859_2 },
+    { "iso8859-2", CHARSET_ISO_8859_2 },
+    { "iso_8859-2", CHARSET_ISO_8859_2 },
+    { "latin2", CHARSET_ISO_8859_2 },
+    { "l2", CHARSET_ISO_8859_2 },
+    { "iso-8859-5", CHARSET_ISO_8859_5 },
+    { "iso8859-5", CHARSET_ISO_8859_5 },
+    { "iso_8859-5", CHARSET_ISO_8859_5 },
+    { "cyrillic", CHARSET_ISO_8859_5 },
+    { "iso-8859-7", CHARSET_ISO_8859_7 },
+    { "iso8859-7", CHARSET_ISO_8859_7 },
+    { "iso_8859-7", CHARSET_ISO_8859_7 },
+    { "greek", CHARSET_ISO_8859_7 },
+    { "iso-8859-15", CHARSET_ISO_8859_15 },
+    { "iso8859-15", CHARSET_ISO_8859_15 },
+    { "iso_8859-15", CHARSET_ISO_8859_15 },
+    { "latin9", CHARSET_ISO_8859_15 },
+    { "l9", CHARSET_ISO_8859_15 },
+    { "koi8-r", CHARSET_KOI8_R },
+    { "koi8r", CHARSET_KOI8_R },
+    { "koi8", CHARSET_KOI8_R },
+    { "koi", CHARSET_KOI8_R },
+    { "koi8-u", CHARSET_KOI8_U },
+    { "koi8-ru", CHARSET_KOI8_U }
+};
+
+static const char *names[CHARSET_COUNT] = {
+    "", "utf-8", "windows-1252", "windows-1250", "windows-1251", "iso-8859-2", "iso-8859-5", "iso-8859-7",
+    "iso-8859-15", "koi8-r", "koi8-u"
+};
+
+// Code points of bytes 0x80 to 0xFF in each charset from windows-1252 on, 0 where none
+static const uint16_t upper_halves[CHARSET_COUNT - CHARSET_WINDOWS_1252][128] = {
+    // windows-1252
+    {
+        0x20AC, 0x0000, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x0000, 0x017D, 0x0000,
+        0x0000, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x0000, 0x017E, 0x0178,
+        0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,
+        0x00A8, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+        0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+        0x00B8, 0x00B9, 0x00BA, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,
+        0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+        0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+        0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+        0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+        0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+        0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+        0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+        0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+    },
+    // windows-1250
+    {
+        0x20AC, 0x0000, 0x201A, 0x0000, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x0000, 0x2030, 0x0160, 0x2039, 0x015A, 0x0164, 0x017D, 0x0179,
+        0x0000, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0x0000, 0x2122, 0x0161, 0x203A, 0x015B, 0x0165, 0x017E, 0x017A,
+        0x00A0, 0x02C7, 0x02D8, 0x0141, 0x00A4, 0x0104, 0x00A6, 0x00A7,
+        0x00A8, 0x00A9, 0x015E, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x017B,
+        0x00B0, 0x00B1, 0x02DB, 0x0142, 0x00B4, 0x00B5, 0x00B6, 0x00B7,
+        0x00B8, 0x0105, 0x015F, 0x00BB, 0x013D, 0x02DD, 0x013E, 0x017C,
+        0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+        0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+        0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+        0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+        0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+        0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+        0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+        0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9
+    },
+    // windows-1251
+    {
+        0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+        0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0x0000, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+        0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+        0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+        0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+        0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+        0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+        0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+        0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+        0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+        0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+        0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+        0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+        0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F
+    },
+    // iso-8859-2
+    {
+        0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+        0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+        0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+        0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+        0x00A0, 0x0104, 0x02D8, 0x0141, 0x00A4, 0x013D, 0x015A, 0x00A7,
+        0x00A8, 0x0160, 0x015E, 0x0164, 0x0179, 0x00AD, 0x017D, 0x017B,
+        0x00B0, 0x0105, 0x02DB, 0x0142, 0x00B4, 0x013E, 0x015B, 0x02C7,
+        0x00B8, 0x0161, 0x015F, 0x0165, 0x017A, 0x02DD, 0x017E, 0x017C,
+        0x0154, 0x00C1, 0x00C2, 0x0102, 0x00C4, 0x0139, 0x0106, 0x00C7,
+        0x010C, 0x00C9, 0x0118, 0x00CB, 0x011A, 0x00CD, 0x00CE, 0x010E,
+        0x0110, 0x0143, 0x0147, 0x00D3, 0x00D4, 0x0150, 0x00D6, 0x00D7,
+        0x0158, 0x016E, 0x00DA, 0x0170, 0x00DC, 0x00DD, 0x0162, 0x00DF,
+        0x0155, 0x00E1, 0x00E2, 0x0103, 0x00E4, 0x013A, 0x0107, 0x00E7,
+        0x010D, 0x00E9, 0x0119, 0x00EB, 0x011B, 0x00ED, 0x00EE, 0x010F,
+        0x0111, 0x0144, 0x0148, 0x00F3, 0x00F4, 0x0151, 0x00F6, 0x00F7,
+        0x0159, 0x016F, 0x00FA, 0x0171, 0x00FC, 0x00FD, 0x0163, 0x02D9
+    },
+    // iso-8859-5
+    {
+        0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+        0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+        0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+        0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+        0x00A0, 0x0401, 0x0402, 0x0403, 0x0404, 0x0405, 0x0406, 0x0407,
+        0x0408, 0x0409, 0x040A, 0x040B, 0x040C, 0x00AD, 0x040E, 0x040F,
+        0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+        0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+        0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+        0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+        0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+        0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+        0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+        0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F,
+        0x2116, 0x0451, 0x0452, 0x0453, 0x0454, 0x0455, 0x0456, 0x0457,
+        0x0458, 0x0459, 0x045A, 0x045B, 0x045C, 0x00A7, 0x045E, 0x045F
+    },
+    // iso-8859-7
+    {
+        0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+        0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+        0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+        0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+        0x00A0, 0x2018, 0x2019, 0x00A3, 0x20AC, 0x20AF, 0x00A6, 0x00A7,
+        0x00A8, 0x00A9, 0x037A, 0x00AB, 0x00AC, 0x00AD, 0x0000, 0x2015,
+        0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x0384, 0x0385, 0x0386, 0x00B7,
+        0x0388, 0x0389, 0x038A, 0x00BB, 0x038C, 0x00BD, 0x038E, 0x038F,
+        0x0390, 0x0391, 0x0392, 0x0393, 0x0394, 0x0395, 0x0396, 0x0397,
+        0x0398, 0x0399, 0x039A, 0x039B, 0x039C, 0x039D, 0x039E, 0x039F,
+        0x03A0, 0x03A1, 0x0000, 0x03A3, 0x03A4, 0x03A5, 0x03A6, 0x03A7,
+        0x03A8, 0x03A9, 0x03AA, 0x03AB, 0x03AC, 0x03AD, 0x03AE, 0x03AF,
+        0x03B0, 0x03B1, 0x03B2, 0x03B3, 0x03B4, 0x03B5, 0x03B6, 0x03B7,
+        0x03B8, 0x03B9, 0x03BA, 0x03BB, 0x03BC, 0x03BD, 0x03BE, 0x03BF,
+        0x03C0, 0x03C1, 0x03C2, 0x03C3, 0x03C4, 0x03C5, 0x03C6, 0x03C7,
+        0x03C8, 0x03C9, 0x03CA, 0x03CB, 0x03CC, 0x03CD, 0x03CE, 0x0000
+    },
+    // iso-8859-15
+    {
+        0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,
+        0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,
+        0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,
+        0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,
+        0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x20AC, 0x00A5, 0x0160, 0x00A7,
+        0x0161, 0x00A9, 0x00AA, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,
+        0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x017D, 0x00B5, 0x00B6, 0x00B7,
+        0x017E, 0x00B9, 0x00BA, 0x00BB, 0x0152, 0x0153, 0x0178, 0x00BF,
+        0x00C0, 0x00C1, 0x00C2, 0x00C3, 0x00C4, 0x00C5, 0x00C6, 0x00C7,
+        0x00C8, 0x00C9, 0x00CA, 0x00CB, 0x00CC, 0x00CD, 0x00CE, 0x00CF,
+        0x00D0, 0x00D1, 0x00D2, 0x00D3, 0x00D4, 0x00D5, 0x00D6, 0x00D7,
+        0x00D8, 0x00D9, 0x00DA, 0x00DB, 0x00DC, 0x00DD, 0x00DE, 0x00DF,
+        0x00E0, 0x00E1, 0x00E2, 0x00E3, 0x00E4, 0x00E5, 0x00E6, 0x00E7,
+        0x00E8, 0x00E9, 0x00EA, 0x00EB, 0x00EC, 0x00ED, 0x00EE, 0x00EF,
+        0x00F0, 0x00F1, 0x00F2, 0x00F3, 0x00F4, 0x00F5, 0x00F6, 0x00F7,
+        0x00F8, 0x00F9, 0x00FA, 0x00FB, 0x00FC, 0x00FD, 0x00FE, 0x00FF
+    },
+    // koi8-r
+    {
+        0x2500, 0x2502, 0x250C, 0x2510, 0x2514, 0x2518, 0x251C, 0x2524,
+        0x252C, 0x2534, 0x253C, 0x2580, 0x2584, 0x2588, 0x258C, 0x2590,
+        0x2591, 0x2592, 0x2593, 0x2320, 0x25A0, 0x2219, 0x221A, 0x2248,
+        0x2264, 0x2265, 0x00A0, 0x2321, 0x00B0, 0x00B2, 0x00B7, 0x00F7,
+        0x2550, 0x2551, 0x2552, 0x0451, 0x2553, 0x2554, 0x2555, 0x2556,
+        0x2557, 0x2558, 0x2559, 0x255A, 0x255B, 0x255C, 0x255D, 0x255E,
+        0x255F, 0x2560, 0x2561, 0x0401, 0x2562, 0x2563, 0x2564, 0x2565,
+        0x2566, 0x2567, 0x2568, 0x2569, 0x256A, 0x256B, 0x256C, 0x00A9,
+        0x044E, 0x0430, 0x0431, 0x0446, 0x0434, 0x0435, 0x0444, 0x0433,
+        0x0445, 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E,
+        0x043F, 0x044F, 0x0440, 0x0441, 0x0442, 0x0443, 0x0436, 0x0432,
+        0x044C, 0x044B, 0x0437, 0x0448, 0x044D, 0x0449, 0x0447, 0x044A,
+        0x042E, 0x0410, 0x0411, 0x0426, 0x0414, 0x0415, 0x0424, 0x0413,
+        0x0425, 0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E,
+        0x041F, 0x042F, 0x0420, 0x0421, 0x0422, 0x0423, 0x0416, 0x0412,
+        0x042C, 0x042B, 0x0417, 0x0428, 0x042D, 0x0429, 0x0427, 0x042A
+    },
+    // koi8-u
+    {
+        0x2500, 0x2502, 0x250C, 0x2510, 0x2514, 0x2518, 0x251C, 0x2524,
+        0x252C, 0x2534, 0x253C, 0x2580, 0x2584, 0x2588, 0x258C, 0x2590,
+        0x2591, 0x2592, 0x2593, 0x2320, 0x25A0, 0x2219, 0x221A, 0x2248,
+        0x2264, 0x2265, 0x00A0, 0x2321, 0x00B0, 0x00B2, 0x00B7, 0x00F7,
+        0x2550, 0x2551, 0x2552, 0x0451, 0x0454, 0x2554, 0x0456, 0x0457,
+        0x2557, 0x2558, 0x2559, 0x255A, 0x255B, 0x0491, 0x255D, 0x255E,
+        0x255F, 0x2560, 0x2561, 0x0401, 0x0404, 0x2563, 0x0406, 0x0407,
+        0x2566, 0x2567, 0x2568, 0x2569, 0x256A, 0x0490, 0x256C, 0x00A9,
+        0x044E, 0x0430, 0x0431, 0x0446, 0x0434, 0x0435, 0x0444, 0x0433,
+        0x0445, 0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E,
+        0x043F, 0x044F, 0x0440, 0x0441, 0x0442, 0x0443, 0x0436, 0x0432,
+        0x044C, 0x044B, 0x0437, 0x0448, 0x044D, 0x0449, 0x0447, 0x044A,
+        0x042E, 0x0410, 0x0411, 0x0426, 0x0414, 0x0415, 0x0424, 0x0413,
+        0x0425, 0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E,
+        0x041F, 0x042F, 0x0420, 0x0421, 0x0422, 0x0423, 0x0416, 0x0412,
+        0x042C, 0x042B, 0x0417, 0x0428, 0x042D, 0x0429, 0x0427, 0x042A
+    }
+};
+
+// Letters that code points past Latin-1 are spelled with, or NULL
+static const char *latin_extended_letters[0x180 - 0x100] = {
+    "A", "a", "A", "a", "A", "a", "C", "c",
+    "C", "c", "C", "c", "C", "c", "D", "d",
+    "D", "d", "E", "e", "E", "e", "E", "e",
+    "E", "e", "E", "e", "G", "g", "G", "g",
+    "G", "g", "G", "g", "H", "h", "H", "h",
+    "I", "i", "I", "i", "I", "i", "I", "i",
+    "I", "i", "IJ", "ij", "J", "j", "K", "k",
+    "k", "L", "l", "L", "l", "L", "l", "L",
+    "l", "L", "l", "N", "n", "N", "n", "N",
+    "n", "n", "NG", "ng", "O", "o", "O", "o",
+    "O", "o", "OE", "oe", "R", "r", "R", "r",
+    "R", "r", "S", "s", "S", "s", "S", "s",
+    "S", "s", "T", "t", "T", "t", "T", "t",
+    "U", "u", "U", "u", "U", "u", "U", "u",
+    "U", "u", "U", "u", "W", "w", "Y", "y",
+    "Y", "Z", "z", "Z", "z", "Z", "z", "s"
+};
+
+static const char *greek_letters[0x3CF - 0x386] = {
+    "A", NULL, "E", "I", "I", NULL, "O", NULL,
+    "Y", "O", "i", "A", "V", "G", "D", "E",
+    "Z", "I", "TH", "I", "K", "L", "M", "N",
+    "X", "O", "P", "R", NULL, "S", "T", "Y",
+    "F", "CH", "PS", "O", "I", "Y", "a", "e",
+    "i", "i", "y", "a", "v", "g", "d", "e",
+    "z", "i", "th", "i", "k", "l", "m", "n",
+    "x", "o", "p", "r", "s", "s", "t", "y",
+    "f", "ch", "ps", "o", "i", "y", "o", "y",
+    "o"
+};
+
+static const char *cyrillic_letters[0x460 - 0x400] = {
+    "E", "YO", "DJ", "GJ", "YE", "DZ", "I", "YI",
+    "J", "LJ", "NJ", "C", "KJ", "I", "U", "DZ",
+    "A", "B", "V", "G", "D", "E", "ZH", "Z",
+    "I", "J", "K", "L", "M", "N", "O", "P",
+    "R", "S", "T", "U", "F", "KH", "C", "CH",
+    "SH", "SHCH", NULL, "Y", NULL, "E", "YU", "YA",
+    "a", "b", "v", "g", "d", "e", "zh", "z",
+    "i", "j", "k", "l", "m", "n", "o", "p",
+    "r", "s", "t", "u", "f", "kh", "c", "ch",
+    "sh", "shch", NULL, "y", NULL, "e", "yu", "ya",
+    "e", "yo", "dj", "gj", "ye", "dz", "i", "yi",
+    "j", "lj", "nj", "c", "kj", "i", "u", "dz"
+};
+
+static CharsetBytes tables[CHARSET_COUNT][256];
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+void build_tables(void);
+void build_tables(void)
+{
+    for (int charset = 0; charset < CHARSET_COUNT; charset++) {
+        for (int c = 0; c < 256; c++) {
+            CharsetBytes *bytes = &tables[charset][c];
+            uint32_t u = c < 0x80 ? (uint32_t)c : 0;
+
+            if (c >= 0x80 && charset >= CHARSET_WINDOWS_1252) u = upper_halves[charset - CHARSET_WINDOWS_1252][c - 0x80];
+
+            memset(bytes, 0, sizeof(*bytes));
+
+            if (c >= 0x80 && charset < CHARSET_WINDOWS_1252) {
+                // UTF-8 is passed on as it is
+                bytes->utf8[0] = (char)c;
+                bytes->length = 1;
+
+            } else if (u == 0 && c != 0) {
+                // not a character in this charset, and left out
+
+            } else if (u < 0x80) {
+                bytes->utf8[0] = (char)u;
+                bytes->length = 1;
+
+            } else if (u < 0x800) {
+                bytes->utf8[0] = (char)(0xC0 | (u >> 6));
+                bytes->utf8[1] = (char)(0x80 | (u & 0x3F));
+                bytes->length = 2;
+
+            } else {
+                bytes->utf8[0] = (char)(0xE0 | (u >> 12));
+                bytes->utf8[1] = (char)(0x80 | ((u >> 6) & 0x3F));
+                bytes->utf8[2] = (char)(0x80 | (u & 0x3F));
+                bytes->length = 3;
+            }
+        }
+    }
+}
+
+Charset charset_from_name(const char *name, size_t length)
+{
+    for (size_t k = 0; name != NULL && k < sizeof(labels) / sizeof(labels[0]); k++) {
+        if (strlen(labels[k].label) == length && strncasecmp(labels[k].label, name, length) == 0) {
+            return labels[k].charset;
+        }
+    }
+
+    return CHARSET_UNKNOWN;
+}
+
+const char *charset_name(Charset charset)
+{
+    return charset >= 0 && charset < CHARSET_COUNT ? names[charset] : "";
+}
+
+// The UTF-8 for each of the 256 bytes of text in charset
+const CharsetBytes *charset_table(Charset charset)
+{
+    pthread_once(&tables_once, build_tables);
+
+    return tables[charset >= 0 && charset < CHARSET_COUNT ? charset : CHARSET_UNKNOWN];
+}
+
+// The code point of a byte that is not part of valid UTF-8, which is taken as windows-1252
+uint32_t charset_fallback(unsigned char c)
+{
+    return c < 0x80 ? c : upper_halves[0][c - 0x80];
+}
+
+const char *charset_letters(uint32_t code_point)
+{
+    const char *letters = NULL;
+
+    if (code_point >= 0x100 && code_point < 0x180) {
+        letters = latin_extended_letters[code_point - 0x100];
+
+    } else if (code_point >= 0x386 && code_point < 0x3CF) {
+        letters = greek_letters[code_point - 0x386];
+
+    } else if (code_point >= 0x400 && code_point < 0x460) {
+        letters = cyrillic_letters[code_point - 0x400];
+
+    } else if (code_point == 0x490) {
+        letters = "G";
+
+    } else if (code_point == 0x491) {
+        letters = "g";
+    }
+
+    return letters;
+}
+
+// Where word starts in text from start on, ignoring case, or length if it does not
+size_t find_folded(const char *text, size_t length, size_t start, const char *word);
+size_t find_folded(const char *text, size_t length, size_t start, const char *word)
+{
+    size_t word_length = strlen(word);
+
+    for (size_t k = start; k + word_length <= length; k++) {
+        if (strncasecmp(text + k, word, word_length) == 0) return k;
+    }
+
+    return length;
+}
+
+// The charset named after "charset" where text ends, as in a Content-Type or a meta tag
+Charset charset_after(const char *text, size_t length, size_t index);
+Charset charset_after(const char *text, size_t length, size_t index)
+{
+    size_t name;
+
+    while (index < length && isspace((unsigned char)text[index])) index++;
+    if (index >= length || text[index] != '=') return CHARSET_UNKNOWN;
+
+    index++;
+    while (index < length && (isspace((unsigned char)text[index]) || text[index] == '"' || text[index] == '\'')) index++;
+
+    name = index;
+    while (index < length && (isalnum((unsigned char)text[index]) || strchr("-_.:", text[index]) != NULL)) index++;
+
+    return charset_from_name(text + name, index - name);
+}
+
+// The charset of a Content-Type such as "text/html; charset=ISO-8859-1"
+Charset charset_declared(const char *content_type)
+{
+    size_t length = content_type == NULL ? 0 : strlen(content_type);
+    size_t found = length == 0 ? 0 : find_folded(content_type, length, 0, "charset");
+
+    return found < length ? charset_after(content_type, length, found + strlen("charset")) : CHARSET_UNKNOWN;
+}
+
+// The charset a meta tag near the start declares, with charset= or with http-equiv and content=
+Charset meta_charset(const char *text, size_t length);
+Charset meta_charset(const char *text, size_t length)
+{
+    Charset charset = CHARSET_UNKNOWN;
+    size_t prescan = length < CHARSET_PRESCAN_SIZE ? length : CHARSET_PRESCAN_SIZE;
+    size_t tag = find_folded(text, prescan, 0, "<meta");
+
+    while (charset == CHARSET_UNKNOWN && tag < prescan) {
+        const char *close = memchr(text + tag, '>', prescan - tag);
+        size_t tag_end = close == NULL ? prescan : (size_t)(close - text);
+        size_t found = find_folded(text, tag_end, tag, "charset");
+
+        if (found < tag_end) charset = charset_after(text, tag_end, found + strlen("charset"));
+
+        tag = find_folded(text, prescan, tag_end, "<meta");
+    }
+
+    return charset;
+}
+
+Charset charset_detect(const char *text, size_t length, Charset declared)
+{
+    size_t sample = length < CHARSET_SAMPLE_SIZE ? length : CHARSET_SAMPLE_SIZE;
+    size_t sequences = 0;
+    size_t invalid = 0;
+    size_t letters = 0;
+    size_t capitals = 0;            // 0xC0 to 0xDF, capitals in windows-1251, lower case in KOI8-R
+    size_t lower_case = 0;          // 0xE0 to 0xFF, the other way round
+    Charset charset = CHARSET_UNKNOWN;
+
+    if (length >= 3 && memcmp(text, "\xEF\xBB\xBF", 3) == 0) return CHARSET_UTF8;
+    if (declared != CHARSET_UNKNOWN) return declared;
+
+    charset = meta_charset(text, length);
+    if (charset != CHARSET_UNKNOWN) return charset;
+
+    for (size_t k = 0; k < sample; ) {
+        unsigned char c = text[k];
+        size_t size = c < 0x80 ? 1 : (c & 0xE0) == 0xC0 ? 2 : (c & 0xF0) == 0xE0 ? 3 : (c & 0xF8) == 0xF0 ? 4 : 0;
+        size_t valid = 1;
+
+        if (isalpha(c)) letters++;
+        if (c >= 0xE0) {
+            lower_case++;
+
+        } else if (c >= 0xC0) {
+            capitals++;
+        }
+
+        // a sequence cut off where the sample ends before the text does is taken as valid
+        while (size > 1 && valid < size && k + valid < sample && (text[k + valid] & 0xC0) == 0x80) valid++;
+
+        if (size == 1) {
+            k++;
+
+        } else if (size > 1 && (valid == size || (k + valid == sample && sample < length))) {
+            sequences++;
+            k += valid;
+
+        } else {
+            invalid++;
+            k++;
+        }
+    }
+
+    if (invalid == 0 || invalid * 8 < sequences) {
+        charset = CHARSET_UTF8;
+
+    } else if (capitals + lower_case > letters) {
+        charset = lower_case >= capitals ? CHARSET_WINDOWS_1251 : CHARSET_KOI8_R;
+
+    } else {
+        charset = CHARSET_WINDOWS_1252;
+    }
+
+    return charset;
+}
+
+// Detects the charset of a file from its first bytes, and goes back to where it was
+Charset charset_detect_file(FILE *file)
+{
+    char *sample = malloc(CHARSET_SAMPLE_SIZE);
+    long at = ftell(file);
+    Charset charset = CHARSET_UTF8;
+
+    if (sample != NULL) {
+        charset = charset_detect(sample, fread(sample, 1, CHARSET_SAMPLE_SIZE, file), CHARSET_UNKNOWN);
+        free(sample);
+    }
+
+    if (at >= 0) fseek(file, at, SEEK_SET);
+    clearerr(file);
+
+    return charset;
+}
+
+#if DEBUG
+void charset_tests(void)
+{
+    bool ok = true;
+    printf("charset_tests()\n");
+
+    // charset_from_name charset_name charset_declared
+    ok &= print_if_fail(charset_from_name("ISO-8859-1", 10) == CHARSET_WINDOWS_1252, "FAIL: charset_from_name (1)");
+    ok &= print_if_fail(charset_from_name("koi8-r; x", 6) == CHARSET_KOI8_R, "FAIL: charset_from_name (2)");
+    ok &= print_if_fail(charset_from_name("ebcdic", 6) == CHARSET_UNKNOWN, "FAIL: charset_from_name (3)");
+    ok &= print_if_fail(strcmp(charset_name(CHARSET_WINDOWS_1251), "windows-1251") == 0, "FAIL: charset_name (1)");
+    ok &= print_if_fail(charset_declared("text/html; charset=\"Windows-1251\"") == CHARSET_WINDOWS_1251,
+                        "FAIL: charset_declared (1)");
+    ok &= print_if_fail(charset_declared("text/html") == CHARSET_UNKNOWN, "FAIL: charset_declared (2)");
+    ok &= print_if_fail(charset_declared(NULL) == CHARSET_UNKNOWN, "FAIL: charset_declared (3)");
+
+    // charset_table charset_fallback charset_letters
+    const CharsetBytes *table = charset_table(CHARSET_WINDOWS_1252);
+    ok &= print_if_fail(table[0x93].length == 3 && memcmp(table[0x93].utf8, "\xE2\x80\x9C", 4) == 0,
+                        "FAIL: charset_table (1)");
+    ok &= print_if_fail(table['a'].length == 1 && table['a'].utf8[0] == 'a', "FAIL: charset_table (2)");
+    ok &= print_if_fail(table[0x81].length == 0, "FAIL: charset_table (3)");
+    table = charset_table(CHARSET_KOI8_R);
+    ok &= print_if_fail(table[0xC1].length == 2 && memcmp(table[0xC1].utf8, "\xD0\xB0", 2) == 0,
+                        "FAIL: charset_table (4)");
+    table = charset_table(CHARSET_UTF8);
+    ok &= print_if_fail(table[0xE9].length == 1 && (unsigned char)table[0xE9].utf8[0] == 0xE9,
+                        "FAIL: charset_table (5)");
+    ok &= print_if_fail(charset_fallback(0x96) == 0x2013 && charset_fallback(0xE9) == 0xE9, "FAIL: charset_fallback (1)");
+    ok &= print_if_fail(strcmp(charset_letters(0x416), "ZH") == 0, "FAIL: charset_letters (1)");
+    ok &= print_if_fail(strcmp(charset_letters(0x161), "s") == 0, "FAIL: charset_letters (2)");
+    ok &= print_if_fail(charset_letters(0x2013) == NULL, "FAIL: charset_letters (3)");
+
+    // charset_detect
+    const char *text = "\xEF\xBB\xBF" "caf\xE9";
+    ok &= print_if_fail(charset_detect(text, strlen(text), CHARSET_KOI8_R) == CHARSET_UTF8, "FAIL: charset_detect (1)");
+    text = "caf\xE9";
+    ok &= print_if_fail(charset_detect(text, strlen(text), CHARSET_KOI8_R) == CHARSET_KOI8_R, "FAIL: charset_detect (2)");
+    ok &= print_if_fail(charset_detect(text, strlen(text), CHARSET_UNKNOWN) == CHARSET_WINDOWS_1252,
+                        "FAIL: charset_detect (3)");
+    text = "caf\xC3\xA9 \xE2\x80\x9Cquoted\xE2\x80\x9D";
+    ok &= print_if_fail(charset_detect(text, strlen(text), CHARSET_UNKNOWN) == CHARSET_UTF8, "FAIL: charset_detect (4)");
+    char *sample = malloc(CHARSET_SAMPLE_SIZE + 1);
+    memset(sample, 'a', CHARSET_SAMPLE_SIZE + 1);
+    memcpy(sample + CHARSET_SAMPLE_SIZE - 1, "\xC3\xA9", 2);
+    ok &= print_if_fail(charset_detect(sample, CHARSET_SAMPLE_SIZE + 1, CHARSET_UNKNOWN) == CHARSET_UTF8 &&
+                        charset_detect(sample, CHARSET_SAMPLE_SIZE, CHARSET_UNKNOWN) == CHARSET_WINDOWS_1252,
+                        "FAIL: charset_detect (5)");
+    free(sample);
+    text = "<html><head><META http-equiv=\"Content-Type\" content=\"text/html; charset=koi8-r\"></head>caf\xC3\xA9";
+    ok &= print_if_fail(charset_detect(text, strlen(text), CHARSET_UNKNOWN) == CHARSET_KOI8_R, "FAIL: charset_detect (6)");
+    text = "<meta name=\"x\"><meta charset='iso-8859-2'>";
+    ok &= print_if_fail(charset_detect(text, strlen(text), CHARSET_UNKNOWN) == CHARSET_ISO_8859_2,
+                        "FAIL: charset_detect (7)");
+    text = "\xEF\xF0\xE8\xE2\xE5\xF2 \xEC\xE8\xF0";
+    ok &= print_if_fail(charset_detect(text, strlen(text), CHARSET_UNKNOWN) == CHARSET_WINDOWS_1251,
+                        "FAIL: charset_detect (8)");
+    text = "\xD0\xD2\xC9\xD7\xC5\xD4 \xCD\xC9\xD2";
+    ok &= print_if_fail(charset_detect(text, strlen(text), CHARSET_UNKNOWN) == CHARSET_KOI8_R, "FAIL: charset_detect (9)");
+    ok &= print_if_fail(charset_detect("", 0, CHARSET_UNKNOWN) == CHARSET_UTF8, "FAIL: charset_detect (10)");
+
+    // charset_detect_file
+    FILE *file = fopen("charset.tmp", "w+");
+    fputs("\xEF\xF0\xE8\xE2\xE5\xF2 \xEC\xE8\xF0", file);
+    fseek(file, 2, SEEK_SET);
+    ok &= print_if_fail(charset_detect_file(file) == CHARSET_WINDOWS_1251 && ftell(file) == 2,
+                        "FAIL: charset_detect_file (1)");
+    fclose(file);
+    remove("charset.tmp");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,81 @@
+//
+//  charset.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef charset_h
+#define charset_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Text that is not UTF-8 is read through a table for its charset that gives, for each byte, the
+// UTF-8 for its code point, so that the tokens passed on are UTF-8 whatever the charset. For
+// UTF-8 each byte is itself, and a byte that is not part of a valid sequence is taken as
+// windows-1252, which is Latin-1 with quotes and dashes in 0x80 to 0x9F. The charset given with
+// --charset is used if there is one, or else the one a BOM, the Content-Type of a URL or a meta
+// tag near the start of HTML declares, in that order. Otherwise it is guessed from the first
+// CHARSET_SAMPLE_SIZE bytes: text with no invalid UTF-8 is UTF-8, text mostly in the upper half
+// of windows-1251 or KOI8-R is Russian in whichever has more of the lower case letters, and
+// anything else is windows-1252.
+#define CHARSET_SAMPLE_SIZE 65536
+#define CHARSET_PRESCAN_SIZE 4096   // bytes of HTML looked through for a meta tag
+
+typedef enum Charset {
+    CHARSET_UNKNOWN = 0,
+    CHARSET_UTF8,
+    CHARSET_WINDOWS_1252,
+    CHARSET_WINDOWS_1250,
+    CHARSET_WINDOWS_1251,
+    CHARSET_ISO_8859_2,
+    CHARSET_ISO_8859_5,
+    CHARSET_ISO_8859_7,
+    CHARSET_ISO_8859_15,
+    CHARSET_KOI8_R,
+    CHARSET_KOI8_U,
+    CHARSET_COUNT
+} Charset;
+
+// The UTF-8 for a byte; bytes past length are zero, so that all four can be copied at once.
+struct CharsetBytes {
+    char utf8[4];
+    uint32_t length;
+};
+typedef struct CharsetBytes CharsetBytes;
+
+Charset charset_from_name(const char *name, size_t length);
+const char *charset_name(Charset charset);
+const CharsetBytes *charset_table(Charset charset);
+uint32_t charset_fallback(unsigned char c);
+const char *charset_letters(uint32_t code_point);
+Charset charset_declared(const char *content_type);
+Charset charset_detect(const char *text, size_t length, Charset declared);
+Charset charset_detect_file(FILE *file);
+
+#if DEBUG
+void charset_tests(void);
+#endif
+
+#endif /* charset_h */
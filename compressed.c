@@ -0,0 +1,792 @@
+//
+//  compressed.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bzlib.h>
+#include <lzma.h>
+#include <zlib.h>
+
+#include "book.h"
+#include "cache.h"
+#include "compressed.h"
+#include "pipeline.h"
+#include "vector.h"
+
+#define RESTART_MAGIC "MFRSTRT1"
+#define INPUT_SIZE 65536
+#define GZIP_TRAILER_SIZE 8
+
+// Text is decompressed into a window that wraps around, and read from it, so that the last
+// RESTART_WINDOW bytes are there to keep with a restart point.
+struct Decompressor {
+    FILE *file;                     // not closed with the stream
+    CompressedFormat format;
+    z_stream gz;
+    bz_stream bz;
+    lzma_stream xz;
+    bool started;                   // one of the above
+    bool raw;                       // gzip resumed inside a deflate stream, so with no header
+    size_t trailer_left;            // of the gzip member a raw stream ended in
+    bool between;                   // at the end of a gzip or bzip2 stream, where the file may end
+    bool input_done;
+    bool ended;
+    bool failed;
+    unsigned char input[INPUT_SIZE];
+    uint64_t in_offset;             // of the file, after what was read into input
+    unsigned char window[RESTART_WINDOW];
+    size_t filled;                  // of window
+    size_t delivered;               // of window, read from the stream
+    uint64_t out_offset;            // of the text, after what was decompressed
+
+    // restart points of a gzip file, kept only with a state file
+    char *index_path;
+    struct stat info;               // of the file
+    uint64_t spacing;
+    uint64_t saved_count;           // in the index
+    uint64_t saved_out;             // of the last in the index
+    uint64_t next_point;            // text offset after which the next is kept
+    Vector points;                  // RestartPoint, found since
+};
+typedef struct Decompressor Decompressor;
+
+CompressedFormat compressed_format(FILE *file)
+{
+    unsigned char magic[10] = { 0 };
+    size_t length = 0;
+    off_t at;
+
+    if (!is_regular_file(file)) return COMPRESSED_NONE;
+
+    // read from wherever the caller has seeked to
+    at = ftello(file);
+    if (at >= 0 && fseeko(file, 0, SEEK_SET) == 0) length = fread(magic, 1, sizeof(magic), file);
+    if (at >= 0) fseeko(file, at, SEEK_SET);
+    clearerr(file);
+
+    if (length >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+        return COMPRESSED_GZIP;
+
+    } else if (length == 10 && memcmp(magic, "BZh", 3) == 0 && magic[3] >= '1' && magic[3] <= '9' &&
+               memcmp(magic + 4, "1AY&SY", 6) == 0) {
+        return COMPRESSED_BZIP2;
+
+    } else if (length >= 6 && memcmp(magic, "\xFD" "7zXZ", 6) == 0) {
+        return COMPRESSED_XZ;
+    }
+
+    return COMPRESSED_NONE;
+}
+
+char *restart_index_path(const char *state_path, const char *path);
+char *restart_index_path(const char *state_path, const char *path)
+{
+    char *dir = malloc(strlen(state_path) + strlen(RESTART_SUFFIX) + 32);
+    char *full_path = realpath(path, NULL);
+    const char *name = full_path != NULL ? full_path : path;
+
+    if (dir != NULL) {
+        sprintf(dir, "%s%s", state_path, RESTART_SUFFIX);
+
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+            free(dir);
+            dir = NULL;
+
+        } else {
+            sprintf(dir + strlen(dir), "/%016llx", (unsigned long long)cache_hash(name, strlen(name), 0));
+        }
+    }
+
+    free(full_path);
+
+    return dir;
+}
+
+bool read_restart_header(FILE *file, const Decompressor *d, RestartHeader *header);
+bool read_restart_header(FILE *file, const Decompressor *d, RestartHeader *header)
+{
+    return fseeko(file, 0, SEEK_SET) == 0 && fread(header, sizeof(*header), 1, file) == 1 &&
+           memcmp(header->magic, RESTART_MAGIC, sizeof(header->magic)) == 0 &&
+           header->file_size == (uint64_t)d->info.st_size && header->modified_seconds == d->info.st_mtim.tv_sec &&
+           header->modified_nanoseconds == d->info.st_mtim.tv_nsec && header->spacing == d->spacing;
+}
+
+// Notes the points in the index, and reads the last at or before start into point, if there is one.
+bool read_restart_point(Decompressor *d, uint64_t start, RestartPoint *point);
+bool read_restart_point(Decompressor *d, uint64_t start, RestartPoint *point)
+{
+    FILE *file = fopen(d->index_path, "rb");
+    RestartHeader header;
+    uint64_t chosen = UINT64_MAX;
+    bool valid;
+
+    if (file == NULL) return false;
+
+    valid = read_restart_header(file, d, &header);
+
+    for (uint64_t k = 0; valid && k < header.count; k++) {
+        uint64_t out;
+
+        valid = fseeko(file, sizeof(header) + k * sizeof(RestartPoint), SEEK_SET) == 0 &&
+                fread(&out, sizeof(out), 1, file) == 1;
+        if (valid && out <= start) chosen = k;
+        if (valid) d->saved_out = out;
+    }
+
+    // a point is read whole before it is used
+    if (valid) {
+        d->saved_count = header.count;
+        valid = chosen != UINT64_MAX &&
+                fseeko(file, sizeof(header) + chosen * sizeof(RestartPoint), SEEK_SET) == 0 &&
+                fread(point, sizeof(*point), 1, file) == 1 && point->bits >= 0 && point->bits < 8;
+
+    } else {
+        d->saved_out = 0;
+    }
+
+    fclose(file);
+
+    return valid;
+}
+
+void write_restart_points(Decompressor *d);
+void write_restart_points(Decompressor *d)
+{
+    RestartHeader header;
+    FILE *file = NULL;
+    char *temp_path = NULL;
+    int fd = -1;
+    bool written = false;
+
+    if (d->index_path == NULL || d->points.size == 0) return;
+
+    // added to the end, and then counted, so a run stopped partway leaves the index as it was
+    if (d->saved_count > 0) {
+        file = fopen(d->index_path, "r+b");
+
+        if (file != NULL && read_restart_header(file, d, &header) && header.count == d->saved_count &&
+            fseeko(file, sizeof(header) + header.count * sizeof(RestartPoint), SEEK_SET) == 0 &&
+            fwrite(d->points.p, sizeof(RestartPoint), d->points.size, file) == d->points.size && fflush(file) == 0) {
+            header.count += d->points.size;
+            if (fseeko(file, 0, SEEK_SET) == 0) fwrite(&header, sizeof(header), 1, file);
+        }
+
+        if (file != NULL) fclose(file);
+        return;
+    }
+
+    temp_path = malloc(strlen(d->index_path) + strlen(".XXXXXX") + 1);
+    if (temp_path == NULL) return;
+
+    sprintf(temp_path, "%s.XXXXXX", d->index_path);
+    fd = mkstemp(temp_path);
+    if (fd >= 0) file = fdopen(fd, "w");
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RESTART_MAGIC, sizeof(header.magic));
+    header.file_size = d->info.st_size;
+    header.modified_seconds = d->info.st_mtim.tv_sec;
+    header.modified_nanoseconds = d->info.st_mtim.tv_nsec;
+    header.spacing = d->spacing;
+    header.count = d->points.size;
+
+    if (file != NULL) {
+        written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  fwrite(d->points.p, sizeof(RestartPoint), d->points.size, file) == d->points.size;
+        written &= fclose(file) == 0;
+
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    if (fd >= 0 && (!written || rename(temp_path, d->index_path) != 0)) remove(temp_path);
+
+    free(temp_path);
+}
+
+void add_restart_point(Decompressor *d);
+void add_restart_point(Decompressor *d)
+{
+    RestartPoint *point = malloc(sizeof(*point));
+
+    // found again after resuming from an earlier point
+    if (point != NULL && d->out_offset > d->saved_out) {
+        point->out = d->out_offset;
+        point->in = d->in_offset - d->gz.avail_in;
+        point->bits = d->gz.data_type & 7;
+        memcpy(point->window, d->window + d->filled, RESTART_WINDOW - d->filled);
+        memcpy(point->window + RESTART_WINDOW - d->filled, d->window, d->filled);
+        vector_push(&d->points, point);
+    }
+
+    free(point);
+    d->next_point = d->out_offset + d->spacing;
+}
+
+// Reads more of the file into input once what was read before is used. The file may only end
+// between streams.
+bool read_input(Decompressor *d, size_t *available);
+bool read_input(Decompressor *d, size_t *available)
+{
+    *available = fread(d->input, 1, INPUT_SIZE, d->file);
+    d->in_offset += *available;
+
+    if (*available == 0) {
+        d->failed = ferror(d->file) || !d->between;
+        d->ended = true;
+    }
+
+    return *available > 0;
+}
+
+void gzip_decode(Decompressor *d);
+void gzip_decode(Decompressor *d)
+{
+    z_stream *gz = &d->gz;
+    size_t room = RESTART_WINDOW - d->filled;
+    size_t available;
+    int result;
+
+    if (gz->avail_in == 0) {
+        if (!read_input(d, &available)) return;
+        gz->next_in = d->input;
+        gz->avail_in = (uInt)available;
+    }
+
+    // a resumed member ends with its trailer, and the member after starts with a header
+    if (d->trailer_left > 0) {
+        size_t skipped = gz->avail_in < d->trailer_left ? gz->avail_in : d->trailer_left;
+
+        gz->next_in += skipped;
+        gz->avail_in -= skipped;
+        d->trailer_left -= skipped;
+
+        if (d->trailer_left == 0) {
+            d->raw = false;
+            d->between = true;
+            if (inflateReset2(gz, 15 + 16) != Z_OK) d->failed = true;
+        }
+        return;
+    }
+
+    gz->next_out = d->window + d->filled;
+    gz->avail_out = (uInt)room;
+    d->between = false;
+
+    result = inflate(gz, Z_BLOCK);
+    d->filled += room - gz->avail_out;
+    d->out_offset += room - gz->avail_out;
+
+    if (result == Z_STREAM_END && d->raw) {
+        d->trailer_left = GZIP_TRAILER_SIZE;
+
+    } else if (result == Z_STREAM_END) {
+        d->between = true;
+        inflateReset(gz);
+
+    } else if (result != Z_OK && result != Z_BUF_ERROR) {
+        d->failed = true;
+
+    } else if (d->index_path != NULL && (gz->data_type & 128) != 0 && (gz->data_type & 64) == 0 &&
+               d->out_offset >= d->next_point) {
+        // at the start of a block other than the first or last
+        add_restart_point(d);
+    }
+}
+
+void bzip2_decode(Decompressor *d);
+void bzip2_decode(Decompressor *d)
+{
+    bz_stream *bz = &d->bz;
+    size_t room = RESTART_WINDOW - d->filled;
+    size_t available;
+    int result;
+
+    if (bz->avail_in == 0) {
+        if (!read_input(d, &available)) return;
+        bz->next_in = (char *)d->input;
+        bz->avail_in = (unsigned int)available;
+    }
+
+    bz->next_out = (char *)d->window + d->filled;
+    bz->avail_out = (unsigned int)room;
+    d->between = false;
+
+    result = BZ2_bzDecompress(bz);
+    d->filled += room - bz->avail_out;
+    d->out_offset += room - bz->avail_out;
+
+    // another stream may follow, as from parallel bzip2
+    if (result == BZ_STREAM_END) {
+        char *next_in = bz->next_in;
+        unsigned int avail_in = bz->avail_in;
+
+        BZ2_bzDecompressEnd(bz);
+        d->started = BZ2_bzDecompressInit(bz, 0, 0) == BZ_OK;
+        d->failed = !d->started;
+        d->between = true;
+        bz->next_in = next_in;
+        bz->avail_in = avail_in;
+
+    } else if (result != BZ_OK) {
+        d->failed = true;
+    }
+}
+
+void xz_decode(Decompressor *d);
+void xz_decode(Decompressor *d)
+{
+    lzma_stream *xz = &d->xz;
+    size_t room = RESTART_WINDOW - d->filled;
+    lzma_ret result;
+
+    if (xz->avail_in == 0 && !d->input_done) {
+        xz->next_in = d->input;
+        xz->avail_in = fread(d->input, 1, INPUT_SIZE, d->file);
+        d->in_offset += xz->avail_in;
+        d->input_done = xz->avail_in == 0;
+
+        if (ferror(d->file)) {
+            d->failed = true;
+            return;
+        }
+    }
+
+    xz->next_out = d->window + d->filled;
+    xz->avail_out = room;
+
+    // streams one after another are decoded as one
+    result = lzma_code(xz, d->input_done ? LZMA_FINISH : LZMA_RUN);
+    d->filled += room - xz->avail_out;
+    d->out_offset += room - xz->avail_out;
+
+    if (result == LZMA_STREAM_END) {
+        d->ended = true;
+
+    } else if (result != LZMA_OK) {
+        d->failed = true;
+    }
+}
+
+void decode(Decompressor *d);
+void decode(Decompressor *d)
+{
+    if (d->filled == RESTART_WINDOW) {
+        d->filled = 0;
+        d->delivered = 0;
+    }
+
+    switch (d->format) {
+        case COMPRESSED_GZIP:   gzip_decode(d);     break;
+        case COMPRESSED_BZIP2:  bzip2_decode(d);    break;
+        case COMPRESSED_XZ:     xz_decode(d);       break;
+        default:                d->failed = true;   break;
+    }
+}
+
+ssize_t decompressor_read(void *cookie, char *buffer, size_t size);
+ssize_t decompressor_read(void *cookie, char *buffer, size_t size)
+{
+    Decompressor *d = cookie;
+    size_t copied = 0;
+
+    while (copied < size) {
+        if (d->delivered < d->filled) {
+            size_t count = d->filled - d->delivered < size - copied ? d->filled - d->delivered : size - copied;
+
+            memcpy(buffer + copied, d->window + d->delivered, count);
+            d->delivered += count;
+            copied += count;
+
+        } else if (d->ended || d->failed) {
+            break;
+
+        } else {
+            decode(d);
+        }
+    }
+
+    return copied == 0 && d->failed ? -1 : (ssize_t)copied;
+}
+
+void free_decompressor(Decompressor *d);
+void free_decompressor(Decompressor *d)
+{
+    if (d->started) {
+        switch (d->format) {
+            case COMPRESSED_GZIP:   inflateEnd(&d->gz);             break;
+            case COMPRESSED_BZIP2:  BZ2_bzDecompressEnd(&d->bz);    break;
+            case COMPRESSED_XZ:     lzma_end(&d->xz);               break;
+            default:                                                break;
+        }
+    }
+
+    vector_free(&d->points);
+    free(d->index_path);
+    free(d);
+}
+
+int decompressor_close(void *cookie);
+int decompressor_close(void *cookie)
+{
+    Decompressor *d = cookie;
+
+    write_restart_points(d);
+    free_decompressor(d);
+
+    return 0;
+}
+
+// From the start of the file.
+MorseFeedError start_decompressor(Decompressor *d);
+MorseFeedError start_decompressor(Decompressor *d)
+{
+    lzma_stream xz = LZMA_STREAM_INIT;
+
+    if (fseeko(d->file, 0, SEEK_SET) != 0) return MF_FILE_READ_ERROR;
+
+    switch (d->format) {
+        case COMPRESSED_GZIP:
+            d->started = inflateInit2(&d->gz, 15 + 16) == Z_OK;
+            break;
+
+        case COMPRESSED_BZIP2:
+            d->started = BZ2_bzDecompressInit(&d->bz, 0, 0) == BZ_OK;
+            break;
+
+        case COMPRESSED_XZ:
+            d->xz = xz;
+            d->started = lzma_stream_decoder(&d->xz, UINT64_MAX, LZMA_CONCATENATED) == LZMA_OK;
+            break;
+
+        default:
+            return MF_INVALID_VALUE;
+    }
+
+    return d->started ? MF_NO_ERROR : MF_OUT_OF_MEMORY;
+}
+
+// From a restart point, with the window the point was found with.
+bool resume_decompressor(Decompressor *d, const RestartPoint *point);
+bool resume_decompressor(Decompressor *d, const RestartPoint *point)
+{
+    uint64_t offset = point->in - (point->bits > 0 ? 1 : 0);
+    int c = 0;
+
+    if (fseeko(d->file, offset, SEEK_SET) != 0 || (point->bits > 0 && (c = getc(d->file)) == EOF)) return false;
+    if (inflateInit2(&d->gz, -15) != Z_OK) return false;
+
+    d->started = true;
+    if (point->bits > 0) inflatePrime(&d->gz, point->bits, c >> (8 - point->bits));
+
+    if (inflateSetDictionary(&d->gz, point->window, RESTART_WINDOW) != Z_OK) {
+        inflateEnd(&d->gz);
+        d->started = false;
+        return false;
+    }
+
+    memcpy(d->window, point->window, RESTART_WINDOW);
+    d->filled = RESTART_WINDOW;
+    d->delivered = RESTART_WINDOW;
+    d->in_offset = point->in;
+    d->out_offset = point->out;
+    d->raw = true;
+    d->next_point = point->out + d->spacing;
+
+    return true;
+}
+
+// Decompresses up to start without reading it.
+MorseFeedError skip_text(Decompressor *d, uint64_t start);
+MorseFeedError skip_text(Decompressor *d, uint64_t start)
+{
+    uint64_t position = d->out_offset - (d->filled - d->delivered);
+
+    while (position < start && !d->failed) {
+        if (d->delivered < d->filled) {
+            size_t count = d->filled - d->delivered < start - position ? d->filled - d->delivered : start - position;
+
+            d->delivered += count;
+            position += count;
+
+        } else if (d->ended) {
+            break;
+
+        } else {
+            decode(d);
+        }
+    }
+
+    return d->failed ? MF_FILE_READ_ERROR : MF_NO_ERROR;
+}
+
+MorseFeedError open_decompressor(FILE **stream, FILE *file, CompressedFormat format, char *index_path,
+                                 const char *path, uint64_t spacing, uint64_t start);
+MorseFeedError open_decompressor(FILE **stream, FILE *file, CompressedFormat format, char *index_path,
+                                 const char *path, uint64_t spacing, uint64_t start)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    cookie_io_functions_t functions = { decompressor_read, NULL, NULL, decompressor_close };
+    Decompressor *d = calloc(1, sizeof(*d));
+    RestartPoint *point = NULL;
+    bool resumed = false;
+
+    *stream = NULL;
+
+    if (d == NULL) {
+        free(index_path);
+        return MF_OUT_OF_MEMORY;
+    }
+
+    d->file = file;
+    d->format = format;
+    d->index_path = index_path;
+    d->spacing = spacing;
+    d->next_point = spacing;
+    d->points = vector_create(0, sizeof(RestartPoint));
+
+    // points are only kept for a file that can be known again
+    if (d->index_path != NULL && (path == NULL || stat(path, &d->info) != 0)) {
+        free(d->index_path);
+        d->index_path = NULL;
+    }
+
+    if (d->index_path != NULL) {
+        point = malloc(sizeof(*point));
+        resumed = point != NULL && read_restart_point(d, start, point) && resume_decompressor(d, point);
+        free(point);
+    }
+
+    if (!resumed) error = start_decompressor(d);
+    if (error == MF_NO_ERROR) error = skip_text(d, start);
+
+    if (error == MF_NO_ERROR) {
+        *stream = fopencookie(d, "r", functions);
+        if (*stream == NULL) error = MF_OUT_OF_MEMORY;
+    }
+
+    if (error != MF_NO_ERROR) free_decompressor(d);
+
+    return error;
+}
+
+// A stream of the text in a compressed file, from start. With a state file and a path, the
+// restart points of a gzip file are read to start from the nearest, and those found after are
+// added when the stream is closed. The file is not closed with it.
+MorseFeedError decompress_open(FILE **stream, FILE *file, CompressedFormat format, const char *state_path,
+                               const char *path, uint64_t start)
+{
+    char *index_path = NULL;
+
+    if (format == COMPRESSED_GZIP && state_path != NULL && path != NULL) {
+        index_path = restart_index_path(state_path, path);
+    }
+
+    return open_decompressor(stream, file, format, index_path, path, RESTART_SPACING, start);
+}
+
+MorseFeedError decompress_read_all(FILE *file, CompressedFormat format, BufferStruct *buffer)
+{
+    FILE *stream = NULL;
+    MorseFeedError error = decompress_open(&stream, file, format, NULL, NULL, 0);
+
+    if (error == MF_NO_ERROR) {
+        error = read_whole_file(stream, buffer);
+        fclose(stream);
+    }
+
+    return error;
+}
+
+#if DEBUG
+bool write_gzip(FILE *file, const char *text, size_t length)
+{
+    z_stream gz;
+    unsigned char output[INPUT_SIZE];
+    int result = Z_OK;
+
+    memset(&gz, 0, sizeof(gz));
+    if (deflateInit2(&gz, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return false;
+
+    gz.next_in = (unsigned char *)text;
+    gz.avail_in = (uInt)length;
+
+    while (result == Z_OK) {
+        gz.next_out = output;
+        gz.avail_out = sizeof(output);
+        result = deflate(&gz, Z_FINISH);
+        fwrite(output, 1, sizeof(output) - gz.avail_out, file);
+    }
+
+    deflateEnd(&gz);
+
+    return result == Z_STREAM_END;
+}
+
+bool reads_as(FILE *stream, const char *text, size_t length);
+bool reads_as(FILE *stream, const char *text, size_t length)
+{
+    BufferStruct buffer = { NULL, 0, 0 };
+    bool same = stream != NULL && read_whole_file(stream, &buffer) == MF_NO_ERROR && buffer.used - 1 == length &&
+                memcmp(buffer.p, text, length) == 0;
+
+    free_buffer(&buffer);
+    if (stream != NULL) fclose(stream);
+
+    return same;
+}
+
+void compressed_tests(void)
+{
+    bool ok = true;
+    size_t length = 0;
+    size_t first_length;
+    char *text = malloc(600000);
+    char *packed = malloc(700000);
+    unsigned int packed_length = 700000;
+    size_t xz_length = 0;
+    BufferStruct buffer = { NULL, 0, 0 };
+    FILE *file;
+    FILE *stream;
+    FILE *index;
+    RestartHeader header;
+    RestartPoint *point = malloc(sizeof(*point));
+    uint64_t full_count;
+    printf("compressed_tests()\n");
+
+    srand(7);
+    while (length < 590000) length += sprintf(text + length, "w%d%c", rand() % 5000, rand() % 10 ? ' ' : '\n');
+
+    // two members, as concatenated gzip files are
+    first_length = length / 3;
+    file = fopen("compressed.tmp", "w+b");
+    ok &= print_if_fail(write_gzip(file, text, first_length) && write_gzip(file, text + first_length, length - first_length),
+                        "FAIL: write_gzip");
+    fflush(file);
+
+    ok &= print_if_fail(compressed_format(file) == COMPRESSED_GZIP, "FAIL: compressed_format (1)");
+    ok &= print_if_fail(decompress_read_all(file, COMPRESSED_GZIP, &buffer) == MF_NO_ERROR &&
+                        buffer.used - 1 == length && memcmp(buffer.p, text, length) == 0, "FAIL: decompress_read_all (1)");
+    free_buffer(&buffer);
+
+    // restart points are found, and then used to start partway, in either member
+    remove("restart.tmp");
+    ok &= print_if_fail(open_decompressor(&stream, file, COMPRESSED_GZIP, strdup("restart.tmp"), "compressed.tmp", 65536,
+                                          0) == MF_NO_ERROR && reads_as(stream, text, length), "FAIL: open_decompressor (1)");
+    index = fopen("restart.tmp", "rb");
+    ok &= print_if_fail(index != NULL && fread(&header, sizeof(header), 1, index) == 1 && header.count >= 5,
+                        "FAIL: write_restart_points (1)");
+    full_count = header.count;
+    if (index != NULL) fclose(index);
+
+    for (size_t start = 100000; start < length; start += 150000) {
+        ok &= print_if_fail(open_decompressor(&stream, file, COMPRESSED_GZIP, strdup("restart.tmp"), "compressed.tmp",
+                                              65536, start) == MF_NO_ERROR &&
+                            reads_as(stream, text + start, length - start), "FAIL: open_decompressor (2)");
+    }
+    fclose(file);
+
+    // only the points after those kept are added
+    remove("restart.tmp");
+    file = fopen("compressed.tmp", "rb");
+    stream = NULL;
+    ok &= print_if_fail(open_decompressor(&stream, file, COMPRESSED_GZIP, strdup("restart.tmp"), "compressed.tmp", 65536,
+                                          length / 2) == MF_NO_ERROR, "FAIL: open_decompressor (3)");
+    if (stream != NULL) fclose(stream);
+    ok &= print_if_fail(open_decompressor(&stream, file, COMPRESSED_GZIP, strdup("restart.tmp"), "compressed.tmp", 65536,
+                                          length / 4) == MF_NO_ERROR && reads_as(stream, text + length / 4, length - length / 4),
+                        "FAIL: open_decompressor (4)");
+    index = fopen("restart.tmp", "rb");
+    ok &= print_if_fail(index != NULL && fread(&header, sizeof(header), 1, index) == 1 && header.count == full_count,
+                        "FAIL: write_restart_points (2)");
+
+    for (uint64_t k = 0, previous = 0; index != NULL && k < header.count; k++) {
+        ok &= print_if_fail(fread(point, sizeof(*point), 1, index) == 1 && point->out > previous,
+                            "FAIL: write_restart_points (3)");
+        previous = point->out;
+    }
+
+    if (index != NULL) fclose(index);
+    fclose(file);
+
+    // a file cut short is an error
+    truncate("compressed.tmp", 5000);
+    file = fopen("compressed.tmp", "rb");
+    ok &= print_if_fail(decompress_read_all(file, COMPRESSED_GZIP, &buffer) == MF_FILE_READ_ERROR,
+                        "FAIL: decompress_read_all (2)");
+    free_buffer(&buffer);
+    fclose(file);
+
+    file = fopen("compressed.tmp", "w+b");
+    ok &= print_if_fail(BZ2_bzBuffToBuffCompress(packed, &packed_length, text, (unsigned int)length, 9, 0, 0) == BZ_OK,
+                        "FAIL: BZ2_bzBuffToBuffCompress");
+    fwrite(packed, 1, packed_length, file);
+    fflush(file);
+    ok &= print_if_fail(compressed_format(file) == COMPRESSED_BZIP2, "FAIL: compressed_format (2)");
+    ok &= print_if_fail(decompress_open(&stream, file, COMPRESSED_BZIP2, NULL, NULL, 1000) == MF_NO_ERROR &&
+                        reads_as(stream, text + 1000, length - 1000), "FAIL: decompress_open (1)");
+    fclose(file);
+
+    file = fopen("compressed.tmp", "w+b");
+    ok &= print_if_fail(lzma_easy_buffer_encode(6, LZMA_CHECK_CRC64, NULL, (uint8_t *)text, length, (uint8_t *)packed,
+                                                &xz_length, 700000) == LZMA_OK, "FAIL: lzma_easy_buffer_encode");
+    fwrite(packed, 1, xz_length, file);
+    fflush(file);
+    ok &= print_if_fail(compressed_format(file) == COMPRESSED_XZ, "FAIL: compressed_format (3)");
+    ok &= print_if_fail(decompress_read_all(file, COMPRESSED_XZ, &buffer) == MF_NO_ERROR &&
+                        buffer.used - 1 == length && memcmp(buffer.p, text, length) == 0, "FAIL: decompress_read_all (3)");
+    free_buffer(&buffer);
+    fclose(file);
+
+    file = fopen("compressed.tmp", "w+b");
+    fputs("BZh plain text", file);
+    fflush(file);
+    ok &= print_if_fail(compressed_format(file) == COMPRESSED_NONE, "FAIL: compressed_format (4)");
+    // where the caller had seeked to is kept
+    fseeko(file, 4, SEEK_SET);
+    ok &= print_if_fail(compressed_format(file) == COMPRESSED_NONE && ftello(file) == 4 && getc(file) == 'p',
+                        "FAIL: compressed_format (5)");
+    fclose(file);
+
+    remove("compressed.tmp");
+    remove("restart.tmp");
+    free(point);
+    free(packed);
+    free(text);
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,83 @@
+//
+//  compressed.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef compressed_h
+#define compressed_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "morsefeed.h"
+
+// An input file compressed with gzip, bzip2 or xz, known by the bytes it starts with, is
+// decompressed as it is read, and converted as the text it holds. Positions saved with -p are
+// in the text. So that a gzip file can be resumed without decompressing it from the start, the
+// places it can be decompressed from are kept while it is read, about every RESTART_SPACING
+// bytes of text: where in the file a deflate block starts, how many bits of the byte before
+// belong to it, and the last RESTART_WINDOW bytes of text, which the block may refer back to.
+// They are kept in a directory next to the state file, with the size and time the file was
+// modified, and added to as more of the file is read. bzip2 and xz files are decompressed from
+// the start.
+#define RESTART_SPACING (4 << 20)
+#define RESTART_WINDOW 32768
+#define RESTART_SUFFIX ".restart"
+
+typedef enum CompressedFormat {
+    COMPRESSED_NONE = 0,
+    COMPRESSED_GZIP,
+    COMPRESSED_BZIP2,
+    COMPRESSED_XZ
+} CompressedFormat;
+
+struct RestartHeader {
+    char magic[8];
+    uint64_t file_size;
+    int64_t modified_seconds;
+    int64_t modified_nanoseconds;
+    uint64_t spacing;
+    uint64_t count;                 // points that follow
+};
+typedef struct RestartHeader RestartHeader;
+
+struct RestartPoint {
+    uint64_t out;                   // offset in the text
+    uint64_t in;                    // offset in the file of the first whole byte of the block
+    int32_t bits;                   // of the byte before, 0 to 7
+    unsigned char window[RESTART_WINDOW];
+};
+typedef struct RestartPoint RestartPoint;
+
+CompressedFormat compressed_format(FILE *file);
+MorseFeedError decompress_open(FILE **stream, FILE *file, CompressedFormat format, const char *state_path,
+                               const char *path, uint64_t start);
+MorseFeedError decompress_read_all(FILE *file, CompressedFormat format, BufferStruct *buffer);
+
+#if DEBUG
+bool write_gzip(FILE *file, const char *text, size_t length);
+void compressed_tests(void);
+#endif
+
+#endif /* compressed_h */
@@ -0,0 +1,381 @@
+//
+//  crawl.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "crawl.h"
+#include "links.h"
+
+enum FetchState { FETCH_PENDING, FETCH_ACTIVE, FETCH_DONE };
+
+struct CrawlFetch {
+    const char *url;
+    const char *host;
+    size_t host_length;
+    enum FetchState state;
+    bool ok;
+    bool over_budget;
+    BufferStruct buffer;
+    size_t *bytes_used;
+    size_t byte_budget;
+};
+typedef struct CrawlFetch CrawlFetch;
+
+size_t crawl_write_data(void *data, size_t size, size_t nmemb, void *userp);
+size_t crawl_write_data(void *data, size_t size, size_t nmemb, void *userp)
+{
+    CrawlFetch *fetch = userp;
+    size_t bytes = size * nmemb;
+
+    if (*fetch->bytes_used + bytes > fetch->byte_budget) {
+        // stops the transfer
+        fetch->over_budget = true;
+        return 0;
+    }
+
+    *fetch->bytes_used += bytes;
+
+    return curl_write_data(data, size, nmemb, &fetch->buffer);
+}
+
+size_t fetches_from_host(const CrawlFetch *fetches, size_t count, const CrawlFetch *fetch);
+size_t fetches_from_host(const CrawlFetch *fetches, size_t count, const CrawlFetch *fetch)
+{
+    size_t active = 0;
+
+    for (size_t k = 0; k < count; k++) {
+        if (fetches[k].state == FETCH_ACTIVE && fetches[k].host_length == fetch->host_length &&
+            strncmp(fetches[k].host, fetch->host, fetch->host_length) == 0) {
+            active++;
+        }
+    }
+
+    return active;
+}
+
+bool start_fetch(CURLM *multi, CrawlFetch *fetch);
+bool start_fetch(CURLM *multi, CrawlFetch *fetch)
+{
+    CURL *handle = curl_easy_init();
+
+    if (handle != NULL) {
+        curl_easy_setopt(handle, CURLOPT_URL, fetch->url);
+        curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, crawl_write_data);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)fetch);
+        curl_easy_setopt(handle, CURLOPT_PRIVATE, (void *)fetch);
+        curl_easy_setopt(handle, CURLOPT_USERAGENT, "libcurl-agent/1.0");
+        curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1);
+        curl_easy_setopt(handle, CURLOPT_MAXREDIRS, 5);
+
+        if (curl_multi_add_handle(multi, handle) != CURLM_OK) {
+            curl_easy_cleanup(handle);
+            handle = NULL;
+        }
+    }
+
+    fetch->state = handle != NULL ? FETCH_ACTIVE : FETCH_DONE;
+
+    return handle != NULL;
+}
+
+// Fetches all pages, starting them in order as the limits allow
+MorseFeedError fetch_pages(CrawlFetch *fetches, size_t count);
+MorseFeedError fetch_pages(CrawlFetch *fetches, size_t count)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    CURLM *multi = curl_multi_init();
+    size_t active = 0;
+    size_t finished = 0;
+
+    if (multi == NULL) error = MF_OUT_OF_MEMORY;
+
+    while (error == MF_NO_ERROR && finished < count) {
+        CURLMsg *message;
+        int running;
+        int queued;
+
+        for (size_t k = 0; k < count && active < CRAWL_FETCHES; k++) {
+            CrawlFetch *fetch = &fetches[k];
+
+            if (fetch->state != FETCH_PENDING) {
+                // already started
+
+            } else if (*fetch->bytes_used >= fetch->byte_budget) {
+                fetch->state = FETCH_DONE;
+                fetch->over_budget = true;
+                finished++;
+
+            } else if (fetches_from_host(fetches, count, fetch) < CRAWL_HOST_FETCHES) {
+                if (start_fetch(multi, fetch)) {
+                    active++;
+
+                } else {
+                    finished++;
+                }
+            }
+        }
+
+        if (active == 0) continue;
+
+        if (curl_multi_perform(multi, &running) != CURLM_OK) error = MF_URL_READ_ERROR;
+
+        while (error == MF_NO_ERROR && (message = curl_multi_info_read(multi, &queued)) != NULL) {
+            if (message->msg == CURLMSG_DONE) {
+                CURL *handle = message->easy_handle;
+                CrawlFetch *fetch = NULL;
+                long response_code = 0;
+                char *content_type = NULL;
+
+                curl_easy_getinfo(handle, CURLINFO_PRIVATE, (char **)&fetch);
+                curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &response_code);
+                if (curl_easy_getinfo(handle, CURLINFO_CONTENT_TYPE, &content_type) == CURLE_OK) {
+                    fetch->buffer.charset = charset_declared(content_type);
+                }
+
+                fetch->ok = message->data.result == CURLE_OK && response_code < 400 && fetch->buffer.used > 0;
+                fetch->state = FETCH_DONE;
+
+                if (!fetch->ok && !fetch->over_budget) {
+                    fprintf(stderr, "response code %ld CURL error %d URL: %s\n", response_code,
+                            message->data.result, fetch->url);
+                }
+
+                curl_multi_remove_handle(multi, handle);
+                curl_easy_cleanup(handle);
+                active--;
+                finished++;
+            }
+        }
+
+        if (error == MF_NO_ERROR && active > 0) curl_multi_wait(multi, NULL, 0, 1000, NULL);
+    }
+
+    if (multi != NULL) curl_multi_cleanup(multi);
+
+    return error;
+}
+
+// Fetches all urls into pages, which must have room for them. Pages that could not be fetched
+// are left empty. Only pages up to the first that did not fit in the budget are usable.
+MorseFeedError fetch_urls(StringVector *urls, BufferStruct *pages, size_t byte_budget, size_t *bytes_used,
+                          size_t *usable)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    CrawlFetch *fetches = calloc(urls->size, sizeof(CrawlFetch));
+
+    *usable = 0;
+
+    if (fetches == NULL) error = MF_OUT_OF_MEMORY;
+
+    for (size_t k = 0; k < urls->size && error == MF_NO_ERROR; k++) {
+        fetches[k].url = string_vector_at(urls, k);
+        fetches[k].host_length = url_authority(fetches[k].url, &fetches[k].host);
+        fetches[k].state = FETCH_PENDING;
+        fetches[k].bytes_used = bytes_used;
+        fetches[k].byte_budget = byte_budget;
+    }
+
+    if (error == MF_NO_ERROR) {
+        curl_global_init(CURL_GLOBAL_ALL);
+        error = fetch_pages(fetches, urls->size);
+        curl_global_cleanup();
+    }
+
+    for (size_t k = 0; fetches != NULL && k < urls->size; k++) {
+        if (error == MF_NO_ERROR && *usable == k && !fetches[k].over_budget) (*usable)++;
+
+        if (k < *usable && fetches[k].ok) {
+            pages[k] = fetches[k].buffer;
+
+        } else {
+            free_buffer(&fetches[k].buffer);
+            init_buffer(&pages[k], 0);
+        }
+    }
+
+    free(fetches);
+
+    return error;
+}
+
+MorseFeedError crawl_links(StringVector *urls, StringVector *titles, int depth, const Markers *section_markers,
+                           size_t byte_budget, size_t *bytes_used, bool verbose)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    StringMap seen = string_map_create(urls->size);
+
+    // a page linked from more than one place is played once, where it was first linked
+    for (size_t k = 0; k < urls->size && error == MF_NO_ERROR; k++) {
+        if (!string_map_put(&seen, string_vector_at(urls, k), k)) error = MF_OUT_OF_MEMORY;
+    }
+
+    curl_global_init(CURL_GLOBAL_ALL);
+
+    for (int level = 1; level < depth && error == MF_NO_ERROR && urls->size > 0; level++) {
+        CrawlFetch *fetches = calloc(urls->size, sizeof(CrawlFetch));
+        StringVector next_urls = string_vector_create(0);
+        StringVector next_titles = string_vector_create(0);
+        bool within_budget = true;
+
+        if (fetches == NULL) error = MF_OUT_OF_MEMORY;
+
+        for (size_t k = 0; k < urls->size && error == MF_NO_ERROR; k++) {
+            fetches[k].url = string_vector_at(urls, k);
+            fetches[k].host_length = url_authority(fetches[k].url, &fetches[k].host);
+            fetches[k].state = FETCH_PENDING;
+            fetches[k].bytes_used = bytes_used;
+            fetches[k].byte_budget = byte_budget;
+        }
+
+        if (error == MF_NO_ERROR) error = fetch_pages(fetches, urls->size);
+
+        for (size_t k = 0; k < urls->size && error == MF_NO_ERROR; k++) {
+            BufferStruct *page = &fetches[k].buffer;
+            StringVector page_urls = string_vector_create(0);
+            StringVector page_titles = string_vector_create(0);
+            size_t start, end;
+
+            // pages are used in order up to the first that did not fit in the budget
+            if (fetches[k].over_budget) within_budget = false;
+
+            if (within_budget && fetches[k].ok) {
+                markers_find_range(&section_markers[level - 1], page->p, page->used - 1, 0, &start, &end);
+                extract_urls(fetches[k].url, page->p, start, end, &page_urls, &page_titles);
+            }
+
+            for (size_t j = 0; j < page_urls.size && error == MF_NO_ERROR; j++) {
+                const char *url = string_vector_at(&page_urls, j);
+                size_t unused;
+
+                if (!string_map_get(&seen, url, &unused)) {
+                    if (!string_map_put(&seen, url, next_urls.size) || !string_vector_push(&next_urls, url) ||
+                        !string_vector_push(&next_titles, string_vector_at(&page_titles, j))) {
+                        error = MF_OUT_OF_MEMORY;
+                    }
+                }
+            }
+
+            string_vector_free(&page_urls);
+            string_vector_free(&page_titles);
+        }
+
+        if (verbose) {
+            fprintf(stderr, "(level %d: %ld pages, %ld links%s)\n", level, (long)urls->size, (long)next_urls.size,
+                    within_budget ? "" : ", byte limit reached");
+        }
+
+        for (size_t k = 0; fetches != NULL && k < urls->size; k++) {
+            free_buffer(&fetches[k].buffer);
+        }
+
+        free(fetches);
+
+        string_vector_free(urls);
+        string_vector_free(titles);
+        *urls = next_urls;
+        *titles = next_titles;
+    }
+
+    curl_global_cleanup();
+    string_map_free(&seen);
+
+    return error;
+}
+
+#if DEBUG
+void crawl_tests(void)
+{
+    bool ok = true;
+    char *cwd = getcwd(NULL, 0);
+    CString url = cstring_create(256);
+    StringVector urls = string_vector_create(0);
+    StringVector titles = string_vector_create(0);
+    Markers section_markers[MAX_CRAWL_DEPTH - 1] = { { { 0 } } };
+    const char *names[] = { "/crawl_a.tmp", "/crawl_missing.tmp", "/crawl_b.tmp" };
+    size_t bytes_used = 0;
+    FILE *file;
+    printf("crawl_tests()\n");
+
+    file = fopen("crawl_a.tmp", "w");
+    fprintf(file, "<a href=\"http://example.com/menu\">Menu</a><main><a href=\"http://example.com/one\">One</a>"
+            "<a href=\"http://example.com/two\">Two</a></main><a href=\"http://example.com/end\">End</a>");
+    fclose(file);
+    file = fopen("crawl_b.tmp", "w");
+    fprintf(file, "<main><a href=\"http://example.com/two\">Two again</a>"
+            "<a href=\"http://example.com/three\">Three</a>");
+    fclose(file);
+
+    // section pages, of which one is missing, are fetched as file URLs; their links are not
+    for (size_t k = 0; k < 3; k++) {
+        cstring_clear(&url);
+        cstring_append(&url, "file://");
+        cstring_append(&url, cwd);
+        cstring_append(&url, names[k]);
+        string_vector_push(&urls, cstring_p(&url));
+        string_vector_push(&titles, "");
+    }
+
+    markers_compile_level(&section_markers[0], "<main>", "</main>", 1);
+
+    ok &= print_if_fail(crawl_links(&urls, &titles, 2, section_markers, SIZE_MAX, &bytes_used, false) ==
+                        MF_NO_ERROR, "FAIL: crawl_links (1)");
+    ok &= print_if_fail(urls.size == 3 && titles.size == 3 && bytes_used > 0, "FAIL: crawl_links (2)");
+    if (urls.size == 3 && titles.size == 3) {
+        ok &= print_if_fail(strcmp(string_vector_at(&urls, 0), "http://example.com/one") == 0 &&
+                            strcmp(string_vector_at(&urls, 1), "http://example.com/two") == 0 &&
+                            strcmp(string_vector_at(&urls, 2), "http://example.com/three") == 0,
+                            "FAIL: crawl_links (3)");
+        ok &= print_if_fail(strcmp(string_vector_at(&titles, 1), "Two") == 0, "FAIL: crawl_links (4)");
+    }
+
+    // nothing is fetched once the byte budget is used
+    string_vector_free(&urls);
+    string_vector_free(&titles);
+    string_vector_push(&urls, cstring_p(&url));
+    string_vector_push(&titles, "");
+    ok &= print_if_fail(crawl_links(&urls, &titles, 2, section_markers, bytes_used, &bytes_used, false) ==
+                        MF_NO_ERROR && urls.size == 0, "FAIL: crawl_links (5)");
+
+    markers_free(&section_markers[0]);
+    string_vector_free(&urls);
+    string_vector_free(&titles);
+    cstring_free(&url);
+    free(cwd);
+    remove("crawl_a.tmp");
+    remove("crawl_b.tmp");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,55 @@
+//
+//  crawl.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef crawl_h
+#define crawl_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "markers.h"
+#include "morsefeed.h"
+#include "vector.h"
+
+#define MAX_CRAWL_DEPTH 5
+#define CRAWL_FETCHES 8         // fetches at once, in all
+#define CRAWL_HOST_FETCHES 2    // fetches at once from one host
+
+// With --depth, pages linked from the first page are section pages, which link to the pages
+// at the next level, and so on; only pages at the last level are played. Each level is fetched
+// at once, within the limits above, and its links are taken from the pages in the order they
+// were linked, so the result does not depend on the order that fetches finish. section_markers
+// has the markers of each level of section pages, depth - 1 of them.
+MorseFeedError fetch_urls(StringVector *urls, BufferStruct *pages, size_t byte_budget, size_t *bytes_used,
+                          size_t *usable);
+MorseFeedError crawl_links(StringVector *urls, StringVector *titles, int depth, const Markers *section_markers,
+                           size_t byte_budget, size_t *bytes_used, bool verbose);
+
+#if DEBUG
+void crawl_tests(void);
+#endif
+
+#endif /* crawl_h */
@@ -0,0 +1,714 @@
+//
+//  links.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "links.h"
+#include "markers.h"
+
+// Links are taken from the href attribute of <a> tags, with the text up to </a> as the title.
+// The HTML is scanned once; URLs are resolved against the base URL as in RFC 3986 section 5.2,
+// without their fragment, and each URL is kept only the first time it appears.
+
+bool match_nocase(const char *str, size_t length, const char *word);
+bool match_nocase(const char *str, size_t length, const char *word)
+{
+    size_t k;
+
+    for (k = 0; word[k] != '\0'; k++) {
+        if (k >= length || tolower((unsigned char)str[k]) != word[k]) return false;
+    }
+
+    return true;
+}
+
+size_t find_nocase(const char *str, size_t start_index, size_t end_index, const char *word);
+size_t find_nocase(const char *str, size_t start_index, size_t end_index, const char *word)
+{
+    size_t k;
+
+    for (k = start_index; k < end_index; k++) {
+        if (match_nocase(&str[k], end_index - k, word)) return k;
+    }
+
+    return end_index;
+}
+
+// Writes the UTF-8 encoding of code point to p, which needs room for 4 bytes; returns its length
+size_t put_utf8(char *p, unsigned long code_point);
+size_t put_utf8(char *p, unsigned long code_point)
+{
+    if (code_point < 0x80) {
+        p[0] = (char)code_point;
+        return 1;
+
+    } else if (code_point < 0x800) {
+        p[0] = (char)(0xc0 | (code_point >> 6));
+        p[1] = (char)(0x80 | (code_point & 0x3f));
+        return 2;
+
+    } else if (code_point < 0x10000) {
+        p[0] = (char)(0xe0 | (code_point >> 12));
+        p[1] = (char)(0x80 | ((code_point >> 6) & 0x3f));
+        p[2] = (char)(0x80 | (code_point & 0x3f));
+        return 3;
+
+    } else {
+        p[0] = (char)(0xf0 | (code_point >> 18));
+        p[1] = (char)(0x80 | ((code_point >> 12) & 0x3f));
+        p[2] = (char)(0x80 | ((code_point >> 6) & 0x3f));
+        p[3] = (char)(0x80 | (code_point & 0x3f));
+        return 4;
+    }
+}
+
+// Decodes character references and the common named entities in place; the decoded text is
+// never longer than the encoded text. Unknown entities are left as they are.
+void decode_entities(char *str)
+{
+    static const char *names[] = { "amp", "lt", "gt", "quot", "apos", "nbsp" };
+    static const char values[] = { '&', '<', '>', '"', '\'', ' ' };
+    char *from = str;
+    char *to = str;
+
+    while (*from != '\0') {
+        char *semicolon = *from == '&' ? strchr(from, ';') : NULL;
+        bool decoded = false;
+
+        if (semicolon != NULL && semicolon - from <= 10) {
+            size_t name_length = semicolon - from - 1;
+
+            if (from[1] == '#') {
+                char *end;
+                unsigned long code_point = (from[2] == 'x' || from[2] == 'X') ?
+                    strtoul(&from[3], &end, 16) : strtoul(&from[2], &end, 10);
+
+                if (end == semicolon && end > &from[2] && code_point > 0 && code_point <= 0x10ffff) {
+                    to += put_utf8(to, code_point);
+                    decoded = true;
+                }
+
+            } else {
+                size_t k;
+
+                for (k = 0; k < sizeof(values) && !decoded; k++) {
+                    if (strlen(names[k]) == name_length && strncmp(&from[1], names[k], name_length) == 0) {
+                        *to++ = values[k];
+                        decoded = true;
+                    }
+                }
+            }
+
+            if (decoded) from = semicolon + 1;
+        }
+
+        if (!decoded) *to++ = *from++;
+    }
+
+    *to = '\0';
+}
+
+// Components of a URL reference, as ranges of the string; a component that is present may be empty
+struct UrlParts {
+    const char *scheme;     size_t scheme_length;
+    const char *authority;  size_t authority_length;
+    const char *path;       size_t path_length;
+    const char *query;      size_t query_length;
+    bool has_scheme;
+    bool has_authority;
+    bool has_query;
+};
+typedef struct UrlParts UrlParts;
+
+UrlParts split_url(const char *url);
+UrlParts split_url(const char *url)
+{
+    UrlParts parts;
+    const char *p = url;
+    size_t k;
+
+    memset(&parts, 0, sizeof(parts));
+
+    // scheme ":"
+    for (k = 0; isalnum((unsigned char)p[k]) || p[k] == '+' || p[k] == '-' || p[k] == '.'; k++) ;
+    if (k > 0 && p[k] == ':' && isalpha((unsigned char)p[0])) {
+        parts.has_scheme = true;
+        parts.scheme = p;
+        parts.scheme_length = k;
+        p += k + 1;
+    }
+
+    // "//" authority
+    if (p[0] == '/' && p[1] == '/') {
+        p += 2;
+        parts.has_authority = true;
+        parts.authority = p;
+        parts.authority_length = strcspn(p, "/?#");
+        p += parts.authority_length;
+    }
+
+    parts.path = p;
+    parts.path_length = strcspn(p, "?#");
+    p += parts.path_length;
+
+    if (*p == '?') {
+        p++;
+        parts.has_query = true;
+        parts.query = p;
+        parts.query_length = strcspn(p, "#");
+    }
+
+    return parts;
+}
+
+size_t url_authority(const char *url, const char **authority)
+{
+    UrlParts parts = split_url(url);
+
+    *authority = parts.authority;
+
+    return parts.has_authority ? parts.authority_length : 0;
+}
+
+// RFC 3986 section 5.2.4; path is changed in place
+void remove_dot_segments(char *path);
+void remove_dot_segments(char *path)
+{
+    char *in = path;
+    size_t out_length = 0;
+
+    while (*in != '\0') {
+        if (strncmp(in, "../", 3) == 0) {
+            in += 3;
+
+        } else if (strncmp(in, "./", 2) == 0) {
+            in += 2;
+
+        } else if (strncmp(in, "/./", 3) == 0) {
+            in += 2;
+
+        } else if (strcmp(in, "/.") == 0) {
+            in += 1;
+            *in = '/';
+
+        } else if (strncmp(in, "/../", 4) == 0 || strcmp(in, "/..") == 0) {
+            // replace with "/" and remove the last output segment
+            in += in[3] == '/' ? 3 : 2;
+            *in = '/';
+            while (out_length > 0 && path[out_length - 1] != '/') out_length--;
+            if (out_length > 0) out_length--;
+
+        } else if (strcmp(in, ".") == 0 || strcmp(in, "..") == 0) {
+            in += strlen(in);
+
+        } else {
+            // move the first segment, with its leading '/', to the output
+            do {
+                path[out_length++] = *in++;
+            } while (*in != '\0' && *in != '/');
+        }
+    }
+
+    path[out_length] = '\0';
+}
+
+bool append_range(CString *cstring, const char *p, size_t length);
+bool append_range(CString *cstring, const char *p, size_t length)
+{
+    bool success = true;
+    size_t k;
+
+    for (k = 0; k < length && success; k++) success = cstring_append_char(cstring, p[k]);
+
+    return success;
+}
+
+// Appends the authority in canonical form: host in lower case, and without the default port
+bool append_authority(CString *cstring, const char *authority, size_t length, bool https);
+bool append_authority(CString *cstring, const char *authority, size_t length, bool https)
+{
+    bool success = true;
+    const char *at = memchr(authority, '@', length);
+    size_t host_start = at == NULL ? 0 : at - authority + 1;
+    size_t port_start = length;
+    size_t k;
+
+    // the port follows the last ':', unless that is inside an IPv6 address
+    for (k = length; k > host_start; k--) {
+        if (authority[k - 1] == ':') {
+            port_start = k - 1;
+            break;
+
+        } else if (authority[k - 1] == ']') {
+            break;
+        }
+    }
+
+    success = append_range(cstring, authority, host_start);
+
+    for (k = host_start; k < port_start && success; k++) {
+        success = cstring_append_char(cstring, tolower((unsigned char)authority[k]));
+    }
+
+    if (success && port_start < length) {
+        const char *port = &authority[port_start + 1];
+        size_t port_length = length - port_start - 1;
+        bool is_default = port_length == 0 || (port_length == 2 && !https && strncmp(port, "80", 2) == 0) ||
+            (port_length == 3 && https && strncmp(port, "443", 3) == 0);
+
+        if (!is_default) success = append_range(cstring, &authority[port_start], length - port_start);
+    }
+
+    return success;
+}
+
+// Sets result to the absolute http or https URL for reference, without fragment, and with scheme
+// and host in lower case and no default port, so that the same page always has the same URL.
+// Returns false if the reference is to some other scheme, or on memory error.
+bool resolve_url(const char *base_url, const char *reference, CString *result)
+{
+    UrlParts base = split_url(base_url);
+    UrlParts ref = split_url(reference);
+    const UrlParts *scheme = ref.has_scheme ? &ref : &base;
+    const UrlParts *authority = ref.has_scheme || ref.has_authority ? &ref : &base;
+    const UrlParts *query = &ref;
+    CString path = cstring_create(base.path_length + ref.path_length + 2);
+    bool success = path.p != NULL;
+
+    if (ref.has_scheme || ref.has_authority || (ref.path_length > 0 && ref.path[0] == '/')) {
+        success = success && append_range(&path, ref.path, ref.path_length);
+
+    } else if (ref.path_length == 0) {
+        success = success && append_range(&path, base.path, base.path_length);
+        if (!ref.has_query) query = &base;
+
+    } else {
+        // merge with the base path up to its last '/'
+        size_t keep = base.path_length;
+
+        while (keep > 0 && base.path[keep - 1] != '/') keep--;
+
+        if (base.has_authority && base.path_length == 0) {
+            success = success && cstring_append_char(&path, '/');
+
+        } else {
+            success = success && append_range(&path, base.path, keep);
+        }
+
+        success = success && append_range(&path, ref.path, ref.path_length);
+    }
+
+    if (success) remove_dot_segments(path.p);
+
+    // an empty path is the same as "/" for http
+    if (success && authority->has_authority && path.size == 1) success = cstring_append_char(&path, '/');
+
+    bool https = scheme->scheme_length == 5 && match_nocase(scheme->scheme, 5, "https");
+
+    success = success && scheme->has_scheme &&
+        (https || (scheme->scheme_length == 4 && match_nocase(scheme->scheme, 4, "http")));
+
+    cstring_clear(result);
+
+    success = success && cstring_append(result, https ? "https:" : "http:");
+
+    if (success && authority->has_authority) {
+        success = cstring_append(result, "//") &&
+            append_authority(result, authority->authority, authority->authority_length, https);
+    }
+
+    success = success && cstring_append(result, cstring_p(&path));
+
+    if (success && query->has_query) {
+        success = cstring_append_char(result, '?') && append_range(result, query->query, query->query_length);
+    }
+
+    cstring_free(&path);
+
+    return success;
+}
+
+// Adds the link to urls and titles unless its URL was already seen
+void add_link(const char *base_url, char *href, CString *title, StringMap *seen, CString *url,
+              StringVector *urls, StringVector *titles);
+void add_link(const char *base_url, char *href, CString *title, StringMap *seen, CString *url,
+              StringVector *urls, StringVector *titles)
+{
+    size_t unused;
+    char *text = (char *)cstring_p(title);
+    size_t length;
+
+    decode_entities(href);
+
+    if (resolve_url(base_url, href, url) && !string_map_get(seen, cstring_p(url), &unused)) {
+        decode_entities(text);
+
+        length = strlen(text);
+        while (length > 0 && isspace((unsigned char)text[length - 1])) text[--length] = '\0';
+
+        if (string_map_put(seen, cstring_p(url), urls->size) && string_vector_push(urls, cstring_p(url))) {
+            // titles stay parallel to urls
+            if (!string_vector_push(titles, text)) string_vector_push(titles, "");
+        }
+    }
+}
+
+void extract_urls(const char *base_url, const char *str, size_t start_index, size_t end_index,
+                  StringVector *urls, StringVector *titles)
+{
+    StringMap seen = string_map_create(64);
+    CString url = cstring_create(256);
+    CString title = cstring_create(128);
+    char *href = NULL;
+    size_t k = start_index;
+
+    // links back to the page itself are not followed
+    if (resolve_url(base_url, "", &url)) string_map_put(&seen, cstring_p(&url), 0);
+
+    while (k < end_index) {
+        if (str[k] != '<') {
+            // title text, with runs of white space collapsed
+            if (href != NULL) {
+                if (!isspace((unsigned char)str[k])) {
+                    cstring_append_char(&title, str[k]);
+
+                } else if (title.size > 1 && ((char *)title.p)[title.size - 2] != ' ') {
+                    cstring_append_char(&title, ' ');
+                }
+            }
+            k++;
+
+        } else if (match_nocase(&str[k], end_index - k, "<!--")) {
+            k = find_nocase(str, k + 4, end_index, "-->") + 3;
+
+        } else {
+            bool closing = k + 1 < end_index && str[k + 1] == '/';
+            size_t name_start = k + (closing ? 2 : 1);
+            size_t name_end = name_start;
+            size_t name_length;
+            bool is_anchor, is_script, is_style;
+
+            while (name_end < end_index && isalnum((unsigned char)str[name_end])) name_end++;
+            name_length = name_end - name_start;
+            is_anchor = name_length == 1 && match_nocase(&str[name_start], 1, "a");
+            is_script = name_length == 6 && match_nocase(&str[name_start], 6, "script");
+            is_style = name_length == 5 && match_nocase(&str[name_start], 5, "style");
+
+            if (href != NULL && is_anchor) {
+                // </a>, or an <a> that implicitly closes the previous one
+                add_link(base_url, href, &title, &seen, &url, urls, titles);
+                free(href);
+                href = NULL;
+            }
+
+            // attributes: name, or name=value with value in double or single quotes or unquoted
+            k = name_end;
+            while (k < end_index && str[k] != '>') {
+                size_t attr_start, attr_end, value_start, value_end;
+
+                if (isspace((unsigned char)str[k]) || str[k] == '/') {
+                    k++;
+                    continue;
+                }
+
+                attr_start = k;
+                while (k < end_index && !isspace((unsigned char)str[k]) && str[k] != '=' && str[k] != '>') k++;
+                attr_end = k;
+                while (k < end_index && isspace((unsigned char)str[k])) k++;
+
+                value_start = value_end = k;
+                if (k < end_index && str[k] == '=') {
+                    k++;
+                    while (k < end_index && isspace((unsigned char)str[k])) k++;
+
+                    if (k < end_index && (str[k] == '"' || str[k] == '\'')) {
+                        char quote = str[k++];
+                        value_start = k;
+                        while (k < end_index && str[k] != quote) k++;
+                        value_end = k;
+                        if (k < end_index) k++;
+
+                    } else {
+                        value_start = k;
+                        while (k < end_index && !isspace((unsigned char)str[k]) && str[k] != '>') k++;
+                        value_end = k;
+                    }
+                }
+
+                if (is_anchor && !closing && href == NULL && attr_end - attr_start == 4 &&
+                    match_nocase(&str[attr_start], 4, "href")) {
+                    href = malloc(value_end - value_start + 1);
+                    if (href != NULL) {
+                        size_t lead = 0, length = value_end - value_start;
+
+                        // HTML allows white space around URLs
+                        while (lead < length && isspace((unsigned char)str[value_start + lead])) lead++;
+                        while (length > lead && isspace((unsigned char)str[value_start + length - 1])) length--;
+
+                        memcpy(href, &str[value_start + lead], length - lead);
+                        href[length - lead] = '\0';
+                        cstring_clear(&title);
+                    }
+                }
+            }
+            if (k < end_index) k++;
+
+            if (!closing && (is_script || is_style)) {
+                // raw text, which may contain '<'
+                k = find_nocase(str, k, end_index, is_script ? "</script" : "</style");
+            }
+        }
+    }
+
+    if (href != NULL) {
+        add_link(base_url, href, &title, &seen, &url, urls, titles);
+        free(href);
+    }
+
+    string_map_free(&seen);
+    cstring_free(&url);
+    cstring_free(&title);
+}
+
+// Compiles each expression of the list, separated as for markers
+bool compile_link_patterns(Vector *patterns, const char *list);
+bool compile_link_patterns(Vector *patterns, const char *list)
+{
+    bool success = true;
+    const char *p = list;
+
+    while (p != NULL && *p != '\0' && success) {
+        size_t length = strcspn(p, (char[]){ MARKER_SEPARATOR, '\0' });
+        char *expression = malloc(length + 1);
+        regex_t regex;
+
+        success = expression != NULL;
+        if (success) {
+            memcpy(expression, p, length);
+            expression[length] = '\0';
+
+            success = regcomp(&regex, expression, REG_EXTENDED | REG_ICASE | REG_NOSUB) == 0;
+            if (success && !vector_push(patterns, &regex)) {
+                regfree(&regex);
+                success = false;
+            }
+
+            free(expression);
+        }
+
+        p += length;
+        if (*p == MARKER_SEPARATOR) p++;
+    }
+
+    return success;
+}
+
+MorseFeedError link_filter_compile(LinkFilter *filter, const char *include, const char *exclude)
+{
+    filter->include = vector_create(0, sizeof(regex_t));
+    filter->exclude = vector_create(0, sizeof(regex_t));
+
+    if (!compile_link_patterns(&filter->include, include) || !compile_link_patterns(&filter->exclude, exclude)) {
+        return MF_INVALID_REGEX;
+    }
+
+    return MF_NO_ERROR;
+}
+
+bool link_matches(Vector *patterns, const char *title, const char *path);
+bool link_matches(Vector *patterns, const char *title, const char *path)
+{
+    for (size_t k = 0; k < patterns->size; k++) {
+        regex_t *regex = (regex_t *)patterns->p + k;
+
+        if (regexec(regex, title, 0, NULL, 0) == 0 || regexec(regex, path, 0, NULL, 0) == 0) return true;
+    }
+
+    return false;
+}
+
+// Removes links that match no include expression, if there are any, or that match an exclude
+// expression; returns the number removed
+size_t link_filter_apply(LinkFilter *filter, StringVector *urls, StringVector *titles)
+{
+    StringVector new_urls;
+    StringVector new_titles;
+    size_t removed = 0;
+    bool mem_error;
+
+    if (filter->include.size == 0 && filter->exclude.size == 0) return 0;
+
+    new_urls = string_vector_create(urls->size);
+    new_titles = string_vector_create(titles->size);
+    mem_error = urls->size > 0 && (new_urls.p == NULL || new_titles.p == NULL);
+
+    for (size_t k = 0; k < urls->size && !mem_error; k++) {
+        const char *url = string_vector_at(urls, k);
+        const char *title = string_vector_at(titles, k);
+        UrlParts parts = split_url(url);
+
+        if ((filter->include.size > 0 && !link_matches(&filter->include, title, parts.path)) ||
+            link_matches(&filter->exclude, title, parts.path)) {
+            removed++;
+
+        } else {
+            mem_error = !string_vector_push(&new_urls, url) || !string_vector_push(&new_titles, title);
+        }
+    }
+
+    if (mem_error) {
+        // keep all links
+        string_vector_free(&new_urls);
+        string_vector_free(&new_titles);
+        removed = 0;
+
+    } else {
+        string_vector_free(urls);
+        string_vector_free(titles);
+        *urls = new_urls;
+        *titles = new_titles;
+    }
+
+    return removed;
+}
+
+void link_filter_free(LinkFilter *filter)
+{
+    for (size_t k = 0; k < filter->include.size; k++) regfree((regex_t *)filter->include.p + k);
+    for (size_t k = 0; k < filter->exclude.size; k++) regfree((regex_t *)filter->exclude.p + k);
+
+    vector_free(&filter->include);
+    vector_free(&filter->exclude);
+}
+
+#if DEBUG
+bool resolves_to(const char *reference, const char *expected);
+bool resolves_to(const char *reference, const char *expected)
+{
+    CString url = cstring_create(64);
+    bool ok = resolve_url("http://a/b/c/d;p?q", reference, &url);
+
+    ok = expected == NULL ? !ok : ok && strcmp(cstring_p(&url), expected) == 0;
+    if (!ok) printf("%s -> %s\n", reference, cstring_p(&url));
+    cstring_free(&url);
+
+    return ok;
+}
+
+void links_tests(void)
+{
+    bool ok = true;
+    printf("links_tests()\n");
+
+    // resolve_url: examples from RFC 3986 section 5.4, less fragments
+    ok &= print_if_fail(resolves_to("g:h", NULL), "FAIL: resolve_url (1)");
+    ok &= print_if_fail(resolves_to("g", "http://a/b/c/g"), "FAIL: resolve_url (2)");
+    ok &= print_if_fail(resolves_to("./g", "http://a/b/c/g"), "FAIL: resolve_url (3)");
+    ok &= print_if_fail(resolves_to("g/", "http://a/b/c/g/"), "FAIL: resolve_url (4)");
+    ok &= print_if_fail(resolves_to("/g", "http://a/g"), "FAIL: resolve_url (5)");
+    ok &= print_if_fail(resolves_to("//g", "http://g/"), "FAIL: resolve_url (6)");
+    ok &= print_if_fail(resolves_to("?y", "http://a/b/c/d;p?y"), "FAIL: resolve_url (7)");
+    ok &= print_if_fail(resolves_to("g?y", "http://a/b/c/g?y"), "FAIL: resolve_url (8)");
+    ok &= print_if_fail(resolves_to("#s", "http://a/b/c/d;p?q"), "FAIL: resolve_url (9)");
+    ok &= print_if_fail(resolves_to("g?y#s", "http://a/b/c/g?y"), "FAIL: resolve_url (10)");
+    ok &= print_if_fail(resolves_to("", "http://a/b/c/d;p?q"), "FAIL: resolve_url (11)");
+    ok &= print_if_fail(resolves_to(".", "http://a/b/c/"), "FAIL: resolve_url (12)");
+    ok &= print_if_fail(resolves_to("..", "http://a/b/"), "FAIL: resolve_url (13)");
+    ok &= print_if_fail(resolves_to("../g", "http://a/b/g"), "FAIL: resolve_url (14)");
+    ok &= print_if_fail(resolves_to("../../../g", "http://a/g"), "FAIL: resolve_url (15)");
+    ok &= print_if_fail(resolves_to("/./g", "http://a/g"), "FAIL: resolve_url (16)");
+    ok &= print_if_fail(resolves_to("g/../h", "http://a/b/c/h"), "FAIL: resolve_url (17)");
+    ok &= print_if_fail(resolves_to("HTTPS://x.ORG:443/Y", "https://x.org/Y"), "FAIL: resolve_url (18)");
+    ok &= print_if_fail(resolves_to("mailto:someone@example.com", NULL), "FAIL: resolve_url (19)");
+    ok &= print_if_fail(resolves_to("//Me@Host:80", "http://Me@host/"), "FAIL: resolve_url (20)");
+    ok &= print_if_fail(resolves_to("//[::1]:8080/", "http://[::1]:8080/"), "FAIL: resolve_url (21)");
+
+    // decode_entities
+    char str[64];
+    strcpy(str, "a?b=1&amp;c=&#50;&#x33;&bogus;&");
+    decode_entities(str);
+    ok &= print_if_fail(strcmp(str, "a?b=1&c=23&bogus;&") == 0, "FAIL: decode_entities (1)");
+    strcpy(str, "&#233;&lt;");
+    decode_entities(str);
+    ok &= print_if_fail(strcmp(str, "\xc3\xa9<") == 0, "FAIL: decode_entities (2)");
+
+    // extract_urls
+    const char *html =
+        "<html><head><link href=\"/style.css\"><script>if (a<b) x='<a href=\"/no\">';</script></head>\n"
+        "<body><a href=\"/news/one\">One</a> <!-- <a href=\"/no\">x</a> -->\n"
+        "<A class=x HREF='two?id=2&amp;p=1'>Two <b>and</b>\n a half</A>\n"
+        "<a href=/news/one>One again</a><a href=\"#top\">Top</a><a href=\"../three\">Three"
+        "<a href = \" http://other.com/four \">Four</a></body></html>";
+    StringVector urls = string_vector_create(10);
+    StringVector titles = string_vector_create(10);
+
+    extract_urls("http://example.com/news/index.html", html, 0, strlen(html), &urls, &titles);
+    ok &= print_if_fail(urls.size == 4 && titles.size == 4, "FAIL: extract_urls (1)");
+    if (urls.size == 4 && titles.size == 4) {
+        ok &= print_if_fail(strcmp(string_vector_at(&urls, 0), "http://example.com/news/one") == 0 &&
+                            strcmp(string_vector_at(&titles, 0), "One") == 0, "FAIL: extract_urls (2)");
+        ok &= print_if_fail(strcmp(string_vector_at(&urls, 1), "http://example.com/news/two?id=2&p=1") == 0 &&
+                            strcmp(string_vector_at(&titles, 1), "Two and a half") == 0, "FAIL: extract_urls (3)");
+        ok &= print_if_fail(strcmp(string_vector_at(&urls, 2), "http://example.com/three") == 0 &&
+                            strcmp(string_vector_at(&titles, 2), "Three") == 0, "FAIL: extract_urls (4)");
+        ok &= print_if_fail(strcmp(string_vector_at(&urls, 3), "http://other.com/four") == 0 &&
+                            strcmp(string_vector_at(&titles, 3), "Four") == 0, "FAIL: extract_urls (5)");
+    }
+
+    // link_filter_apply
+    LinkFilter filter;
+    ok &= print_if_fail(link_filter_compile(&filter, NULL, "^sport\x1f" "/video/") == MF_NO_ERROR,
+                        "FAIL: link_filter_compile (1)");
+    string_vector_push(&urls, "http://example.com/video/five");
+    string_vector_push(&titles, "Five");
+    string_vector_push(&urls, "http://example.com/six?video=1");
+    string_vector_push(&titles, "Sports results");
+    ok &= print_if_fail(link_filter_apply(&filter, &urls, &titles) == 2 && urls.size == 4,
+                        "FAIL: link_filter_apply (1)");
+    link_filter_free(&filter);
+
+    link_filter_compile(&filter, "two|three", NULL);
+    ok &= print_if_fail(link_filter_apply(&filter, &urls, &titles) == 2 && urls.size == 2 &&
+                        strcmp(string_vector_at(&titles, 1), "Three") == 0, "FAIL: link_filter_apply (2)");
+    link_filter_free(&filter);
+
+    ok &= print_if_fail(link_filter_compile(&filter, "(", NULL) == MF_INVALID_REGEX, "FAIL: link_filter_compile (2)");
+    link_filter_free(&filter);
+
+    string_vector_free(&urls);
+    string_vector_free(&titles);
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
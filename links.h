@@ -0,0 +1,57 @@
+//
+//  links.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef links_h
+#define links_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "morsefeed.h"
+#include "vector.h"
+
+// Regular expressions for --include and --exclude, matched against titles and URL paths
+struct LinkFilter {
+    Vector include;     // regex_t
+    Vector exclude;     // regex_t
+};
+typedef struct LinkFilter LinkFilter;
+
+void extract_urls(const char *base_url, const char *str, size_t start_index, size_t end_index,
+                  StringVector *urls, StringVector *titles);
+bool resolve_url(const char *base_url, const char *reference, CString *result);
+size_t url_authority(const char *url, const char **authority);
+void decode_entities(char *str);
+
+MorseFeedError link_filter_compile(LinkFilter *filter, const char *include, const char *exclude);
+size_t link_filter_apply(LinkFilter *filter, StringVector *urls, StringVector *titles);
+void link_filter_free(LinkFilter *filter);
+
+#if DEBUG
+void links_tests(void);
+#endif
+
+#endif /* links_h */
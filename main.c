@@ -28,9 +28,26 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "batch.h"
+#include "boiler.h"
+#include "book.h"
+#include "cache.h"
+#include "catalog.h"
+#include "charset.h"
+#include "compressed.h"
+#include "crawl.h"
+#include "links.h"
+#include "markers.h"
 #include "morsefeed.h"
+#include "pipeline.h"
+#include "seek.h"
+#include "seen.h"
+#include "server.h"
+#include "tee.h"
 #include "text.h"
+#include "timing.h"
 #include "vector.h"
+#include "watch.h"
 
 #define STATE_FILE_NAME ".morsefeed"
 
@@ -46,6 +63,19 @@ int main(int argc, const char * argv[]) {
     MorseFeedParams mfp;
     const char *state_label = NULL;
     StringVector string_storage = string_vector_create(0);
+    const char *serve_path = NULL;
+    const char *connect_path = NULL;
+    const char *connect_source = NULL;
+    const char *batch_dir = NULL;
+    const char **batch_inputs = NULL;
+    int batch_count = 0;
+    int threads = DEFAULT;
+    const char *compile_path = NULL;
+    const char *catalog_dir = NULL;
+    const char *sample_dir = NULL;
+    const char *watch_input_dir = NULL;
+    const char *watch_output_dir = NULL;
+    int section_level = 1;
 
     mfp.in_file_name = NULL;
     mfp.in_file = NULL;
@@ -72,6 +102,26 @@ int main(int argc, const char * argv[]) {
     mfp.print_fcc_wpm = false;
     mfp.wav_file_name = NULL;
 
+    mfp.show_progress = false;
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.include_links = NULL;
+    mfp.exclude_links = NULL;
+    mfp.crawl_depth = DEFAULT;
+    mfp.section_text_after = NULL;
+    mfp.section_text_before = NULL;
+    mfp.max_megabytes = DEFAULT;
+    mfp.strip_common = false;
+    mfp.stage_stats = false;
+    mfp.cache_megabytes = DEFAULT;
+    mfp.cache_stats = false;
+    mfp.start_word = DEFAULT;
+    mfp.start_offset = DEFAULT;
+    mfp.start_percent = DEFAULT;
+    mfp.back_paragraphs = DEFAULT;
+    mfp.charset = CHARSET_UNKNOWN;
+    mfp.tee_files = NULL;
+    mfp.tee_mbeeps = NULL;
+
     // make path to state file
     if (home != NULL) {
         mfp.state_path = malloc(strlen(home) + strlen("/") + strlen(STATE_FILE_NAME) + 1);
@@ -151,13 +201,19 @@ int main(int argc, const char * argv[]) {
         } else if (strcmp(argv[index], "-u") == 0 && index + 1 < argc) {
             mfp.url = argv[++index];
 
+        //  --charset  charset of the input instead of the one detected
+        } else if (strcmp(argv[index], "--charset") == 0 && index + 1 < argc) {
+            index++;
+            mfp.charset = charset_from_name(argv[index], strlen(argv[index]));
+            if (mfp.charset == CHARSET_UNKNOWN) error = MF_INVALID_VALUE;
+
         //  -a  use text after string
         } else if (strcmp(argv[index], "-a") == 0 && index + 1 < argc) {
-            mfp.text_after = argv[++index];
+            if (!join_marker(&mfp.text_after, argv[++index], &string_storage)) error = MF_OUT_OF_MEMORY;
 
         //  -b  use text before string
         } else if (strcmp(argv[index], "-b") == 0 && index + 1 < argc) {
-            mfp.text_before = argv[++index];
+            if (!join_marker(&mfp.text_before, argv[++index], &string_storage)) error = MF_OUT_OF_MEMORY;
 
         //  -L (follow links)
         } else if (strcmp(argv[index], "-L") == 0) {
@@ -165,11 +221,78 @@ int main(int argc, const char * argv[]) {
 
         //  -A  use text after string
         } else if (strcmp(argv[index], "-A") == 0 && index + 1 < argc) {
-            mfp.linked_text_after = argv[++index];
+            if (!join_marker(&mfp.linked_text_after, argv[++index], &string_storage)) error = MF_OUT_OF_MEMORY;
 
         //  -B  use text before string
         } else if (strcmp(argv[index], "-B") == 0 && index + 1 < argc) {
-            mfp.linked_text_before = argv[++index];
+            if (!join_marker(&mfp.linked_text_before, argv[++index], &string_storage)) error = MF_OUT_OF_MEMORY;
+
+        //  --include  follow only links with title or URL path matching
+        } else if (strcmp(argv[index], "--include") == 0 && index + 1 < argc) {
+            if (!join_marker(&mfp.include_links, argv[++index], &string_storage)) error = MF_OUT_OF_MEMORY;
+
+        //  --exclude  do not follow links with title or URL path matching
+        } else if (strcmp(argv[index], "--exclude") == 0 && index + 1 < argc) {
+            if (!join_marker(&mfp.exclude_links, argv[++index], &string_storage)) error = MF_OUT_OF_MEMORY;
+
+        //  --depth  levels of links to follow
+        } else if (strcmp(argv[index], "--depth") == 0 && index + 1 < argc) {
+            mfp.crawl_depth = atoi(argv[++index]);
+            if (mfp.crawl_depth < 1 || mfp.crawl_depth > MAX_CRAWL_DEPTH) error = MF_INVALID_VALUE;
+
+        //  --section-level  the level of section pages that the following section markers are for
+        } else if (strcmp(argv[index], "--section-level") == 0 && index + 1 < argc) {
+            section_level = atoi(argv[++index]);
+            if (section_level < 1 || section_level >= MAX_CRAWL_DEPTH) error = MF_INVALID_VALUE;
+
+        //  --section-after  use links on section pages after string
+        } else if (strcmp(argv[index], "--section-after") == 0 && index + 1 < argc) {
+            if (!join_level_marker(&mfp.section_text_after, section_level, argv[++index], &string_storage)) {
+                error = MF_OUT_OF_MEMORY;
+            }
+
+        //  --section-before  use links on section pages before string
+        } else if (strcmp(argv[index], "--section-before") == 0 && index + 1 < argc) {
+            if (!join_level_marker(&mfp.section_text_before, section_level, argv[++index], &string_storage)) {
+                error = MF_OUT_OF_MEMORY;
+            }
+
+        //  --max-megabytes  stop following links after fetching this much
+        } else if (strcmp(argv[index], "--max-megabytes") == 0 && index + 1 < argc) {
+            mfp.max_megabytes = atof(argv[++index]);
+            if (mfp.max_megabytes <= 0) error = MF_INVALID_VALUE;
+
+        //  --strip-common  remove text common to most linked pages
+        } else if (strcmp(argv[index], "--strip-common") == 0) {
+            mfp.strip_common = true;
+
+        //  --progress  show progress and time remaining
+        } else if (strcmp(argv[index], "--progress") == 0) {
+            mfp.show_progress = true;
+
+        //  --stage-stats  print how full the rings between stages were, and how often stages waited
+        } else if (strcmp(argv[index], "--stage-stats") == 0) {
+            mfp.stage_stats = true;
+
+        //  --cache  keep converted words, up to this many megabytes of them
+        } else if (strcmp(argv[index], "--cache") == 0 && index + 1 < argc) {
+            mfp.cache_megabytes = atof(argv[++index]);
+
+            if (mfp.cache_megabytes <= 0) {
+                error = MF_INVALID_VALUE;
+
+            } else if (mfp.state_path == NULL) {
+                error = MF_NO_STATE_PATH;
+            }
+
+        //  --cache-stats  print cache hits and misses
+        } else if (strcmp(argv[index], "--cache-stats") == 0) {
+            mfp.cache_stats = true;
+
+        //  --minutes  stop after sending for this many minutes
+        } else if (strcmp(argv[index], "--minutes") == 0 && index + 1 < argc) {
+            mfp.time_limit_minutes = atof(argv[++index]);
+            if (mfp.time_limit_minutes <= 0) error = MF_INVALID_VALUE;
 
         //  -p  (save and use position)
         } else if (strcmp(argv[index], "-p") == 0) {
@@ -188,6 +311,39 @@ int main(int argc, const char * argv[]) {
                 error = MF_OUTPUT_FILE_OPEN_ERROR;
             }
 
+        //  --tee  also write converted text to a file, or to stdout if "-"
+        } else if (strcmp(argv[index], "--tee") == 0 && index + 1 < argc) {
+            if (!join_marker(&mfp.tee_files, argv[++index], &string_storage)) error = MF_OUT_OF_MEMORY;
+
+        //  --tee-mbeep  also send to another mbeep at this wpm, writing a .wav file unless "-"
+        } else if (strcmp(argv[index], "--tee-mbeep") == 0 && index + 2 < argc) {
+            double paris_wpm = atof(argv[++index]);
+            const char *wav_file_name = argv[++index];
+            char *entry = malloc(strlen(wav_file_name) + 32);
+
+            if (paris_wpm < 5.0 || paris_wpm > 60.0) {
+                error = MF_INVALID_WPM;
+
+            } else if (entry == NULL) {
+                error = MF_OUT_OF_MEMORY;
+
+            } else {
+                if (strcmp(wav_file_name, "-") == 0) {
+                    sprintf(entry, "%.3f", paris_wpm);
+
+                } else {
+                    sprintf(entry, "%.3f %s", paris_wpm, wav_file_name);
+                }
+
+                if (!string_vector_push(&string_storage, entry) ||
+                    !join_marker(&mfp.tee_mbeeps, string_vector_at(&string_storage, string_storage.size - 1),
+                                 &string_storage)) {
+                    error = MF_OUT_OF_MEMORY;
+                }
+            }
+
+            free(entry);
+
         //  -s  save state for re-use
         } else if (strcmp(argv[index], "-s") == 0 && index + 1 < argc) {
             state_label = argv[++index];
@@ -196,6 +352,59 @@ int main(int argc, const char * argv[]) {
         } else if (strcmp(argv[index], "-r") == 0 && index + 1 < argc) {
             error = read_state(argv[++index], &mfp, &string_storage);
 
+        //  --serve  serve converted sources on Unix domain socket
+        } else if (strcmp(argv[index], "--serve") == 0 && index + 1 < argc) {
+            serve_path = argv[++index];
+
+        //  --connect  get source converted by server on Unix domain socket
+        } else if (strcmp(argv[index], "--connect") == 0 && index + 2 < argc) {
+            connect_path = argv[++index];
+            connect_source = argv[++index];
+
+        //  --start  word of source to start at, from server, book or input file
+        } else if (strcmp(argv[index], "--start") == 0 && index + 1 < argc) {
+            mfp.start_word = atol(argv[++index]);
+            if (mfp.start_word < 0) error = MF_INVALID_VALUE;
+
+        //  --percent  percentage of book or input file to start at
+        } else if (strcmp(argv[index], "--percent") == 0 && index + 1 < argc) {
+            mfp.start_percent = atof(argv[++index]);
+            if (mfp.start_percent < 0 || mfp.start_percent > 100) error = MF_INVALID_VALUE;
+
+        //  --back  number of paragraphs of input file to go back
+        } else if (strcmp(argv[index], "--back") == 0 && index + 1 < argc) {
+            mfp.back_paragraphs = atoi(argv[++index]);
+            if (mfp.back_paragraphs < 1) error = MF_INVALID_VALUE;
+
+        //  --compile  convert input to book file
+        } else if (strcmp(argv[index], "--compile") == 0 && index + 1 < argc) {
+            compile_path = argv[++index];
+
+        //  --catalog  update catalog of files in directory and show it
+        } else if (strcmp(argv[index], "--catalog") == 0 && index + 1 < argc) {
+            catalog_dir = argv[++index];
+
+        //  --sample  input from random word of file in directory
+        } else if (strcmp(argv[index], "--sample") == 0 && index + 1 < argc) {
+            sample_dir = argv[++index];
+
+        //  --batch  convert all following input files to output directory
+        } else if (strcmp(argv[index], "--batch") == 0 && index + 2 < argc) {
+            batch_dir = argv[++index];
+            batch_inputs = &argv[index + 1];
+            batch_count = argc - index - 1;
+            index = argc;
+
+        //  --watch  convert files written to input directory to output directory
+        } else if (strcmp(argv[index], "--watch") == 0 && index + 2 < argc) {
+            watch_input_dir = argv[++index];
+            watch_output_dir = argv[++index];
+
+        //  --threads  number of threads for --batch, --watch, --catalog and large input files
+        } else if (strcmp(argv[index], "--threads") == 0 && index + 1 < argc) {
+            threads = atoi(argv[++index]);
+            if (threads < 1 || threads > BATCH_MAX_THREADS) error = MF_INVALID_VALUE;
+
         //  -v --version    print version of mbeep
         } else if ((strcmp(argv[index], "--version") == 0) ||
                    (strcmp(argv[index], "-v") == 0)) {
@@ -221,6 +430,23 @@ int main(int argc, const char * argv[]) {
         //  --test      run tests
         } else if (strcmp(argv[index], "--test") == 0) {
             vector_tests();
+            timing_tests();
+            links_tests();
+            crawl_tests();
+            batch_tests();
+            boiler_tests();
+            markers_tests();
+            pipeline_tests();
+            book_tests();
+            cache_tests();
+            catalog_tests();
+            charset_tests();
+            compressed_tests();
+            seek_tests();
+            seen_tests();
+            server_tests();
+            tee_tests();
+            watch_tests();
             morsefeed_tests();
             error = MF_EXIT;
 #endif
@@ -234,10 +460,50 @@ int main(int argc, const char * argv[]) {
         error = save_state(state_label, &mfp);
     }
 
-    if (error == MF_NO_ERROR) {
+    if (error == MF_NO_ERROR && serve_path != NULL) {
+        error = serve(serve_path, &mfp);
+
+    } else if (error == MF_NO_ERROR && batch_dir != NULL) {
+        StringVector paths = string_vector_create(0);
+
+        error = collect_inputs(batch_inputs, batch_count, batch_dir, &paths);
+        if (error == MF_NO_ERROR) error = batch_convert(&paths, batch_dir, &mfp, threads, BATCH_CHUNK_SIZE);
+
+        string_vector_free(&paths);
+
+    } else if (error == MF_NO_ERROR && watch_input_dir != NULL) {
+        error = watch_dir(watch_input_dir, watch_output_dir, &mfp, threads);
+
+    } else if (error == MF_NO_ERROR && connect_path != NULL) {
+        error = connect_server(connect_path, connect_source, mfp.start_word, mfp);
+
+    } else if (error == MF_NO_ERROR && catalog_dir != NULL) {
+        Catalog catalog;
+
+        error = catalog_update(&catalog, mfp.state_path, catalog_dir, threads);
+        if (error == MF_NO_ERROR) catalog_print(&catalog, stdout);
+
+        catalog_free(&catalog);
+
+    } else if (error == MF_NO_ERROR && sample_dir != NULL) {
+        error = catalog_sample(sample_dir, &mfp, threads, &string_storage);
+        if (error == MF_NO_ERROR) error = process_and_send(mfp);
+
+    } else if (error == MF_NO_ERROR && compile_path != NULL) {
+        error = book_compile(&mfp, compile_path);
+
+    } else if (error == MF_NO_ERROR && mfp.in_file_name != NULL && is_book(mfp.in_file_name)) {
+        error = book_play(mfp, mfp.in_file_name, mfp.start_word, mfp.start_percent);
+
+    } else if (error == MF_NO_ERROR && can_convert_in_parallel(&mfp, threads)) {
+        error = convert_in_parallel(&mfp, threads, BATCH_CHUNK_SIZE);
+
+    } else if (error == MF_NO_ERROR) {
         error = process_and_send(mfp);
     }
 
+    release_url_handle();
+
     if (mfp.in_file != NULL) {
         if (mfp.in_file != stdin) fclose(mfp.in_file);
         mfp.in_file = NULL;
@@ -273,6 +539,8 @@ int main(int argc, const char * argv[]) {
         case MF_PROGRAM_ERR:                printf("Error: MF_PROGRAM_ERR\n");              break;
         case MF_NO_STATE_PATH:              printf("Error: MF_NO_STATE_PATH\n");            break;
         case MF_UNKNOWN_SAVED_STATE:        printf("Error: MF_UNKNOWN_SAVED_STATE\n");      break;
+        case MF_INVALID_REGEX:              printf("Error: MF_INVALID_REGEX\n");            break;
+        case MF_SOCKET_ERROR:               printf("Error: MF_SOCKET_ERROR\n");             break;
 
         case MF_UNKNOWN:
         default:
@@ -0,0 +1,368 @@
+//
+//  markers.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "markers.h"
+
+bool join_marker(const char **markers, const char *marker, StringVector *string_storage)
+{
+    bool success = true;
+
+    if (*markers == NULL) {
+        *markers = marker;
+
+    } else {
+        char *joined = malloc(strlen(*markers) + 1 + strlen(marker) + 1);
+
+        success = joined != NULL;
+        if (success) {
+            sprintf(joined, "%s%c%s", *markers, MARKER_SEPARATOR, marker);
+            success = string_vector_push(string_storage, joined);
+            free(joined);
+        }
+
+        if (success) *markers = string_vector_at(string_storage, string_storage->size - 1);
+    }
+
+    return success;
+}
+
+// Start of the list of markers for level, counting from 1, or NULL if there is none
+const char *level_markers(const char *list, int level);
+const char *level_markers(const char *list, int level)
+{
+    for (int k = 1; k < level && list != NULL; k++) {
+        list = strchr(list, LEVEL_SEPARATOR);
+        if (list != NULL) list++;
+    }
+
+    return list;
+}
+
+bool join_level_marker(const char **markers, int level, const char *marker, StringVector *string_storage)
+{
+    const char *list = *markers != NULL ? *markers : "";
+    const char *start = level_markers(list, level);
+    size_t levels = 1;
+    size_t end;
+    char *joined;
+    bool success;
+
+    for (const char *p = list; *p != '\0'; p++) {
+        if (*p == LEVEL_SEPARATOR) levels++;
+    }
+
+    end = start != NULL ? (size_t)(start - list) + strcspn(start, (char[]){ LEVEL_SEPARATOR, '\0' }) : strlen(list);
+    joined = malloc(strlen(list) + level + 1 + strlen(marker) + 1);
+    success = joined != NULL;
+
+    if (success) {
+        size_t k = end;
+
+        memcpy(joined, list, end);
+        for (size_t added = levels; added < (size_t)level; added++) joined[k++] = LEVEL_SEPARATOR;
+        if (start != NULL && list + end > start) joined[k++] = MARKER_SEPARATOR;
+        sprintf(joined + k, "%s%s", marker, list + end);
+
+        success = string_vector_push(string_storage, joined);
+        free(joined);
+    }
+
+    if (success) *markers = string_vector_at(string_storage, string_storage->size - 1);
+
+    return success;
+}
+
+bool add_marker_state(Markers *markers, int32_t *state);
+bool add_marker_state(Markers *markers, int32_t *state)
+{
+    MarkerState new_state;
+
+    for (size_t c = 0; c < 256; c++) new_state.next[c] = -1;
+    new_state.longest[MARKER_AFTER] = 0;
+    new_state.longest[MARKER_BEFORE] = 0;
+
+    *state = (int32_t)markers->states.size;
+
+    return vector_push(&markers->states, &new_state);
+}
+
+// Adds each marker of the list to the trie
+bool add_markers(Markers *markers, const char *list, enum MarkerKind kind);
+bool add_markers(Markers *markers, const char *list, enum MarkerKind kind)
+{
+    bool success = true;
+    const char *p = list;
+
+    while (p != NULL && *p != '\0' && *p != LEVEL_SEPARATOR && success) {
+        size_t length = strcspn(p, (char[]){ MARKER_SEPARATOR, LEVEL_SEPARATOR, '\0' });
+        int32_t state = 0;
+
+        for (size_t k = 0; k < length && success; k++) {
+            unsigned char c = p[k];
+            int32_t next = ((MarkerState *)markers->states.p)[state].next[c];
+
+            if (next < 0) {
+                success = add_marker_state(markers, &next);
+                if (success) ((MarkerState *)markers->states.p)[state].next[c] = next;
+            }
+
+            state = next;
+        }
+
+        if (success && length > 0) {
+            MarkerState *end = (MarkerState *)markers->states.p + state;
+            if (end->longest[kind] < length) end->longest[kind] = (uint32_t)length;
+            if (markers->max_length[kind] < length) markers->max_length[kind] = length;
+        }
+
+        p += length;
+        if (*p == MARKER_SEPARATOR) p++;
+    }
+
+    return success;
+}
+
+MorseFeedError markers_compile(Markers *markers, const char *after, const char *before)
+{
+    int32_t root;
+    bool success;
+
+    markers->states = vector_create(1, sizeof(MarkerState));
+    markers->max_length[MARKER_AFTER] = 0;
+    markers->max_length[MARKER_BEFORE] = 0;
+
+    success = add_marker_state(markers, &root) && add_markers(markers, after, MARKER_AFTER) &&
+        add_markers(markers, before, MARKER_BEFORE);
+
+    if (success) {
+        // breadth first, so failure states are done before the states that use them
+        MarkerState *states = markers->states.p;
+        int32_t *fail = calloc(markers->states.size, sizeof(int32_t));
+        int32_t *queue = malloc(markers->states.size * sizeof(int32_t));
+        size_t head = 0, tail = 0;
+
+        success = fail != NULL && queue != NULL;
+
+        for (size_t c = 0; c < 256 && success; c++) {
+            if (states[0].next[c] < 0) {
+                states[0].next[c] = 0;
+
+            } else {
+                queue[tail++] = states[0].next[c];
+            }
+        }
+
+        while (head < tail && success) {
+            int32_t state = queue[head++];
+
+            for (size_t c = 0; c < 256; c++) {
+                int32_t next = states[state].next[c];
+                int32_t fallback = states[fail[state]].next[c];
+
+                if (next < 0) {
+                    states[state].next[c] = fallback;
+
+                } else {
+                    fail[next] = fallback;
+
+                    // markers ending in the failure state also end here
+                    for (int kind = MARKER_AFTER; kind <= MARKER_BEFORE; kind++) {
+                        if (states[next].longest[kind] < states[fail[next]].longest[kind]) {
+                            states[next].longest[kind] = states[fail[next]].longest[kind];
+                        }
+                    }
+
+                    queue[tail++] = next;
+                }
+            }
+        }
+
+        free(fail);
+        free(queue);
+    }
+
+    return success ? MF_NO_ERROR : MF_OUT_OF_MEMORY;
+}
+
+// Returns the start of the earliest marker of kind at or after from, or length if there is none.
+// Of markers starting at the same place, the longest is used.
+size_t markers_search(const Markers *markers, const char *buffer, size_t length, size_t from,
+                      enum MarkerKind kind, size_t *marker_length);
+size_t markers_search(const Markers *markers, const char *buffer, size_t length, size_t from,
+                      enum MarkerKind kind, size_t *marker_length)
+{
+    const MarkerState *states = markers->states.p;
+    size_t max_length = markers->max_length[kind];
+    size_t best = length;
+    int32_t state = 0;
+
+    *marker_length = 0;
+
+    for (size_t k = from; k < length && max_length > 0; k++) {
+        uint32_t longest;
+
+        state = states[state].next[(unsigned char)buffer[k]];
+        longest = states[state].longest[kind];
+
+        if (longest > 0 && (k + 1 - longest < best || (k + 1 - longest == best && longest > *marker_length))) {
+            best = k + 1 - longest;
+            *marker_length = longest;
+        }
+
+        // markers ending later start after the best so far
+        if (best < length && k + 2 > best + max_length) break;
+    }
+
+    return best;
+}
+
+// Sets text_start to the end of the earliest "after" marker, or to from if none, and text_end
+// to the start of the earliest "before" marker after that, or to length if none
+void markers_find_range(const Markers *markers, const char *buffer, size_t length, size_t from,
+                        size_t *text_start, size_t *text_end)
+{
+    size_t marker_length;
+    size_t found_at = markers_search(markers, buffer, length, from, MARKER_AFTER, &marker_length);
+
+    *text_start = found_at < length ? found_at + marker_length : from;
+    *text_end = markers_find_before(markers, buffer, length, *text_start);
+}
+
+size_t markers_find_before(const Markers *markers, const char *buffer, size_t length, size_t from)
+{
+    size_t marker_length;
+
+    return markers_search(markers, buffer, length, from, MARKER_BEFORE, &marker_length);
+}
+
+bool has_level_markers(const char *list);
+bool has_level_markers(const char *list)
+{
+    return list != NULL && *list != '\0' && *list != LEVEL_SEPARATOR;
+}
+
+// Compiles the section page markers of one level, or of the nearest level above with any
+MorseFeedError markers_compile_level(Markers *markers, const char *after, const char *before, int level)
+{
+    const char *level_after = level_markers(after, level);
+    const char *level_before = level_markers(before, level);
+
+    while (level > 1 && !has_level_markers(level_after) && !has_level_markers(level_before)) {
+        level--;
+        level_after = level_markers(after, level);
+        level_before = level_markers(before, level);
+    }
+
+    return markers_compile(markers, level_after, level_before);
+}
+
+void markers_free(Markers *markers)
+{
+    vector_free(&markers->states);
+}
+
+#if DEBUG
+void markers_tests(void)
+{
+    bool ok = true;
+    Markers markers;
+    StringVector storage = string_vector_create(0);
+    const char *after = NULL;
+    const char *before = NULL;
+    const char *text = "<html><div id=top>menu</div><h1>Title</h1><p>Text he said</p><footer>end";
+    size_t length = strlen(text);
+    size_t start, end;
+    printf("markers_tests()\n");
+
+    // no markers
+    markers_compile(&markers, NULL, NULL);
+    markers_find_range(&markers, text, length, 0, &start, &end);
+    ok &= print_if_fail(start == 0 && end == length, "FAIL: markers_find_range (1)");
+    markers_free(&markers);
+
+    // earliest of several, and the longest of those starting there
+    join_marker(&after, "<p>", &storage);
+    join_marker(&after, "<h1>", &storage);
+    join_marker(&after, "<h1>Ti", &storage);
+    join_marker(&before, "</p>", &storage);
+    join_marker(&before, "he", &storage);
+    join_marker(&before, "<footer>", &storage);
+    ok &= print_if_fail(strchr(after, MARKER_SEPARATOR) != NULL, "FAIL: join_marker (1)");
+
+    markers_compile(&markers, after, before);
+    markers_find_range(&markers, text, length, 0, &start, &end);
+    ok &= print_if_fail(start == strstr(text, "tle</h1>") - text, "FAIL: markers_find_range (2)");
+    ok &= print_if_fail(end == strstr(text, "he said") - text, "FAIL: markers_find_range (3)");
+    ok &= print_if_fail(markers_find_before(&markers, text, length, end + 1) == strstr(text, "</p>") - text,
+                        "FAIL: markers_find_before (1)");
+    markers_free(&markers);
+
+    // overlapping markers, where a shorter one ends first but starts later
+    markers_compile(&markers, "bcd\x1f" "abcde", NULL);
+    markers_find_range(&markers, "xxabcdefg", 9, 0, &start, &end);
+    ok &= print_if_fail(start == 7 && end == 9, "FAIL: markers_find_range (4)");
+    markers_find_range(&markers, "xxabcxbcdg", 10, 0, &start, &end);
+    ok &= print_if_fail(start == 9, "FAIL: markers_find_range (5)");
+    markers_free(&markers);
+
+    // not found
+    markers_compile(&markers, "zzz", "yyy");
+    markers_find_range(&markers, text, length, 3, &start, &end);
+    ok &= print_if_fail(start == 3 && end == length, "FAIL: markers_find_range (6)");
+    markers_free(&markers);
+
+    // section markers of each level, where level 3 has none and uses those of level 2
+    after = NULL;
+    before = NULL;
+    join_level_marker(&after, 1, "<h1>", &storage);
+    join_level_marker(&after, 2, "<p>", &storage);
+    join_level_marker(&after, 1, "<div", &storage);
+    join_level_marker(&before, 4, "he", &storage);
+    ok &= print_if_fail(strcmp(after, "<h1>\x1f<div\x1e<p>") == 0, "FAIL: join_level_marker (1)");
+    ok &= print_if_fail(strcmp(before, "\x1e\x1e\x1ehe") == 0, "FAIL: join_level_marker (2)");
+
+    markers_compile_level(&markers, after, before, 1);
+    markers_find_range(&markers, text, length, 0, &start, &end);
+    ok &= print_if_fail(start == strstr(text, " id=top") - text && end == length, "FAIL: markers_compile_level (1)");
+    markers_free(&markers);
+    markers_compile_level(&markers, after, before, 3);
+    markers_find_range(&markers, text, length, 0, &start, &end);
+    ok &= print_if_fail(start == strstr(text, "Text") - text && end == length, "FAIL: markers_compile_level (2)");
+    markers_free(&markers);
+    markers_compile_level(&markers, after, before, 4);
+    markers_find_range(&markers, text, length, 0, &start, &end);
+    ok &= print_if_fail(start == 0 && end == strstr(text, "he said") - text, "FAIL: markers_compile_level (3)");
+    markers_free(&markers);
+
+    string_vector_free(&storage);
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,74 @@
+//
+//  markers.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef markers_h
+#define markers_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "morsefeed.h"
+#include "vector.h"
+
+// Options -a, -b, -A and -B may be repeated to give alternative markers; they are kept in one
+// string, separated by MARKER_SEPARATOR, so saved options stay one cell each.
+#define MARKER_SEPARATOR '\x1f'
+
+// Section page markers may differ for each level of --depth; the lists of the levels are kept in
+// the one string too, separated by LEVEL_SEPARATOR. A level with none uses those of the level above.
+#define LEVEL_SEPARATOR '\x1e'
+
+enum MarkerKind { MARKER_AFTER, MARKER_BEFORE };
+
+// Aho-Corasick automaton for the "after" and "before" markers of a page, with the transitions
+// of every state filled in, so searching takes one table lookup per byte.
+struct MarkerState {
+    int32_t next[256];
+    uint32_t longest[2];    // longest marker of each kind ending in this state, or 0
+};
+typedef struct MarkerState MarkerState;
+
+struct Markers {
+    Vector states;          // MarkerState; state 0 is the root
+    size_t max_length[2];
+};
+typedef struct Markers Markers;
+
+bool join_marker(const char **markers, const char *marker, StringVector *string_storage);
+bool join_level_marker(const char **markers, int level, const char *marker, StringVector *string_storage);
+MorseFeedError markers_compile(Markers *markers, const char *after, const char *before);
+MorseFeedError markers_compile_level(Markers *markers, const char *after, const char *before, int level);
+void markers_find_range(const Markers *markers, const char *buffer, size_t length, size_t from,
+                        size_t *text_start, size_t *text_end);
+size_t markers_find_before(const Markers *markers, const char *buffer, size_t length, size_t from);
+void markers_free(Markers *markers);
+
+#if DEBUG
+void markers_tests(void);
+#endif
+
+#endif /* markers_h */
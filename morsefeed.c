@@ -29,8 +29,10 @@
 #endif
 
 #include <ctype.h>
+#include <errno.h>
 #include <execinfo.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -46,7 +48,18 @@
 
 #include <curl/curl.h>
 
+#include "boiler.h"
+#include "cache.h"
+#include "compressed.h"
+#include "crawl.h"
+#include "links.h"
+#include "markers.h"
 #include "morsefeed.h"
+#include "pipeline.h"
+#include "seek.h"
+#include "seen.h"
+#include "state.h"
+#include "tee.h"
 
 #define FIRST_BUFFER_SIZE 65536
 
@@ -55,30 +68,60 @@ MorseFeedError process_and_send(MorseFeedParams mfp)
     MorseFeedError error = MF_NO_ERROR;
     BufferStruct text_buffer = { NULL, 0, 0 };
 
-    FILE *pipe_to_mbeep = NULL;
-    FILE *pipe_from_mbeep = NULL;
-    pid_t pid = -1;
+    MbeepSession session;
+    Tee tee;
     bool use_key_control = false;
     int word_number = 0;
-    char line[LINE_SIZE];
-    char token[LINE_SIZE];
-    size_t token_length = 0;
     size_t buffer_index = 0;
-    size_t line_offset = 0;
     size_t token_offset = 0;
-    bool more_buffers;
-    size_t link_index;
     StringVector linked_urls = string_vector_create(0);
     StringVector linked_titles = string_vector_create(0);
     bool filter_html = false;
-    bool excluding_tag = false;
-    char entity[ENTITY_SIZE];
-    char tag[TAG_SIZE];
-
-    if (mfp.fork_mbeep) init_fork_mbeep(use_key_control);
+    Pipeline pipeline;
+    PlaybackState playback;
+    StateJournal journal = { -1, -1 };
+    SeenSet seen;
+    bool use_seen = mfp.follow_links && mfp.save_and_use_position && mfp.url != NULL;
+    bool all_played = false;
+    Markers markers = { { 0 } };
+    Markers linked_markers = { { 0 } };
+    Markers section_markers[MAX_CRAWL_DEPTH - 1] = { { { 0 } } };
+    size_t byte_budget = mfp.max_megabytes != DEFAULT ? (size_t)(mfp.max_megabytes * 1e6) : SIZE_MAX;
+    size_t bytes_used = 0;
+    BufferStruct *linked_pages = NULL;
+    bool prefetched = true;                 // before playing, with --strip-common
+    LinkFilter link_filter = { { 0 } };
+    size_t text_start = 0;
+    size_t text_end = 0;
+    ConvertCache cache = { NULL };
+    bool use_cache = mfp.cache_megabytes != DEFAULT;
+    bool cache_hit = false;
+    bool use_seek = mfp.url == NULL &&
+        (mfp.start_word != DEFAULT || mfp.start_percent != DEFAULT || mfp.back_paragraphs != DEFAULT);
+    bool use_offset = mfp.url == NULL && mfp.in_file != NULL && mfp.start_offset != DEFAULT;
+    const char *position_label = mfp.url != NULL ? mfp.url : mfp.in_file_name;
+    CompressedFormat compressed = mfp.url == NULL ? compressed_format(mfp.in_file) : COMPRESSED_NONE;
+    FILE *decompressed = NULL;
+    Charset charset = mfp.charset;
+
+    init_playback(&playback, &mfp);
+    init_mbeep_session(&session);
+    tee_init(&tee);
+
+    if (use_seen) error = seen_open(&seen, mfp.state_path, mfp.url);
+
+    // compiled once for all pages
+    if (error == MF_NO_ERROR) error = markers_compile(&markers, mfp.text_after, mfp.text_before);
+    if (error == MF_NO_ERROR) error = markers_compile(&linked_markers, mfp.linked_text_after, mfp.linked_text_before);
+    for (int level = 1; level < mfp.crawl_depth && error == MF_NO_ERROR; level++) {
+        error = markers_compile_level(&section_markers[level - 1], mfp.section_text_after, mfp.section_text_before,
+                                      level);
+    }
+    if (error == MF_NO_ERROR) error = link_filter_compile(&link_filter, mfp.include_links, mfp.exclude_links);
 
-    if (mfp.url != NULL) {
+    if (error == MF_NO_ERROR && mfp.url != NULL) {
         error = url_to_buffer(mfp.url, &text_buffer);
+        bytes_used += text_buffer.used;
         filter_html = true;
     }
 
@@ -86,11 +129,18 @@ MorseFeedError process_and_send(MorseFeedParams mfp)
         if (mfp.in_file == NULL && mfp.url == NULL) mfp.in_file = stdin;
         use_key_control = mfp.fork_mbeep && mfp.in_file != stdin;
 
+        // before rows get their length, which differs between sinks
+        error = tee_open(&tee, &mfp);
+        if (tee.count > 0) playback.tee = &tee;
+    }
+
+    if (error == MF_NO_ERROR) {
         if (mfp.fork_mbeep) {
             if (mfp.words_per_row == DEFAULT) mfp.words_per_row = 1;
-            begin_fork_mbeep(&pipe_to_mbeep, &pipe_from_mbeep, &pid, mfp.freq, mfp.paris_wpm, mfp.codex_wpm,
-                             mfp.farnsworth_wpm, mfp.word_space_wpm, mfp.print_fcc_wpm, mfp.wav_file_name,
-                             use_key_control);
+            error = begin_fork_mbeep(&session, mfp.freq, mfp.paris_wpm, mfp.codex_wpm,
+                                     mfp.farnsworth_wpm, mfp.word_space_wpm, mfp.print_fcc_wpm,
+                                     mfp.wav_file_name, use_key_control);
+            if (use_key_control) playback.session = &session;
 
         } else {
             if (mfp.out_file == NULL) mfp.out_file = stdout;
@@ -98,9 +148,17 @@ MorseFeedError process_and_send(MorseFeedParams mfp)
         }
     }
 
+    // a compressed file is decompressed whole only to find markers, look it up in the cache or seek in it
+    if (error == MF_NO_ERROR && compressed != COMPRESSED_NONE &&
+        (mfp.text_after != NULL || mfp.text_before != NULL || use_cache || use_seek)) {
+        error = decompress_read_all(mfp.in_file, compressed, &text_buffer);
+    }
+
+    // a file is hashed whole to look for it in the cache
     if (error == MF_NO_ERROR &&
-        (mfp.save_and_use_position || mfp.text_after != NULL || mfp.text_before != NULL) &&
-        text_buffer.p == NULL && mfp.in_file != NULL) {
+        (mfp.save_and_use_position || mfp.text_after != NULL || mfp.text_before != NULL ||
+         ((use_cache || use_seek) && is_regular_file(mfp.in_file))) &&
+        text_buffer.p == NULL && mfp.in_file != NULL && compressed == COMPRESSED_NONE) {
         long file_size = 0;
 
         if (fseek(mfp.in_file, 0L, SEEK_END) < 0) {
@@ -124,195 +182,303 @@ MorseFeedError process_and_send(MorseFeedParams mfp)
         }
     }
 
-    buffer_index = 0;
+    // detected from the start of the text, for which a compressed file read as it is decompressed is
+    // opened a second time; typed or piped text is UTF-8
+    if (error == MF_NO_ERROR && charset == CHARSET_UNKNOWN) {
+        if (text_buffer.p != NULL) {
+            charset = charset_detect(text_buffer.p, text_buffer.used - 1, text_buffer.charset);
 
-    if (error == MF_NO_ERROR && mfp.text_after != NULL) {
-        size_t position = find_string(mfp.text_after, text_buffer.p, text_buffer.used - 1, 0);
-        if (position < text_buffer.used - 1) {
-            position += strlen(mfp.text_after);
-            buffer_index = position;
-            line_offset = position;
-            token_offset = position;
+        } else if (compressed != COMPRESSED_NONE) {
+            FILE *start = NULL;
+
+            if (decompress_open(&start, mfp.in_file, compressed, NULL, NULL, 0) == MF_NO_ERROR) {
+                charset = charset_detect_file(start);
+                fclose(start);
+            }
+
+        } else if (is_regular_file(mfp.in_file)) {
+            charset = charset_detect_file(mfp.in_file);
         }
     }
 
+    buffer_index = 0;
+
+    if (error == MF_NO_ERROR && text_buffer.p != NULL) {
+        markers_find_range(&markers, text_buffer.p, text_buffer.used - 1, 0, &buffer_index, &text_end);
+        token_offset = buffer_index;
+        text_start = buffer_index;
+    }
+
     if (error == MF_NO_ERROR && mfp.save_and_use_position) {
         size_t position = 0;
-        error = read_saved_position(mfp.state_path, mfp.url != NULL ? mfp.url : mfp.in_file_name, &position);
+        uint64_t fingerprint = 0;
+
+        error = read_saved_position(mfp.state_path, position_label, &position, &fingerprint);
+
+        if (error == MF_NO_ERROR && position > 0 && fingerprint != 0 && text_buffer.p != NULL) {
+            // text may have changed since position was saved
+            size_t found_at = find_anchor(text_buffer.p, text_buffer.used - 1, position, fingerprint);
+            if (found_at < text_buffer.used - 1) position = found_at;
+        }
+
         if (position > buffer_index) {
             buffer_index = position;
-            line_offset = position;
             token_offset = position;
+
+            if (text_buffer.p != NULL && position > text_end) {
+                text_end = markers_find_before(&markers, text_buffer.p, text_buffer.used - 1, position);
+            }
         }
-    }
 
-    if (error == MF_NO_ERROR && mfp.text_before != NULL) {
-        size_t position = find_string(mfp.text_before, text_buffer.p, text_buffer.used - 1, buffer_index);
-        if (position < text_buffer.used - 1) {
-            text_buffer.used = position + 1;
+        // checkpoints are best effort, so playing does not depend on them
+        if (error == MF_NO_ERROR && position_label != NULL &&
+            journal_open(&journal, mfp.state_path) == MF_NO_ERROR) {
+            playback.journal = &journal;
+            playback.journal_label = position_label;
+            playback.checkpoint_offset = buffer_index;
         }
     }
 
-    if (error == MF_NO_ERROR && mfp.follow_links && text_buffer.p != NULL) {
-        extract_urls(mfp.url, text_buffer.p, buffer_index, text_buffer.used - 1,
-                     &linked_urls, &linked_titles);
-#if DEBUG
-//            string_vector_each(&linked_urls, print_string);
-//            string_vector_each(&linked_titles, print_string);
-#endif
+    // a word or percentage replaces the position saved with -p, and paragraphs go back from either
+    if (error == MF_NO_ERROR && use_seek && text_buffer.p != NULL) {
+        size_t position = buffer_index;
+
+        if (mfp.start_word != DEFAULT) {
+            WordIndex index;
+
+            error = word_index_open(&index, mfp.state_path, mfp.in_file_name, text_buffer.p, text_buffer.used - 1,
+                                   charset);
+            if (error == MF_NO_ERROR) {
+                position = word_index_seek(&index, text_buffer.p, text_buffer.used - 1, mfp.start_word);
+            }
+            word_index_free(&index);
+
+        } else if (mfp.start_percent != DEFAULT) {
+            position = seek_percent(text_buffer.p, text_start, text_end, mfp.start_percent);
+        }
+
+        if (mfp.back_paragraphs != DEFAULT) {
+            position = back_paragraphs(text_buffer.p, text_start, position, mfp.back_paragraphs);
+        }
+
+        if (position < text_start) position = text_start;
+        if (position > text_end) position = text_end;
+
+        buffer_index = position;
+        token_offset = position;
+        playback.checkpoint_offset = position;
     }
 
-    more_buffers = true;
-    link_index = 0;
+    // a token found with --sample is started at without reading the text before it
+    if (error == MF_NO_ERROR && use_offset) {
+        size_t position = (size_t)mfp.start_offset;
 
-    while (error == MF_NO_ERROR && more_buffers) {
-        if (text_buffer.p == NULL) {
-            // reading from file; only one pass
-            more_buffers = false;
+        if (text_buffer.p != NULL) {
+            if (position < text_start) position = text_start;
+            if (position > text_end) position = text_end;
 
-        } else if (linked_urls.size == 0) {
-            // only one text buffer; only one pass
-            more_buffers = false;
+        } else if (compressed == COMPRESSED_NONE && fseeko(mfp.in_file, (off_t)position, SEEK_SET) != 0) {
+            error = MF_FILE_READ_ERROR;
+        }
 
-        } else {
-            // read next linked URL
-            const char *next_url = string_vector_at(&linked_urls, link_index);
-            const char *next_title = string_vector_at(&linked_titles, link_index);
-
-            if (mfp.fork_mbeep) fprintf(stderr, "%ld) %s\n", (long)link_index, next_title);
-
-            token_length = 0;
-            buffer_index = 0;
-            line_offset = 0;
-            token_offset = 0;
-            excluding_tag = false;
-            entity[0] = '\0';
-            tag[0] = '\0';
+        buffer_index = position;
+        token_offset = position;
+        playback.checkpoint_offset = position;
+    }
 
-            error = url_to_buffer(next_url, &text_buffer);
+    // otherwise it is read as it is decompressed, from the saved position
+    if (error == MF_NO_ERROR && compressed != COMPRESSED_NONE && text_buffer.p == NULL) {
+        error = decompress_open(&decompressed, mfp.in_file, compressed,
+                                mfp.save_and_use_position || use_offset ? mfp.state_path : NULL, mfp.in_file_name,
+                                buffer_index);
+        if (error == MF_NO_ERROR) mfp.in_file = decompressed;
+    }
 
-            if (error == MF_NO_ERROR && mfp.linked_text_after != NULL) {
-                size_t position = find_string(mfp.linked_text_after, text_buffer.p, text_buffer.used - 1, 0);
-                if (position < text_buffer.used - 1) {
-                    position += strlen(mfp.linked_text_after);
-                    buffer_index = position;
-                    line_offset = position;
-                    token_offset = position;
-                }
-            }
+    if (error == MF_NO_ERROR && text_buffer.p != NULL && text_end < text_buffer.used - 1) {
+        text_buffer.used = text_end + 1;
+    }
 
-            if (error == MF_NO_ERROR && mfp.linked_text_before != NULL) {
-                size_t position = find_string(mfp.linked_text_before, text_buffer.p, text_buffer.used - 1, buffer_index);
-                if (position < text_buffer.used - 1) {
-                    text_buffer.used = position + 1;
-                }
-            }
+    if (error == MF_NO_ERROR && text_buffer.p != NULL) {
+        playback_set_source(&playback, text_buffer.p, buffer_index, buffer_index, text_buffer.used - 1);
+    }
 
-            if (++link_index >= linked_urls.size) {
-                // this is the last one
-                more_buffers = false;
+    if (error == MF_NO_ERROR && mfp.follow_links && text_buffer.p != NULL) {
+        extract_urls(mfp.url, text_buffer.p, buffer_index, text_buffer.used - 1,
+                     &linked_urls, &linked_titles);
 
-            } else if (link_index > 1) {
-                write_token("=", mfp.out_file, pipe_to_mbeep, pipe_from_mbeep,
-                            mfp.words_per_row, &word_number, mfp.word_count,
-                            use_key_control, filter_html, &excluding_tag, entity, tag);
-            }
+        if (mfp.crawl_depth > 1) {
+            error = crawl_links(&linked_urls, &linked_titles, mfp.crawl_depth, section_markers,
+                                byte_budget, &bytes_used, mfp.fork_mbeep);
         }
 
-        while (error == MF_NO_ERROR && NULL !=
-               fbgets(line, LINE_SIZE, mfp.in_file, text_buffer.p, text_buffer.used - 1, &buffer_index)) {
-#ifdef DEBUG
-            fprintf(stderr, "fgets(%s)\n", line);
-#endif
-            size_t k;
-            for (k = 0; k < strlen(line) && error == MF_NO_ERROR; k++) {
-                char c = line[k];
-                if (isspace(c)) {
-                    if (token_length > 0) {
-                        token[token_length] = '\0';
-                        error = write_token(token, mfp.out_file, pipe_to_mbeep, pipe_from_mbeep,
-                                            mfp.words_per_row, &word_number, mfp.word_count,
-                                            use_key_control, filter_html, &excluding_tag, entity, tag);
-
-                        if (error == MF_NO_ERROR) {
-                            token_offset = line_offset + k + 1;
-#ifdef DEBUG
-                            fprintf(stderr, "token_offset = %d\n", (int)token_offset);
-#endif
-                        }
+        if (error == MF_NO_ERROR) {
+            size_t filtered = link_filter_apply(&link_filter, &linked_urls, &linked_titles);
 
-                        token_length = 0;
-                    }
+            if (filtered > 0) fprintf(stderr, "(%ld links not fetched by filters)\n", (long)filtered);
+        }
 
-                } else if (token_length == LINE_SIZE - 1) {
-                    token[token_length] = '\0';
-                    error = write_token(token, mfp.out_file, pipe_to_mbeep, pipe_from_mbeep,
-                                        mfp.words_per_row, &word_number, mfp.word_count,
-                                        use_key_control, filter_html, &excluding_tag, entity, tag);
+        // with -p, articles already played are skipped
+        if (use_seen) {
+            size_t skipped = seen_filter(&seen, &linked_urls, &linked_titles);
 
-                    if (error == MF_NO_ERROR) {
-                        token_offset = line_offset + token_length;
-#ifdef DEBUG
-                        fprintf(stderr, "token_offset = %d\n", (int)token_offset);
-#endif
-                    }
-                    token[0] = c;
-                    token_length = 1;
+            if (skipped > 0) fprintf(stderr, "(skipping %ld already played)\n", (long)skipped);
 
-                } else {
-                    token[token_length++] = c;
+            all_played = skipped > 0 && linked_urls.size == 0;
+        }
+
+        // text common to most pages can only be found once all are fetched
+        if (error == MF_NO_ERROR && mfp.strip_common && linked_urls.size > 1) {
+            size_t usable = 0;
+
+            linked_pages = calloc(linked_urls.size, sizeof(BufferStruct));
+            error = linked_pages == NULL ? MF_OUT_OF_MEMORY :
+                fetch_urls(&linked_urls, linked_pages, byte_budget, &bytes_used, &usable);
+
+            while (error == MF_NO_ERROR && linked_urls.size > usable) {
+                char *dropped;
+
+                if (linked_urls.size == usable + 1) {
+                    fprintf(stderr, "(stopped after %.1f megabytes)\n", bytes_used / 1e6);
                 }
+
+                vector_delete_at(&linked_urls, linked_urls.size - 1, &dropped);
+                free(dropped);
+                vector_delete_at(&linked_titles, linked_titles.size - 1, &dropped);
+                free(dropped);
             }
 
-            line_offset += strlen(line);
+            if (error == MF_NO_ERROR) {
+                size_t removed = remove_boilerplate(linked_pages, linked_urls.size, &linked_markers);
+                fprintf(stderr, "(removed %ld bytes common to most pages)\n", (long)removed);
+            }
         }
+#if DEBUG
+//            string_vector_each(&linked_urls, print_string);
+//            string_vector_each(&linked_titles, print_string);
+#endif
+    }
 
-        // see if last token to finish
-        if (token_length > 0) {
-            token[token_length] = '\0';
-            error = write_token(token, mfp.out_file, pipe_to_mbeep, pipe_from_mbeep,
-                                mfp.words_per_row, &word_number, mfp.word_count,
-                                use_key_control, filter_html, &excluding_tag, entity, tag);
-            token_length = 0;
+    // pages are read as they are played, unless fetched already
+    if (error == MF_NO_ERROR && linked_urls.size > 0 && linked_pages == NULL) {
+        linked_pages = calloc(linked_urls.size, sizeof(BufferStruct));
+        prefetched = false;
+        if (linked_pages == NULL) error = MF_OUT_OF_MEMORY;
+    }
+
+    pipeline.cached = NULL;
+    pipeline.cache_file = NULL;
+
+    // only a single page or file is kept, and a failing cache does not stop it from being played
+    if (error == MF_NO_ERROR && use_cache && text_buffer.p != NULL && linked_urls.size == 0 && !all_played &&
+        cache_open(&cache, mfp.state_path, mfp.cache_megabytes) == MF_NO_ERROR) {
+        const char *records;
+        size_t size;
+        size_t start;
+
+        // HTML resumed partway is stripped as if no tag were open there, unlike the words kept
+        if (cache_find(&cache, text_buffer.p, text_buffer.used - 1, text_start, filter_html, charset,
+                       &records, &size) &&
+            (buffer_index == text_start || !filter_html) && pipeline_cached_start(records, size, buffer_index, &start)) {
+            pipeline.cached = records + start;
+            pipeline.cached_size = size - start;
+            cache_hit = true;
+
+        } else if (buffer_index == text_start) {
+            pipeline.cache_file = cache_begin(&cache);
         }
+    }
+
+    if (error == MF_NO_ERROR) {
+        pipeline.mfp = &mfp;
+        pipeline.text_buffer = &text_buffer;
+        pipeline.buffer_index = buffer_index;
+        pipeline.more_buffers = !all_played;
+        pipeline.linked_urls = &linked_urls;
+        pipeline.linked_titles = &linked_titles;
+        pipeline.linked_pages = linked_pages;
+        pipeline.prefetched = prefetched;
+        pipeline.linked_markers = &linked_markers;
+        pipeline.byte_budget = byte_budget;
+        pipeline.bytes_used = &bytes_used;
+        pipeline.filter_html = filter_html;
+        pipeline.decompressing = decompressed != NULL;
+        pipeline.charset = charset;
+        pipeline.pipe_to_mbeep = session.pipe_to_mbeep;
+        pipeline.pipe_from_mbeep = session.pipe_from_mbeep;
+        pipeline.use_key_control = use_key_control;
+        pipeline.word_number = &word_number;
+        pipeline.playback = &playback;
+        pipeline.seen = use_seen ? &seen : NULL;
+
+        error = pipeline_run(&pipeline);
+        token_offset = pipeline.token_offset;
+
+        if (mfp.stage_stats) pipeline_print_stats(&pipeline);
+    }
 
-        if (error == MF_NEXT) error = MF_NO_ERROR;
+    if (cache.dir != NULL) {
+        cache_finish(&cache, cache_hit, pipeline.cache_complete && !pipeline.stopped_reading);
+        if (mfp.cache_stats) cache_print_stats(&cache, cache_hit);
+        cache_close(&cache);
     }
 
+    for (size_t k = 0; linked_pages != NULL && k < linked_urls.size; k++) free_buffer(&linked_pages[k]);
+    free(linked_pages);
+
     string_vector_free(&linked_urls);
     string_vector_free(&linked_titles);
 
-    if (error == MF_NO_ERROR && text_buffer.p == NULL && !feof(mfp.in_file)) {
+    if (error == MF_NO_ERROR && text_buffer.p == NULL && (pipeline.stopped_reading || !pipeline.input_ended)) {
         error = MF_FILE_READ_ERROR;
     }
 
-    if (error == MF_NO_ERROR && token_length > 0) {
-        token[token_length] = '\0';
-        error = write_token(token, mfp.out_file, pipe_to_mbeep, pipe_from_mbeep,
-                            mfp.words_per_row, &word_number, mfp.word_count, use_key_control,
-                            filter_html, &excluding_tag, entity, tag);
-
-        if (error == MF_NO_ERROR) {
-            token_offset = line_offset;
-#ifdef DEBUG
-            fprintf(stderr, "final token_offset = %d\n", (int)token_offset);
-#endif
-        }
-    }
-
-    if ((error == MF_NO_ERROR || error == MF_EXIT) && pipe_to_mbeep == NULL &&
+    if ((error == MF_NO_ERROR || error == MF_EXIT) && session.pipe_to_mbeep == NULL &&
             fprintf(mfp.out_file, "\n") < 0) {
         error = MF_FILE_WRITE_ERROR;
     }
 
-    if (mfp.fork_mbeep) end_fork_mbeep(pipe_to_mbeep, pipe_from_mbeep, pid);
+    // after 'q', rows still queued in mbeep should not be heard
+    if (mfp.fork_mbeep) end_fork_mbeep(&session, playback.quit);
+
+    if (tee.count > 0) {
+        MorseFeedError tee_error = tee_close(&tee, playback.quit);
+
+        if (error == MF_NO_ERROR) error = tee_error;
+        if (mfp.stage_stats) tee_print_stats(&tee);
+    }
+
+    free_playback(&playback);
+
+    if (playback.show_progress) fprintf(stderr, "\n");
 
     if ((error == MF_NO_ERROR || error == MF_EXIT) && mfp.save_and_use_position) {
+        if (playback.quit) token_offset = playback.heard_offset;
         if (token_offset >= text_buffer.used - 1) token_offset = 0;
+        // a compressed file played to its end starts again, as a file read whole does
+        if (decompressed != NULL && error == MF_NO_ERROR && !pipeline.stopped_reading) token_offset = 0;
+
+        uint64_t fingerprint = 0;
 
-        error = write_saved_position(mfp.state_path, mfp.url != NULL ? mfp.url : mfp.in_file_name, token_offset);
+        if (token_offset > 0 && text_buffer.p != NULL) {
+            fingerprint = anchor_fingerprint(text_buffer.p, text_buffer.used - 1, token_offset);
+        }
+
+        error = write_saved_position(mfp.state_path, position_label, token_offset, fingerprint);
+    }
+
+    journal_close(&journal);
+    markers_free(&markers);
+    markers_free(&linked_markers);
+    for (int level = 1; level < MAX_CRAWL_DEPTH; level++) markers_free(&section_markers[level - 1]);
+    link_filter_free(&link_filter);
+
+    if (use_seen) {
+        MorseFeedError seen_error = seen_save(&seen);
+        if (error == MF_NO_ERROR) error = seen_error;
+        seen_close(&seen);
     }
 
+    if (decompressed != NULL) fclose(decompressed);
     free_buffer(&text_buffer);
 
     return error;
@@ -364,18 +530,74 @@ size_t curl_write_data(void *buffer, size_t size, size_t nmemb, void *userp)
     return bytes_to_copy;
 }
 
+// Handles are kept from one call to the next, so that connections and DNS lookups are reused.
+// Each call takes one that no other is using, or a new one, so that sessions and pipelines on
+// several threads fetch at once; up to URL_HANDLES are kept when they are done.
+#define URL_HANDLES 8
+
+static pthread_mutex_t url_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CURL *url_handles[URL_HANDLES];
+static int url_handle_count = 0;
+static bool url_initialized = false;
+
+CURL *take_url_handle(void);
+CURL *take_url_handle(void)
+{
+    CURL *handle = NULL;
+
+    pthread_mutex_lock(&url_mutex);
+
+    if (!url_initialized) {
+        curl_global_init(CURL_GLOBAL_ALL);
+        url_initialized = true;
+    }
+
+    if (url_handle_count > 0) handle = url_handles[--url_handle_count];
+
+    pthread_mutex_unlock(&url_mutex);
+
+    if (handle == NULL) {
+        handle = curl_easy_init();
+
+    } else {
+        curl_easy_reset(handle);
+    }
+
+    return handle;
+}
+
+void give_back_url_handle(CURL *handle);
+void give_back_url_handle(CURL *handle)
+{
+    pthread_mutex_lock(&url_mutex);
+
+    if (url_handle_count < URL_HANDLES) {
+        url_handles[url_handle_count++] = handle;
+
+    } else {
+        curl_easy_cleanup(handle);
+    }
+
+    pthread_mutex_unlock(&url_mutex);
+}
+
 MorseFeedError url_to_buffer(const char *url, BufferStruct *buffer)
 {
     MorseFeedError error = MF_NO_ERROR;
     CURLcode curl_code = CURLE_OK;
     CURL *handle = NULL;
     long response_code = 0;
+    char *content_type = NULL;
 
     buffer->used = 0;
+    buffer->charset = CHARSET_UNKNOWN;
 
     if (url != NULL) {
-        curl_global_init(CURL_GLOBAL_ALL);
-        handle = curl_easy_init();
+        handle = take_url_handle();
+        if (handle == NULL) error = MF_OUT_OF_MEMORY;
+    }
+
+    if (handle != NULL) {
         curl_easy_setopt(handle, CURLOPT_URL, url);
         curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, curl_write_data);
         curl_easy_setopt(handle, CURLOPT_WRITEDATA, (void *)buffer);
@@ -392,8 +614,11 @@ MorseFeedError url_to_buffer(const char *url, BufferStruct *buffer)
             if (curl_code != CURLE_OK) error = MF_URL_READ_ERROR;
         }
 
-        curl_easy_cleanup(handle);
-        curl_global_cleanup();
+        if (error == MF_NO_ERROR && curl_easy_getinfo(handle, CURLINFO_CONTENT_TYPE, &content_type) == CURLE_OK) {
+            buffer->charset = charset_declared(content_type);
+        }
+
+        give_back_url_handle(handle);
     }
 
     if (curl_code != CURLE_OK) {
@@ -426,11 +651,26 @@ MorseFeedError url_to_buffer(const char *url, BufferStruct *buffer)
     return error;
 }
 
+void release_url_handle(void)
+{
+    pthread_mutex_lock(&url_mutex);
+
+    while (url_handle_count > 0) curl_easy_cleanup(url_handles[--url_handle_count]);
+
+    if (url_initialized) {
+        curl_global_cleanup();
+        url_initialized = false;
+    }
+
+    pthread_mutex_unlock(&url_mutex);
+}
+
 void init_buffer(BufferStruct *buffer, size_t capacity)
 {
     buffer->p = capacity == 0 ? NULL : malloc(capacity);
     buffer->capacity = buffer->p == NULL ? 0 : capacity;
     buffer->used = 0;
+    buffer->charset = CHARSET_UNKNOWN;
 }
 
 void free_buffer(BufferStruct *buffer)
@@ -467,188 +707,423 @@ char *fbgets(char *line, int line_size, FILE *file, char *buffer, size_t buffer_
     return result;
 }
 
-MorseFeedError read_saved_position(const char *state_path, const char *label, size_t *position)
+StringVector position_row(const char *label, size_t position, uint64_t fingerprint);
+StringVector position_row(const char *label, size_t position, uint64_t fingerprint)
 {
-    MorseFeedError error = MF_NO_ERROR;
-    StringArray array = read_string_array(state_path);
-    size_t k;
-    bool found = false;
-    
+    StringVector row = string_vector_create(4);
+    char str[32];
+    bool push_error = false;
+
+    push_error |= !string_vector_push(&row, "position");
+    push_error |= !string_vector_push(&row, label);
+
+    sprintf(str, "%ld", (long)position);
+    push_error |= !string_vector_push(&row, str);
+
+    if (fingerprint != 0) {
+        sprintf(str, "%016llx", (unsigned long long)fingerprint);
+        push_error |= !string_vector_push(&row, str);
+    }
+
+    if (push_error) string_vector_free(&row);
+
+    return row;
+}
+
+// Position rows are: "position", label, byte offset, and optionally the anchor fingerprint in hex.
+MorseFeedError read_saved_position(const char *state_path, const char *label, size_t *position,
+                                   uint64_t *fingerprint)
+{
+    StateStore store;
+    MorseFeedError error = state_open(&store, state_path, false);
+    StringVector *row = error == MF_NO_ERROR ? state_find(&store, "position", label) : NULL;
+
     *position = 0;
-    for (k = 0; k < array.size && !found; k++) {
-        StringVector next;
-        if (vector_at(&array, k, &next) && next.size == 3 &&
-            strcmp(string_vector_at(&next, 0), "position") == 0 &&
-            strcmp(string_vector_at(&next, 1), label) == 0) {
-            
-            found = true;
-            *position = atoi(string_vector_at(&next, 2));
+    if (fingerprint != NULL) *fingerprint = 0;
+
+    if (row != NULL && row->size >= 3) {
+        *position = atol(string_vector_at(row, 2));
+
+        if (row->size >= 4 && fingerprint != NULL) {
+            *fingerprint = strtoull(string_vector_at(row, 3), NULL, 16);
         }
     }
-    
-    string_array_free(&array);
-    
+
+    state_close(&store);
+
     return error;
 }
 
-MorseFeedError write_saved_position(const char *state_path, const char *label, size_t position)
+MorseFeedError write_saved_position(const char *state_path, const char *label, size_t position,
+                                    uint64_t fingerprint)
 {
-    MorseFeedError error = MF_NO_ERROR;
-    StringArray array = read_string_array(state_path);
-    StringVector new_entry = string_vector_create(3);
-    size_t found_index = 0;
-    bool found = false;
-    bool changed = false;
-    char position_str[32];
-    
-    for (size_t index = 0; index < array.size && !found; index++) {
-        StringVector next;
-        if (vector_at(&array, index, &next) && next.size == 3 &&
-            strcmp(string_vector_at(&next, 0), "position") == 0 &&
-            strcmp(string_vector_at(&next, 1), label) == 0) {
-            
-            found = true;
-            found_index = index;
-        }
-    }
-    
-    if (position == 0) {
-        if (found) {
-            StringVector previous;
-            vector_delete_at(&array, found_index, &previous);
-            string_vector_free(&previous);
-            changed = true;
-        }
-        
-    } else {
-        sprintf(position_str, "%ld", (long)position);
-        if (new_entry.p == NULL || !string_vector_push(&new_entry, "position") ||
-            !string_vector_push(&new_entry, label) ||
-            !string_vector_push(&new_entry, position_str)) {
-            
-            string_vector_free(&new_entry);
+    StateStore store;
+    MorseFeedError error = state_open(&store, state_path, true);
+
+    if (error == MF_NO_ERROR && position == 0) {
+        state_remove(&store, "position", label);
+
+    } else if (error == MF_NO_ERROR) {
+        StringVector new_entry = position_row(label, position, fingerprint);
+
+        if (new_entry.p == NULL) {
             error = MF_OUT_OF_MEMORY;
-        }
-        
-        if (error == MF_NO_ERROR) {
-            if (found) {
-                StringVector previous;
-                vector_replace_at(&array, found_index, &new_entry, &previous);
-                string_vector_free(&previous);
-                changed = true;
-                
-            } else {
-                if (!vector_push(&array, &new_entry)) {
-                    string_vector_free(&new_entry);
-                    error = MF_OUT_OF_MEMORY;
-                }
-                changed = true;
-            }
+
+        } else {
+            error = state_put(&store, &new_entry);
         }
     }
-    
-    if (changed && error == MF_NO_ERROR) {
-        write_string_array(state_path, &array);
+
+    if (error == MF_NO_ERROR) {
+        error = state_commit(&store);
     }
-    
-    string_array_free(&array);
-    
+
+    state_close(&store);
+
     return error;
 }
 
-MorseFeedError write_token(char *token, FILE *out_file, FILE *pipe_to_mbeep, FILE *pipe_from_mbeep,
-                           int words_per_row, int *word_number, int word_count,
-                           bool use_key_control, bool filter_html, bool *excluding_tag,
-                           char entity[ENTITY_SIZE], char tag[TAG_SIZE])
+// A saved position is anchored by a fingerprint of the ANCHOR_WORDS words that follow it, so that
+// the position can be found again after text is inserted or removed earlier in the source.
+// Words are whitespace-separated tokens; the fingerprint is a polynomial hash of their hashes,
+// which lets find_anchor() roll a window of words across the text in one pass.
+#define ANCHOR_WORDS 8
+#define ANCHOR_NEAR 65536
+#define ANCHOR_BASE 1099511628211ULL
+
+size_t next_anchor_word(const char *buffer, size_t length, size_t offset, uint64_t *word_hash);
+size_t next_anchor_word(const char *buffer, size_t length, size_t offset, uint64_t *word_hash)
 {
-    MorseFeedError error = MF_NO_ERROR;
-    char word[LINE_SIZE];
-    size_t word_length = 0;
-    size_t index = 0;
-    bool latin1 = false;
+    size_t start = offset;
 
-#ifdef DEBUG
-    fprintf(stderr, "strlen(%s) = %d\n", token, (int)strlen(token));
-#endif
+    while (start < length && isspace((unsigned char)buffer[start])) start++;
 
-    while (index < strlen(token) && word_length < LINE_SIZE - 1) {
-        char *name = "";
-        unsigned char c = token[index];
+    offset = start;
+    while (offset < length && !isspace((unsigned char)buffer[offset])) offset++;
 
-        if (filter_html && c == '<') {
-            size_t len = strlen(tag);
-            *excluding_tag = true;
-            if (len < TAG_SIZE - 1) {
-                tag[len++] = c;
-                tag[len] = '\0';
-            }
+    *word_hash = hash_bytes(buffer + start, offset - start, 0);
 
-        } else if (*excluding_tag && c == '>') {
-            size_t len = strlen(tag);
-            *excluding_tag = false;
-            if (len < TAG_SIZE - 1) {
-                tag[len++] = c;
-                tag[len] = '\0';
-            }
+    return offset;
+}
 
-            if (strcmp(tag, "</li>") == 0) {
-                name = "|";
+size_t skip_to_word(const char *buffer, size_t length, size_t offset);
+size_t skip_to_word(const char *buffer, size_t length, size_t offset)
+{
+    while (offset < length && isspace((unsigned char)buffer[offset])) offset++;
 
-            } else {
-                name = " ";
-            }
+    return offset;
+}
 
-            tag[0] = '\0';
+uint64_t anchor_fingerprint(const char *buffer, size_t length, size_t offset)
+{
+    uint64_t fingerprint = 0;
+    uint64_t word_hash;
+    int words;
 
-        } else if (*excluding_tag) {
-            size_t len = strlen(tag);
-            if (len < TAG_SIZE - 1) {
-                tag[len++] = c;
-                tag[len] = '\0';
+    for (words = 0; words < ANCHOR_WORDS; words++) {
+        offset = skip_to_word(buffer, length, offset);
+        if (offset >= length) break;
+
+        offset = next_anchor_word(buffer, length, offset, &word_hash);
+        fingerprint = fingerprint * ANCHOR_BASE + word_hash;
+    }
+
+    return fingerprint != 0 ? fingerprint : 1;
+}
+
+// Returns the start of the word window in [from, to) whose fingerprint matches, nearest to near,
+// or length if there is none. Windows shorter than ANCHOR_WORDS at the end of text are not matched.
+size_t scan_anchor(const char *buffer, size_t length, size_t from, size_t to, size_t near,
+                   uint64_t fingerprint);
+size_t scan_anchor(const char *buffer, size_t length, size_t from, size_t to, size_t near,
+                   uint64_t fingerprint)
+{
+    size_t starts[ANCHOR_WORDS];
+    uint64_t hashes[ANCHOR_WORDS];
+    uint64_t window = 0;
+    uint64_t top_power = 1;
+    size_t offset = from;
+    size_t best = length;
+    size_t best_distance = (size_t)-1;
+    int count = 0;
+    int i;
+
+    for (i = 1; i < ANCHOR_WORDS; i++) top_power *= ANCHOR_BASE;
+
+    // start at a word boundary
+    if (offset > 0 && offset < length && !isspace((unsigned char)buffer[offset - 1])) {
+        while (offset < length && !isspace((unsigned char)buffer[offset])) offset++;
+    }
+
+    for (;;) {
+        uint64_t word_hash;
+        size_t start = skip_to_word(buffer, length, offset);
+        int slot = count % ANCHOR_WORDS;
+
+        if (start >= length) break;
+
+        // drop the oldest word and add this one
+        if (count >= ANCHOR_WORDS) window -= hashes[slot] * top_power;
+
+        offset = next_anchor_word(buffer, length, start, &word_hash);
+        starts[slot] = start;
+        hashes[slot] = word_hash;
+        window = window * ANCHOR_BASE + word_hash;
+        count++;
+
+        if (count >= ANCHOR_WORDS) {
+            size_t window_start = starts[count % ANCHOR_WORDS];
+            size_t distance = window_start > near ? window_start - near : near - window_start;
+
+            if (window_start >= to) break;
+
+            if (window == fingerprint && distance < best_distance) {
+                best = window_start;
+                best_distance = distance;
             }
+        }
+    }
 
-        } else if (filter_html && c == '&') {
+    return best;
+}
+
+// Finds where the text with the given fingerprint moved to: first at near itself, then within
+// ANCHOR_NEAR bytes of it, then anywhere. If the text is gone, near is kept but moved to the
+// start of the next word so that playback does not resume in the middle of one.
+size_t find_anchor(const char *buffer, size_t length, size_t near, uint64_t fingerprint)
+{
+    size_t found_at;
+
+    if (near > length) near = length;
+
+    if (anchor_fingerprint(buffer, length, near) == fingerprint) return near;
+
+    found_at = scan_anchor(buffer, length, near > ANCHOR_NEAR ? near - ANCHOR_NEAR : 0,
+                           near + ANCHOR_NEAR, near, fingerprint);
+
+    if (found_at == length) found_at = scan_anchor(buffer, length, 0, length, near, fingerprint);
+
+    if (found_at == length) {
+        found_at = near;
+        if (found_at > 0 && !isspace((unsigned char)buffer[found_at - 1])) {
+            while (found_at < length && !isspace((unsigned char)buffer[found_at])) found_at++;
+        }
+    }
+
+    return found_at;
+}
+
+// The next token of text from *position, as the read stage splits them: at white space, or
+// where its UTF-8 in charset would be longer than LINE_SIZE - 1 bytes. Text ends at length or
+// at a 0 byte. *start is set to where the token begins and *position to just past it; false
+// if there are no more tokens.
+bool next_token(const char *text, size_t length, size_t *position, const CharsetBytes *charset,
+                char token[LINE_SIZE + sizeof(uint32_t)], size_t *start)
+{
+    size_t token_length = 0;
+    size_t k = *position;
+
+    while (k < length && text[k] != '\0' && isspace((unsigned char)text[k])) k++;
+    *start = k;
+
+    while (k < length && text[k] != '\0' && !isspace((unsigned char)text[k])) {
+        const CharsetBytes *utf8 = &charset[(unsigned char)text[k]];
+
+        if (token_length + utf8->length > LINE_SIZE - 1) break;
+        memcpy(token + token_length, utf8->utf8, sizeof(utf8->utf8));
+        token_length += utf8->length;
+        k++;
+    }
+
+    token[token_length] = '\0';
+    *position = k;
+
+    return k > *start;
+}
+
+// Appends a byte of the token, keeping a byte that could end a UTF-8 sequence apart from one
+// that could begin it, as they were apart before what was removed between them.
+void append_stripped(char *stripped, size_t *length, unsigned char c, bool *removed);
+void append_stripped(char *stripped, size_t *length, unsigned char c, bool *removed)
+{
+    if (c == STRIPPED_NAME || (*removed && (c & 0b11000000) == 0b10000000)) {
+        stripped[(*length)++] = STRIPPED_NAME;
+        stripped[(*length)++] = STRIPPED_NAME;
+    }
+
+    if (c != STRIPPED_NAME) stripped[(*length)++] = c;
+    *removed = false;
+}
+
+void append_stripped_name(char *stripped, size_t *length, const char *name, bool *removed);
+void append_stripped_name(char *stripped, size_t *length, const char *name, bool *removed)
+{
+    size_t name_length = strlen(name);
+
+    stripped[(*length)++] = STRIPPED_NAME;
+    memcpy(&stripped[*length], name, name_length);
+    *length += name_length;
+    stripped[(*length)++] = STRIPPED_NAME;
+    *removed = false;
+}
+
+// Removes a byte of a tag or entity. Once a token has had a Latin-1 byte, the original conversion
+// went on to convert removed bytes as Latin-1 too, so those that could be are kept, marked.
+void remove_stripped(char *stripped, size_t *length, unsigned char c, bool *removed);
+void remove_stripped(char *stripped, size_t *length, unsigned char c, bool *removed)
+{
+    if (c >= 0xA1) {
+        stripped[(*length)++] = STRIPPED_NAME;
+        stripped[(*length)++] = STRIPPED_REMOVED;
+        stripped[(*length)++] = c;
+        stripped[(*length)++] = STRIPPED_NAME;
+    }
+
+    *removed = true;
+}
+
+// Removes HTML tags and entities, which may be split between tokens, leaving the rest to be
+// converted by convert_token. Returns the length of stripped.
+size_t strip_token(const char *token, char stripped[STRIPPED_SIZE], bool filter_html, bool *excluding_tag,
+                   char entity[ENTITY_SIZE], char tag[TAG_SIZE])
+{
+    size_t length = 0;
+    bool removed = false;
+
+    for (size_t index = 0; token[index] != '\0'; index++) {
+        unsigned char c = token[index];
+
+        if (filter_html && c == '<') {
+            size_t len = strlen(tag);
+            *excluding_tag = true;
+            if (len < TAG_SIZE - 1) {
+                tag[len++] = c;
+                tag[len] = '\0';
+            }
+
+            remove_stripped(stripped, &length, c, &removed);
+
+        } else if (*excluding_tag && c == '>') {
+            size_t len = strlen(tag);
+            *excluding_tag = false;
+            if (len < TAG_SIZE - 1) {
+                tag[len++] = c;
+                tag[len] = '\0';
+            }
+
+            if (strcmp(tag, "</li>") == 0) {
+                append_stripped_name(stripped, &length, "|", &removed);
+
+            } else {
+                append_stripped_name(stripped, &length, " ", &removed);
+            }
+
+            tag[0] = '\0';
+
+        } else if (*excluding_tag) {
+            size_t len = strlen(tag);
+            if (len < TAG_SIZE - 1) {
+                tag[len++] = c;
+                tag[len] = '\0';
+            }
+
+            remove_stripped(stripped, &length, c, &removed);
+
+        } else if (filter_html && c == '&') {
             strcpy(entity, "&");
-            
+            remove_stripped(stripped, &length, c, &removed);
+
         } else if (filter_html && entity[0] != '\0') {
             size_t len = strlen(entity);
             if (len < ENTITY_SIZE - 1) {
                 entity[len++] = c;
                 entity[len] = '\0';
             }
-            
+
+            remove_stripped(stripped, &length, c, &removed);
+
             if (c == ';') {
+                // characters are converted as the entity would have been
                 if (strcmp(entity, "&amp;") == 0) {
-                    name = "andsign";
-                    
+                    append_stripped(stripped, &length, '&', &removed);
+
                 } else if (strcmp(entity, "&#x27;") == 0) {
                     // skip - ambiguous whether quote or apostrophe
                     //name = "apostrophe";
-                    
+
                 } else if (strcmp(entity, "&quot;") == 0) {
-                    name = word_length == 0 ? "quote" : "unquote";
-                    
+                    append_stripped(stripped, &length, '"', &removed);
+
                 } else if (strcmp(entity, "&middot;") == 0) {
-                    name = "dot";
-                    
+                    append_stripped_name(stripped, &length, "dot", &removed);
+
                 } else if (strcmp(entity, "&gt;") == 0) {
-                    name = "greaterthan";
-                    
+                    append_stripped(stripped, &length, '>', &removed);
+
                 } else if (strcmp(entity, "&lt;") == 0) {
-                    name = "lessthan";
-                    
+                    append_stripped(stripped, &length, '<', &removed);
+
                 } else if (strcmp(entity, "&copy;") == 0) {
-                    name = "copyright";
-                
+                    append_stripped_name(stripped, &length, "copyright", &removed);
+
                 } else {
 #ifdef DEBUG
                     fprintf(stderr, "entity: %s\n", entity);
 #endif
                 }
-                
+
                 entity[0] = '\0';
             }
 
+        } else {
+            append_stripped(stripped, &length, c, &removed);
+        }
+    }
+
+    stripped[length] = '\0';
+
+    return length;
+}
+
+// Converts a stripped token to words, passing each to emit. Stops early only if emit fails.
+MorseFeedError convert_token(const char *token, WordEmitter emit, void *context)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    char word[LINE_SIZE];
+    char marked_name[LINE_SIZE];
+    size_t word_length = 0;
+    size_t token_length = strlen(token);
+    size_t index = 0;
+    bool latin1 = false;
+    bool emitted = true;
+
+#ifdef DEBUG
+    fprintf(stderr, "strlen(%s) = %d\n", token, (int)token_length);
+#endif
+
+    while (index < token_length && word_length < LINE_SIZE - 1 && emitted) {
+        char *name = "";
+        unsigned char c = token[index];
+        uint32_t u = 0;                     // named or spelled below
+
+        if (c == STRIPPED_NAME && index + 3 < token_length && token[index + 1] == STRIPPED_REMOVED) {
+            // only converted once the token has had Latin-1
+            if (latin1) u = charset_fallback(token[index + 2]);
+            index += 3;
+
+        } else if (c == STRIPPED_NAME) {
+            size_t end = index + 1;
+
+            while (end < token_length && token[end] != STRIPPED_NAME) end++;
+
+            if (end - index - 1 < LINE_SIZE) {
+                memcpy(marked_name, &token[index + 1], end - index - 1);
+                marked_name[end - index - 1] = '\0';
+                name = marked_name;
+            }
+
+            index = end;
+
         } else if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
             c == '.' || c == ',' || c == '?' || c == '/') {
             word[word_length++] = toupper(c);
@@ -694,7 +1169,7 @@ MorseFeedError write_token(char *token, FILE *out_file, FILE *pipe_to_mbeep, FIL
             fprintf(stderr, "%X %X\n", c, (unsigned char)token[index + 1]);
 #endif
             
-            if ((index + 1 < strlen(token)) && ((token[index + 1] & 0b11000000) == 0b10000000)) {
+            if ((index + 1 < token_length) && ((token[index + 1] & 0b11000000) == 0b10000000)) {
                 // valid
 #ifdef DEBUG
                 fprintf(stderr, "(uint32_t)c & 0b00011111 %X\n", (uint32_t)c & 0b00011111);
@@ -702,61 +1177,50 @@ MorseFeedError write_token(char *token, FILE *out_file, FILE *pipe_to_mbeep, FIL
                 fprintf(stderr, "(token[index + 1] & 0b00111111) %X\n", (token[index + 1] & 0b00111111));
 #endif
                 
-                uint32_t u = (((uint32_t)c & 0b00011111) << 6) | (token[index + 1] & 0b00111111);
-                if (u <= 0x00FF) {
-                    c = (unsigned char)u;
-                    latin1 = true;
-                    
-                } else {
-                    switch (u) {
-                        case /* “ */ 0x201C:    name = "quote";     break;
-                        case /* ” */ 0x201D:    name = "unquote";   break;
-                            
-                        case /* © */ 0xC2A9:    name = "copyright"; break;
-                            
-                        // skip - ambiguous whether quote or apostrophe
-                        //case /* ʼ */ 0x02BC:    name = "/";         break;
-                        //case /* ‘ */ 0x2018:    name = "/";         break;
-                        //case /* ’ */ 0x2019:    name = "/";         break;
-                            
-                    }
-                }
+                u = (((uint32_t)c & 0b00011111) << 6) | (token[index + 1] & 0b00111111);
+                if (u <= 0x00FF) latin1 = true;
                 
                 index++;
                 
             } else {
+                u = charset_fallback(c);
                 latin1 = true;
             }
             
         } else if ((c & 0b11110000) == 0b11100000) {
             // 3 byte UTF-8
-            if ((index + 2 < strlen(token)) && ((token[index + 1] & 0b11000000) == 0b10000000) &&
+            if ((index + 2 < token_length) && ((token[index + 1] & 0b11000000) == 0b10000000) &&
                 ((token[index + 2] & 0b11000000) == 0b10000000)) {
                 // valid
+                u = (((uint32_t)c & 0b00001111) << 12) | ((token[index + 1] & 0b00111111) << 6) |
+                    (token[index + 2] & 0b00111111);
                 index += 2;
                 
             } else {
+                u = charset_fallback(c);
                 latin1 = true;
             }
             
         } else if ((c & 0b11111000) == 0b11110000) {
-            // 4 byte UTF-8
-            if ((index + 3 < strlen(token)) && ((token[index + 1] & 0b11000000) == 0b10000000) &&
+            // 4 byte UTF-8, none of which are named or spelled
+            if ((index + 3 < token_length) && ((token[index + 1] & 0b11000000) == 0b10000000) &&
                 ((token[index + 2] & 0b11000000) == 0b10000000) &&
                 ((token[index + 3] & 0b11000000) == 0b10000000)) {
                 // valid
                 index += 3;
                 
             } else {
+                u = charset_fallback(c);
                 latin1 = true;
             }
             
         } else {
+            u = charset_fallback(c);
             latin1 = true;
         }
         
-        if (latin1) {
-            switch (c) {
+        if (u != 0) {
+            switch (u) {
                 case /* ¡ */ 0xA1:  name = "exclamation";       break;
                 case /* ¢ */ 0xA2:  name = "cents";             break;
                 case /* £ */ 0xA3:  name = "pounds";            break;
@@ -780,12 +1244,30 @@ MorseFeedError write_token(char *token, FILE *out_file, FILE *pipe_to_mbeep, FIL
 
                 case /* » */ 0xBB:  name = "angleunquote";      break;
                 case /* ÷ */ 0xF7:  name = "dividedby";         break;
+
+                case /* – */ 0x2013:    name = "dash";          break;
+                case /* — */ 0x2014:    name = "dash";          break;
+                case /* “ */ 0x201C:    name = "quote";         break;
+                case /* ” */ 0x201D:    name = "unquote";       break;
+                case /* „ */ 0x201E:    name = "quote";         break;
+                case /* • */ 0x2022:    name = "bullet";        break;
+                case /* ‰ */ 0x2030:    name = "permille";      break;
+                case /* ‹ */ 0x2039:    name = "anglequote";    break;
+                case /* › */ 0x203A:    name = "angleunquote";  break;
+                case /* € */ 0x20AC:    name = "euro";          break;
+                case /* № */ 0x2116:    name = "number";        break;
+                case /* ™ */ 0x2122:    name = "trademark";     break;
+
+                // skip - ambiguous whether quote or apostrophe
+                //case /* ʼ */ 0x02BC:    name = "/";         break;
+                //case /* ‘ */ 0x2018:    name = "/";         break;
+                //case /* ’ */ 0x2019:    name = "/";         break;
             }
 
             if (strlen(name) == 0) {
                 char *cstr = NULL;
 
-                switch (c) {
+                switch (u) {
                     case /* ª */ 0xAA:  cstr = "a";                 break;
 
                     case /* ² */ 0xB2:  cstr = "2";                 break;
@@ -860,222 +1342,721 @@ MorseFeedError write_token(char *token, FILE *out_file, FILE *pipe_to_mbeep, FIL
                     case /* ý */ 0xFD:  cstr = "y";                 break;
                     case /* þ */ 0xFE:  cstr = "th";                break;
                     case /* ÿ */ 0xFF:  cstr = "y";                 break;
+
+                    case /* ƒ */ 0x0192:    cstr = "f";             break;
+                    case /* … */ 0x2026:    cstr = "...";           break;
+
+                    // Latin Extended-A, Greek and Cyrillic
+                    default:    cstr = (char *)charset_letters(u);  break;
+                }
+
+                if (cstr != NULL) {
+                    size_t cstr_len = strlen(cstr);
+                    if (word_length + cstr_len < LINE_SIZE) {
+                        memcpy(&word[word_length], cstr, cstr_len);
+                        word_length += cstr_len;
+
+                    } else {
+                        // no room, treat as name
+                        name = cstr;
+                    }
                 }
+            }
+        }
+        
+        if (strlen(name) > 0) {
+            // a word before a name is written even after an error, as it always has been
+            if (word_length > 0) {
+                word[word_length] = '\0';
+                emitted = emit(context, word, WORD_ALWAYS);
+                word_length = 0;
+            }
+
+            emitted = emitted && emit(context, name, WORD_IF_NO_ERROR);
+        }
+        
+        index++;
+    }
+    
+    if (index < token_length) error = emitted ? MF_PROGRAM_ERR : MF_EXIT;
+    
+    if (error == MF_NO_ERROR && word_length > 0) {
+        word[word_length] = '\0';
+        if (!emit(context, word, WORD_IF_NO_ERROR)) error = MF_EXIT;
+    }
+    
+    return error;
+}
+
+MorseFeedError write_word(char *word, FILE *out_file, FILE *pipe_to_mbeep, FILE *pipe_from_mbeep,
+                          int words_per_row, int *word_number, int word_count, bool use_key_control,
+                          PlaybackState *playback)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    FILE *output;
+    bool paused = false;
+    bool replay = false;
+
+    // mbeep may have been started again by 'b'
+    if (playback != NULL && playback->session != NULL) {
+        pipe_to_mbeep = playback->session->pipe_to_mbeep;
+        pipe_from_mbeep = playback->session->pipe_from_mbeep;
+    }
+
+    // stopped by a signal as if by 'q'
+    if (signal_received() != 0) {
+        error = MF_EXIT;
+        if (playback != NULL) playback->quit = true;
+    }
+
+    if (use_key_control && error == MF_NO_ERROR) {
+        do {
+            char c;
+            int count = (int)fread(&c, 1, 1, stdin);
+            if (count != 0) {
+                if (c == ' ') {
+                    paused = !paused;
+                    //if (paused) usleep(500000L);
+                    if (paused) {
+                        struct timespec ts = { 0, 500000000L };
+                        nanosleep(&ts, NULL);
+                    }
+
+                } else if (c == 'q' || c == 'Q') {
+                    error = MF_EXIT;
+                    if (playback != NULL) playback->quit = true;
+
+                } else if (c == 'n' || c == 'N') {
+                    error = MF_NEXT;
+
+                } else if ((c == 'b' || c == 'B') && playback != NULL && !playback->replaying) {
+                    replay = true;
+                    paused = false;
+                }
+            }
+            
+        } while (paused && error == MF_NO_ERROR);
+    }
+
+    if (replay && error == MF_NO_ERROR) {
+        error = playback_replay(playback, out_file, words_per_row, word_number, word_count);
+
+        if (playback->session != NULL) {
+            pipe_to_mbeep = playback->session->pipe_to_mbeep;
+            pipe_from_mbeep = playback->session->pipe_from_mbeep;
+        }
+    }
+
+    output = pipe_to_mbeep != NULL ? pipe_to_mbeep : out_file;
+    
+    if (error == MF_NO_ERROR) {
+#ifdef DEBUG
+        fprintf(stderr, "write word(%s)\n", word);
+#endif
+        
+        if (*word_number % words_per_row == 0) {
+            // no preceeding space
+            
+        } else {
+            if (fprintf(output, " ") < 0) error = MF_FILE_WRITE_ERROR;
+        }
+        
+        if (fprintf(output, "%s", word) < 0) error = MF_FILE_WRITE_ERROR;
+
+        if (playback != NULL) playback_add_word(playback, word);
+        if (playback != NULL && playback->tee != NULL && !playback->replaying) tee_word(playback->tee, word);
+        
+        if (*word_number % words_per_row == words_per_row - 1) {
+            if (fprintf(output, "\n") < 0) error = MF_FILE_WRITE_ERROR;
+            
+            if (pipe_to_mbeep != NULL) {
+                fflush(pipe_to_mbeep);
+            }
+
+            if (playback != NULL) playback_row_sent(playback);
+            
+            if (pipe_from_mbeep == NULL) {
+                if (playback != NULL) playback_row_echoed(playback);
+
+            } else if (playback == NULL) {
+                error = read_mbeep_echo(pipe_from_mbeep, NULL);
+
+            } else {
+                // keep rows queued in mbeep so there is no gap between them
+                while (error == MF_NO_ERROR && playback->row - playback->rows_echoed > MBEEP_ROWS_AHEAD) {
+                    error = read_mbeep_echo(pipe_from_mbeep, playback);
+                }
+            }
+        }
+        
+        if (strlen(word ) != 0 && strcmp(word, " ") != 0) (*word_number)++;
+
+        if (word_count != DEFAULT && *word_number >= word_count) error = MF_EXIT;
+
+        if (playback != NULL && playback->time_limit != DEFAULT &&
+            playback->sent_seconds >= playback->time_limit) {
+            error = MF_EXIT;
+        }
+    }
+    
+    return error;
+}
+
+double monotonic_seconds(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void init_playback(PlaybackState *playback, const MorseFeedParams *mfp)
+{
+    memset(playback, 0, sizeof(PlaybackState));
+
+    timing_init(&playback->timing, mfp->paris_wpm, mfp->codex_wpm, mfp->farnsworth_wpm,
+                mfp->word_space_wpm);
+    playback->show_progress = mfp->show_progress;
+    playback->time_limit = mfp->time_limit_minutes == DEFAULT ? DEFAULT : 60.0 * mfp->time_limit_minutes;
+
+    playback->row_start = monotonic_seconds();
+    playback->checkpoint_time = playback->row_start;
+}
+
+void free_playback(PlaybackState *playback)
+{
+    for (size_t k = 0; k < playback->history_count; k++) {
+        free(playback->history[(playback->history_first + k) % PLAYBACK_HISTORY_SIZE].word);
+    }
+
+    playback->history_count = 0;
+}
+
+void playback_set_source(PlaybackState *playback, const char *text, size_t start, size_t offset, size_t end)
+{
+    playback->source_text = text;
+    playback->source_start = start;
+    playback->source_offset = offset;
+    playback->source_end = end;
+    playback->source_seconds = 0;
+
+    if (playback->ring_count == 0) playback->heard_offset = offset;
+}
+
+void playback_pop_word(PlaybackState *playback);
+void playback_pop_word(PlaybackState *playback)
+{
+    PlaybackWord *entry = &playback->ring[playback->ring_first];
+
+    playback->heard_seconds += entry->seconds;
+    playback->heard_offset = entry->token_done ? entry->end_offset : entry->resume_offset;
+
+    playback->ring_first = (playback->ring_first + 1) % PLAYBACK_RING_SIZE;
+    playback->ring_count--;
+}
+
+void playback_add_word(PlaybackState *playback, const char *word)
+{
+    double seconds = timing_word_seconds(&playback->timing, word);
+    PlaybackWord *entry;
+
+    if (seconds == 0) return;
+
+    if (playback->ring_count == PLAYBACK_RING_SIZE) {
+        // oldest word must have been heard by now
+        playback_pop_word(playback);
+    }
+
+    entry = &playback->ring[(playback->ring_first + playback->ring_count) % PLAYBACK_RING_SIZE];
+    strncpy(entry->word, word, PLAYBACK_WORD_SIZE - 1);
+    entry->word[PLAYBACK_WORD_SIZE - 1] = '\0';
+    entry->row = playback->row;
+    entry->seconds = seconds;
+    entry->resume_offset = playback->source_offset;
+    entry->end_offset = playback->source_offset;
+    entry->token_done = false;
+    playback->ring_count++;
+
+    playback->sent_seconds += seconds;
+    playback->source_seconds += seconds;
+
+    if (playback->session != NULL) {
+        HistoryWord *written;
+
+        if (playback->history_count == PLAYBACK_HISTORY_SIZE) {
+            free(playback->history[playback->history_first].word);
+            playback->history_first = (playback->history_first + 1) % PLAYBACK_HISTORY_SIZE;
+            playback->history_count--;
+        }
+
+        written = &playback->history[(playback->history_first + playback->history_count) % PLAYBACK_HISTORY_SIZE];
+        written->word = malloc(strlen(word) + 1);
+
+        if (written->word != NULL) {
+            strcpy(written->word, word);
+            written->resume_offset = playback->source_offset;
+            written->end_offset = playback->source_offset;
+            written->token_done = false;
+            playback->history_count++;
+        }
+    }
+}
+
+// Called after all words of the token at source_offset have been written.
+void playback_token_done(PlaybackState *playback, size_t end_offset)
+{
+    PlaybackWord *last = NULL;
+
+    if (playback->ring_count > 0) {
+        last = &playback->ring[(playback->ring_first + playback->ring_count - 1) % PLAYBACK_RING_SIZE];
+    }
+
+    if (last != NULL && !last->token_done && last->resume_offset == playback->source_offset) {
+        last->end_offset = end_offset;
+        last->token_done = true;
+
+    } else if (playback->heard_offset == playback->source_offset) {
+        // every word of the token has been heard already, or it had none
+        playback->heard_offset = end_offset;
+    }
+
+    if (playback->history_count > 0) {
+        HistoryWord *written = &playback->history[(playback->history_first + playback->history_count - 1) %
+                                                  PLAYBACK_HISTORY_SIZE];
+
+        if (!written->token_done && written->resume_offset == playback->source_offset) {
+            written->end_offset = end_offset;
+            written->token_done = true;
+        }
+    }
+
+    playback->source_offset = end_offset;
+}
+
+// After 'b', mbeep is started again so that the rows queued in it are not heard, and the words
+// not yet heard are written again from the history, with the last row heard or
+// PLAYBACK_REPLAY_WORDS before them. Nothing is read or converted again. With a WAV file, which
+// starting mbeep again would overwrite, the words are only written again after those queued.
+MorseFeedError playback_replay(PlaybackState *playback, FILE *out_file, int words_per_row, int *word_number,
+                               int word_count)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    MbeepSession *session = playback->session;
+    HistoryWord replayed[PLAYBACK_HISTORY_SIZE];
+    size_t count = playback->ring_count + (words_per_row > PLAYBACK_REPLAY_WORDS ? words_per_row : PLAYBACK_REPLAY_WORDS);
+    size_t source_offset = playback->source_offset;
+    size_t k;
+
+    if (count > playback->history_count) count = playback->history_count;
+
+    if (session != NULL && session->wav_file_name == NULL) {
+        error = restart_fork_mbeep(session);
+
+        // rows queued in the mbeep stopped were not heard
+        while (playback->ring_count > 0) {
+            PlaybackWord *entry = &playback->ring[(playback->ring_first + playback->ring_count - 1) %
+                                                  PLAYBACK_RING_SIZE];
+
+            playback->sent_seconds -= entry->seconds;
+            playback->source_seconds -= entry->seconds;
+            playback->ring_count--;
+        }
+
+        playback->row = playback->rows_echoed;
+        playback->row_start = monotonic_seconds();
+        *word_number -= *word_number % words_per_row;
+    }
+
+    // taken out, as writing them again adds them again
+    for (k = 0; k < count; k++) {
+        replayed[k] = playback->history[(playback->history_first + playback->history_count - count + k) %
+                                        PLAYBACK_HISTORY_SIZE];
+    }
+    playback->history_count -= count;
+
+    playback->replaying = true;
+
+    for (k = 0; k < count; k++) {
+        if (error == MF_NO_ERROR) {
+            playback->source_offset = replayed[k].resume_offset;
+            error = write_word(replayed[k].word, out_file, NULL, NULL, words_per_row, word_number, word_count,
+                               session != NULL && session->key_control, playback);
+            if (error == MF_NO_ERROR && replayed[k].token_done) playback_token_done(playback, replayed[k].end_offset);
+        }
+
+        free(replayed[k].word);
+    }
+
+    playback->replaying = false;
+    playback->source_offset = source_offset;
+
+    return error;
+}
+
+void playback_row_sent(PlaybackState *playback)
+{
+    if (playback->rows_echoed == playback->row) {
+        // nothing ahead of this row, so it starts sounding now
+        playback->row_start = monotonic_seconds();
+    }
+
+    playback->row++;
+}
+
+// mbeep echoes a row after sending it
+void playback_row_echoed(PlaybackState *playback)
+{
+    while (playback->ring_count > 0 && playback->ring[playback->ring_first].row <= playback->rows_echoed) {
+        playback_pop_word(playback);
+    }
+
+    playback->rows_echoed++;
+    playback->row_start = monotonic_seconds();
+
+    if (playback->journal != NULL) playback_checkpoint(playback);
+
+    if (playback->show_progress) print_progress(playback);
+}
+
+#define CHECKPOINT_ROWS 8
+#define CHECKPOINT_MIN_SECONDS 1.0
+#define CHECKPOINT_MAX_SECONDS 10.0
+
+// Appends the heard position to the journal every few rows or seconds, so that it survives
+// signals and crashes; the state file itself is only rewritten at exit.
+void playback_checkpoint(PlaybackState *playback)
+{
+    double now = playback->row_start;
+    double since = now - playback->checkpoint_time;
+    size_t position = playback->heard_offset;
+
+    if (playback->source_end > 0 && position >= playback->source_end) position = 0;
+
+    if (position != playback->checkpoint_offset &&
+        ((playback->rows_echoed - playback->checkpoint_row >= CHECKPOINT_ROWS && since >= CHECKPOINT_MIN_SECONDS) ||
+         since >= CHECKPOINT_MAX_SECONDS)) {
+        uint64_t fingerprint = 0;
+        StringVector row;
+
+        if (position > 0 && playback->source_text != NULL) {
+            fingerprint = anchor_fingerprint(playback->source_text, playback->source_end, position);
+        }
+
+        row = position_row(playback->journal_label, position, fingerprint);
+
+        if (row.p != NULL && journal_append(playback->journal, &row)) {
+            playback->checkpoint_row = playback->rows_echoed;
+            playback->checkpoint_time = now;
+            playback->checkpoint_offset = position;
+        }
+
+        string_vector_free(&row);
+    }
+}
+
+MorseFeedError read_mbeep_echo(FILE *pipe_from_mbeep, PlaybackState *playback)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    char echo_str[LINE_SIZE];
+
+    char *got = fgets(echo_str, LINE_SIZE, pipe_from_mbeep);
+#ifdef DEBUG
+    if (got != NULL) {
+        fprintf(stderr, "echoed '%s'", got);
+    }
+#endif
+    if (got == NULL) error = MF_PIPE_ERROR;
+
+    // interrupted, or mbeep stopped by the same signal
+    if (got == NULL && signal_received() != 0) {
+        error = MF_EXIT;
+        if (playback != NULL) playback->quit = true;
+    }
+
+    if (playback != NULL && error == MF_NO_ERROR) playback_row_echoed(playback);
+
+    return error;
+}
+
+const char *playback_sounding_word(const PlaybackState *playback, double now)
+{
+    const char *word = NULL;
+    double elapsed = now - playback->row_start;
+    size_t k;
+
+    for (k = 0; k < playback->ring_count && word == NULL; k++) {
+        const PlaybackWord *entry = &playback->ring[(playback->ring_first + k) % PLAYBACK_RING_SIZE];
+
+        if (elapsed < entry->seconds || k == playback->ring_count - 1) {
+            word = entry->word;
+
+        } else {
+            elapsed -= entry->seconds;
+        }
+    }
+
+    return word;
+}
+
+#define PROGRESS_INTERVAL 0.25
+
+void print_progress(PlaybackState *playback)
+{
+    double now = monotonic_seconds();
+    char heard[16];
+    char left[16];
+    const char *word;
 
-                if (cstr != NULL) {
-                    size_t cstr_len = strlen(cstr);
-                    if (word_length + cstr_len < LINE_SIZE) {
-                        memcpy(&word[word_length], cstr, cstr_len);
-                        word_length += cstr_len;
+    if (now - playback->last_progress < PROGRESS_INTERVAL) return;
+    playback->last_progress = now;
 
-                    } else {
-                        // no room, treat as name
-                        name = cstr;
-                    }
-                }
-            }
-        }
-        
-        if (strlen(name) > 0) {
-            if (word_length > 0) {
-                word[word_length] = '\0';
-                error = write_word(word, out_file, pipe_to_mbeep, pipe_from_mbeep, words_per_row,
-                                   word_number, word_count, use_key_control);
-                word_length = 0;
-            }
+    word = playback_sounding_word(playback, now);
+    format_duration(heard, sizeof(heard), playback->heard_seconds);
 
-            if (error == MF_NO_ERROR) {
-                error = write_word(name, out_file, pipe_to_mbeep, pipe_from_mbeep, words_per_row,
-                                   word_number, word_count, use_key_control);
-            }
-        }
-        
-        index++;
+    if (playback->source_end > playback->source_offset &&
+        playback->source_offset > playback->source_start) {
+        size_t done = playback->source_offset - playback->source_start;
+        size_t total = playback->source_end - playback->source_start;
+        double remaining = playback->source_seconds * (total - done) / done +
+            playback->sent_seconds - playback->heard_seconds;
+
+        format_duration(left, sizeof(left), remaining);
+        fprintf(stderr, "\r%5.1f%%  %s  ETA %s", 100.0 * done / total, heard, left);
+
+    } else {
+        fprintf(stderr, "\r%s", heard);
     }
-    
-    if (index < strlen(token)) error = MF_PROGRAM_ERR;
-    
-    if (error == MF_NO_ERROR && word_length > 0) {
-        word[word_length] = '\0';
-        error = write_word(word, out_file, pipe_to_mbeep, pipe_from_mbeep, words_per_row,
-                           word_number, word_count, use_key_control);
+
+    if (playback->time_limit != DEFAULT) {
+        format_duration(left, sizeof(left), playback->time_limit - playback->sent_seconds);
+        fprintf(stderr, "  limit %s", left);
     }
-    
-    return error;
+
+    fprintf(stderr, "  %-*s", PLAYBACK_WORD_SIZE, word == NULL ? "" : word);
 }
 
-MorseFeedError write_word(char *word, FILE *out_file, FILE *pipe_to_mbeep, FILE *pipe_from_mbeep,
-                          int words_per_row, int *word_number, int word_count, bool use_key_control)
+// Signals that stop a session are written to a pipe by the handler, and are noticed by whatever
+// is waiting: reads from mbeep are interrupted, and loops that poll can include the pipe.
+// Handlers are installed while any session or server needs them, and the previous ones put back
+// after the last is done. Ctrl-Z still suspends, with the terminal as it was before key control.
+// There is one terminal, so only one session at a time owns it for key control: the first to
+// ask, until it ends. Others started meanwhile play without reading keys, and only the owner
+// sets or clears the settings the suspend handler puts back.
+#define SIGNAL_COUNT 4
+
+static const int stop_signals[SIGNAL_COUNT] = { SIGINT, SIGHUP, SIGQUIT, SIGTERM };
+static struct sigaction previous_stop_actions[SIGNAL_COUNT];
+static struct sigaction previous_pipe_action;
+static struct sigaction previous_segv_action;
+static struct sigaction previous_suspend_action;
+static struct termios suspend_termios;              // put back while suspended, if key control is on
+static int suspend_flags;
+static volatile sig_atomic_t suspend_restores = 0;
+static MbeepSession *terminal_owner = NULL;         // with key control, guarded by signals_mutex
+static pthread_mutex_t signals_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int signals_users = 0;
+static int signal_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t received_signal = 0;
+
+void signal_to_pipe(int signum);
+void signal_to_pipe(int signum)
 {
-    MorseFeedError error = MF_NO_ERROR;
-    FILE *output = pipe_to_mbeep != NULL ? pipe_to_mbeep : out_file;
-    bool paused = false;
+    unsigned char byte = (unsigned char)signum;
+    int saved_errno = errno;
 
-    if (use_key_control) {
-        do {
-            char c;
-            int count = (int)fread(&c, 1, 1, stdin);
-            if (count != 0) {
-                if (c == ' ') {
-                    paused = !paused;
-                    //if (paused) usleep(500000L);
-                    if (paused) {
-                        struct timespec ts = { 0, 500000000L };
-                        nanosleep(&ts, NULL);
-                    }
+    // if the pipe is full, a signal is already waiting to be noticed
+    write(signal_pipe[1], &byte, 1);
+    errno = saved_errno;
+}
 
-                } else if (c == 'q' || c == 'Q') {
-                    error = MF_EXIT;
+void suspend_handler(int signum);
+void suspend_handler(int signum)
+{
+    struct termios raw;
+    int raw_flags = 0;
+    bool restore = suspend_restores && tcgetattr(STDIN_FILENO, &raw) == 0;
+    sigset_t suspending;
+    int saved_errno = errno;
+
+    if (restore) {
+        raw_flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+        tcsetattr(STDIN_FILENO, TCSANOW, &suspend_termios);
+        fcntl(STDIN_FILENO, F_SETFL, suspend_flags);
+    }
 
-                } else if (c == 'n' || c == 'N') {
-                    error = MF_NEXT;
-                }
-            }
-            
-        } while (paused && error == MF_NO_ERROR);
+    // stopped here by the default action, until continued
+    signal(signum, SIG_DFL);
+    sigemptyset(&suspending);
+    sigaddset(&suspending, signum);
+    sigprocmask(SIG_UNBLOCK, &suspending, NULL);
+    raise(signum);
+    signal(signum, suspend_handler);
+
+    if (restore) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+        fcntl(STDIN_FILENO, F_SETFL, raw_flags);
     }
-    
-    if (error == MF_NO_ERROR) {
-#ifdef DEBUG
-        fprintf(stderr, "write word(%s)\n", word);
-#endif
-        
-        if (*word_number % words_per_row == 0) {
-            // no preceeding space
-            
+
+    errno = saved_errno;
+}
+
+void crash_handler(int signum);
+void crash_handler(int signum)
+{
+    // see 'man backtrace'
+    void* callstack[128];
+    int i, frames = backtrace(callstack, 128);
+    char** strs = backtrace_symbols(callstack, frames);
+
+    write(STDERR_FILENO, " signal_handler(SIGSEGV)\nStack:\n", strlen(" signal_handler(SIGSEGV)\nStack:\n"));
+    for (i = 0; strs != NULL && i < frames; ++i) {
+        write(STDERR_FILENO, strs[i], strlen(strs[i]));
+        write(STDERR_FILENO, "\n", 1);
+    }
+
+    signal(signum, SIG_DFL);
+    raise(signum);
+}
+
+MorseFeedError signals_open(void)
+{
+    MorseFeedError error = MF_NO_ERROR;
+
+    pthread_mutex_lock(&signals_mutex);
+
+    if (signals_users == 0) {
+        if (pipe(signal_pipe) != 0) {
+            error = MF_PIPE_ERROR;
+
         } else {
-            if (fprintf(output, " ") < 0) error = MF_FILE_WRITE_ERROR;
-        }
-        
-        if (fprintf(output, "%s", word) < 0) error = MF_FILE_WRITE_ERROR;
-        
-        if (*word_number % words_per_row == words_per_row - 1) {
-            if (fprintf(output, "\n") < 0) error = MF_FILE_WRITE_ERROR;
-            
-            if (pipe_to_mbeep != NULL) {
-                fflush(pipe_to_mbeep);
+            struct sigaction action;
+
+            for (int k = 0; k < 2; k++) {
+                fcntl(signal_pipe[k], F_SETFL, fcntl(signal_pipe[k], F_GETFL, 0) | O_NONBLOCK);
+                fcntl(signal_pipe[k], F_SETFD, FD_CLOEXEC);
             }
-            
-            if (pipe_from_mbeep != NULL) {
-                char echo_str[LINE_SIZE];
-                
-                char *got = fgets(echo_str, LINE_SIZE, pipe_from_mbeep);
-#ifdef DEBUG
-                if (got != NULL) {
-                    fprintf(stderr, "echoed '%s'", got);
-                }
-#endif
-                if (got == NULL) error = MF_PIPE_ERROR;
+
+            received_signal = 0;
+            memset(&action, 0, sizeof(action));
+            sigemptyset(&action.sa_mask);
+
+            // no SA_RESTART, so that a blocking read returns
+            action.sa_handler = signal_to_pipe;
+            for (int k = 0; k < SIGNAL_COUNT; k++) {
+                sigaction(stop_signals[k], &action, &previous_stop_actions[k]);
             }
-        }
-        
-        if (strlen(word ) != 0 && strcmp(word, " ") != 0) (*word_number)++;
 
-        if (word_count != DEFAULT && *word_number >= word_count) error = MF_EXIT;
+            // a write to an mbeep that has gone fails instead
+            action.sa_handler = SIG_IGN;
+            sigaction(SIGPIPE, &action, &previous_pipe_action);
+
+            action.sa_handler = crash_handler;
+            sigaction(SIGSEGV, &action, &previous_segv_action);
+
+            // reads from mbeep go on once continued
+            action.sa_handler = suspend_handler;
+            action.sa_flags = SA_RESTART;
+            sigaction(SIGTSTP, &action, &previous_suspend_action);
+        }
     }
-    
+
+    if (error == MF_NO_ERROR) signals_users++;
+
+    pthread_mutex_unlock(&signals_mutex);
+
     return error;
 }
 
-struct termios previous_termios;
-int flags;
-
-void signal_handler(int signum)
+void signals_close(void)
 {
-    char *message = "signal_handler(<unknown>)\n";
-    switch (signum) {
-        case SIGINT:    message = " signal_handler(SIGINT)\n";    break;
-        case SIGHUP:    message = " signal_handler(SIGHUP)\n";    break;
-        case SIGQUIT:   message = " signal_handler(SIGQUIT)\n";   break;
-        case SIGTERM:   message = " signal_handler(SIGTERM)\n";   break;
-        case SIGSEGV:   message = " signal_handler(SIGSEGV)\n";   break;
-        case SIGPIPE:   message = " signal_handler(SIGPIPE)\n";   break;
-        case SIGCHLD:   message = "";                             break;
-        case SIGTSTP:   message = " signal_handler(SIGTSTP)\n";   break;
-    }
-    
-    write(STDERR_FILENO, message, strlen(message));
-    tcsetattr(STDIN_FILENO, TCSANOW, &previous_termios);
-    fcntl(STDIN_FILENO, F_SETFL, flags);
-
-    if (signum == SIGSEGV) {
-        // see 'man backtrace'
-        void* callstack[128];
-        int i, frames = backtrace(callstack, 128);
-        char** strs = backtrace_symbols(callstack, frames);
-
-        write(STDERR_FILENO, "Stack:\n", strlen("Stack:\n"));
-        for (i = 0; i < frames; ++i) {
-            write(STDERR_FILENO, strs[i], strlen(strs[i]));
-            write(STDERR_FILENO, "\n", 1);
-        }
-        free(strs);
+    pthread_mutex_lock(&signals_mutex);
+
+    if (signals_users > 0 && --signals_users == 0) {
+        for (int k = 0; k < SIGNAL_COUNT; k++) sigaction(stop_signals[k], &previous_stop_actions[k], NULL);
+        sigaction(SIGPIPE, &previous_pipe_action, NULL);
+        sigaction(SIGSEGV, &previous_segv_action, NULL);
+        sigaction(SIGTSTP, &previous_suspend_action, NULL);
+
+        close(signal_pipe[0]);
+        close(signal_pipe[1]);
+        signal_pipe[0] = -1;
+        signal_pipe[1] = -1;
+        received_signal = 0;
     }
-    
-    if (signum != SIGCHLD) _exit(EXIT_FAILURE);
+
+    pthread_mutex_unlock(&signals_mutex);
 }
 
-// #define TWO_WAY_POPEN
+// For poll; readable once a signal has been received.
+int signals_fd(void)
+{
+    return signal_pipe[0];
+}
 
-void init_fork_mbeep(bool use_key_control)
+// Returns the last signal received since signals_open, or 0. Once received, a signal stays
+// received, so every session waiting on it sees it.
+int signal_received(void)
 {
-    struct termios raw;
+    unsigned char byte;
 
-    tcgetattr(STDIN_FILENO, &previous_termios);
-    flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-
-    {
-        struct sigaction sa;
-        sa.sa_handler = signal_handler;
-        sigaction(SIGINT, &sa, NULL);
-        sigaction(SIGHUP, &sa, NULL);
-        sigaction(SIGQUIT, &sa, NULL);
-        sigaction(SIGTERM, &sa, NULL);
-        sigaction(SIGSEGV, &sa, NULL);
-        sigaction(SIGPIPE, &sa, NULL);
-        sigaction(SIGCHLD, &sa, NULL);
-        sigaction(SIGTSTP, &sa, NULL);
-    }
-
-    if (use_key_control) {
-        tcgetattr(STDIN_FILENO, &raw);
-        raw.c_lflag &= ~(ECHO | ICANON);
-        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    while (signal_pipe[0] >= 0 && read(signal_pipe[0], &byte, 1) == 1) received_signal = byte;
 
-        fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
-    }
+    return received_signal;
+}
+
+void init_mbeep_session(MbeepSession *session)
+{
+    session->pipe_to_mbeep = NULL;
+    session->pipe_from_mbeep = NULL;
+    session->pid = -1;
+    session->key_control = false;
+    session->previous_flags = 0;
+    session->signals = false;
+    session->wav_file_name = NULL;
 }
 
-MorseFeedError begin_fork_mbeep(FILE **pipe_to_mbeep, FILE **pipe_from_mbeep, pid_t *pid,
+// #define TWO_WAY_POPEN
+
+MorseFeedError begin_fork_mbeep(MbeepSession *session,
                                 double freq, double paris_wpm, double codex_wpm, double farnsworth_wpm,
                                 double word_space_wpm,
                                 bool print_fcc_wpm, const char *wav_file_name, bool use_key_control)
 {
-    MorseFeedError error = MF_NO_ERROR;
-    struct termios raw;
-
-    tcgetattr(STDIN_FILENO, &previous_termios);
-    flags = fcntl(STDIN_FILENO, F_GETFL, 0);
-
-    {
-        struct sigaction sa;
-        sa.sa_handler = signal_handler;
-        sigaction(SIGINT, &sa, NULL);
-        sigaction(SIGHUP, &sa, NULL);
-        sigaction(SIGQUIT, &sa, NULL);
-        sigaction(SIGTERM, &sa, NULL);
-        sigaction(SIGSEGV, &sa, NULL);
-        sigaction(SIGPIPE, &sa, NULL);
-        sigaction(SIGCHLD, &sa, NULL);
-        sigaction(SIGTSTP, &sa, NULL);
-    }
-
-    if (use_key_control) {
-        tcgetattr(STDIN_FILENO, &raw);
-        raw.c_lflag &= ~(ECHO | ICANON);
-        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    MorseFeedError error = signals_open();
+    FILE **pipe_to_mbeep = &session->pipe_to_mbeep;
+    FILE **pipe_from_mbeep = &session->pipe_from_mbeep;
+    pid_t *pid = &session->pid;
+
+    session->signals = error == MF_NO_ERROR;
+    session->freq = freq;
+    session->paris_wpm = paris_wpm;
+    session->codex_wpm = codex_wpm;
+    session->farnsworth_wpm = farnsworth_wpm;
+    session->word_space_wpm = word_space_wpm;
+    session->print_fcc_wpm = print_fcc_wpm;
+    session->wav_file_name = wav_file_name;
+
+    if (error == MF_NO_ERROR && use_key_control) {
+        pthread_mutex_lock(&signals_mutex);
+
+        if (terminal_owner == NULL && tcgetattr(STDIN_FILENO, &session->previous_termios) == 0) {
+            struct termios raw = session->previous_termios;
+
+            raw.c_lflag &= ~(ECHO | ICANON);
+            tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+            session->previous_flags = fcntl(STDIN_FILENO, F_GETFL, 0);
+            fcntl(STDIN_FILENO, F_SETFL, session->previous_flags | O_NONBLOCK);
+            session->key_control = true;
+
+            terminal_owner = session;
+            suspend_termios = session->previous_termios;
+            suspend_flags = session->previous_flags;
+            suspend_restores = 1;
+        }
 
-        fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+        pthread_mutex_unlock(&signals_mutex);
     }
 
 #define MAX_COMMAND 256
@@ -1139,6 +2120,12 @@ MorseFeedError begin_fork_mbeep(FILE **pipe_to_mbeep, FILE **pipe_from_mbeep, pi
     if (error == MF_NO_ERROR && pipe(from_parent_pipes)) error = MF_PIPE_ERROR;
     if (error == MF_NO_ERROR && pipe(to_parent_pipes)) error = MF_PIPE_ERROR;
 
+    // another mbeep started after must not keep this one's pipes open
+    if (error == MF_NO_ERROR) {
+        fcntl(from_parent_pipes[1], F_SETFD, FD_CLOEXEC);
+        fcntl(to_parent_pipes[0], F_SETFD, FD_CLOEXEC);
+    }
+
     *pid = -1;
     if (error == MF_NO_ERROR) {
         *pid = fork();
@@ -1208,6 +2195,9 @@ MorseFeedError begin_fork_mbeep(FILE **pipe_to_mbeep, FILE **pipe_from_mbeep, pi
             mbeep_args[arg_count++] = NULL;
 
             if (error == MF_NO_ERROR) {
+                // an ignored signal would stay ignored in mbeep
+                signal(SIGPIPE, SIG_DFL);
+
                 dup2(from_parent_pipes[0], STDIN_FILENO);
                 dup2(to_parent_pipes[1], STDOUT_FILENO);
                 close(from_parent_pipes[1]);
@@ -1240,21 +2230,67 @@ MorseFeedError begin_fork_mbeep(FILE **pipe_to_mbeep, FILE **pipe_from_mbeep, pi
     return error;
 }
 
-MorseFeedError end_fork_mbeep(FILE *pipe_to_mbeep, FILE *pipe_from_mbeep, pid_t pid)
+MorseFeedError end_fork_mbeep(MbeepSession *session, bool stop_now)
 {
     MorseFeedError error = MF_NO_ERROR;
 
-    tcsetattr(STDIN_FILENO, TCSANOW, &previous_termios);
-    fcntl(STDIN_FILENO, F_SETFL, flags);
+    if (session->key_control) {
+        pthread_mutex_lock(&signals_mutex);
+
+        if (terminal_owner == session) {
+            suspend_restores = 0;
+            terminal_owner = NULL;
+            tcsetattr(STDIN_FILENO, TCSANOW, &session->previous_termios);
+            fcntl(STDIN_FILENO, F_SETFL, session->previous_flags);
+        }
+
+        pthread_mutex_unlock(&signals_mutex);
+        session->key_control = false;
+    }
 
 #ifdef TWO_WAY_POPEN
-    if (pipe_to_mbeep != NULL) pclose(pipe_to_mbeep);
+    if (session->pipe_to_mbeep != NULL) pclose(session->pipe_to_mbeep);
 #else
-    if (pipe_to_mbeep != NULL) fclose(pipe_to_mbeep);
-    if (pipe_from_mbeep != NULL) fclose(pipe_from_mbeep);
+    // close first, so flushing can't raise SIGPIPE
+    if (session->pipe_to_mbeep != NULL) fclose(session->pipe_to_mbeep);
+    if (stop_now && session->pid > 0) kill(session->pid, SIGTERM);
+    if (session->pipe_from_mbeep != NULL) fclose(session->pipe_from_mbeep);
 #endif
 
-    if (pid > 0) wait(NULL);    //kill(pid, SIGTERM);
+    if (session->pid > 0) waitpid(session->pid, NULL, 0);
+
+    if (session->signals) signals_close();
+
+    init_mbeep_session(session);
+
+    return error;
+}
+
+// Stops mbeep at once and starts it again with the same options, keeping the terminal and signal
+// settings made for the first.
+MorseFeedError restart_fork_mbeep(MbeepSession *session)
+{
+    MorseFeedError error;
+    MbeepSession previous = *session;
+
+    if (session->pid > 0) kill(session->pid, SIGTERM);
+    if (session->pipe_to_mbeep != NULL) fclose(session->pipe_to_mbeep);
+    if (session->pipe_from_mbeep != NULL) fclose(session->pipe_from_mbeep);
+    if (session->pid > 0) waitpid(session->pid, NULL, 0);
+
+    session->pipe_to_mbeep = NULL;
+    session->pipe_from_mbeep = NULL;
+    session->pid = -1;
+
+    error = begin_fork_mbeep(session, previous.freq, previous.paris_wpm, previous.codex_wpm,
+                             previous.farnsworth_wpm, previous.word_space_wpm, previous.print_fcc_wpm,
+                             previous.wav_file_name, false);
+
+    if (session->signals) signals_close();
+    session->signals = previous.signals;
+    session->key_control = previous.key_control;
+    session->previous_termios = previous.previous_termios;
+    session->previous_flags = previous.previous_flags;
 
     return error;
 }
@@ -1273,112 +2309,16 @@ size_t find_string(const char *string, const char *buffer, size_t buffer_length,
     return found_at;
 }
 
-void extract_urls(const char *base_url, const char *str, size_t start_index, size_t end_index,
-                  StringVector *urls, StringVector *titles)
-{
-#define BEGIN_URL "href=\""
-#define END_URL "\""
-#define BEGIN_TITLE ">"
-#define END_TITLE "</a>"
-#define URL_SIZE 1024
-#define TITLE_SIZE 128
-#define HTTP_PREFIX "http://"
-#define HTTPS_PREFIX "https://"
-
-    char url[URL_SIZE];
-    char title[TITLE_SIZE];
-    size_t found_at = start_index;
-
-    do {
-        size_t offset;
-        bool got_url = false;
-
-        // URL
-        found_at = find_string(BEGIN_URL, str, end_index, found_at);
-        offset = found_at + strlen(BEGIN_URL);
-        if (offset < end_index) {
-            found_at = find_string(END_URL, str, end_index, offset);
-        }
-
-        if (offset < found_at) {
-            size_t url_length = found_at - offset;
-            if (url_length < URL_SIZE && found_at < end_index) {
-                strncpy(url, &str[offset], url_length);
-                url[url_length] = '\0';
-
-                if (strncmp(url, HTTP_PREFIX, strlen(HTTP_PREFIX)) == 0) {
-                    string_vector_push(urls, url);
-                    got_url = true;
-
-                } else if (strncmp(url, HTTPS_PREFIX, strlen(HTTPS_PREFIX)) == 0) {
-                    string_vector_push(urls, url);
-                    got_url = true;
+#define STATE_VECTOR_SIZE 29
+#define STATE_VECTOR_MIN_SIZE 20     // rows saved before link filters
 
-                } else if (strlen(base_url) + strlen("/") + strlen(url) > URL_SIZE - 1) {
-                    // too big
-                    // (allowing for extra '/', which might be needed)
-
-                } else if (url[0] == '/') {
-                    char full_url[URL_SIZE];
-                    size_t slash_at;
-
-                    strcpy(full_url, base_url);
-                    slash_at = find_string("//", full_url, strlen(full_url), 0);
-                    if (slash_at + 2 < strlen(full_url)) {
-                        slash_at = find_string("/", full_url, strlen(full_url), slash_at + 2);
-                    }
-
-                    if (slash_at < strlen(full_url)) {
-                        full_url[slash_at] = '\0';
-                    }
-
-                    strcat(full_url, url);
-                    string_vector_push(urls, full_url);
-                    got_url = true;
-
-                } else {
-                    char full_url[URL_SIZE];
-
-                    strcpy(full_url, base_url);
-                    if (full_url[strlen(full_url) - 1] != '/') {
-                        strcat(full_url, "/");
-                    }
-
-                    strcat(full_url, url);
-                    string_vector_push(urls, full_url);
-                    got_url = true;
-                }
-            }
-        }
-
-        // title
-        if (got_url) {
-            bool got_title = false;
-
-            found_at = find_string(BEGIN_TITLE, str, end_index, found_at);
-            offset = found_at + strlen(BEGIN_TITLE);
-            if (offset < end_index) {
-                found_at = find_string(END_TITLE, str, end_index, offset);
-            }
-
-            if (offset < found_at && found_at < end_index) {
-                size_t title_length = found_at - offset;
-                if (title_length > TITLE_SIZE - 1) title_length = TITLE_SIZE - 1;
-
-                strncpy(title, &str[offset], title_length);
-                title[title_length] = '\0';
-                string_vector_push(titles, title);
-                got_title = true;
-            }
-
-            if (!got_title) string_vector_push(titles, "");
-        }
-
-    } while (found_at < end_index);
+// Cells added since STATE_VECTOR_MIN_SIZE are missing from rows saved by earlier versions
+const char *optional_cell(StringVector *row, size_t index);
+const char *optional_cell(StringVector *row, size_t index)
+{
+    return index < row->size ? string_vector_at(row, index) : NULL;
 }
 
-#define STATE_VECTOR_SIZE 20
-
 bool replace_with_copy_or_null(const char **str, StringVector *string_storage);
 bool replace_with_copy_or_null(const char **str, StringVector *string_storage)
 {
@@ -1404,76 +2344,96 @@ bool replace_with_copy_or_null(const char **str, StringVector *string_storage)
 
 MorseFeedError read_state(const char *label, MorseFeedParams *mfp, StringVector *string_storage)
 {
-    MorseFeedError error = MF_NO_ERROR;
-    StringArray array = read_string_array(mfp->state_path);
-    bool found = false;
+    StateStore store;
+    MorseFeedError error = state_open(&store, mfp->state_path, false);
+    StringVector *row = error == MF_NO_ERROR ? state_find(&store, "state", label) : NULL;
     
-    for (size_t k = 0; k < array.size && !found; k++) {
-        StringVector next;
-        if (vector_at(&array, k, &next) && next.size == STATE_VECTOR_SIZE &&
-            strcmp(string_vector_at(&next, 0), "state") == 0 &&
-            strcmp(string_vector_at(&next, 1), label) == 0) {
-            
-            bool mem_error = false;
-            
-            found = true;
-            
-            mfp->in_file_name = string_vector_at(&next, 2);
-            mem_error |= replace_with_copy_or_null(&mfp->in_file_name, string_storage);
-            
-            mfp->url = string_vector_at(&next, 3);
-            mem_error |= replace_with_copy_or_null(&mfp->url, string_storage);
-            
-            mfp->words_per_row = atoi(string_vector_at(&next, 4));
-            mfp->word_count = atoi(string_vector_at(&next, 5));
-            
-            mfp->fork_mbeep = atoi(string_vector_at(&next, 6)) != 0;
-            mfp->save_and_use_position = atoi(string_vector_at(&next, 7)) != 0;
-            mfp->follow_links = atoi(string_vector_at(&next, 8)) != 0;
-            
-            mfp->text_after = string_vector_at(&next, 9);
-            mem_error |= replace_with_copy_or_null(&mfp->text_after, string_storage);
-            
-            mfp->text_before = string_vector_at(&next, 10);
-            mem_error |= replace_with_copy_or_null(&mfp->text_before, string_storage);
-            
-            mfp->linked_text_after = string_vector_at(&next, 11);
-            mem_error |= replace_with_copy_or_null(&mfp->linked_text_after, string_storage);
-            
-            mfp->linked_text_before = string_vector_at(&next, 12);
-            mem_error |= replace_with_copy_or_null(&mfp->linked_text_before, string_storage);
-            
-            mfp->freq = atof(string_vector_at(&next, 13));
-            mfp->paris_wpm = atof(string_vector_at(&next, 14));
-            mfp->codex_wpm = atof(string_vector_at(&next, 15));
-            mfp->farnsworth_wpm = atof(string_vector_at(&next, 16));
-            mfp->word_space_wpm = atof(string_vector_at(&next, 17));
+    if (row != NULL && row->size >= STATE_VECTOR_MIN_SIZE) {
+        bool mem_error = false;
+        
+        mfp->in_file_name = string_vector_at(row, 2);
+        mem_error |= replace_with_copy_or_null(&mfp->in_file_name, string_storage);
+        
+        mfp->url = string_vector_at(row, 3);
+        mem_error |= replace_with_copy_or_null(&mfp->url, string_storage);
+        
+        mfp->words_per_row = atoi(string_vector_at(row, 4));
+        mfp->word_count = atoi(string_vector_at(row, 5));
+        
+        mfp->fork_mbeep = atoi(string_vector_at(row, 6)) != 0;
+        mfp->save_and_use_position = atoi(string_vector_at(row, 7)) != 0;
+        mfp->follow_links = atoi(string_vector_at(row, 8)) != 0;
+        
+        mfp->text_after = string_vector_at(row, 9);
+        mem_error |= replace_with_copy_or_null(&mfp->text_after, string_storage);
+        
+        mfp->text_before = string_vector_at(row, 10);
+        mem_error |= replace_with_copy_or_null(&mfp->text_before, string_storage);
+        
+        mfp->linked_text_after = string_vector_at(row, 11);
+        mem_error |= replace_with_copy_or_null(&mfp->linked_text_after, string_storage);
+        
+        mfp->linked_text_before = string_vector_at(row, 12);
+        mem_error |= replace_with_copy_or_null(&mfp->linked_text_before, string_storage);
+        
+        mfp->freq = atof(string_vector_at(row, 13));
+        mfp->paris_wpm = atof(string_vector_at(row, 14));
+        mfp->codex_wpm = atof(string_vector_at(row, 15));
+        mfp->farnsworth_wpm = atof(string_vector_at(row, 16));
+        mfp->word_space_wpm = atof(string_vector_at(row, 17));
 
-            mfp->print_fcc_wpm = atoi(string_vector_at(&next, 18)) != 0;
+        mfp->print_fcc_wpm = atoi(string_vector_at(row, 18)) != 0;
 
-            mfp->wav_file_name = string_vector_at(&next, 19);
-            mem_error |= replace_with_copy_or_null(&mfp->wav_file_name, string_storage);
-            
-            if (mem_error) error = MF_OUT_OF_MEMORY;
+        mfp->wav_file_name = string_vector_at(row, 19);
+        mem_error |= replace_with_copy_or_null(&mfp->wav_file_name, string_storage);
+
+        // link filters
+        mfp->include_links = optional_cell(row, 20);
+        mem_error |= replace_with_copy_or_null(&mfp->include_links, string_storage);
+
+        mfp->exclude_links = optional_cell(row, 21);
+        mem_error |= replace_with_copy_or_null(&mfp->exclude_links, string_storage);
+
+        // crawl
+        if (optional_cell(row, 22) != NULL) mfp->crawl_depth = atoi(optional_cell(row, 22));
+
+        mfp->section_text_after = optional_cell(row, 23);
+        mem_error |= replace_with_copy_or_null(&mfp->section_text_after, string_storage);
+
+        mfp->section_text_before = optional_cell(row, 24);
+        mem_error |= replace_with_copy_or_null(&mfp->section_text_before, string_storage);
+
+        if (optional_cell(row, 25) != NULL) mfp->max_megabytes = atof(optional_cell(row, 25));
+
+        if (optional_cell(row, 26) != NULL) mfp->strip_common = atoi(optional_cell(row, 26)) != 0;
+
+        if (optional_cell(row, 27) != NULL) mfp->cache_megabytes = atof(optional_cell(row, 27));
+
+        if (optional_cell(row, 28) != NULL) {
+            mfp->charset = charset_from_name(optional_cell(row, 28), strlen(optional_cell(row, 28)));
         }
-    }
+        
+        if (mem_error) error = MF_OUT_OF_MEMORY;
 
-    string_array_free(&array);
+    } else if (error == MF_NO_ERROR) {
+        error = MF_UNKNOWN_SAVED_STATE;
+    }
 
-    if (!found) error = MF_UNKNOWN_SAVED_STATE;
+    state_close(&store);
 
     return error;
 }
 
 MorseFeedError save_state(const char *label, const MorseFeedParams *mfp)
 {
-    MorseFeedError error = MF_NO_ERROR;
-    StringArray array = read_string_array(mfp->state_path);
+    StateStore store;
+    MorseFeedError error = state_open(&store, mfp->state_path, true);
     StringVector new_entry = string_vector_create(STATE_VECTOR_SIZE);
-    bool found = false;
-    size_t found_index = 0;
 
-    if (new_entry.p == NULL) {
+    if (error != MF_NO_ERROR) {
+        string_vector_free(&new_entry);
+
+    } else if (new_entry.p == NULL) {
         error = MF_OUT_OF_MEMORY;
         
     } else {
@@ -1518,6 +2478,25 @@ MorseFeedError save_state(const char *label, const MorseFeedParams *mfp)
 
         push_error |= !string_vector_push(&new_entry, mfp->wav_file_name == NULL ? "" : mfp->wav_file_name);
 
+        push_error |= !string_vector_push(&new_entry, mfp->include_links == NULL ? "" : mfp->include_links);
+        push_error |= !string_vector_push(&new_entry, mfp->exclude_links == NULL ? "" : mfp->exclude_links);
+
+        sprintf(str, "%d", mfp->crawl_depth);
+        push_error |= !string_vector_push(&new_entry, str);
+
+        push_error |= !string_vector_push(&new_entry, mfp->section_text_after == NULL ? "" : mfp->section_text_after);
+        push_error |= !string_vector_push(&new_entry, mfp->section_text_before == NULL ? "" : mfp->section_text_before);
+
+        sprintf(str, "%12.3f", mfp->max_megabytes);
+        push_error |= !string_vector_push(&new_entry, str);
+
+        push_error |= !string_vector_push(&new_entry, mfp->strip_common ? "1" : "0");
+
+        sprintf(str, "%12.3f", mfp->cache_megabytes);
+        push_error |= !string_vector_push(&new_entry, str);
+
+        push_error |= !string_vector_push(&new_entry, charset_name(mfp->charset));
+
         if (push_error) {
             string_vector_free(&new_entry);
             error = MF_OUT_OF_MEMORY;
@@ -1525,35 +2504,14 @@ MorseFeedError save_state(const char *label, const MorseFeedParams *mfp)
     }
     
     if (error == MF_NO_ERROR) {
-        for (size_t index = 0; index < array.size && !found; index++) {
-            StringVector next;
-            if (vector_at(&array, index, &next) && next.size == 17 &&
-                strcmp(string_vector_at(&next, 0), "state") == 0 &&
-                strcmp(string_vector_at(&next, 1), label) == 0) {
-                
-                found = true;
-                found_index = index;
-            }
-        }
-        
-        if (found) {
-            StringVector previous;
-            vector_replace_at(&array, found_index, &new_entry, &previous);
-            string_vector_free(&previous);
-            
-        } else {
-            if (!vector_push(&array, &new_entry)) {
-                string_vector_free(&new_entry);
-                error = MF_OUT_OF_MEMORY;
-            }
-        }
+        error = state_put(&store, &new_entry);
     }
 
     if (error == MF_NO_ERROR) {
-        write_string_array(mfp->state_path, &array);
+        error = state_commit(&store);
     }
     
-    string_array_free(&array);
+    state_close(&store);
 
     return error;
 }
@@ -1597,10 +2555,42 @@ bool same_state(MorseFeedParams *a, MorseFeedParams *b)
 
     same = same && a->print_fcc_wpm == b->print_fcc_wpm;
     same = same && same_or_nulls(a->wav_file_name, b->wav_file_name);
+    same = same && same_or_nulls(a->include_links, b->include_links);
+    same = same && same_or_nulls(a->exclude_links, b->exclude_links);
+    same = same && a->crawl_depth == b->crawl_depth;
+    same = same && a->max_megabytes == b->max_megabytes;
+    same = same && same_or_nulls(a->section_text_after, b->section_text_after);
+    same = same && same_or_nulls(a->section_text_before, b->section_text_before);
+    same = same && a->strip_common == b->strip_common;
+    same = same && a->cache_megabytes == b->cache_megabytes;
+    same = same && a->charset == b->charset;
 
     return same;
 }
 
+struct UrlTest {
+    const char *url;
+    bool fetched;
+};
+
+// Fetches the file URL of the test many times, on one of several threads at once.
+void *fetch_url_test(void *arg);
+void *fetch_url_test(void *arg)
+{
+    struct UrlTest *test = arg;
+    BufferStruct buffer;
+
+    test->fetched = true;
+
+    for (int k = 0; k < 20; k++) {
+        init_buffer(&buffer, 0);
+        test->fetched &= url_to_buffer(test->url, &buffer) == MF_NO_ERROR && buffer.used == 6 &&
+                         strcmp(buffer.p, "hello") == 0;
+        free_buffer(&buffer);
+    }
+
+    return NULL;
+}
 
 void morsefeed_tests(void)
 {
@@ -1616,25 +2606,64 @@ void morsefeed_tests(void)
 
     // read_saved_position write_saved_position
     size_t position = 999;
-    ok &= print_if_fail(read_saved_position("state.tmp", "file1", &position) == MF_NO_ERROR, "FAIL: read_saved_position (1)");
+    ok &= print_if_fail(read_saved_position("state.tmp", "file1", &position, NULL) == MF_NO_ERROR, "FAIL: read_saved_position (1)");
     ok &= print_if_fail(position == 0, "FAIL: read_saved_position (2)");
 
-    ok &= print_if_fail(write_saved_position("state.tmp", "file1", 11) == MF_NO_ERROR, "FAIL: write_saved_position (1)");
-    ok &= print_if_fail(write_saved_position("state.tmp", "file2", 22) == MF_NO_ERROR, "FAIL: write_saved_position (2)");
+    ok &= print_if_fail(write_saved_position("state.tmp", "file1", 11, 0) == MF_NO_ERROR, "FAIL: write_saved_position (1)");
+    ok &= print_if_fail(write_saved_position("state.tmp", "file2", 22, 0) == MF_NO_ERROR, "FAIL: write_saved_position (2)");
 
-    ok &= print_if_fail(read_saved_position("state.tmp", "file1", &position) == MF_NO_ERROR, "FAIL: read_saved_position (3)");
+    ok &= print_if_fail(read_saved_position("state.tmp", "file1", &position, NULL) == MF_NO_ERROR, "FAIL: read_saved_position (3)");
     ok &= print_if_fail(position == 11, "FAIL: read_saved_position (4)");
-    ok &= print_if_fail(read_saved_position("state.tmp", "file2", &position) == MF_NO_ERROR, "FAIL: read_saved_position (5)");
+    ok &= print_if_fail(read_saved_position("state.tmp", "file2", &position, NULL) == MF_NO_ERROR, "FAIL: read_saved_position (5)");
     ok &= print_if_fail(position == 22, "FAIL: read_saved_position (6)");
 
-    write_saved_position("state.tmp", "file1", 0);
-    write_saved_position("state.tmp", "file2", 200);
+    write_saved_position("state.tmp", "file1", 0, 0);
+    write_saved_position("state.tmp", "file2", 200, 0);
 
-    ok &= print_if_fail(read_saved_position("state.tmp", "file1", &position) == MF_NO_ERROR, "FAIL: read_saved_position (7)");
+    ok &= print_if_fail(read_saved_position("state.tmp", "file1", &position, NULL) == MF_NO_ERROR, "FAIL: read_saved_position (7)");
     ok &= print_if_fail(position == 0, "FAIL: read_saved_position (8)");
-    ok &= print_if_fail(read_saved_position("state.tmp", "file2", &position) == MF_NO_ERROR, "FAIL: read_saved_position (9)");
+    ok &= print_if_fail(read_saved_position("state.tmp", "file2", &position, NULL) == MF_NO_ERROR, "FAIL: read_saved_position (9)");
     ok &= print_if_fail(position == 200, "FAIL: read_saved_position (10)");
 
+    uint64_t fingerprint = 0;
+    write_saved_position("state.tmp", "file3", 33, 0x1234abcdULL);
+    ok &= print_if_fail(read_saved_position("state.tmp", "file3", &position, &fingerprint) == MF_NO_ERROR &&
+                        position == 33 && fingerprint == 0x1234abcdULL, "FAIL: read_saved_position (11)");
+    write_saved_position("state.tmp", "file3", 0, 0);
+
+    // state_open reuses rows read before until the state file is written
+    StateStore store1;
+    StateStore store2;
+    state_open(&store1, "state.tmp", false);
+    state_open(&store2, "state.tmp", false);
+    ok &= print_if_fail(store1.cache != NULL && store1.cache == store2.cache, "FAIL: state_open (1)");
+    ok &= print_if_fail(state_find(&store2, "position", "file2") != NULL, "FAIL: state_open (2)");
+    state_close(&store1);
+    state_close(&store2);
+
+    write_saved_position("state.tmp", "file2", 0, 0);
+    state_open(&store1, "state.tmp", false);
+    ok &= print_if_fail(state_find(&store1, "position", "file2") == NULL, "FAIL: state_open (3)");
+    state_close(&store1);
+
+    // anchor_fingerprint find_anchor
+    const char *before = "one two three four five six seven eight nine ten eleven twelve thirteen";
+    const char *after = "zero, and a new line\none  two three four five six seven\neight nine ten eleven twelve thirteen";
+    const char *reworded = "one two three four fiver six seven eight nine ten eleven twelve thirteen";
+    size_t five = strstr(before, "five") - before;
+    uint64_t anchor = anchor_fingerprint(before, strlen(before), five);
+
+    ok &= print_if_fail(anchor == anchor_fingerprint(before, strlen(before), five - 1), "FAIL: anchor_fingerprint (1)");
+    ok &= print_if_fail(anchor != anchor_fingerprint(before, strlen(before), 0), "FAIL: anchor_fingerprint (2)");
+    ok &= print_if_fail(find_anchor(before, strlen(before), five, anchor) == five, "FAIL: find_anchor (1)");
+    ok &= print_if_fail(find_anchor(after, strlen(after), five, anchor) == strstr(after, "five") - after,
+                        "FAIL: find_anchor (2)");
+    ok &= print_if_fail(find_anchor(after, strlen(after), 0, anchor) == strstr(after, "five") - after,
+                        "FAIL: find_anchor (3)");
+    ok &= print_if_fail(find_anchor(reworded, strlen(reworded), five + 2, anchor) == five + 5,
+                        "FAIL: find_anchor (4)");
+    ok &= print_if_fail(find_anchor(reworded, strlen(reworded), 1000, anchor) == strlen(reworded), "FAIL: find_anchor (5)");
+
     FILE *foo = fopen("state.tmp", "r");
     char txt[512];
     size_t fs = fread(txt, 1, 511, foo);
@@ -1648,6 +2677,8 @@ void morsefeed_tests(void)
 
     MorseFeedParams mfp2 = { "bar.txt", NULL, NULL, "https:://foo.com", "state.tmp",
         3, 4, true, false, true, "alpha", "bravo", "charlie", "delta", 16.0, 17.0, 18.0, 19.0, false, NULL };
+    mfp2.charset = CHARSET_KOI8_R;
+    mfp2.max_megabytes = 2.5;
 
     ok &= print_if_fail(save_state("one", &mfp1) == MF_NO_ERROR, "FAIL: save_state (1)");
     ok &= print_if_fail(save_state("two", &mfp2) == MF_NO_ERROR, "FAIL: save_state (2)");
@@ -1671,6 +2702,78 @@ void morsefeed_tests(void)
     ok &= print_if_fail(same_state(&mfp2, &mfp), "FAIL: read_state (8)");
 
     remove("state.tmp");
+    remove("state.tmp.lock");
+
+    // signals are noticed through the pipe, by every session, until the last one closes
+    ok &= print_if_fail(signals_open() == MF_NO_ERROR && signals_open() == MF_NO_ERROR, "FAIL: signals_open (1)");
+    ok &= print_if_fail(signal_received() == 0, "FAIL: signal_received (1)");
+    raise(SIGHUP);
+    ok &= print_if_fail(signal_received() == SIGHUP && signal_received() == SIGHUP, "FAIL: signal_received (2)");
+    signals_close();
+    ok &= print_if_fail(signals_fd() >= 0 && signal_received() == SIGHUP, "FAIL: signal_received (3)");
+    signals_close();
+    ok &= print_if_fail(signals_fd() < 0 && signal_received() == 0, "FAIL: signal_received (4)");
+
+    // each fetch takes a handle no other is using, so threads fetch at once
+    FILE *url_file = fopen("url.tmp", "w");
+    char *url_cwd = getcwd(NULL, 0);
+    char url[LINE_SIZE];
+    struct UrlTest url_tests[4];
+    pthread_t url_threads[4];
+
+    fputs("hello", url_file);
+    fclose(url_file);
+    snprintf(url, LINE_SIZE, "file://%s/url.tmp", url_cwd);
+
+    for (int k = 0; k < 4; k++) {
+        url_tests[k].url = url;
+        url_tests[k].fetched = false;
+        pthread_create(&url_threads[k], NULL, fetch_url_test, &url_tests[k]);
+    }
+
+    for (int k = 0; k < 4; k++) {
+        pthread_join(url_threads[k], NULL);
+        ok &= print_if_fail(url_tests[k].fetched, "FAIL: url_to_buffer (1)");
+    }
+
+    release_url_handle();
+    free(url_cwd);
+    remove("url.tmp");
+
+    // with a WAV file mbeep is not started again, and the words are written after those before
+    PlaybackState playback;
+    MbeepSession session;
+    char replay_output[128] = "";
+    FILE *replay_file = fmemopen(replay_output, sizeof(replay_output), "w");
+    char *words[] = { "A", "B", "C", "D", "E", "F" };
+    int word_number = 0;
+
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.paris_wpm = DEFAULT;
+    mfp.codex_wpm = DEFAULT;
+    mfp.farnsworth_wpm = DEFAULT;
+    mfp.word_space_wpm = DEFAULT;
+    init_playback(&playback, &mfp);
+    init_mbeep_session(&session);
+    session.wav_file_name = "replay.wav";
+    playback.session = &session;
+
+    for (int k = 0; k < 6; k++) {
+        playback_set_source(&playback, NULL, 0, k, 6);
+        write_word(words[k], replay_file, NULL, NULL, 3, &word_number, DEFAULT, false, &playback);
+        playback_token_done(&playback, k + 1);
+    }
+
+    ok &= print_if_fail(playback.history_count == 6 && playback.heard_offset == 6, "FAIL: playback_replay (1)");
+    ok &= print_if_fail(playback_replay(&playback, replay_file, 3, &word_number, DEFAULT) == MF_NO_ERROR,
+                        "FAIL: playback_replay (2)");
+    fputc('\0', replay_file);
+    fclose(replay_file);
+    ok &= print_if_fail(strcmp(replay_output, "A B C\nD E F\nB C D\nE F") == 0, "FAIL: playback_replay (3)");
+    ok &= print_if_fail(playback.history_count == 6 && word_number == 11 && playback.source_offset == 6 &&
+                        playback.history[(playback.history_first + 1) % PLAYBACK_HISTORY_SIZE].end_offset == 2,
+                        "FAIL: playback_replay (4)");
+    free_playback(&playback);
 
     printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
 
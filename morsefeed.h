@@ -29,9 +29,13 @@
 #define morsefeed_h
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <termios.h>
 
+#include "charset.h"
+#include "timing.h"
 #include "vector.h"
 
 #define DEFAULT -1
@@ -66,13 +70,135 @@ struct MorseFeedParams {
     double word_space_wpm;
     bool print_fcc_wpm;
     const char *wav_file_name;
+
+    // Playback
+    bool show_progress;
+    double time_limit_minutes;
+
+    // Link filters
+    const char *include_links;
+    const char *exclude_links;
+
+    // Crawl
+    int crawl_depth;
+    const char *section_text_after;
+    const char *section_text_before;
+    double max_megabytes;
+    bool strip_common;
+
+    // Pipeline
+    bool stage_stats;
+
+    // Cache
+    double cache_megabytes;
+    bool cache_stats;
+
+    // Seek
+    long start_word;
+    long start_offset;              // of the token in the text to start at, as --sample finds it
+    double start_percent;
+    int back_paragraphs;
+
+    // Charset
+    Charset charset;                // or CHARSET_UNKNOWN to detect it
+
+    // Tee
+    const char *tee_files;          // also written to; see tee.h
+    const char *tee_mbeeps;
 };
 typedef struct MorseFeedParams MorseFeedParams;
 
+#define PLAYBACK_RING_SIZE 256
+#define PLAYBACK_WORD_SIZE 32
+
+// Words written, kept with mbeep under key control so that 'b' can write them again. It writes
+// the words not yet heard and at least PLAYBACK_REPLAY_WORDS, or a row, before them.
+#define PLAYBACK_HISTORY_SIZE 256
+#define PLAYBACK_REPLAY_WORDS 5
+
+// Number of rows written to mbeep before waiting for the echo of the oldest one
+#define MBEEP_ROWS_AHEAD 1
+
+// A word that has been written, kept until its row has been echoed by mbeep.
+struct PlaybackWord {
+    char word[PLAYBACK_WORD_SIZE];      // truncated copy, for display only
+    int row;
+    double seconds;
+    size_t resume_offset;               // source offset of the token the word came from
+    size_t end_offset;                  // source offset after the token, if last word of token
+    bool token_done;
+};
+typedef struct PlaybackWord PlaybackWord;
+
+// A word that has been written, kept whole after it has been heard.
+struct HistoryWord {
+    char *word;
+    size_t resume_offset;
+    size_t end_offset;
+    bool token_done;
+};
+typedef struct HistoryWord HistoryWord;
+
+// Timing model of what has been sent, used for progress, ETA and time limit.
+struct PlaybackState {
+    MorseTiming timing;
+    bool show_progress;
+    double time_limit;                  // seconds, or DEFAULT
+    double sent_seconds;                // all words written so far
+    double heard_seconds;               // words in rows echoed by mbeep
+    double source_seconds;              // words written from the current text buffer
+    const char *source_text;            // current text buffer, or NULL if reading a stream
+    size_t source_start;                // range of the current text buffer; end is 0 if unknown
+    size_t source_end;
+    size_t source_offset;               // start of the token being converted
+    size_t heard_offset;                // resume here to hear nothing twice or miss anything
+    int row;                            // row now being written
+    int rows_echoed;
+    bool quit;                          // user typed 'q'
+    struct StateJournal *journal;       // checkpoints of heard_offset, or NULL
+    const char *journal_label;
+    int checkpoint_row;
+    double checkpoint_time;
+    size_t checkpoint_offset;
+    double row_start;                   // monotonic time the oldest row not yet echoed began sounding
+    double last_progress;
+    PlaybackWord ring[PLAYBACK_RING_SIZE];
+    size_t ring_first;
+    size_t ring_count;
+    struct MbeepSession *session;       // restarted by 'b', or NULL if keys are not read
+    HistoryWord history[PLAYBACK_HISTORY_SIZE];
+    size_t history_first;
+    size_t history_count;
+    bool replaying;
+    struct Tee *tee;                    // words are also written to, or NULL
+};
+typedef struct PlaybackState PlaybackState;
+
+// An mbeep child process with its pipes, and the terminal settings to put back when it ends.
+struct MbeepSession {
+    FILE *pipe_to_mbeep;
+    FILE *pipe_from_mbeep;
+    pid_t pid;
+    bool key_control;                   // stdin switched to raw, non-blocking reads for keys, by this
+                                        // session alone while it owns the terminal
+    struct termios previous_termios;
+    int previous_flags;
+    bool signals;                       // signals_open succeeded
+    double freq;                        // options mbeep was started with, to start it again
+    double paris_wpm;
+    double codex_wpm;
+    double farnsworth_wpm;
+    double word_space_wpm;
+    bool print_fcc_wpm;
+    const char *wav_file_name;
+};
+typedef struct MbeepSession MbeepSession;
+
 struct BufferStruct {
     char *p;
     size_t capacity;    // current allocation
     size_t used;        // including terminating null
+    Charset charset;    // the Content-Type of a URL declares, or CHARSET_UNKNOWN
 };
 typedef struct BufferStruct BufferStruct;
 
@@ -97,45 +223,90 @@ typedef enum MorseFeedError {
     MF_PROGRAM_ERR,
     MF_NO_STATE_PATH,
     MF_UNKNOWN_SAVED_STATE,
+    MF_INVALID_REGEX,
+    MF_SOCKET_ERROR,
     MF_UNKNOWN
 } MorseFeedError;
 
-MorseFeedError write_token(char *token, FILE *out_file, FILE *pipe_to_mbeep, FILE *pipe_from_mbeep,
-                           int words_per_row, int *word_number, int word_count,
-                           bool use_key_control, bool exclude_tags, bool *excluding,
-                           char entity[ENTITY_SIZE], char tag[TAG_SIZE]);
+// A stripped token marks names found in HTML, such as the space a tag stands for, with
+// STRIPPED_NAME before and after. Two together are left where a byte that could have ended a
+// UTF-8 sequence was removed, and stand for a STRIPPED_NAME in the text. A removed byte that
+// could still be converted as Latin-1 is marked with STRIPPED_REMOVED before it.
+#define STRIPPED_NAME '\x01'
+#define STRIPPED_REMOVED '\x02'
+#define STRIPPED_SIZE (4 * LINE_SIZE + 32)
+
+// Whether a word of a converted token is written depends on how writing those before it went.
+typedef enum WordRule {
+    WORD_ALWAYS,
+    WORD_IF_NO_ERROR
+} WordRule;
+
+typedef bool (*WordEmitter)(void *context, char *word, WordRule rule);
+
+bool next_token(const char *text, size_t length, size_t *position, const CharsetBytes *charset,
+                char token[LINE_SIZE + sizeof(uint32_t)], size_t *start);
+size_t strip_token(const char *token, char stripped[STRIPPED_SIZE], bool filter_html, bool *excluding_tag,
+                   char entity[ENTITY_SIZE], char tag[TAG_SIZE]);
+MorseFeedError convert_token(const char *stripped, WordEmitter emit, void *context);
 
 MorseFeedError write_word(char *word, FILE *out_file, FILE *pipe_to_mbeep, FILE *pipe_from_mbeep,
-                          int words_per_row, int *word_number, int word_count, bool use_key_control);
+                          int words_per_row, int *word_number, int word_count, bool use_key_control,
+                          PlaybackState *playback);
+
+double monotonic_seconds(void);
 
-void init_fork_mbeep(bool use_key_control);
+void init_playback(PlaybackState *playback, const MorseFeedParams *mfp);
+void free_playback(PlaybackState *playback);
+void playback_set_source(PlaybackState *playback, const char *text, size_t start, size_t offset, size_t end);
+void playback_add_word(PlaybackState *playback, const char *word);
+void playback_row_sent(PlaybackState *playback);
+void playback_row_echoed(PlaybackState *playback);
+void playback_token_done(PlaybackState *playback, size_t end_offset);
+MorseFeedError playback_replay(PlaybackState *playback, FILE *out_file, int words_per_row, int *word_number,
+                               int word_count);
+void playback_checkpoint(PlaybackState *playback);
+MorseFeedError read_mbeep_echo(FILE *pipe_from_mbeep, PlaybackState *playback);
+const char *playback_sounding_word(const PlaybackState *playback, double now);
+void print_progress(PlaybackState *playback);
 
-MorseFeedError begin_fork_mbeep(FILE **pipe_to_mbeep, FILE **pipe_from_mbeep, pid_t *pid,
+MorseFeedError signals_open(void);
+void signals_close(void);
+int signals_fd(void);
+int signal_received(void);
+
+void init_mbeep_session(MbeepSession *session);
+
+MorseFeedError begin_fork_mbeep(MbeepSession *session,
                                 double freq, double paris_wpm, double codex_wpm, double farnsworth_wpm,
                                 double word_space_wpm,
                                 bool print_fcc_wpm, const char *wav_file_name, bool use_key_control);
 
-MorseFeedError end_fork_mbeep(FILE *pipe_to_mbeep, FILE *pipe_from_mbeep, pid_t pid);
+MorseFeedError end_fork_mbeep(MbeepSession *session, bool stop_now);
+MorseFeedError restart_fork_mbeep(MbeepSession *session);
 
 size_t find_string(const char *string, const char *buffer, size_t buffer_length,
                    size_t starting_at);
 
-MorseFeedError read_saved_position(const char *state_path, const char *label, size_t *position);
-MorseFeedError write_saved_position(const char *state_path, const char *label, size_t position);
+MorseFeedError read_saved_position(const char *state_path, const char *label, size_t *position,
+                                   uint64_t *fingerprint);
+MorseFeedError write_saved_position(const char *state_path, const char *label, size_t position,
+                                    uint64_t fingerprint);
+
+uint64_t anchor_fingerprint(const char *buffer, size_t length, size_t offset);
+size_t find_anchor(const char *buffer, size_t length, size_t near, uint64_t fingerprint);
 
 void init_buffer(BufferStruct *buffer, size_t capacity);
 void free_buffer(BufferStruct *buffer);
 
 size_t curl_write_data(void *buffer, size_t size, size_t nmemb, void *userp);
 MorseFeedError url_to_buffer(const char *url, BufferStruct *buffer);
+void release_url_handle(void);
 
 char *fbgets(char *line, int line_size, FILE *file, char *buffer, size_t buffer_size, size_t *next_index);
 
 MorseFeedError process_and_send(MorseFeedParams mfp);
 
-void extract_urls(const char *base_url, const char *str, size_t start_index, size_t end_index,
-                  StringVector *urls, StringVector *titles);
-
 MorseFeedError read_state(const char *label, MorseFeedParams *mfp, StringVector *string_storage);
 MorseFeedError save_state(const char *label, const MorseFeedParams *mfp);
 
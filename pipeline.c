@@ -0,0 +1,1121 @@
+//
+//  pipeline.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+
+typedef enum RecordKind {
+    RECORD_PAGE,            // a new page, or the only one; the text is a PipePage
+    RECORD_TOKEN,           // the text is a token, then a stripped token
+    RECORD_WORD,            // the text is a word of a converted token
+    RECORD_TOKEN_END,       // after the words of a token
+    RECORD_END              // nothing more to read, with the error that stopped reading
+} RecordKind;
+
+// flags of tokens
+#define TOKEN_DONE 1        // the offset is where to resume once the token is written
+#define TOKEN_SEPARATOR 2   // written between pages, and any error writing it is ignored
+#define TOKEN_SPLIT 4       // too long, and split before the next character
+#define TOKEN_CARRY 8       // that character, written alone only if writing the split token failed
+
+// flags of words, besides their WordRule
+#define WORD_CARRIED 2      // of a TOKEN_CARRY
+
+struct PipeRecord {
+    unsigned char kind;
+    unsigned char flags;    // of a token, or the WordRule of a word
+    MorseFeedError error;
+    size_t offset;
+    size_t length;          // of the text after the record, not counting its nul
+};
+typedef struct PipeRecord PipeRecord;
+
+#define RECORD_SPACE(length) ((sizeof(PipeRecord) + (length) + sizeof(size_t)) & ~(sizeof(size_t) - 1))
+#define RECORD_TEXT(record) ((char *)((record) + 1))
+
+struct PipePage {
+    size_t link_index;      // or SIZE_MAX if reading the text buffer or the input file
+    size_t start;
+    bool fetched;
+};
+typedef struct PipePage PipePage;
+
+// The records copied to the cache are written compactly, and the same on every machine: a byte
+// with the kind, the flags and whether an error follows, then the offset of a token as the
+// difference from the one before it or from the start of the page, then the text of a token or
+// word after its length. A page is written as its link index plus 1, its start and whether it
+// was fetched.
+#define COPY_FLAGS_SHIFT 3
+#define COPY_ERROR 0x80
+#define COPY_HAS_OFFSET(kind) ((kind) == RECORD_TOKEN || (kind) == RECORD_TOKEN_END)
+#define COPY_HAS_TEXT(kind) ((kind) == RECORD_TOKEN || (kind) == RECORD_WORD)
+
+struct PipeWriter {
+    Pipeline *pipeline;
+    PipeRing *ring;
+    PipeBlock *block;       // being filled, or NULL
+    FILE *copy;             // where each record is also written, or NULL
+    size_t copy_offset;     // of the last token or page copied
+};
+typedef struct PipeWriter PipeWriter;
+
+struct PipeReader {
+    Pipeline *pipeline;
+    PipeRing *ring;         // or NULL if reading a cached block
+    PipeBlock *block;       // being read, or NULL
+    size_t next;
+    // a cached record is decoded into a record of its own
+    size_t copy_offset;
+    PipeRecord *decoded;
+    size_t decoded_space;
+};
+typedef struct PipeReader PipeReader;
+
+static const char *stage_names[PIPE_STAGES] = { "read", "strip", "convert", "write" };
+
+bool pipe_stopped(Pipeline *pipeline);
+bool pipe_stopped(Pipeline *pipeline)
+{
+    return __atomic_load_n(&pipeline->stopped, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Marks the last stage done, and wakes any stage waiting for it.
+void pipe_stop(Pipeline *pipeline);
+void pipe_stop(Pipeline *pipeline)
+{
+    __atomic_store_n(&pipeline->stopped, 1, __ATOMIC_SEQ_CST);
+
+    for (int k = 0; k < PIPE_STAGES - 1; k++) {
+        pthread_mutex_lock(&pipeline->rings[k].mutex);
+        pthread_cond_broadcast(&pipeline->rings[k].wakeup);
+        pthread_mutex_unlock(&pipeline->rings[k].mutex);
+    }
+}
+
+// Whether the writer has room in the ring, or the reader has a block in it.
+bool pipe_ready(const PipeRing *ring, bool writing);
+bool pipe_ready(const PipeRing *ring, bool writing)
+{
+    size_t used = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) - __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+
+    return writing ? used < PIPE_RING_SIZE : used > 0;
+}
+
+// Sleeps until the ring is ready, or the last stage is done. The waiter is counted before the
+// ring is checked again, and the other stage moves head or tail before it checks the count, so
+// one of them always sees the other.
+void pipe_wait(Pipeline *pipeline, PipeRing *ring, bool writing);
+void pipe_wait(Pipeline *pipeline, PipeRing *ring, bool writing)
+{
+    pthread_mutex_lock(&ring->mutex);
+    __atomic_add_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+
+    while (!pipe_ready(ring, writing) && !pipe_stopped(pipeline)) pthread_cond_wait(&ring->wakeup, &ring->mutex);
+
+    __atomic_sub_fetch(&ring->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+// Wakes the other stage, if it is waiting on the ring.
+void pipe_wake(PipeRing *ring);
+void pipe_wake(PipeRing *ring)
+{
+    if (__atomic_load_n(&ring->waiters, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&ring->mutex);
+        pthread_cond_broadcast(&ring->wakeup);
+        pthread_mutex_unlock(&ring->mutex);
+    }
+}
+
+bool copy_record(FILE *copy, const PipeRecord *record, size_t *copy_offset);
+bool copy_record(FILE *copy, const PipeRecord *record, size_t *copy_offset)
+{
+    int flags = record->flags << COPY_FLAGS_SHIFT | (record->error != MF_NO_ERROR ? COPY_ERROR : 0);
+    bool written = putc(record->kind | flags, copy) != EOF;
+
+    if (written && record->error != MF_NO_ERROR) written = write_varint(copy, (uint64_t)record->error);
+
+    if (record->kind == RECORD_PAGE) {
+        PipePage page;
+
+        memcpy(&page, RECORD_TEXT(record), sizeof(page));
+        written = written && write_varint(copy, (uint64_t)page.link_index + 1) && write_varint(copy, page.start) &&
+            write_varint(copy, page.fetched);
+        *copy_offset = page.start;
+    }
+
+    if (COPY_HAS_OFFSET(record->kind)) {
+        // zigzag, so that a small step back is as short as a small step forward
+        int64_t step = (int64_t)(record->offset - *copy_offset);
+
+        written = written && write_varint(copy, (uint64_t)step << 1 ^ (uint64_t)(step >> 63));
+        *copy_offset = record->offset;
+    }
+
+    if (COPY_HAS_TEXT(record->kind)) {
+        written = written && write_varint(copy, record->length) &&
+            fwrite(RECORD_TEXT(record), 1, record->length, copy) == record->length;
+    }
+
+    return written;
+}
+
+// Reads back a record copied to the cache at *next, all but its text, which is left at *text; a
+// page is read into page. False if the records do not follow each other as they were written.
+bool read_copied_record(const char *records, size_t size, size_t *next, size_t *copy_offset, PipeRecord *record,
+                        PipePage *page, const char **text);
+bool read_copied_record(const char *records, size_t size, size_t *next, size_t *copy_offset, PipeRecord *record,
+                        PipePage *page, const char **text)
+{
+    uint64_t number = 0;
+    uint64_t start = 0;
+    uint64_t fetched = 0;
+    bool valid = *next < size;
+    int byte = valid ? (unsigned char)records[(*next)++] : 0;
+
+    memset(record, 0, sizeof(*record));
+    record->kind = byte & ((1 << COPY_FLAGS_SHIFT) - 1);
+    record->flags = (byte & ~COPY_ERROR) >> COPY_FLAGS_SHIFT;
+    *text = "";
+    valid = valid && record->kind <= RECORD_END;
+
+    if (valid && (byte & COPY_ERROR) != 0) {
+        valid = read_varint(records, size, next, &number) && number <= MF_UNKNOWN;
+        record->error = (MorseFeedError)number;
+    }
+
+    if (valid && record->kind == RECORD_PAGE) {
+        valid = read_varint(records, size, next, &number) && read_varint(records, size, next, &start) &&
+            read_varint(records, size, next, &fetched);
+        page->link_index = (size_t)(number - 1);
+        page->start = start;
+        page->fetched = fetched != 0;
+        record->length = sizeof(*page);
+        *copy_offset = page->start;
+    }
+
+    if (valid && COPY_HAS_OFFSET(record->kind)) {
+        valid = read_varint(records, size, next, &number);
+        record->offset = *copy_offset + (size_t)(number >> 1 ^ (0 - (number & 1)));
+        *copy_offset = record->offset;
+    }
+
+    if (valid && COPY_HAS_TEXT(record->kind)) {
+        valid = read_varint(records, size, next, &number) && number <= size - *next;
+        record->length = (size_t)number;
+        *text = records + *next;
+        if (valid) *next += record->length;
+    }
+
+    return valid;
+}
+
+// Passes the block being filled to the next stage.
+bool pipe_flush(PipeWriter *writer);
+bool pipe_flush(PipeWriter *writer)
+{
+    PipeRing *ring = writer->ring;
+
+    if (writer->block != NULL && writer->block->used > 0) {
+        size_t occupancy = ring->head + 1 - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+        ring->written++;
+        ring->occupancy_total += occupancy;
+        if (occupancy > ring->occupancy_most) ring->occupancy_most = occupancy;
+
+        for (size_t next = 0; writer->copy != NULL && next < writer->block->used; ) {
+            const PipeRecord *record = (const PipeRecord *)(writer->block->p + next);
+
+            // an incomplete copy is not kept
+            if (!copy_record(writer->copy, record, &writer->copy_offset)) writer->copy = NULL;
+            next += RECORD_SPACE(record->length);
+        }
+
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_SEQ_CST);
+        writer->block = NULL;
+        pipe_wake(ring);
+    }
+
+    return !pipe_stopped(writer->pipeline);
+}
+
+// Room for a record with text of up to length bytes, or NULL if the last stage is done.
+PipeRecord *pipe_reserve(PipeWriter *writer, size_t length);
+PipeRecord *pipe_reserve(PipeWriter *writer, size_t length)
+{
+    PipeRing *ring = writer->ring;
+
+    if (writer->block != NULL && writer->block->used + RECORD_SPACE(length) > PIPE_BLOCK_SIZE) pipe_flush(writer);
+
+    while (writer->block == NULL && !pipe_stopped(writer->pipeline)) {
+        if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < PIPE_RING_SIZE) {
+            writer->block = &ring->blocks[ring->head % PIPE_RING_SIZE];
+            writer->block->used = 0;
+
+        } else {
+            ring->full_waits++;
+            pipe_wait(writer->pipeline, ring, true);
+        }
+    }
+
+    return writer->block == NULL ? NULL : (PipeRecord *)(writer->block->p + writer->block->used);
+}
+
+void pipe_commit(PipeWriter *writer, PipeRecord *record);
+void pipe_commit(PipeWriter *writer, PipeRecord *record)
+{
+    RECORD_TEXT(record)[record->length] = '\0';
+    writer->block->used += RECORD_SPACE(record->length);
+}
+
+bool pipe_put(PipeWriter *writer, RecordKind kind, int flags, MorseFeedError error, size_t offset,
+              const void *text, size_t length);
+bool pipe_put(PipeWriter *writer, RecordKind kind, int flags, MorseFeedError error, size_t offset,
+              const void *text, size_t length)
+{
+    PipeRecord *record = pipe_reserve(writer, length);
+
+    if (record != NULL) {
+        record->kind = kind;
+        record->flags = flags;
+        record->error = error;
+        record->offset = offset;
+        record->length = length;
+        memcpy(RECORD_TEXT(record), text, length);
+        pipe_commit(writer, record);
+    }
+
+    return record != NULL;
+}
+
+bool pipe_forward(PipeWriter *writer, const PipeRecord *record);
+bool pipe_forward(PipeWriter *writer, const PipeRecord *record)
+{
+    return pipe_put(writer, record->kind, record->flags, record->error, record->offset,
+                    RECORD_TEXT(record), record->length);
+}
+
+// The next record copied to the cache, read back into the reader's own record, or NULL after
+// the last one.
+PipeRecord *pipe_decode(PipeReader *reader);
+PipeRecord *pipe_decode(PipeReader *reader)
+{
+    PipeRecord record;
+    PipePage page;
+    const char *text;
+
+    if (!read_copied_record(reader->block->p, reader->block->used, &reader->next, &reader->copy_offset, &record,
+                            &page, &text)) {
+        return NULL;
+    }
+
+    if (reader->decoded_space < RECORD_SPACE(record.length)) {
+        PipeRecord *decoded = realloc(reader->decoded, RECORD_SPACE(record.length));
+
+        if (decoded == NULL) return NULL;
+        reader->decoded = decoded;
+        reader->decoded_space = RECORD_SPACE(record.length);
+    }
+
+    *reader->decoded = record;
+    memcpy(RECORD_TEXT(reader->decoded), record.kind == RECORD_PAGE ? (const char *)&page : text, record.length);
+    RECORD_TEXT(reader->decoded)[record.length] = '\0';
+
+    return reader->decoded;
+}
+
+// The next record, or NULL if the last stage is done. Whatever has been written to out is
+// passed on before waiting, so that nothing is held back while this stage has nothing to do.
+PipeRecord *pipe_next(PipeReader *reader, PipeWriter *out);
+PipeRecord *pipe_next(PipeReader *reader, PipeWriter *out)
+{
+    PipeRing *ring = reader->ring;
+    PipeRecord *record = NULL;
+
+    while (record == NULL && (reader->block != NULL || !pipe_stopped(reader->pipeline))) {
+        if (reader->ring == NULL) {
+            record = pipe_decode(reader);
+            break;
+
+        } else if (reader->block != NULL && reader->next < reader->block->used) {
+            record = (PipeRecord *)(reader->block->p + reader->next);
+            reader->next += RECORD_SPACE(record->length);
+
+        } else if (reader->block != NULL) {
+            __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_SEQ_CST);
+            reader->block = NULL;
+            pipe_wake(ring);
+
+        } else if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail) {
+            reader->block = &ring->blocks[ring->tail % PIPE_RING_SIZE];
+            reader->next = 0;
+
+        } else {
+            ring->empty_waits++;
+            if (out != NULL) pipe_flush(out);
+            pipe_wait(reader->pipeline, ring, false);
+        }
+    }
+
+    return record;
+}
+
+bool is_regular_file(FILE *file);
+bool is_regular_file(FILE *file)
+{
+    struct stat info;
+
+    return file != NULL && fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// Typed or piped text is read as it comes, a line at a time, while also waiting for the last stage
+// to be done, so that stopping does not wait for more input. Nothing must have been read from the
+// stream through stdio before.
+struct PipeStream {
+    int fd;
+    int stop_fd;
+    char buffer[LINE_SIZE];
+    size_t used;
+    bool ended;
+    bool failed;
+    bool stopped;
+};
+typedef struct PipeStream PipeStream;
+
+char *stream_gets(PipeStream *stream, char line[LINE_SIZE]);
+char *stream_gets(PipeStream *stream, char line[LINE_SIZE])
+{
+    char *result = NULL;
+
+    while (result == NULL && !stream->stopped && !stream->failed && (!stream->ended || stream->used > 0)) {
+        char *newline = memchr(stream->buffer, '\n', stream->used);
+        struct pollfd polled[2] = { { stream->fd, POLLIN, 0 }, { stream->stop_fd, POLLIN, 0 } };
+
+        if (newline != NULL || stream->used == LINE_SIZE - 1 || stream->ended) {
+            size_t length = newline != NULL ? (size_t)(newline - stream->buffer) + 1 : stream->used;
+
+            memcpy(line, stream->buffer, length);
+            line[length] = '\0';
+            memmove(stream->buffer, stream->buffer + length, stream->used - length);
+            stream->used -= length;
+            result = line;
+
+        } else if (poll(polled, 2, -1) < 0) {
+            stream->failed = errno != EINTR;
+
+        } else if (polled[1].revents != 0) {
+            stream->stopped = true;
+
+        } else if (polled[0].revents != 0) {
+            ssize_t count = read(stream->fd, stream->buffer + stream->used, LINE_SIZE - 1 - stream->used);
+
+            if (count > 0) {
+                stream->used += count;
+
+            } else if (count == 0) {
+                stream->ended = true;
+
+            } else {
+                stream->failed = errno != EINTR && errno != EAGAIN;
+            }
+        }
+    }
+
+    return result;
+}
+
+// Reads each page in turn and splits it into tokens at white space, as process_and_send did. Each
+// byte is passed on as the UTF-8 for it in the charset of the page.
+void *read_stage(void *arg);
+void *read_stage(void *arg)
+{
+    Pipeline *pipeline = (Pipeline *)arg;
+    const MorseFeedParams *mfp = pipeline->mfp;
+    PipeWriter out = { pipeline, &pipeline->rings[0], NULL, NULL };
+    MorseFeedError error = MF_NO_ERROR;
+    BufferStruct text = *pipeline->text_buffer;
+    size_t buffer_index = pipeline->buffer_index;
+    size_t line_offset = buffer_index;
+    size_t text_end = 0;
+    bool more_buffers = pipeline->more_buffers;
+    size_t link_index = 0;
+    size_t page = 0;
+    char line[LINE_SIZE];
+    char token[LINE_SIZE + sizeof(uint32_t)];  // room to copy the UTF-8 for a byte whole
+    size_t token_length = 0;
+    const CharsetBytes *charset = charset_table(pipeline->charset);
+    // typed or piped text is passed on a line at a time
+    bool flush_lines = text.p == NULL && !is_regular_file(mfp->in_file) && !pipeline->decompressing;
+    bool sending = true;
+    PipeStream stream = { flush_lines ? fileno(mfp->in_file) : -1, pipeline->stop_fds[0], "", 0, false, false, false };
+
+    while (error == MF_NO_ERROR && more_buffers && sending) {
+        PipePage next = { SIZE_MAX, buffer_index, true };
+        bool separator = false;
+
+        if (text.p == NULL) {
+            // reading from file; only one pass
+            more_buffers = false;
+
+        } else if (pipeline->linked_urls->size == 0) {
+            // only one text buffer; only one pass
+            more_buffers = false;
+
+        } else if (!pipeline->prefetched && *pipeline->bytes_used >= pipeline->byte_budget) {
+            fprintf(stderr, "(stopped after %.1f megabytes)\n", *pipeline->bytes_used / 1e6);
+            break;
+
+        } else {
+            // read next linked URL
+            BufferStruct *page_buffer = &pipeline->linked_pages[link_index];
+
+            token_length = 0;
+            buffer_index = 0;
+            line_offset = 0;
+
+            if (pipeline->prefetched) {
+                if (page_buffer->p == NULL) error = MF_URL_READ_ERROR;
+
+            } else {
+                sending = pipe_flush(&out);
+                error = url_to_buffer(string_vector_at((StringVector *)pipeline->linked_urls, link_index), page_buffer);
+                *pipeline->bytes_used += page_buffer->used;
+            }
+
+            if (error == MF_NO_ERROR) {
+                markers_find_range(pipeline->linked_markers, page_buffer->p, page_buffer->used - 1, 0,
+                                   &buffer_index, &text_end);
+                line_offset = buffer_index;
+                if (text_end < page_buffer->used - 1) page_buffer->used = text_end + 1;
+
+                charset = charset_table(mfp->charset != CHARSET_UNKNOWN ? mfp->charset :
+                                        charset_detect(page_buffer->p, page_buffer->used - 1, page_buffer->charset));
+            }
+
+            // the last stage frees the page once it has started on the next
+            text = *page_buffer;
+            next.link_index = link_index;
+            next.start = buffer_index;
+            next.fetched = error == MF_NO_ERROR;
+
+            if (++link_index >= pipeline->linked_urls->size) {
+                // this is the last one
+                more_buffers = false;
+
+            } else if (link_index > 1) {
+                separator = true;
+            }
+        }
+
+        sending = sending && pipe_put(&out, RECORD_PAGE, 0, MF_NO_ERROR, 0, &next, sizeof(next));
+        if (separator) sending = sending && pipe_put(&out, RECORD_TOKEN, TOKEN_SEPARATOR, MF_NO_ERROR, 0, "=", 1);
+
+        while (error == MF_NO_ERROR && sending &&
+               page >= __atomic_load_n(&pipeline->skip_before, __ATOMIC_ACQUIRE) &&
+               NULL != (stream.fd >= 0 ? stream_gets(&stream, line) :
+                        fbgets(line, LINE_SIZE, mfp->in_file, text.p, text.used - 1, &buffer_index))) {
+            size_t line_length = strlen(line);
+
+            for (size_t k = 0; k < line_length && sending; k++) {
+                char c = line[k];
+                const CharsetBytes *utf8 = &charset[(unsigned char)c];
+
+                if (isspace(c)) {
+                    if (token_length > 0) {
+                        sending = pipe_put(&out, RECORD_TOKEN, TOKEN_DONE, MF_NO_ERROR, line_offset + k + 1,
+                                           token, token_length);
+                        token_length = 0;
+                    }
+
+                } else if (token_length + utf8->length > LINE_SIZE - 1) {
+                    sending = pipe_put(&out, RECORD_TOKEN, TOKEN_DONE | TOKEN_SPLIT, MF_NO_ERROR,
+                                       line_offset + token_length, token, token_length) &&
+                        pipe_put(&out, RECORD_TOKEN, TOKEN_CARRY, MF_NO_ERROR, 0, utf8->utf8, utf8->length);
+                    memcpy(token, utf8->utf8, sizeof(utf8->utf8));
+                    token_length = utf8->length;
+
+                } else {
+                    memcpy(token + token_length, utf8->utf8, sizeof(utf8->utf8));
+                    token_length += utf8->length;
+                }
+            }
+
+            line_offset += line_length;
+            if (flush_lines) sending = sending && pipe_flush(&out);
+        }
+
+        // see if last token to finish
+        if (token_length > 0 && sending && page >= __atomic_load_n(&pipeline->skip_before, __ATOMIC_ACQUIRE)) {
+            sending = pipe_put(&out, RECORD_TOKEN, 0, MF_NO_ERROR, 0, token, token_length);
+        }
+
+        token_length = 0;
+        page++;
+    }
+
+    if (text.p == NULL) pipeline->input_ended = stream.fd >= 0 ? stream.ended && !stream.failed : feof(mfp->in_file);
+
+    if (sending && pipe_put(&out, RECORD_END, 0, error, 0, "", 0)) pipe_flush(&out);
+
+    return NULL;
+}
+
+void *strip_stage(void *arg);
+void *strip_stage(void *arg)
+{
+    Pipeline *pipeline = (Pipeline *)arg;
+    PipeReader in = { pipeline, &pipeline->rings[0], NULL, 0 };
+    PipeWriter out = { pipeline, &pipeline->rings[1], NULL, NULL };
+    bool excluding_tag = false;
+    char entity[ENTITY_SIZE] = "";
+    char tag[TAG_SIZE] = "";
+    PipeRecord *record;
+    bool sending = true;
+
+    while (sending && (record = pipe_next(&in, &out)) != NULL) {
+        if (record->kind == RECORD_TOKEN) {
+            PipeRecord *stripped = pipe_reserve(&out, STRIPPED_SIZE);
+
+            if (stripped == NULL) {
+                sending = false;
+
+            } else if ((record->flags & TOKEN_CARRY) != 0) {
+                // stripped again as part of the next token, so the state is left as it is
+                bool carry_excluding_tag = excluding_tag;
+                char carry_entity[ENTITY_SIZE];
+                char carry_tag[TAG_SIZE];
+
+                strcpy(carry_entity, entity);
+                strcpy(carry_tag, tag);
+                *stripped = *record;
+                stripped->length = strip_token(RECORD_TEXT(record), RECORD_TEXT(stripped), pipeline->filter_html,
+                                               &carry_excluding_tag, carry_entity, carry_tag);
+                pipe_commit(&out, stripped);
+
+            } else {
+                *stripped = *record;
+                stripped->length = strip_token(RECORD_TEXT(record), RECORD_TEXT(stripped), pipeline->filter_html,
+                                               &excluding_tag, entity, tag);
+                pipe_commit(&out, stripped);
+            }
+
+        } else {
+            if (record->kind == RECORD_PAGE) {
+                excluding_tag = false;
+                entity[0] = '\0';
+                tag[0] = '\0';
+            }
+
+            sending = pipe_forward(&out, record) && record->kind != RECORD_END;
+            if (record->kind == RECORD_END) pipe_flush(&out);
+        }
+    }
+
+    return NULL;
+}
+
+struct WordContext {
+    PipeWriter *out;
+    int flags;
+};
+typedef struct WordContext WordContext;
+
+bool emit_word(void *context, char *word, WordRule rule);
+bool emit_word(void *context, char *word, WordRule rule)
+{
+    WordContext *word_context = (WordContext *)context;
+
+    return pipe_put(word_context->out, RECORD_WORD, rule | word_context->flags, MF_NO_ERROR, 0, word, strlen(word));
+}
+
+void *convert_stage(void *arg);
+void *convert_stage(void *arg)
+{
+    Pipeline *pipeline = (Pipeline *)arg;
+    PipeReader in = { pipeline, &pipeline->rings[1], NULL, 0 };
+    PipeWriter out = { pipeline, &pipeline->rings[2], NULL, pipeline->cache_file };
+    PipeRecord *record;
+    bool sending = true;
+
+    while (sending && (record = pipe_next(&in, &out)) != NULL) {
+        if (record->kind == RECORD_TOKEN) {
+            WordContext context = { &out, (record->flags & TOKEN_CARRY) != 0 ? WORD_CARRIED : 0 };
+            MorseFeedError error = convert_token(RECORD_TEXT(record), emit_word, &context);
+
+            sending = error != MF_EXIT &&
+                pipe_put(&out, RECORD_TOKEN_END, record->flags, error, record->offset, "", 0);
+
+        } else {
+            sending = pipe_forward(&out, record) && record->kind != RECORD_END;
+
+            if (record->kind == RECORD_END) {
+                pipe_flush(&out);
+                pipeline->cache_complete = out.copy != NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Checks that records read back from the cache are whole and end as the convert stage ends
+// them, and finds where to start writing them to resume at offset: the first record, or the
+// one after the token that ended there.
+bool pipeline_cached_start(const char *records, size_t size, size_t offset, size_t *start)
+{
+    size_t next = 0;
+    size_t copy_offset = 0;
+    PipeRecord record = { RECORD_PAGE, 0, MF_NO_ERROR, 0, 0 };
+    PipePage page;
+    const char *text;
+    bool found = false;
+    bool valid = true;
+
+    while (valid && next < size) {
+        size_t at = next;
+
+        valid = read_copied_record(records, size, &next, &copy_offset, &record, &page, &text);
+
+        if (!valid) {
+            // not whole
+
+        } else if (at == 0 && record.kind == RECORD_PAGE && page.start == offset) {
+            *start = 0;
+            found = true;
+
+        } else if (!found && record.kind == RECORD_TOKEN_END && record.error == MF_NO_ERROR &&
+                   record.flags == TOKEN_DONE && record.offset == offset) {
+            *start = next;
+            found = true;
+        }
+    }
+
+    return valid && found && next == size && record.kind == RECORD_END;
+}
+
+// Writes words as write_token did when it converted and wrote them in one step: a token stops
+// writing if writing its words ended in an error, except that 'n' skips to the next page. If a
+// token split for being too long fails, the character after it is written alone, and unless that
+// fails too, the rest of the page is skipped.
+MorseFeedError write_stage(Pipeline *pipeline);
+MorseFeedError write_stage(Pipeline *pipeline)
+{
+    const MorseFeedParams *mfp = pipeline->mfp;
+    PipeReader in = { pipeline, &pipeline->rings[PIPE_STAGES - 2], NULL, 0 };
+    PipeBlock cached = { (char *)pipeline->cached, pipeline->cached_size };
+    MorseFeedError error = MF_NO_ERROR;
+    MorseFeedError token_error = MF_NO_ERROR;
+    PipePage page = { SIZE_MAX, 0, false };
+    size_t pages = 0;
+    bool skipping = false;
+    bool carrying = false;          // a split token failed
+    bool done = false;
+    bool ended = false;
+    PipeRecord *record;
+
+    if (pipeline->cached != NULL) {
+        // the offsets of tokens are read back from where writing them resumes
+        in.ring = NULL;
+        in.block = &cached;
+        in.copy_offset = pipeline->buffer_index;
+    }
+
+    while (!done && (record = pipe_next(&in, NULL)) != NULL) {
+        switch ((RecordKind)record->kind) {
+            case RECORD_PAGE:
+                if (pages > 0 && pipeline->seen != NULL && page.link_index != SIZE_MAX && !pipeline->playback->quit) {
+                    seen_add(pipeline->seen, string_vector_at((StringVector *)pipeline->linked_urls, page.link_index));
+                }
+
+                memcpy(&page, RECORD_TEXT(record), sizeof(page));
+                pages++;
+                skipping = false;
+
+                if (page.link_index != SIZE_MAX && mfp->fork_mbeep) {
+                    fprintf(stderr, "%ld) %s\n", (long)page.link_index,
+                            string_vector_at((StringVector *)pipeline->linked_titles, page.link_index));
+                }
+
+                if (page.link_index != SIZE_MAX && page.fetched) {
+                    BufferStruct *text_buffer = pipeline->text_buffer;
+
+                    free_buffer(text_buffer);
+                    *text_buffer = pipeline->linked_pages[page.link_index];
+                    init_buffer(&pipeline->linked_pages[page.link_index], 0);
+
+                    pipeline->token_offset = page.start;
+                    playback_set_source(pipeline->playback, text_buffer->p, page.start, page.start, text_buffer->used - 1);
+                }
+                break;
+
+            case RECORD_TOKEN:
+                // only stripped tokens come to this stage
+                break;
+
+            case RECORD_WORD:
+                if (skipping || ((record->flags & WORD_CARRIED) != 0) != carrying) {
+                    // not written
+
+                } else if ((record->flags & ~WORD_CARRIED) == WORD_ALWAYS || token_error == MF_NO_ERROR) {
+                    token_error = write_word(RECORD_TEXT(record), mfp->out_file, pipeline->pipe_to_mbeep,
+                                             pipeline->pipe_from_mbeep, mfp->words_per_row, pipeline->word_number,
+                                             mfp->word_count, pipeline->use_key_control, pipeline->playback);
+                }
+                break;
+
+            case RECORD_TOKEN_END:
+                if (record->error != MF_NO_ERROR) token_error = record->error;
+
+                if (skipping || (record->flags & TOKEN_SEPARATOR) != 0) {
+                    // nothing more
+
+                } else if ((record->flags & TOKEN_CARRY) != 0) {
+                    if (carrying && (token_error == MF_NO_ERROR || token_error == MF_NEXT)) {
+                        skipping = true;
+
+                    } else if (carrying) {
+                        error = token_error;
+                        done = true;
+                    }
+
+                    carrying = false;
+
+                } else if (token_error != MF_NO_ERROR && (record->flags & TOKEN_SPLIT) != 0) {
+                    carrying = true;
+
+                } else if (token_error == MF_NO_ERROR) {
+                    if ((record->flags & TOKEN_DONE) != 0) {
+                        pipeline->token_offset = record->offset;
+                        playback_token_done(pipeline->playback, record->offset);
+#ifdef DEBUG
+                        fprintf(stderr, "token_offset = %d\n", (int)record->offset);
+#endif
+                    }
+
+                } else if (token_error == MF_NEXT) {
+                    skipping = true;
+
+                } else {
+                    error = token_error;
+                    done = true;
+                }
+
+                if (skipping) {
+                    __atomic_store_n(&pipeline->skip_before, pages, __ATOMIC_RELEASE);
+                    if (page.link_index == SIZE_MAX) pipeline->stopped_reading = true;
+                }
+
+                token_error = MF_NO_ERROR;
+                break;
+
+            case RECORD_END:
+                error = record->error;
+
+                if (error == MF_NO_ERROR && pages > 0 && pipeline->seen != NULL && page.link_index != SIZE_MAX &&
+                    !pipeline->playback->quit) {
+                    seen_add(pipeline->seen, string_vector_at((StringVector *)pipeline->linked_urls, page.link_index));
+                }
+
+                done = true;
+                ended = true;
+                break;
+        }
+    }
+
+    // the words not written are still converted, to be kept in the cache
+    while (pipeline->cache_file != NULL && !pipeline->stopped_reading && !ended &&
+           (record = pipe_next(&in, NULL)) != NULL) {
+        ended = record->kind == RECORD_END;
+    }
+
+    pipe_stop(pipeline);
+    free(in.decoded);
+
+    return error;
+}
+
+MorseFeedError pipeline_run(Pipeline *pipeline)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    void *(*stages[PIPE_STAGES - 1])(void *) = { read_stage, strip_stage, convert_stage };
+    pthread_t threads[PIPE_STAGES - 1];
+    bool started[PIPE_STAGES - 1] = { false };
+    bool stop_pipe;
+
+    pipeline->stopped = 0;
+    pipeline->skip_before = 0;
+    pipeline->token_offset = pipeline->buffer_index;
+    pipeline->stopped_reading = false;
+    pipeline->input_ended = false;
+    pipeline->cache_complete = false;
+    memset(pipeline->rings, 0, sizeof(pipeline->rings));
+
+    for (int k = 0; k < PIPE_STAGES - 1; k++) {
+        pthread_mutex_init(&pipeline->rings[k].mutex, NULL);
+        pthread_cond_init(&pipeline->rings[k].wakeup, NULL);
+    }
+
+    stop_pipe = pipe(pipeline->stop_fds) == 0;
+    if (!stop_pipe) error = MF_PIPE_ERROR;
+
+    for (int k = 0; k < PIPE_STAGES - 1; k++) {
+        for (int b = 0; b < PIPE_RING_SIZE; b++) {
+            pipeline->rings[k].blocks[b].p = malloc(PIPE_BLOCK_SIZE);
+            if (pipeline->rings[k].blocks[b].p == NULL) error = MF_OUT_OF_MEMORY;
+        }
+    }
+
+    // words read back from the cache need only be written
+    for (int k = 0; k < PIPE_STAGES - 1 && error == MF_NO_ERROR && pipeline->cached == NULL; k++) {
+        started[k] = pthread_create(&threads[k], NULL, stages[k], pipeline) == 0;
+        if (!started[k]) error = MF_OUT_OF_MEMORY;
+    }
+
+    // the last stage runs on this thread, which has the terminal and mbeep
+    if (error == MF_NO_ERROR) error = write_stage(pipeline);
+
+    pipe_stop(pipeline);
+    if (stop_pipe && write(pipeline->stop_fds[1], "", 1) != 1 && error == MF_NO_ERROR) error = MF_PIPE_ERROR;
+
+    for (int k = 0; k < PIPE_STAGES - 1; k++) {
+        if (started[k]) pthread_join(threads[k], NULL);
+    }
+
+    if (stop_pipe) {
+        close(pipeline->stop_fds[0]);
+        close(pipeline->stop_fds[1]);
+    }
+
+    for (int k = 0; k < PIPE_STAGES - 1; k++) {
+        for (int b = 0; b < PIPE_RING_SIZE; b++) free(pipeline->rings[k].blocks[b].p);
+        pthread_mutex_destroy(&pipeline->rings[k].mutex);
+        pthread_cond_destroy(&pipeline->rings[k].wakeup);
+    }
+
+    return error;
+}
+
+void pipeline_print_stats(const Pipeline *pipeline)
+{
+    for (int k = 0; k < PIPE_STAGES - 1; k++) {
+        const PipeRing *ring = &pipeline->rings[k];
+
+        fprintf(stderr, "(%s to %s: %ld blocks, %.1f of %d in ring on average, %ld at most; "
+                "%s waited %ld times when full, %s %ld times when empty)\n",
+                stage_names[k], stage_names[k + 1], (long)ring->written,
+                ring->written > 0 ? (double)ring->occupancy_total / ring->written : 0.0, PIPE_RING_SIZE,
+                (long)ring->occupancy_most, stage_names[k], (long)ring->full_waits,
+                stage_names[k + 1], (long)ring->empty_waits);
+    }
+}
+
+#if DEBUG
+bool collect_word(void *context, char *word, WordRule rule);
+bool collect_word(void *context, char *word, WordRule rule)
+{
+    CString *words = (CString *)context;
+
+    return cstring_append(words, word) && cstring_append_char(words, rule == WORD_ALWAYS ? '!' : '|');
+}
+
+bool converts_to(const char *token, bool filter_html, const char *expected);
+bool converts_to(const char *token, bool filter_html, const char *expected)
+{
+    char stripped[STRIPPED_SIZE];
+    bool excluding_tag = false;
+    char entity[ENTITY_SIZE] = "";
+    char tag[TAG_SIZE] = "";
+    CString words = cstring_create(0);
+    bool same;
+
+    strip_token(token, stripped, filter_html, &excluding_tag, entity, tag);
+    same = convert_token(stripped, collect_word, &words) == MF_NO_ERROR && strcmp(cstring_p(&words), expected) == 0;
+    if (!same) printf("%s: %s\n", token, cstring_p(&words));
+
+    cstring_free(&words);
+
+    return same;
+}
+
+void pipeline_tests(void)
+{
+    bool ok = true;
+    const char *text = "Tom & Jerry\n\"Caf\xC3\xA9\"  (1907)\nthe end";
+    MorseFeedParams mfp;
+    Pipeline pipeline;
+    BufferStruct text_buffer = { NULL, 0, 0 };
+    PlaybackState playback;
+    int word_number = 0;
+    char output[256];
+    printf("pipeline_tests()\n");
+
+    ok &= print_if_fail(converts_to("Tom&amp;Jerry", false, "TOM!andsign|AMP!semicolon|JERRY|"), "FAIL: convert_token (1)");
+    ok &= print_if_fail(converts_to("<b>Tom&amp;Jerry</b>", true, " |TOM!andsign|JERRY! |"), "FAIL: convert_token (2)");
+    ok &= print_if_fail(converts_to("x&quot;y&copy;&middot;", true, "X!unquote|Y!copyright|dot|"), "FAIL: convert_token (3)");
+    ok &= print_if_fail(converts_to("<li>a</li>", true, " |A!||"), "FAIL: convert_token (4)");
+    // a lead byte is not joined to a continuation byte once what was between them is removed
+    ok &= print_if_fail(converts_to("\xC3<b>\xA9", true, "A! |copyright|"), "FAIL: convert_token (5)");
+    ok &= print_if_fail(converts_to("\xC3&x;\xA9", true, "A!copyright|"), "FAIL: convert_token (6)");
+    ok &= print_if_fail(converts_to("a\x01" "b", false, "AB|"), "FAIL: convert_token (7)");
+    // code points past Latin-1 are named or spelled, whether from UTF-8 or from windows-1252
+    ok &= print_if_fail(converts_to("\x93" "Hi\x94", false, "quote|HI!unquote|"), "FAIL: convert_token (8)");
+    ok &= print_if_fail(converts_to("\xE2\x80\x9CHi\xE2\x80\x9D", false, "quote|HI!unquote|"), "FAIL: convert_token (9)");
+    ok &= print_if_fail(converts_to("caf\xC3\xA9\xE2\x80\x94" "bar", false, "CAFe!dash|BAR|"), "FAIL: convert_token (10)");
+    ok &= print_if_fail(converts_to("\xD0\x9C\xD0\xB8\xD1\x80\xE2\x82\xAC", false, "Mir!euro|"), "FAIL: convert_token (11)");
+
+    memset(&mfp, 0, sizeof(mfp));
+    mfp.words_per_row = 3;
+    mfp.word_count = DEFAULT;
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.max_megabytes = DEFAULT;
+    mfp.crawl_depth = DEFAULT;
+    mfp.in_file = fmemopen((void *)text, strlen(text), "r");
+    mfp.out_file = fmemopen(output, sizeof(output), "w");
+    init_playback(&playback, &mfp);
+
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.mfp = &mfp;
+    pipeline.text_buffer = &text_buffer;
+    pipeline.more_buffers = true;
+    pipeline.byte_budget = SIZE_MAX;
+    pipeline.word_number = &word_number;
+    pipeline.playback = &playback;
+
+    ok &= print_if_fail(pipeline_run(&pipeline) == MF_NO_ERROR, "FAIL: pipeline_run (1)");
+    fputc('\0', mfp.out_file);
+    fclose(mfp.out_file);
+    fclose(mfp.in_file);
+
+    ok &= print_if_fail(strcmp(output, "TOM andsign JERRY\nquote CAFe unquote\nopenparen 1907 closeparen\nTHE END") == 0,
+                        "FAIL: pipeline_run (2)");
+    ok &= print_if_fail(word_number == 11 && pipeline.token_offset == strlen(text) - 3, "FAIL: pipeline_run (3)");
+    ok &= print_if_fail(pipeline.rings[0].written > 0 && pipeline.rings[2].written > 0 &&
+                        pipeline.rings[0].occupancy_most <= PIPE_RING_SIZE, "FAIL: pipeline_run (4)");
+
+    // written again from a copy of the words, from the start and from after the first token
+    FILE *copy = tmpfile();
+    char *records = NULL;
+    size_t size = 0;
+    size_t start = SIZE_MAX;
+
+    mfp.in_file = fmemopen((void *)text, strlen(text), "r");
+    mfp.out_file = fopen("/dev/null", "w");
+    pipeline.cache_file = copy;
+    ok &= print_if_fail(pipeline_run(&pipeline) == MF_NO_ERROR && pipeline.cache_complete, "FAIL: pipeline_run (5)");
+    fclose(mfp.out_file);
+    fclose(mfp.in_file);
+
+    size = ftell(copy);
+    records = malloc(size);
+    rewind(copy);
+    ok &= print_if_fail(records != NULL && fread(records, 1, size, copy) == size, "FAIL: pipeline_run (6)");
+    fclose(copy);
+
+    ok &= print_if_fail(pipeline_cached_start(records, size, 0, &start) && start == 0, "FAIL: pipeline_cached_start (1)");
+    ok &= print_if_fail(!pipeline_cached_start(records, size, 5, &start), "FAIL: pipeline_cached_start (2)");
+    ok &= print_if_fail(!pipeline_cached_start(records, size - 8, 0, &start), "FAIL: pipeline_cached_start (3)");
+    ok &= print_if_fail(pipeline_cached_start(records, size, 4, &start) && start > 0, "FAIL: pipeline_cached_start (4)");
+
+    word_number = 0;
+    init_playback(&playback, &mfp);
+    mfp.in_file = NULL;
+    mfp.out_file = fmemopen(output, sizeof(output), "w");
+    pipeline.cache_file = NULL;
+    pipeline.cached = records + start;
+    pipeline.cached_size = size - start;
+    pipeline.buffer_index = 4;
+    ok &= print_if_fail(pipeline_run(&pipeline) == MF_NO_ERROR, "FAIL: pipeline_run (7)");
+    fputc('\0', mfp.out_file);
+    fclose(mfp.out_file);
+
+    ok &= print_if_fail(strcmp(output, "andsign JERRY quote\nCAFe unquote openparen\n1907 closeparen THE\nEND") == 0 &&
+                        pipeline.token_offset == strlen(text) - 3 && size < 3 * strlen(text), "FAIL: pipeline_run (8)");
+    free(records);
+    pipeline.buffer_index = 0;
+
+    // bytes are read in the charset of the text, and offsets are still those of the bytes
+    const char *cyrillic = "\xCC\xE8\xF0 \x97 \x93\xEC\xE8\xF0\x94";
+
+    word_number = 0;
+    init_playback(&playback, &mfp);
+    mfp.in_file = fmemopen((void *)cyrillic, strlen(cyrillic), "r");
+    mfp.out_file = fmemopen(output, sizeof(output), "w");
+    pipeline.cached = NULL;
+    pipeline.charset = CHARSET_WINDOWS_1251;
+    ok &= print_if_fail(pipeline_run(&pipeline) == MF_NO_ERROR, "FAIL: pipeline_run (9)");
+    fputc('\0', mfp.out_file);
+    fclose(mfp.out_file);
+    fclose(mfp.in_file);
+
+    ok &= print_if_fail(strcmp(output, "Mir dash quote\nmir unquote") == 0 && pipeline.token_offset == strlen(cyrillic) - 5,
+                        "FAIL: pipeline_run (10)");
+
+    // stopping does not wait for more piped input, with the pipe still open
+    int fds[2] = { -1, -1 };
+
+    word_number = 0;
+    mfp.word_count = 2;
+    init_playback(&playback, &mfp);
+    ok &= print_if_fail(pipe(fds) == 0 && write(fds[1], "one two three\n", 14) == 14, "FAIL: pipeline_run (11)");
+    mfp.in_file = fdopen(fds[0], "r");
+    mfp.out_file = fmemopen(output, sizeof(output), "w");
+    pipeline.charset = CHARSET_UNKNOWN;
+    ok &= print_if_fail(pipeline_run(&pipeline) == MF_EXIT && !pipeline.input_ended, "FAIL: pipeline_run (12)");
+    fputc('\0', mfp.out_file);
+    fclose(mfp.out_file);
+    ok &= print_if_fail(strcmp(output, "ONE TWO") == 0, "FAIL: pipeline_run (13)");
+
+    // and is read to its end once closed, with a line split across writes
+    word_number = 0;
+    mfp.word_count = DEFAULT;
+    init_playback(&playback, &mfp);
+    ok &= print_if_fail(write(fds[1], "fo", 2) == 2 && write(fds[1], "ur five", 7) == 7 && close(fds[1]) == 0,
+                        "FAIL: pipeline_run (14)");
+    mfp.out_file = fmemopen(output, sizeof(output), "w");
+    ok &= print_if_fail(pipeline_run(&pipeline) == MF_NO_ERROR && pipeline.input_ended, "FAIL: pipeline_run (15)");
+    fputc('\0', mfp.out_file);
+    fclose(mfp.out_file);
+    fclose(mfp.in_file);
+    ok &= print_if_fail(strcmp(output, "FOUR FIVE") == 0, "FAIL: pipeline_run (16)");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,125 @@
+//
+//  pipeline.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef pipeline_h
+#define pipeline_h
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "markers.h"
+#include "morsefeed.h"
+#include "seen.h"
+#include "vector.h"
+
+// Text is converted by four stages, each on its own thread: reading the file, the URL or the
+// linked pages and splitting it into tokens; removing HTML tags and entities; converting tokens
+// to words; and writing words in rows to the output or to mbeep, which runs on the calling
+// thread. Each stage passes blocks of records to the next through a ring that only it writes
+// and only the next reads, so no locks are needed to pass blocks. A stage sleeps while the ring
+// it writes is full or the ring it reads is empty, and is woken by the other stage only then;
+// waits and how full each ring is are counted.
+#define PIPE_STAGES 4
+#define PIPE_RING_SIZE 16           // blocks, a power of 2
+#define PIPE_BLOCK_SIZE 16384       // bytes
+
+struct PipeBlock {
+    char *p;
+    size_t used;
+};
+typedef struct PipeBlock PipeBlock;
+
+struct PipeRing {
+    PipeBlock blocks[PIPE_RING_SIZE];
+    size_t head;                    // blocks written, changed only by the writer
+    size_t tail;                    // blocks read, changed only by the reader
+    // a stage waiting on the ring sleeps on wakeup, and is counted so the other knows to wake it
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+    int waiters;
+    // counted by the writer
+    size_t written;
+    size_t full_waits;
+    size_t occupancy_total;
+    size_t occupancy_most;
+    // counted by the reader
+    size_t empty_waits;
+};
+typedef struct PipeRing PipeRing;
+
+struct Pipeline {
+    // the first stage reads the text buffer, or the input file if there is none, or the linked pages
+    const MorseFeedParams *mfp;
+    BufferStruct *text_buffer;      // the current page, owned by the last stage once it starts
+    size_t buffer_index;
+    bool more_buffers;
+    const StringVector *linked_urls;
+    const StringVector *linked_titles;
+    BufferStruct *linked_pages;     // one per link, filled as they are read unless prefetched
+    bool prefetched;
+    const Markers *linked_markers;
+    size_t byte_budget;
+    size_t *bytes_used;
+    bool filter_html;
+    bool decompressing;             // the input file is a compressed file read as it is decompressed
+    Charset charset;                // of the text buffer or the input file
+
+    // the last stage writes words
+    FILE *pipe_to_mbeep;
+    FILE *pipe_from_mbeep;
+    bool use_key_control;
+    int *word_number;
+    PlaybackState *playback;
+    SeenSet *seen;                  // or NULL
+    size_t token_offset;            // after the last token written
+    bool stopped_reading;           // the rest of the input file was skipped
+    bool input_ended;               // the input file was read to its end
+
+    // words converted before, written instead of converting the text, or NULL
+    const char *cached;
+    size_t cached_size;
+    // or else where to keep a copy of the words as they are converted, or NULL
+    FILE *cache_file;
+    bool cache_complete;            // all words were copied
+
+    PipeRing rings[PIPE_STAGES - 1];
+    int stopped;                    // the last stage is done
+    int stop_fds[2];                // readable once it is, for the first stage waiting on a stream
+    size_t skip_before;             // pages before this are skipped
+};
+typedef struct Pipeline Pipeline;
+
+bool is_regular_file(FILE *file);
+bool pipeline_cached_start(const char *records, size_t size, size_t offset, size_t *start);
+MorseFeedError pipeline_run(Pipeline *pipeline);
+void pipeline_print_stats(const Pipeline *pipeline);
+
+#if DEBUG
+void pipeline_tests(void);
+#endif
+
+#endif /* pipeline_h */
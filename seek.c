@@ -0,0 +1,406 @@
+//
+//  seek.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "compressed.h"
+#include "seek.h"
+
+#define INDEX_MAGIC "MFINDEX2"
+
+bool count_word(void *context, char *word, WordRule rule);
+bool count_word(void *context, char *word, WordRule rule)
+{
+    (void)word;
+    (void)rule;
+    (*(uint64_t *)context)++;
+
+    return true;
+}
+
+// The number of words a token of a plain text file is converted to.
+uint64_t token_words(const char *token);
+uint64_t token_words(const char *token)
+{
+    char stripped[STRIPPED_SIZE];
+    bool excluding_tag = false;
+    char entity[ENTITY_SIZE] = "";
+    char tag[TAG_SIZE] = "";
+    uint64_t words = 0;
+
+    strip_token(token, stripped, false, &excluding_tag, entity, tag);
+    convert_token(stripped, count_word, &words);
+
+    return words;
+}
+
+void word_index_build(WordIndex *index, const char *text, size_t length, Charset charset)
+{
+    const CharsetBytes *table = charset_table(charset);
+    char token[LINE_SIZE + sizeof(uint32_t)];
+    size_t position = 0;
+    size_t start;
+    uint64_t words = 0;
+
+    vector_free(&index->entries);
+    index->entries = vector_create(length / (6 * WORD_INDEX_STEP) + 1, sizeof(WordIndexEntry));
+
+    while (next_token(text, length, &position, table, token, &start)) {
+        uint64_t count = token_words(token);
+
+        // a token converted to many words may hold more than one
+        while (index->entries.size * WORD_INDEX_STEP < words + count) {
+            WordIndexEntry entry = { start, words };
+            if (!vector_push(&index->entries, &entry)) break;
+        }
+
+        words += count;
+    }
+
+    memcpy(index->header.magic, INDEX_MAGIC, sizeof(index->header.magic));
+    index->header.text_length = length;
+    index->header.charset = charset;
+    index->header.step = WORD_INDEX_STEP;
+    index->header.words = words;
+    index->header.count = index->entries.size;
+    index->built = true;
+}
+
+char *word_index_path(const char *state_path, const char *path);
+char *word_index_path(const char *state_path, const char *path)
+{
+    char *dir = malloc(strlen(state_path) + strlen(WORD_INDEX_SUFFIX) + 32);
+    char *full_path = realpath(path, NULL);
+    const char *name = full_path != NULL ? full_path : path;
+
+    if (dir != NULL) {
+        sprintf(dir, "%s%s", state_path, WORD_INDEX_SUFFIX);
+
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+            free(dir);
+            dir = NULL;
+
+        } else {
+            sprintf(dir + strlen(dir), "/%016llx", (unsigned long long)cache_hash(name, strlen(name), 0));
+        }
+    }
+
+    free(full_path);
+
+    return dir;
+}
+
+bool read_word_index(WordIndex *index, const char *index_path, const struct stat *info, size_t length,
+                     Charset charset);
+bool read_word_index(WordIndex *index, const char *index_path, const struct stat *info, size_t length,
+                     Charset charset)
+{
+    FILE *file = fopen(index_path, "r");
+    WordIndexHeader header;
+    bool valid = false;
+
+    if (file == NULL) return false;
+
+    if (fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, INDEX_MAGIC, sizeof(header.magic)) == 0 &&
+        header.file_size == (uint64_t)info->st_size && header.text_length == length && header.charset == charset &&
+        header.modified_seconds == info->st_mtim.tv_sec && header.modified_nanoseconds == info->st_mtim.tv_nsec &&
+        header.step == WORD_INDEX_STEP && header.count == (header.words + WORD_INDEX_STEP - 1) / WORD_INDEX_STEP) {
+
+        vector_free(&index->entries);
+        index->entries = vector_create(header.count + 1, sizeof(WordIndexEntry));
+
+        if (index->entries.p != NULL &&
+            fread(index->entries.p, sizeof(WordIndexEntry), header.count, file) == header.count) {
+            index->entries.size = header.count;
+            index->header = header;
+            valid = true;
+        }
+    }
+
+    fclose(file);
+
+    return valid;
+}
+
+void write_word_index(const WordIndex *index, const char *index_path);
+void write_word_index(const WordIndex *index, const char *index_path)
+{
+    char *temp_path = malloc(strlen(index_path) + strlen(".XXXXXX") + 1);
+    int fd = -1;
+    FILE *file = NULL;
+    bool written = false;
+
+    if (temp_path == NULL) return;
+
+    sprintf(temp_path, "%s.XXXXXX", index_path);
+    fd = mkstemp(temp_path);
+    if (fd >= 0) file = fdopen(fd, "w");
+
+    if (file != NULL) {
+        written = fwrite(&index->header, sizeof(index->header), 1, file) == 1 &&
+                  fwrite(index->entries.p, sizeof(WordIndexEntry), index->entries.size, file) == index->entries.size;
+        written &= fclose(file) == 0;
+
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    // another run may be writing the same index; either is complete
+    if (fd >= 0 && (!written || rename(temp_path, index_path) != 0)) remove(temp_path);
+
+    free(temp_path);
+}
+
+// The index of the file at path, whose text is loaded. It is read from the directory next to
+// the state file if the file is the same size and was modified at the same time as when it was
+// written, and otherwise built and written there. With no state file, it is only built.
+MorseFeedError word_index_open(WordIndex *index, const char *state_path, const char *path,
+                               const char *text, size_t length, Charset charset)
+{
+    struct stat info;
+    char *index_path = NULL;
+    bool have_info = path != NULL && stat(path, &info) == 0;
+
+    memset(index, 0, sizeof(*index));
+
+    if (have_info && state_path != NULL) {
+        index_path = word_index_path(state_path, path);
+        if (index_path != NULL && read_word_index(index, index_path, &info, length, charset)) {
+            free(index_path);
+            return MF_NO_ERROR;
+        }
+    }
+
+    word_index_build(index, text, length, charset);
+
+    if (index->entries.p == NULL) {
+        free(index_path);
+        return MF_OUT_OF_MEMORY;
+    }
+
+    if (have_info) {
+        index->header.file_size = info.st_size;
+        index->header.modified_seconds = info.st_mtim.tv_sec;
+        index->header.modified_nanoseconds = info.st_mtim.tv_nsec;
+        if (index_path != NULL) write_word_index(index, index_path);
+    }
+
+    free(index_path);
+
+    return MF_NO_ERROR;
+}
+
+// Where the token the word numbered from 0 was converted from begins, or length if the text has
+// fewer words.
+size_t word_index_seek(const WordIndex *index, const char *text, size_t length, size_t word)
+{
+    return word_index_seek_from(index, text, length, 0, word);
+}
+
+// As word_index_seek, for text that holds only the text of the file from text_offset on, which
+// must be at or before the token of the index entry for the word. Offsets are in the whole text.
+size_t word_index_seek_from(const WordIndex *index, const char *text, size_t length, size_t text_offset,
+                            size_t word)
+{
+    const CharsetBytes *table = charset_table((Charset)index->header.charset);
+    char token[LINE_SIZE + sizeof(uint32_t)];
+    const WordIndexEntry *entry;
+    size_t position;
+    size_t start;
+    uint64_t first;
+
+    if (word >= index->header.words) return text_offset + length;
+
+    entry = (const WordIndexEntry *)index->entries.p + word / WORD_INDEX_STEP;
+    if (entry->offset < text_offset) return text_offset + length;
+    position = entry->offset - text_offset;
+
+    for (first = entry->word; next_token(text, length, &position, table, token, &start); ) {
+        first += token_words(token);
+        if (first > word) return text_offset + start;
+    }
+
+    return text_offset + length;
+}
+
+void word_index_free(WordIndex *index)
+{
+    vector_free(&index->entries);
+}
+
+// The first word that begins at or after percent of the way from start to end.
+size_t seek_percent(const char *text, size_t start, size_t end, double percent)
+{
+    size_t position;
+
+    if (percent <= 0 || end <= start) return start;
+    if (percent >= 100) return end;
+
+    position = start + (size_t)((end - start) * percent / 100);
+
+    if (position > start && !isspace((unsigned char)text[position - 1])) {
+        while (position < end && !isspace((unsigned char)text[position])) position++;
+    }
+    while (position < end && isspace((unsigned char)text[position])) position++;
+
+    return position;
+}
+
+// a word with only white space between it and start or a blank line
+bool is_paragraph_start(const char *text, size_t start, size_t position);
+bool is_paragraph_start(const char *text, size_t start, size_t position)
+{
+    int newlines = 0;
+
+    if (isspace((unsigned char)text[position])) return false;
+
+    while (position > start && isspace((unsigned char)text[position - 1])) {
+        if (text[--position] == '\n' && ++newlines == 2) return true;
+    }
+
+    return position == start;
+}
+
+// Where the paragraph that position is in begins, or, if it is at the start of one, the one
+// before; repeated paragraphs times. Paragraphs are separated by blank lines.
+size_t back_paragraphs(const char *text, size_t start, size_t position, int paragraphs)
+{
+    for ( ; paragraphs > 0 && position > start; paragraphs--) {
+        position--;
+        while (position > start && !is_paragraph_start(text, start, position)) position--;
+    }
+
+    return position;
+}
+
+#if DEBUG
+void seek_tests(void)
+{
+    bool ok = true;
+    WordIndex index;
+    CString text = cstring_create(0);
+    const char *paragraphs = "One two.\nThree\n\n  Four five.\n \nSix\nseven.";
+    char *index_path;
+    FILE *file;
+    int i;
+    printf("seek_tests()\n");
+
+    for (i = 0; i < 3 * WORD_INDEX_STEP + 5; i++) {
+        char word[16];
+        sprintf(word, i % 7 == 0 ? "w%d\n" : "w%d  ", i);
+        cstring_append(&text, word);
+    }
+
+    memset(&index, 0, sizeof(index));
+    word_index_build(&index, text.p, text.size - 1, CHARSET_UTF8);
+    ok &= print_if_fail(index.header.words == 3 * WORD_INDEX_STEP + 5 && index.header.count == 4, "FAIL: word_index_build (1)");
+    ok &= print_if_fail(word_index_seek(&index, text.p, text.size - 1, 0) == 0, "FAIL: word_index_seek (1)");
+    ok &= print_if_fail(strncmp(text.p + word_index_seek(&index, text.p, text.size - 1, 1500), "w1500 ", 6) == 0,
+                        "FAIL: word_index_seek (2)");
+    ok &= print_if_fail(strncmp(text.p + word_index_seek(&index, text.p, text.size - 1, 2048), "w2048 ", 6) == 0,
+                        "FAIL: word_index_seek (3)");
+    ok &= print_if_fail(word_index_seek(&index, text.p, text.size - 1, 4000) == text.size - 1, "FAIL: word_index_seek (4)");
+
+    // from the entry before the word, with only the text from there to the next entry
+    size_t from = ((WordIndexEntry *)index.entries.p)[1].offset;
+    size_t to = ((WordIndexEntry *)index.entries.p)[2].offset;
+    ok &= print_if_fail(word_index_seek_from(&index, text.p + from, to - from, from, 1500) ==
+                        word_index_seek(&index, text.p, text.size - 1, 1500), "FAIL: word_index_seek_from (1)");
+    ok &= print_if_fail(word_index_seek_from(&index, text.p + from, to - from, from, 500) == to,
+                        "FAIL: word_index_seek_from (2)");
+    word_index_free(&index);
+
+    // counted as converted, a token to as many words as it is converted to
+    word_index_build(&index, "a-b c", 5, CHARSET_UTF8);
+    ok &= print_if_fail(index.header.words == 4, "FAIL: word_index_build (2)");
+    ok &= print_if_fail(word_index_seek(&index, "a-b c", 5, 2) == 0 && word_index_seek(&index, "a-b c", 5, 3) == 4,
+                        "FAIL: word_index_seek (5)");
+    word_index_free(&index);
+
+    // kept next to the state file while the file is the same
+    file = fopen("seek.tmp", "w");
+    fwrite(text.p, text.size - 1, 1, file);
+    fclose(file);
+    word_index_open(&index, "state.tmp", "seek.tmp", text.p, text.size - 1, CHARSET_UTF8);
+    ok &= print_if_fail(index.built && index.header.count == 4, "FAIL: word_index_open (1)");
+    word_index_free(&index);
+    word_index_open(&index, "state.tmp", "seek.tmp", text.p, text.size - 1, CHARSET_UTF8);
+    ok &= print_if_fail(!index.built && index.header.count == 4 &&
+                        strncmp(text.p + word_index_seek(&index, text.p, text.size - 1, 3071), "w3071", 5) == 0,
+                        "FAIL: word_index_open (2)");
+    word_index_free(&index);
+    file = fopen("seek.tmp", "w");
+    fwrite(paragraphs, strlen(paragraphs), 1, file);
+    fclose(file);
+    word_index_open(&index, "state.tmp", "seek.tmp", paragraphs, strlen(paragraphs), CHARSET_UTF8);
+    ok &= print_if_fail(index.built && index.header.words == 7, "FAIL: word_index_open (3)");
+    word_index_free(&index);
+
+    // a compressed file is indexed by the text it holds
+    file = fopen("seek.tmp", "w");
+    write_gzip(file, paragraphs, strlen(paragraphs));
+    fclose(file);
+    word_index_open(&index, "state.tmp", "seek.tmp", paragraphs, strlen(paragraphs), CHARSET_UTF8);
+    word_index_free(&index);
+    word_index_open(&index, "state.tmp", "seek.tmp", paragraphs, strlen(paragraphs), CHARSET_UTF8);
+    ok &= print_if_fail(!index.built && index.header.words == 7, "FAIL: word_index_open (4)");
+    word_index_free(&index);
+
+    index_path = word_index_path("state.tmp", "seek.tmp");
+    remove(index_path);
+    free(index_path);
+    rmdir("state.tmp" WORD_INDEX_SUFFIX);
+    remove("seek.tmp");
+
+    ok &= print_if_fail(seek_percent(paragraphs, 0, strlen(paragraphs), 0) == 0, "FAIL: seek_percent (1)");
+    ok &= print_if_fail(seek_percent(paragraphs, 0, strlen(paragraphs), 10) == 4, "FAIL: seek_percent (2)");
+    ok &= print_if_fail(seek_percent(paragraphs, 0, strlen(paragraphs), 50) == 23, "FAIL: seek_percent (3)");
+    ok &= print_if_fail(seek_percent(paragraphs, 4, 8, 50) == 8, "FAIL: seek_percent (4)");
+    ok &= print_if_fail(seek_percent(paragraphs, 0, strlen(paragraphs), 100) == strlen(paragraphs), "FAIL: seek_percent (5)");
+
+    ok &= print_if_fail(back_paragraphs(paragraphs, 0, 36, 1) == 31, "FAIL: back_paragraphs (1)");
+    ok &= print_if_fail(back_paragraphs(paragraphs, 0, 31, 1) == 18, "FAIL: back_paragraphs (2)");
+    ok &= print_if_fail(back_paragraphs(paragraphs, 0, 36, 2) == 18, "FAIL: back_paragraphs (3)");
+    ok &= print_if_fail(back_paragraphs(paragraphs, 0, 23, 5) == 0, "FAIL: back_paragraphs (4)");
+    ok &= print_if_fail(back_paragraphs(paragraphs, 4, 23, 1) == 18, "FAIL: back_paragraphs (5)");
+    ok &= print_if_fail(back_paragraphs(paragraphs, 4, 18, 1) == 4, "FAIL: back_paragraphs (6)");
+
+    cstring_free(&text);
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,87 @@
+//
+//  seek.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef seek_h
+#define seek_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "morsefeed.h"
+#include "vector.h"
+
+// Places to start a plain text file other than the saved position: a word number, a percentage
+// of the text, or a number of paragraphs back. Words are counted as they are converted, as for a
+// book or --connect, and a word number starts at the token the word was converted from. The
+// token of every WORD_INDEX_STEP-th word is kept in an index, so that a seek converts at most
+// that many words; it is built in one pass over the text and kept in a directory next to the
+// state file, with the size and time the file was modified and the length of the text it holds,
+// which differs for a compressed file, and built again whenever any of them changes.
+#define WORD_INDEX_STEP 1024
+#define WORD_INDEX_SUFFIX ".index"
+
+struct WordIndexHeader {
+    char magic[8];
+    uint64_t file_size;             // on disk
+    int64_t modified_seconds;
+    int64_t modified_nanoseconds;
+    uint64_t text_length;           // decompressed, if it is compressed
+    uint64_t charset;               // converted as
+    uint64_t step;
+    uint64_t words;                 // in the whole file
+    uint64_t count;                 // entries that follow
+};
+typedef struct WordIndexHeader WordIndexHeader;
+
+struct WordIndexEntry {
+    uint64_t offset;                // of a token
+    uint64_t word;                  // the first converted from it
+};
+typedef struct WordIndexEntry WordIndexEntry;
+
+struct WordIndex {
+    WordIndexHeader header;
+    Vector entries;                 // WordIndexEntry of the tokens of words 0, WORD_INDEX_STEP...
+    bool built;                     // not read from the cache
+};
+typedef struct WordIndex WordIndex;
+
+void word_index_build(WordIndex *index, const char *text, size_t length, Charset charset);
+MorseFeedError word_index_open(WordIndex *index, const char *state_path, const char *path,
+                               const char *text, size_t length, Charset charset);
+size_t word_index_seek(const WordIndex *index, const char *text, size_t length, size_t word);
+size_t word_index_seek_from(const WordIndex *index, const char *text, size_t length, size_t text_offset,
+                            size_t word);
+void word_index_free(WordIndex *index);
+size_t seek_percent(const char *text, size_t start, size_t end, double percent);
+size_t back_paragraphs(const char *text, size_t start, size_t position, int paragraphs);
+
+#if DEBUG
+void seek_tests(void);
+#endif
+
+#endif /* seek_h */
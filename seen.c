@@ -0,0 +1,343 @@
+//
+//  seen.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "seen.h"
+
+#define SEEN_SUFFIX ".seen"
+#define LOCK_SUFFIX ".lock"
+#define SEEN_DAYS 60
+
+struct SeenEntry {
+    uint64_t hash;
+    long day;
+};
+typedef struct SeenEntry SeenEntry;
+
+long seen_today(void);
+long seen_today(void)
+{
+    return (long)(time(NULL) / (24 * 60 * 60));
+}
+
+uint64_t seen_hash(SeenSet *seen, const char *url);
+uint64_t seen_hash(SeenSet *seen, const char *url)
+{
+    return hash_bytes(url, strlen(url), seen->seed);
+}
+
+// by hash, then most recent first
+int compare_seen_entries(const void *a, const void *b);
+int compare_seen_entries(const void *a, const void *b)
+{
+    const SeenEntry *entry_a = a;
+    const SeenEntry *entry_b = b;
+
+    if (entry_a->hash != entry_b->hash) return entry_a->hash < entry_b->hash ? -1 : 1;
+
+    return entry_a->day > entry_b->day ? -1 : entry_a->day < entry_b->day;
+}
+
+// Adds rows of "hash<TAB>day" to entries; a missing file is the same as an empty one
+bool read_seen_file(const char *path, Vector *entries);
+bool read_seen_file(const char *path, Vector *entries)
+{
+    bool success = true;
+    FILE *file = fopen(path, "r");
+    unsigned long long hash;
+    long day;
+
+    if (file != NULL) {
+        while (success && fscanf(file, "%llx %ld", &hash, &day) == 2) {
+            SeenEntry entry = { hash, day };
+            success = vector_push(entries, &entry);
+        }
+
+        fclose(file);
+    }
+
+    return success;
+}
+
+MorseFeedError seen_open(SeenSet *seen, const char *state_path, const char *page_url)
+{
+    MorseFeedError error = MF_NO_ERROR;
+
+    seen->path = NULL;
+    seen->seed = hash_string(page_url);
+    seen->entries = vector_create(0, sizeof(SeenEntry));
+    seen->added = vector_create(0, sizeof(SeenEntry));
+
+    if (state_path != NULL) {
+        seen->path = malloc(strlen(state_path) + strlen(SEEN_SUFFIX) + 1);
+
+        if (seen->path == NULL) {
+            error = MF_OUT_OF_MEMORY;
+
+        } else {
+            strcpy(seen->path, state_path);
+            strcat(seen->path, SEEN_SUFFIX);
+
+            if (!read_seen_file(seen->path, &seen->entries)) error = MF_OUT_OF_MEMORY;
+            if (seen->entries.size > 1) qsort(seen->entries.p, seen->entries.size, sizeof(SeenEntry), compare_seen_entries);
+        }
+    }
+
+    return error;
+}
+
+bool seen_contains(SeenSet *seen, const char *url)
+{
+    SeenEntry key = { seen_hash(seen, url), 0 };
+    size_t low = 0;
+    size_t high = seen->entries.size;
+
+    // binary search of entries, ignoring day
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        uint64_t hash = ((SeenEntry *)seen->entries.p)[middle].hash;
+
+        if (hash == key.hash) return true;
+
+        if (hash < key.hash) {
+            low = middle + 1;
+
+        } else {
+            high = middle;
+        }
+    }
+
+    for (size_t k = 0; k < seen->added.size; k++) {
+        if (((SeenEntry *)seen->added.p)[k].hash == key.hash) return true;
+    }
+
+    return false;
+}
+
+bool seen_add(SeenSet *seen, const char *url)
+{
+    SeenEntry entry = { seen_hash(seen, url), seen_today() };
+
+    return vector_push(&seen->added, &entry);
+}
+
+// Removes links already seen from urls and titles, keeping them from aging out while the page
+// still links to them; returns the number removed
+size_t seen_filter(SeenSet *seen, StringVector *urls, StringVector *titles)
+{
+    StringVector new_urls = string_vector_create(urls->size);
+    StringVector new_titles = string_vector_create(titles->size);
+    size_t removed = 0;
+    bool mem_error = urls->size > 0 && (new_urls.p == NULL || new_titles.p == NULL);
+
+    for (size_t k = 0; k < urls->size && !mem_error; k++) {
+        const char *url = string_vector_at(urls, k);
+
+        if (seen_contains(seen, url)) {
+            seen_add(seen, url);
+            removed++;
+
+        } else {
+            mem_error = !string_vector_push(&new_urls, url) ||
+                !string_vector_push(&new_titles, string_vector_at(titles, k));
+        }
+    }
+
+    if (mem_error) {
+        // keep all links
+        string_vector_free(&new_urls);
+        string_vector_free(&new_titles);
+        removed = 0;
+
+    } else {
+        string_vector_free(urls);
+        string_vector_free(titles);
+        *urls = new_urls;
+        *titles = new_titles;
+    }
+
+    return removed;
+}
+
+// Merges entries added in this run into the file as it is now, since other runs may have
+// changed it, dropping duplicates and entries too old to keep
+MorseFeedError seen_save(SeenSet *seen)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    Vector all = vector_create(0, sizeof(SeenEntry));
+    char *lock_path = NULL;
+    char *temp_path = NULL;
+    int lock_fd = -1;
+    int fd = -1;
+    FILE *file = NULL;
+
+    if (seen->path == NULL || seen->added.size == 0) return MF_NO_ERROR;
+
+    lock_path = malloc(strlen(seen->path) + strlen(LOCK_SUFFIX) + 1);
+    temp_path = malloc(strlen(seen->path) + strlen(".XXXXXX") + 1);
+
+    if (lock_path == NULL || temp_path == NULL) {
+        error = MF_OUT_OF_MEMORY;
+
+    } else {
+        sprintf(lock_path, "%s" LOCK_SUFFIX, seen->path);
+        sprintf(temp_path, "%s.XXXXXX", seen->path);
+
+        lock_fd = open(lock_path, O_RDWR | O_CREAT, 0600);
+        if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) error = MF_POSITION_FILE_OPEN_ERROR;
+    }
+
+    if (error == MF_NO_ERROR && !read_seen_file(seen->path, &all)) error = MF_OUT_OF_MEMORY;
+
+    for (size_t k = 0; k < seen->added.size && error == MF_NO_ERROR; k++) {
+        if (!vector_push(&all, (SeenEntry *)seen->added.p + k)) error = MF_OUT_OF_MEMORY;
+    }
+
+    if (error == MF_NO_ERROR) {
+        qsort(all.p, all.size, sizeof(SeenEntry), compare_seen_entries);
+
+        fd = mkstemp(temp_path);
+        file = fd < 0 ? NULL : fdopen(fd, "w");
+        if (file == NULL) error = MF_POSITION_FILE_OPEN_ERROR;
+    }
+
+    if (error == MF_NO_ERROR) {
+        long oldest = seen_today() - SEEN_DAYS;
+        SeenEntry *entries = all.p;
+
+        for (size_t k = 0; k < all.size && error == MF_NO_ERROR; k++) {
+            // the first of each hash is the most recent
+            if ((k == 0 || entries[k].hash != entries[k - 1].hash) && entries[k].day >= oldest &&
+                fprintf(file, "%016llx\t%ld\n", (unsigned long long)entries[k].hash, entries[k].day) < 0) {
+                error = MF_FILE_WRITE_ERROR;
+            }
+        }
+
+        if (error == MF_NO_ERROR && (fflush(file) != 0 || fsync(fd) != 0)) error = MF_FILE_WRITE_ERROR;
+    }
+
+    if (file != NULL) {
+        if (fclose(file) != 0) error = MF_FILE_WRITE_ERROR;
+
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    if (fd >= 0) {
+        if (error == MF_NO_ERROR && rename(temp_path, seen->path) != 0) error = MF_FILE_WRITE_ERROR;
+        if (error != MF_NO_ERROR) remove(temp_path);
+    }
+
+    // closing releases the lock
+    if (lock_fd >= 0) close(lock_fd);
+
+    free(lock_path);
+    free(temp_path);
+    vector_free(&all);
+
+    return error;
+}
+
+void seen_close(SeenSet *seen)
+{
+    free(seen->path);
+    seen->path = NULL;
+    vector_free(&seen->entries);
+    vector_free(&seen->added);
+}
+
+#if DEBUG
+void seen_tests(void)
+{
+    bool ok = true;
+    SeenSet seen;
+    FILE *file;
+    printf("seen_tests()\n");
+
+    remove("seen.tmp" SEEN_SUFFIX);
+
+    ok &= print_if_fail(seen_open(&seen, "seen.tmp", "http://example.com/") == MF_NO_ERROR, "FAIL: seen_open (1)");
+    ok &= print_if_fail(!seen_contains(&seen, "http://example.com/one"), "FAIL: seen_contains (1)");
+    seen_add(&seen, "http://example.com/one");
+    seen_add(&seen, "http://example.com/two");
+    ok &= print_if_fail(seen_contains(&seen, "http://example.com/one"), "FAIL: seen_contains (2)");
+    ok &= print_if_fail(seen_save(&seen) == MF_NO_ERROR, "FAIL: seen_save (1)");
+
+    // an entry too old to keep
+    file = fopen("seen.tmp" SEEN_SUFFIX, "a");
+    fprintf(file, "%016llx\t%ld\n", (unsigned long long)seen_hash(&seen, "http://example.com/old"),
+            seen_today() - SEEN_DAYS - 1);
+    fclose(file);
+    seen_close(&seen);
+
+    // other pages have their own sets
+    seen_open(&seen, "seen.tmp", "http://example.org/");
+    ok &= print_if_fail(!seen_contains(&seen, "http://example.com/one"), "FAIL: seen_contains (3)");
+    seen_close(&seen);
+
+    seen_open(&seen, "seen.tmp", "http://example.com/");
+    ok &= print_if_fail(seen.entries.size == 3, "FAIL: seen_open (2)");
+    ok &= print_if_fail(seen_contains(&seen, "http://example.com/two"), "FAIL: seen_contains (4)");
+
+    StringVector urls = string_vector_create(3);
+    StringVector titles = string_vector_create(3);
+    string_vector_push(&urls, "http://example.com/one");
+    string_vector_push(&urls, "http://example.com/three");
+    string_vector_push(&urls, "http://example.com/two");
+    string_vector_push(&titles, "One");
+    string_vector_push(&titles, "Three");
+    string_vector_push(&titles, "Two");
+
+    ok &= print_if_fail(seen_filter(&seen, &urls, &titles) == 2, "FAIL: seen_filter (1)");
+    ok &= print_if_fail(urls.size == 1 && strcmp(string_vector_at(&urls, 0), "http://example.com/three") == 0 &&
+                        strcmp(string_vector_at(&titles, 0), "Three") == 0, "FAIL: seen_filter (2)");
+    ok &= print_if_fail(seen_save(&seen) == MF_NO_ERROR, "FAIL: seen_save (2)");
+    seen_close(&seen);
+
+    seen_open(&seen, "seen.tmp", "http://example.com/");
+    ok &= print_if_fail(seen.entries.size == 2, "FAIL: seen_save (3)");
+    ok &= print_if_fail(!seen_contains(&seen, "http://example.com/old"), "FAIL: seen_save (4)");
+    seen_close(&seen);
+
+    string_vector_free(&urls);
+    string_vector_free(&titles);
+    remove("seen.tmp" SEEN_SUFFIX);
+    remove("seen.tmp" SEEN_SUFFIX LOCK_SUFFIX);
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,59 @@
+//
+//  seen.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef seen_h
+#define seen_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "morsefeed.h"
+#include "vector.h"
+
+// Linked articles already played, so that following links again plays only new ones.
+// Each URL is kept as a 64-bit hash seeded by the page it was linked from, with the day it
+// was last played or last seen linked; entries not seen for SEEN_DAYS are dropped.
+// All pages share one file next to the state file.
+struct SeenSet {
+    char *path;         // NULL if not saved
+    uint64_t seed;
+    Vector entries;     // SeenEntry sorted by hash, as read
+    Vector added;       // SeenEntry played or seen linked in this run
+};
+typedef struct SeenSet SeenSet;
+
+MorseFeedError seen_open(SeenSet *seen, const char *state_path, const char *page_url);
+bool seen_contains(SeenSet *seen, const char *url);
+bool seen_add(SeenSet *seen, const char *url);
+size_t seen_filter(SeenSet *seen, StringVector *urls, StringVector *titles);
+MorseFeedError seen_save(SeenSet *seen);
+void seen_close(SeenSet *seen);
+
+#if DEBUG
+void seen_tests(void);
+#endif
+
+#endif /* seen_h */
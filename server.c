@@ -0,0 +1,947 @@
+//
+//  server.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+
+// Positions of clients are saved under the source with this prefix, apart from file positions
+#define SERVED_LABEL_PREFIX "served:"
+#define REPLY_SIZE 64
+
+// One connection, first reading its request, then sending the reply and the words.
+struct ServeClient {
+    int fd;
+    char request[LINE_SIZE];
+    size_t request_length;
+    char reply[REPLY_SIZE];
+    size_t reply_length;
+    size_t reply_sent;
+    ServedSource *served;   // or NULL until the request is read
+    size_t start;           // word asked for, kept while the source is converted
+    size_t offset;          // next byte of its words to send
+};
+typedef struct ServeClient ServeClient;
+
+bool socket_address(const char *socket_path, struct sockaddr_un *address);
+bool socket_address(const char *socket_path, struct sockaddr_un *address)
+{
+    bool fits = strlen(socket_path) < sizeof(address->sun_path);
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (fits) strcpy(address->sun_path, socket_path);
+
+    return fits;
+}
+
+// Splits "source\tstart" in place; start is 0 if not given.
+bool parse_request(char *line, const char **source, size_t *start)
+{
+    size_t length = strlen(line);
+    char *tab = NULL;
+    bool valid = true;
+
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) line[--length] = '\0';
+
+    *source = line;
+    *start = 0;
+    tab = strchr(line, '\t');
+
+    if (tab != NULL) {
+        char *end = NULL;
+
+        *tab = '\0';
+        if (tab[1] != '\0') {
+            *start = strtoul(tab + 1, &end, 10);
+            valid = isdigit((unsigned char)tab[1]) && *end == '\0';
+        }
+    }
+
+    return valid && **source != '\0';
+}
+
+// Copies the words of converted text, one per line, noting where each starts.
+MorseFeedError index_words(ServedSource *served, const char *text, size_t length)
+{
+    MorseFeedError error = MF_NO_ERROR;
+
+    served->length = 0;
+    served->words = malloc(length + 1);
+    served->word_starts = vector_create(0, sizeof(size_t));
+    if (served->words == NULL) error = MF_OUT_OF_MEMORY;
+
+    for (size_t k = 0; k < length && error == MF_NO_ERROR; k++) {
+        bool space = isspace((unsigned char)text[k]);
+
+        if (!space && (k == 0 || isspace((unsigned char)text[k - 1]))) {
+            if (!vector_push(&served->word_starts, &served->length)) error = MF_OUT_OF_MEMORY;
+        }
+
+        if (!space) served->words[served->length++] = text[k];
+
+        if (!space && (k + 1 == length || isspace((unsigned char)text[k + 1]))) {
+            served->words[served->length++] = '\n';
+        }
+    }
+
+    return error;
+}
+
+void free_served_source(ServedSource *served);
+void free_served_source(ServedSource *served)
+{
+    free(served->source);
+    free(served->words);
+    vector_free(&served->word_starts);
+    served->source = NULL;
+    served->words = NULL;
+}
+
+// Converts once for every client, so nothing that depends on one listener is used.
+MorseFeedError convert_source(ServedSource *served, const MorseFeedParams *defaults);
+MorseFeedError convert_source(ServedSource *served, const MorseFeedParams *defaults)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    MorseFeedParams mfp = *defaults;
+    StringVector string_storage = string_vector_create(0);
+    char *text = NULL;
+    size_t length = 0;
+
+    mfp.in_file_name = NULL;
+    mfp.in_file = NULL;
+    mfp.out_file = NULL;
+    mfp.url = NULL;
+
+    if (strstr(served->source, "://") != NULL) {
+        mfp.url = served->source;
+
+    } else {
+        error = read_state(served->source, &mfp, &string_storage);
+    }
+
+    if (error == MF_NO_ERROR && mfp.url == NULL) {
+        mfp.in_file = mfp.in_file_name == NULL ? NULL : fopen(mfp.in_file_name, "r");
+        if (mfp.in_file == NULL) error = MF_INPUT_FILE_OPEN_ERROR;
+    }
+
+    mfp.words_per_row = 1;
+    mfp.word_count = DEFAULT;
+    mfp.fork_mbeep = false;
+    mfp.save_and_use_position = false;
+    mfp.show_progress = false;
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.start_word = DEFAULT;
+    mfp.start_offset = DEFAULT;
+    mfp.start_percent = DEFAULT;
+    mfp.back_paragraphs = DEFAULT;
+
+    if (error == MF_NO_ERROR) {
+        mfp.out_file = open_memstream(&text, &length);
+        if (mfp.out_file == NULL) error = MF_OUT_OF_MEMORY;
+    }
+
+    // with no word count or time limit, only a signal stops it early, and what it has is not kept
+    if (error == MF_NO_ERROR) error = process_and_send(mfp);
+
+    if (mfp.out_file != NULL && fclose(mfp.out_file) != 0 && error == MF_NO_ERROR) error = MF_OUT_OF_MEMORY;
+    if (mfp.in_file != NULL) fclose(mfp.in_file);
+
+    if (error == MF_NO_ERROR) {
+        error = index_words(served, text, length);
+        served->converted_at = monotonic_seconds();
+    }
+
+    free(text);
+    string_vector_free(&string_storage);
+
+    return error;
+}
+
+// A source converted on a thread of its own. When it is done, it is written to the pipe the
+// serve loop polls, which puts the words in place.
+struct ServeConversion {
+    pthread_t thread;
+    ServedSource *served;           // replaced by fresh, or given its words if it has none yet
+    ServedSource fresh;
+    MorseFeedParams defaults;
+    MorseFeedError error;
+    int done_fd;
+};
+typedef struct ServeConversion ServeConversion;
+
+void *conversion_thread(void *arg);
+void *conversion_thread(void *arg)
+{
+    ServeConversion *conversion = arg;
+
+    conversion->error = convert_source(&conversion->fresh, &conversion->defaults);
+
+    // a pointer is written whole to a pipe
+    if (write(conversion->done_fd, &conversion, sizeof(conversion)) != sizeof(conversion)) {
+        fprintf(stderr, "(could not finish converting %s)\n", conversion->fresh.source);
+    }
+
+    return NULL;
+}
+
+MorseFeedError start_conversion(ServedSource *served, const MorseFeedParams *defaults, int done_fd);
+MorseFeedError start_conversion(ServedSource *served, const MorseFeedParams *defaults, int done_fd)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    ServeConversion *conversion = calloc(1, sizeof(ServeConversion));
+
+    if (conversion != NULL) {
+        conversion->fresh.source = strdup(served->source);
+        conversion->fresh.word_starts = vector_create(0, sizeof(size_t));
+    }
+
+    if (conversion == NULL || conversion->fresh.source == NULL) {
+        error = MF_OUT_OF_MEMORY;
+
+    } else {
+        conversion->served = served;
+        conversion->defaults = *defaults;
+        conversion->done_fd = done_fd;
+
+        fprintf(stderr, "(converting %s)\n", served->source);
+        if (pthread_create(&conversion->thread, NULL, conversion_thread, conversion) != 0) error = MF_OUT_OF_MEMORY;
+    }
+
+    if (error == MF_NO_ERROR) {
+        served->converting = true;
+
+    } else if (conversion != NULL) {
+        free(conversion->fresh.source);
+        free(conversion);
+    }
+
+    return error;
+}
+
+// Finds source, adding it to be converted if new, and converting it again if stale. Until a new
+// source is converted it has no words.
+MorseFeedError find_source(Vector *sources, const char *source, const MorseFeedParams *defaults, int done_fd,
+                           ServedSource **found);
+MorseFeedError find_source(Vector *sources, const char *source, const MorseFeedParams *defaults, int done_fd,
+                           ServedSource **found)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    ServedSource *served = NULL;
+
+    for (size_t k = 0; k < sources->size && served == NULL; k++) {
+        if (strcmp(((ServedSource **)sources->p)[k]->source, source) == 0) served = ((ServedSource **)sources->p)[k];
+    }
+
+    if (served == NULL) {
+        served = calloc(1, sizeof(ServedSource));
+        if (served != NULL) served->source = strdup(source);
+
+        if (served == NULL || served->source == NULL || !vector_push(sources, &served)) {
+            error = MF_OUT_OF_MEMORY;
+
+        } else {
+            served->word_starts = vector_create(0, sizeof(size_t));
+            error = start_conversion(served, defaults, done_fd);
+            if (error != MF_NO_ERROR) sources->size--;
+        }
+
+        if (error != MF_NO_ERROR && served != NULL) {
+            free_served_source(served);
+            free(served);
+            served = NULL;
+        }
+
+    } else if (!served->converting && monotonic_seconds() - served->converted_at > SERVE_REFRESH_SECONDS) {
+        // the copy there is still sent, and if it cannot be started now it is tried next time
+        start_conversion(served, defaults, done_fd);
+    }
+
+    *found = served;
+
+    return error;
+}
+
+// Sends the words of the source from start, once it has them.
+void start_streaming(ServeClient *client);
+void start_streaming(ServeClient *client)
+{
+    ServedSource *served = client->served;
+    size_t count = served->word_starts.size;
+    size_t start = client->start < count ? client->start : count;
+
+    client->offset = start < count ? ((size_t *)served->word_starts.p)[start] : served->length;
+
+    snprintf(client->reply, REPLY_SIZE, "ok\t%ld\t%ld\n", (long)start, (long)count);
+    client->reply_length = strlen(client->reply);
+    fprintf(stderr, "(streaming %s from word %ld of %ld)\n", served->source, (long)start, (long)count);
+}
+
+void reply_error(ServeClient *client, MorseFeedError error);
+void reply_error(ServeClient *client, MorseFeedError error)
+{
+    snprintf(client->reply, REPLY_SIZE, "error\t%d\n", error);
+    client->reply_length = strlen(client->reply);
+}
+
+void handle_request(ServeClient *client, Vector *sources, const MorseFeedParams *defaults, int done_fd);
+void handle_request(ServeClient *client, Vector *sources, const MorseFeedParams *defaults, int done_fd)
+{
+    const char *source = NULL;
+    ServedSource *served = NULL;
+    MorseFeedError error = parse_request(client->request, &source, &client->start) ? MF_NO_ERROR : MF_INVALID_VALUE;
+
+    if (error == MF_NO_ERROR) error = find_source(sources, source, defaults, done_fd, &served);
+
+    if (error == MF_NO_ERROR) {
+        client->served = served;
+        served->clients++;
+
+        // otherwise the reply waits for the source to be converted
+        if (served->words != NULL) start_streaming(client);
+
+    } else {
+        reply_error(client, error);
+    }
+}
+
+// Returns false when the client has all it asked for, or is gone.
+bool client_read(ServeClient *client, Vector *sources, const MorseFeedParams *defaults, int done_fd);
+bool client_read(ServeClient *client, Vector *sources, const MorseFeedParams *defaults, int done_fd)
+{
+    ssize_t count = recv(client->fd, client->request + client->request_length,
+                         LINE_SIZE - 1 - client->request_length, 0);
+    bool open = count > 0 || (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR));
+
+    if (count > 0 && client->served == NULL) {
+        client->request_length += count;
+        client->request[client->request_length] = '\0';
+
+        if (strchr(client->request, '\n') != NULL) {
+            handle_request(client, sources, defaults, done_fd);
+
+        } else if (client->request_length == LINE_SIZE - 1) {
+            reply_error(client, MF_INVALID_VALUE);
+        }
+    }
+
+    return open;
+}
+
+bool client_send(ServeClient *client);
+bool client_send(ServeClient *client)
+{
+    const ServedSource *served = client->served;
+    ssize_t sent = 0;
+    bool more;
+
+    if (client->reply_sent < client->reply_length) {
+        sent = send(client->fd, client->reply + client->reply_sent,
+                    client->reply_length - client->reply_sent, MSG_NOSIGNAL);
+        if (sent > 0) client->reply_sent += sent;
+
+    } else if (served != NULL && client->offset < served->length) {
+        size_t chunk = served->length - client->offset < SERVE_CHUNK ? served->length - client->offset : SERVE_CHUNK;
+
+        sent = send(client->fd, served->words + client->offset, chunk, MSG_NOSIGNAL);
+        if (sent > 0) client->offset += sent;
+    }
+
+    more = client->reply_sent < client->reply_length || (served != NULL && client->offset < served->length);
+    if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) more = false;
+
+    return more;
+}
+
+void close_client(ServeClient *client);
+void close_client(ServeClient *client)
+{
+    ServedSource *served = client->served;
+
+    if (served != NULL && --served->clients == 0 && served->retired) {
+        free_served_source(served);
+        free(served);
+    }
+
+    close(client->fd);
+}
+
+// Puts the words of a finished conversion in place, and replies to the clients waiting for them.
+// A copy still being sent is replaced in sources, and kept until its last client is done.
+void finish_conversion(ServeConversion *conversion, Vector *sources, ServeClient *clients, size_t client_count);
+void finish_conversion(ServeConversion *conversion, Vector *sources, ServeClient *clients, size_t client_count)
+{
+    ServedSource *served = conversion->served;
+    ServedSource *fresh = NULL;
+    MorseFeedError error = conversion->error;
+    size_t index = 0;
+
+    pthread_join(conversion->thread, NULL);
+    served->converting = false;
+
+    while (index < sources->size && ((ServedSource **)sources->p)[index] != served) index++;
+
+    if (error == MF_NO_ERROR && served->words == NULL) {
+        free(conversion->fresh.source);
+        conversion->fresh.source = served->source;
+        conversion->fresh.clients = served->clients;
+        *served = conversion->fresh;
+
+    } else if (error == MF_NO_ERROR && served->clients == 0) {
+        free_served_source(served);
+        *served = conversion->fresh;
+
+    } else if (error == MF_NO_ERROR && (fresh = malloc(sizeof(ServedSource))) != NULL) {
+        *fresh = conversion->fresh;
+        vector_replace_at(sources, index, &fresh, NULL);
+        served->retired = true;
+
+    } else {
+        if (error == MF_NO_ERROR) error = MF_OUT_OF_MEMORY;
+        free_served_source(&conversion->fresh);
+
+        // a stale copy is still sent, and not converted again until it is stale again
+        served->converted_at = monotonic_seconds();
+    }
+
+    for (size_t k = 0; k < client_count; k++) {
+        if (clients[k].served == served && clients[k].reply_length == 0) {
+            if (served->words != NULL) {
+                start_streaming(&clients[k]);
+
+            } else {
+                reply_error(&clients[k], error);
+            }
+        }
+    }
+
+    // a new source that could not be converted is tried again by the next request for it
+    if (served->words == NULL) {
+        vector_delete_at(sources, index, NULL);
+        for (size_t k = 0; k < client_count; k++) {
+            if (clients[k].served == served) clients[k].served = NULL;
+        }
+        free_served_source(served);
+        free(served);
+    }
+
+    free(conversion);
+}
+
+// Serves until interrupted. Sources are converted on threads of their own, which hand them back
+// through a pipe that is polled with the clients, so words keep being sent meanwhile.
+MorseFeedError serve(const char *socket_path, const MorseFeedParams *defaults)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    struct sockaddr_un address;
+    int listen_fd = -1;
+    int done_pipe[2] = { -1, -1 };
+    bool signals = false;
+    ServeClient clients[SERVE_CLIENTS];
+    size_t client_count = 0;
+    size_t converting = 0;
+    Vector sources = vector_create(0, sizeof(ServedSource *));
+
+    if (!socket_address(socket_path, &address)) error = MF_INVALID_VALUE;
+    if (error == MF_NO_ERROR) {
+        error = signals_open();
+        signals = error == MF_NO_ERROR;
+    }
+
+    if (error == MF_NO_ERROR && (pipe(done_pipe) != 0 || fcntl(done_pipe[0], F_SETFL, O_NONBLOCK) != 0)) {
+        error = MF_PIPE_ERROR;
+    }
+
+    if (error == MF_NO_ERROR) {
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(socket_path);
+
+        if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+            listen(listen_fd, SERVE_CLIENTS) != 0 || fcntl(listen_fd, F_SETFL, O_NONBLOCK) != 0) {
+            error = MF_SOCKET_ERROR;
+        }
+    }
+
+    if (error == MF_NO_ERROR) fprintf(stderr, "(serving on %s)\n", socket_path);
+
+    while (error == MF_NO_ERROR && signal_received() == 0) {
+        struct pollfd polled[SERVE_CLIENTS + 3];
+
+        polled[0].fd = listen_fd;
+        polled[0].events = client_count < SERVE_CLIENTS ? POLLIN : 0;
+
+        // a client waiting for its source to be converted is only watched for hanging up
+        for (size_t k = 0; k < client_count; k++) {
+            polled[k + 1].fd = clients[k].fd;
+            polled[k + 1].events = clients[k].reply_length > 0 ? POLLOUT : clients[k].served == NULL ? POLLIN : 0;
+        }
+
+        polled[client_count + 1].fd = signals_fd();
+        polled[client_count + 1].events = POLLIN;
+        polled[client_count + 2].fd = done_pipe[0];
+        polled[client_count + 2].events = POLLIN;
+
+        if (poll(polled, client_count + 3, -1) < 0) {
+            if (errno != EINTR) error = MF_SOCKET_ERROR;
+
+        } else {
+            ServeConversion *conversion;
+
+            // before clients, so that those waiting are replied to when next polled
+            if (polled[client_count + 2].revents & POLLIN) {
+                while (read(done_pipe[0], &conversion, sizeof(conversion)) == sizeof(conversion)) {
+                    finish_conversion(conversion, &sources, clients, client_count);
+                }
+            }
+
+            // from the end, so that a closed client can be replaced by the last one
+            for (size_t k = client_count; k > 0; k--) {
+                ServeClient *client = &clients[k - 1];
+                bool open = true;
+
+                if (polled[k].revents & (POLLERR | POLLNVAL)) {
+                    open = false;
+
+                } else if (client->reply_length == 0 && (polled[k].revents & (POLLIN | POLLHUP))) {
+                    open = client_read(client, &sources, defaults, done_pipe[1]);
+
+                } else if (client->reply_length > 0 && (polled[k].revents & (POLLOUT | POLLHUP))) {
+                    open = client_send(client);
+                }
+
+                if (!open) {
+                    close_client(client);
+                    *client = clients[--client_count];
+                }
+            }
+
+            if (polled[0].revents & POLLIN) {
+                int fd = accept(listen_fd, NULL, NULL);
+
+                if (fd >= 0 && fcntl(fd, F_SETFL, O_NONBLOCK) == 0) {
+                    ServeClient *client = &clients[client_count++];
+
+                    client->fd = fd;
+                    client->request_length = 0;
+                    client->reply_length = 0;
+                    client->reply_sent = 0;
+                    client->served = NULL;
+                    client->start = 0;
+                    client->offset = 0;
+
+                } else if (fd >= 0) {
+                    close(fd);
+                }
+            }
+        }
+    }
+
+    for (size_t k = 0; k < client_count; k++) close_client(&clients[k]);
+    client_count = 0;
+
+    // conversions still running are waited for; a signal stops them early
+    for (size_t k = 0; k < sources.size; k++) {
+        if (((ServedSource **)sources.p)[k]->converting) converting++;
+    }
+
+    while (converting > 0) {
+        ServeConversion *conversion;
+        struct pollfd done = { done_pipe[0], POLLIN, 0 };
+
+        if (read(done_pipe[0], &conversion, sizeof(conversion)) == sizeof(conversion)) {
+            finish_conversion(conversion, &sources, clients, client_count);
+            converting--;
+
+        } else {
+            poll(&done, 1, -1);
+        }
+    }
+
+    for (size_t k = 0; k < sources.size; k++) {
+        free_served_source(((ServedSource **)sources.p)[k]);
+        free(((ServedSource **)sources.p)[k]);
+    }
+    vector_free(&sources);
+
+    if (listen_fd >= 0) {
+        close(listen_fd);
+        unlink(socket_path);
+    }
+
+    for (int k = 0; k < 2; k++) {
+        if (done_pipe[k] >= 0) close(done_pipe[k]);
+    }
+
+    if (signals) signals_close();
+
+    release_url_handle();
+
+    return error;
+}
+
+// Stand-in client: writes words from the server as morsefeed writes converted text,
+// so its output can be piped to another morsefeed with -m to be heard.
+MorseFeedError connect_server(const char *socket_path, const char *source, long start_word,
+                              MorseFeedParams mfp)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    struct sockaddr_un address;
+    char label[LINE_SIZE];
+    char line[LINE_SIZE];
+    char *word = NULL;
+    size_t word_size = 0;
+    ssize_t word_length;
+    int fd = -1;
+    FILE *stream = NULL;
+    long first = 0;
+    long total = 0;
+    int reply_error = 0;
+    int word_number = 0;
+
+    if (strpbrk(source, "\t\n") != NULL || !socket_address(socket_path, &address) ||
+        snprintf(label, LINE_SIZE, SERVED_LABEL_PREFIX "%s", source) >= LINE_SIZE) {
+        error = MF_INVALID_VALUE;
+    }
+
+    if (error == MF_NO_ERROR && start_word == DEFAULT && mfp.save_and_use_position) {
+        size_t position = 0;
+
+        error = read_saved_position(mfp.state_path, label, &position, NULL);
+        start_word = position;
+    }
+
+    if (start_word == DEFAULT) start_word = 0;
+    if (mfp.words_per_row == DEFAULT) mfp.words_per_row = 5;
+    if (mfp.out_file == NULL) mfp.out_file = stdout;
+
+    if (error == MF_NO_ERROR) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+            dprintf(fd, "%s\t%ld\n", source, start_word) < 0) {
+            error = MF_SOCKET_ERROR;
+        }
+    }
+
+    if (error == MF_NO_ERROR) {
+        stream = fdopen(fd, "r");
+        if (stream == NULL) error = MF_SOCKET_ERROR;
+    }
+
+    if (error == MF_NO_ERROR) {
+        if (fgets(line, LINE_SIZE, stream) == NULL) {
+            error = MF_SOCKET_ERROR;
+
+        } else if (sscanf(line, "error\t%d", &reply_error) == 1) {
+            error = reply_error > MF_NO_ERROR && reply_error < MF_UNKNOWN ? (MorseFeedError)reply_error : MF_UNKNOWN;
+
+        } else if (sscanf(line, "ok\t%ld\t%ld", &first, &total) != 2) {
+            error = MF_SOCKET_ERROR;
+        }
+    }
+
+    // read whole, so that a word longer than a line is still counted once
+    while (error == MF_NO_ERROR && (word_length = getline(&word, &word_size, stream)) > 0) {
+        if (word[word_length - 1] == '\n') word[--word_length] = '\0';
+
+        if (word_length > 0) {
+            error = write_word(word, mfp.out_file, NULL, NULL, mfp.words_per_row, &word_number,
+                               mfp.word_count, false, NULL);
+        }
+    }
+
+    if ((error == MF_NO_ERROR || error == MF_EXIT) && fprintf(mfp.out_file, "\n") < 0) {
+        error = MF_FILE_WRITE_ERROR;
+    }
+
+    if ((error == MF_NO_ERROR || error == MF_EXIT) && mfp.save_and_use_position) {
+        size_t position = first + word_number < total ? first + word_number : 0;
+
+        error = write_saved_position(mfp.state_path, label, position, 0);
+    }
+
+    if (stream != NULL) {
+        fclose(stream);
+
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    free(word);
+
+    return error;
+}
+
+#if DEBUG
+// Connects once the server in another process is listening, and returns what was written.
+MorseFeedError connect_when_listening(const char *socket_path, const char *source, long start_word,
+                                      MorseFeedParams mfp, char **output);
+MorseFeedError connect_when_listening(const char *socket_path, const char *source, long start_word,
+                                      MorseFeedParams mfp, char **output)
+{
+    MorseFeedError error = MF_SOCKET_ERROR;
+    size_t length = 0;
+
+    *output = NULL;
+
+    for (int k = 0; k < 500 && error == MF_SOCKET_ERROR; k++) {
+        struct timespec ts = { 0, 10000000L };
+
+        free(*output);
+        *output = NULL;
+        mfp.out_file = open_memstream(output, &length);
+        error = mfp.out_file == NULL ? MF_OUT_OF_MEMORY : connect_server(socket_path, source, start_word, mfp);
+        if (mfp.out_file != NULL) fclose(mfp.out_file);
+        if (error == MF_SOCKET_ERROR) nanosleep(&ts, NULL);
+    }
+
+    return error;
+}
+
+// A client on a thread of its own, for a source the server is still converting.
+struct WaitingClient {
+    pthread_t thread;
+    const char *source;
+    MorseFeedParams mfp;
+    char *output;
+    size_t length;
+    MorseFeedError error;
+};
+typedef struct WaitingClient WaitingClient;
+
+void *waiting_client_thread(void *arg);
+void *waiting_client_thread(void *arg)
+{
+    WaitingClient *waiting = arg;
+
+    waiting->mfp.out_file = open_memstream(&waiting->output, &waiting->length);
+    waiting->error = waiting->mfp.out_file == NULL ? MF_OUT_OF_MEMORY :
+                     connect_server("server.tmp.sock", waiting->source, 0, waiting->mfp);
+    if (waiting->mfp.out_file != NULL) fclose(waiting->mfp.out_file);
+
+    return NULL;
+}
+
+// Opens a fifo for writing once the server has it open for reading, or returns -1.
+int open_fifo_when_read(const char *path);
+int open_fifo_when_read(const char *path)
+{
+    int fd = -1;
+
+    for (int k = 0; k < 500 && fd < 0; k++) {
+        struct timespec ts = { 0, 10000000L };
+
+        fd = open(path, O_WRONLY | O_NONBLOCK);
+        if (fd < 0) nanosleep(&ts, NULL);
+    }
+
+    if (fd >= 0) fcntl(fd, F_SETFL, 0);
+
+    return fd;
+}
+
+// Replies to one request as a server would, with words given.
+void reply_once(const char *socket_path, const char *reply);
+void reply_once(const char *socket_path, const char *reply)
+{
+    struct sockaddr_un address;
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int fd = -1;
+    char request[LINE_SIZE];
+
+    socket_address(socket_path, &address);
+    unlink(socket_path);
+
+    if (listen_fd >= 0 && bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) == 0 &&
+        listen(listen_fd, 1) == 0 && (fd = accept(listen_fd, NULL, NULL)) >= 0 && recv(fd, request, LINE_SIZE, 0) > 0) {
+        send(fd, reply, strlen(reply), MSG_NOSIGNAL);
+    }
+
+    if (fd >= 0) close(fd);
+    if (listen_fd >= 0) close(listen_fd);
+    unlink(socket_path);
+}
+
+void server_tests(void)
+{
+    bool ok = true;
+    char request[LINE_SIZE];
+    const char *source = NULL;
+    size_t start = 99;
+    ServedSource served = { NULL, NULL, 0, { 0 }, 0, 0, false, false };
+    const char *text = "  CQ CQ\n DE\tW1AW  \n\nK";
+    printf("server_tests()\n");
+
+    strcpy(request, "news\t120\n");
+    ok &= print_if_fail(parse_request(request, &source, &start) && strcmp(source, "news") == 0 && start == 120,
+                        "FAIL: parse_request (1)");
+    strcpy(request, "https://example.com/a b\r\n");
+    ok &= print_if_fail(parse_request(request, &source, &start) && strcmp(source, "https://example.com/a b") == 0 &&
+                        start == 0, "FAIL: parse_request (2)");
+    strcpy(request, "news\t\n");
+    ok &= print_if_fail(parse_request(request, &source, &start) && start == 0, "FAIL: parse_request (3)");
+    strcpy(request, "news\t-5\n");
+    ok &= print_if_fail(!parse_request(request, &source, &start), "FAIL: parse_request (4)");
+    strcpy(request, "news\t12x\n");
+    ok &= print_if_fail(!parse_request(request, &source, &start), "FAIL: parse_request (5)");
+    strcpy(request, "\t12\n");
+    ok &= print_if_fail(!parse_request(request, &source, &start), "FAIL: parse_request (6)");
+
+    ok &= print_if_fail(index_words(&served, text, strlen(text)) == MF_NO_ERROR, "FAIL: index_words (1)");
+    ok &= print_if_fail(served.length == strlen("CQ\nCQ\nDE\nW1AW\nK\n") &&
+                        strncmp(served.words, "CQ\nCQ\nDE\nW1AW\nK\n", served.length) == 0,
+                        "FAIL: index_words (2)");
+    ok &= print_if_fail(served.word_starts.size == 5 && ((size_t *)served.word_starts.p)[3] == 9 &&
+                        ((size_t *)served.word_starts.p)[4] == 14, "FAIL: index_words (3)");
+    free_served_source(&served);
+
+    ok &= print_if_fail(index_words(&served, " \n ", 3) == MF_NO_ERROR && served.length == 0 &&
+                        served.word_starts.size == 0, "FAIL: index_words (4)");
+    free_served_source(&served);
+
+    // converted by a server in another process and streamed through its socket
+    MorseFeedParams mfp;
+    FILE *file = fopen("server.tmp.txt", "w");
+    char *path;
+    char url[LINE_SIZE];
+    char *output = NULL;
+    char *long_reply;
+    pid_t child;
+    int status = 0;
+
+    fputs("One two three four\nfive", file);
+    fclose(file);
+    path = realpath("server.tmp.txt", NULL);
+    snprintf(url, LINE_SIZE, "file://%s", path);
+
+    memset(&mfp, 0, sizeof(mfp));
+    mfp.words_per_row = 2;
+    mfp.word_count = DEFAULT;
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.max_megabytes = DEFAULT;
+    mfp.crawl_depth = DEFAULT;
+    mfp.cache_megabytes = DEFAULT;
+    mfp.charset = CHARSET_UNKNOWN;
+
+    fflush(NULL);
+    child = fork();
+    if (child == 0) _exit(serve("server.tmp.sock", &mfp) == MF_NO_ERROR ? 0 : 1);
+
+    ok &= print_if_fail(connect_when_listening("server.tmp.sock", url, 1, mfp, &output) == MF_NO_ERROR &&
+                        output != NULL && strcmp(output, "TWO THREE\nFOUR FIVE\n\n") == 0, "FAIL: serve (1)");
+    free(output);
+    // with the error the server had converting it
+    ok &= print_if_fail(connect_server("server.tmp.sock", "label", 0, mfp) == MF_NO_STATE_PATH,
+                        "FAIL: serve (2)");
+
+    // a source still being converted holds back only its own client
+    WaitingClient waiting;
+    char fifo_url[LINE_SIZE];
+    int fifo_fd = -1;
+
+    memset(&waiting, 0, sizeof(waiting));
+    remove("server.tmp.fifo");
+    if (mkfifo("server.tmp.fifo", 0600) == 0) {
+        char *fifo_path = realpath("server.tmp.fifo", NULL);
+
+        snprintf(fifo_url, LINE_SIZE, "file://%s", fifo_path);
+        free(fifo_path);
+        waiting.source = fifo_url;
+        waiting.mfp = mfp;
+        if (pthread_create(&waiting.thread, NULL, waiting_client_thread, &waiting) == 0) {
+            fifo_fd = open_fifo_when_read("server.tmp.fifo");
+        }
+    }
+
+    ok &= print_if_fail(fifo_fd >= 0 && connect_when_listening("server.tmp.sock", url, 3, mfp, &output) ==
+                        MF_NO_ERROR && output != NULL && strcmp(output, "FOUR FIVE\n\n") == 0, "FAIL: serve (4)");
+    free(output);
+
+    if (fifo_fd >= 0) {
+        dprintf(fifo_fd, "Six seven eight");
+        close(fifo_fd);
+        pthread_join(waiting.thread, NULL);
+    }
+
+    ok &= print_if_fail(fifo_fd >= 0 && waiting.error == MF_NO_ERROR && waiting.output != NULL &&
+                        strcmp(waiting.output, "SIX SEVEN\nEIGHT\n") == 0, "FAIL: serve (5)");
+    free(waiting.output);
+
+    if (child > 0) {
+        kill(child, SIGTERM);
+        waitpid(child, &status, 0);
+    }
+
+    ok &= print_if_fail(child > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0, "FAIL: serve (3)");
+
+    // a word longer than a line, read in pieces, is still one word
+    long_reply = malloc(2 * LINE_SIZE + 32);
+    strcpy(long_reply, "ok\t0\t2\n");
+    memset(long_reply + strlen(long_reply), 'W', LINE_SIZE + 10);
+    strcpy(long_reply + strlen("ok\t0\t2\n") + LINE_SIZE + 10, "\nX\n");
+
+    fflush(NULL);
+    child = fork();
+    if (child == 0) {
+        reply_once("server.tmp.sock", long_reply);
+        _exit(0);
+    }
+
+    mfp.words_per_row = 1;
+    ok &= print_if_fail(connect_when_listening("server.tmp.sock", "words", 0, mfp, &output) == MF_NO_ERROR &&
+                        output != NULL && strlen(output) == LINE_SIZE + 10 + strlen("\nX\n\n") &&
+                        strcmp(output + LINE_SIZE + 10, "\nX\n\n") == 0, "FAIL: connect_server (1)");
+    free(output);
+    if (child > 0) waitpid(child, &status, 0);
+
+    free(long_reply);
+    free(path);
+    remove("server.tmp.txt");
+    remove("server.tmp.fifo");
+    remove("server.tmp.sock");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,70 @@
+//
+//  server.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef server_h
+#define server_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "morsefeed.h"
+#include "vector.h"
+
+// With --serve, morsefeed converts sources once and streams the words to any number of clients
+// on a Unix domain socket. A client sends one request line, "source\tstart\n", where source is a
+// label saved with -s or a URL, and start is the number of words to skip. The reply is a line
+// "ok\tstart\ttotal\n", or "error\tcode\n" with a MorseFeedError, then one word per line.
+// Converted sources are shared by all clients and converted again after SERVE_REFRESH_SECONDS.
+// Sources are converted on threads of their own, so that words keep being sent to every client
+// meanwhile: a client of a new source gets its reply once it is converted, and clients of one
+// being converted again are sent the copy they have until the new one replaces it.
+#define SERVE_CLIENTS 32
+#define SERVE_REFRESH_SECONDS 900
+#define SERVE_CHUNK 4096
+
+struct ServedSource {
+    char *source;           // label or URL as requested
+    char *words;            // each followed by '\n'
+    size_t length;
+    Vector word_starts;     // size_t offset in words of each word
+    double converted_at;    // monotonic seconds
+    int clients;            // connections now streaming it, or waiting for it
+    bool converting;        // on a thread; words is NULL until it is first converted
+    bool retired;           // replaced by a newer copy, and freed after its last client
+};
+typedef struct ServedSource ServedSource;
+
+bool parse_request(char *line, const char **source, size_t *start);
+MorseFeedError index_words(ServedSource *served, const char *text, size_t length);
+MorseFeedError serve(const char *socket_path, const MorseFeedParams *defaults);
+MorseFeedError connect_server(const char *socket_path, const char *source, long start_word,
+                              MorseFeedParams mfp);
+
+#if DEBUG
+void server_tests(void);
+#endif
+
+#endif /* server_h */
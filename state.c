@@ -0,0 +1,439 @@
+//
+//  state.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "state.h"
+
+#define KEY_SIZE 1040
+#define JOURNAL_SUFFIX ".journal"
+#define LOCK_SUFFIX ".lock"
+
+bool make_state_key(char key[KEY_SIZE], const char *kind, const char *label);
+bool make_state_key(char key[KEY_SIZE], const char *kind, const char *label)
+{
+    return snprintf(key, KEY_SIZE, "%s\t%s", kind, label) < KEY_SIZE;
+}
+
+// Drop a row, keeping row indexes of the others unchanged.
+void clear_row(StateStore *store, size_t index);
+void clear_row(StateStore *store, size_t index)
+{
+    StringVector *row = (StringVector *)store->rows.p + index;
+    string_vector_free(row);
+}
+
+struct StateCache {
+    char *path;
+    struct stat info;               // of the state file when read, or zeroed if there was none
+    struct stat journal_info;
+    StringArray rows;
+    StringMap index;
+    bool has_journal;
+    int users;                      // stores open with it
+};
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static StateCache *current_cache = NULL;    // the one read last, for all below
+
+// Zeroed if there is no such file.
+void state_file_info(const char *path, const char *suffix, struct stat *info);
+void state_file_info(const char *path, const char *suffix, struct stat *info)
+{
+    char suffixed[KEY_SIZE];
+
+    memset(info, 0, sizeof(*info));
+
+    if (snprintf(suffixed, KEY_SIZE, "%s%s", path, suffix) >= KEY_SIZE || stat(suffixed, info) != 0) {
+        memset(info, 0, sizeof(*info));
+    }
+}
+
+// Updates replace the state file, so it is another file after each.
+bool same_file_info(const struct stat *a, const struct stat *b);
+bool same_file_info(const struct stat *a, const struct stat *b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+void free_state_cache(StateCache *cache);
+void free_state_cache(StateCache *cache)
+{
+    free(cache->path);
+    string_array_free(&cache->rows);
+    string_map_free(&cache->index);
+    free(cache);
+}
+
+// Takes the rows read into store, to share while the files are as they were before reading.
+void cache_state_rows(StateStore *store, const struct stat *info, const struct stat *journal_info);
+void cache_state_rows(StateStore *store, const struct stat *info, const struct stat *journal_info)
+{
+    StateCache *cache = calloc(1, sizeof(StateCache));
+
+    if (cache != NULL) cache->path = strdup(store->path);
+
+    if (cache == NULL || cache->path == NULL) {
+        free(cache);
+        return;
+    }
+
+    cache->info = *info;
+    cache->journal_info = *journal_info;
+    cache->rows = store->rows;
+    cache->index = store->index;
+    cache->has_journal = store->has_journal;
+    cache->users = 1;
+    store->cache = cache;
+
+    pthread_mutex_lock(&cache_mutex);
+    if (current_cache != NULL && current_cache->users == 0) free_state_cache(current_cache);
+    current_cache = cache;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void release_state_cache(StateCache *cache);
+void release_state_cache(StateCache *cache)
+{
+    pthread_mutex_lock(&cache_mutex);
+    if (--cache->users == 0 && cache != current_cache) free_state_cache(cache);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+MorseFeedError read_state_rows(StateStore *store);
+MorseFeedError read_state_rows(StateStore *store)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    const char *path = store->path;
+    char journal_path[KEY_SIZE];
+    StringArray journal_rows = { 0, 0, sizeof(StringVector), NULL };
+    size_t first_journal_row;
+
+    vector_free(&store->rows);
+    store->rows = read_string_array(path);
+    first_journal_row = store->rows.size;
+
+    if (snprintf(journal_path, KEY_SIZE, "%s" JOURNAL_SUFFIX, path) < KEY_SIZE) {
+        journal_rows = read_string_array(journal_path);
+    }
+
+    for (size_t k = 0; k < journal_rows.size && error == MF_NO_ERROR; k++) {
+        if (!vector_push(&store->rows, (StringVector *)journal_rows.p + k)) {
+            string_vector_free((StringVector *)journal_rows.p + k);
+            error = MF_OUT_OF_MEMORY;
+        }
+    }
+
+    store->has_journal = journal_rows.size > 0;
+
+    // rows now belong to store
+    vector_free(&journal_rows);
+
+    for (size_t k = 0; k < store->rows.size && error == MF_NO_ERROR; k++) {
+        StringVector *row = (StringVector *)store->rows.p + k;
+        char key[KEY_SIZE];
+        size_t previous;
+
+        if (row->size < 2 || !make_state_key(key, string_vector_at(row, 0), string_vector_at(row, 1))) {
+            clear_row(store, k);
+
+        } else {
+            // later rows win; older duplicates are dropped when next written
+            if (string_map_get(&store->index, key, &previous)) clear_row(store, previous);
+
+            if (k >= first_journal_row && row->size == 3 && strcmp(string_vector_at(row, 2), "0") == 0) {
+                clear_row(store, k);
+                string_map_remove(&store->index, key);
+
+            } else if (!string_map_put(&store->index, key, k)) {
+                error = MF_OUT_OF_MEMORY;
+            }
+        }
+    }
+
+    return error;
+}
+
+MorseFeedError state_open(StateStore *store, const char *path, bool for_update)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    struct stat info;
+    struct stat journal_info;
+
+    store->path = path;
+    store->lock_fd = -1;
+    store->rows = vector_create(0, sizeof(StringVector));
+    store->index = string_map_create(0);
+    store->has_journal = false;
+    store->cache = NULL;
+
+    if (path == NULL) {
+        error = MF_NO_STATE_PATH;
+
+    } else if (for_update) {
+        char lock_path[KEY_SIZE];
+
+        if (snprintf(lock_path, KEY_SIZE, "%s" LOCK_SUFFIX, path) >= KEY_SIZE) {
+            error = MF_NO_STATE_PATH;
+
+        } else {
+            store->lock_fd = open(lock_path, O_RDWR | O_CREAT, 0600);
+            if (store->lock_fd < 0 || flock(store->lock_fd, LOCK_EX) != 0) {
+                error = MF_POSITION_FILE_OPEN_ERROR;
+            }
+        }
+    }
+
+    // taken before reading, so that rows changed while reading are read again the next time
+    if (error == MF_NO_ERROR && !for_update) {
+        state_file_info(path, "", &info);
+        state_file_info(path, JOURNAL_SUFFIX, &journal_info);
+
+        pthread_mutex_lock(&cache_mutex);
+
+        if (current_cache != NULL && strcmp(current_cache->path, path) == 0 &&
+            same_file_info(&current_cache->info, &info) && same_file_info(&current_cache->journal_info, &journal_info)) {
+            current_cache->users++;
+            store->cache = current_cache;
+            string_map_free(&store->index);
+            vector_free(&store->rows);
+            store->rows = current_cache->rows;
+            store->index = current_cache->index;
+            store->has_journal = current_cache->has_journal;
+        }
+
+        pthread_mutex_unlock(&cache_mutex);
+    }
+
+    if (error == MF_NO_ERROR && store->cache == NULL) {
+        error = read_state_rows(store);
+        if (error == MF_NO_ERROR && !for_update) cache_state_rows(store, &info, &journal_info);
+    }
+
+    return error;
+}
+
+StringVector *state_find(StateStore *store, const char *kind, const char *label)
+{
+    StringVector *row = NULL;
+    char key[KEY_SIZE];
+    size_t index;
+
+    if (make_state_key(key, kind, label) && string_map_get(&store->index, key, &index)) {
+        row = (StringVector *)store->rows.p + index;
+    }
+
+    return row;
+}
+
+// Takes ownership of row, which replaces any row with the same kind and label.
+MorseFeedError state_put(StateStore *store, StringVector *row)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    char key[KEY_SIZE];
+    size_t index;
+
+    if (store->cache != NULL) {
+        error = MF_PROGRAM_ERR;
+
+    } else if (row->size < 2 || !make_state_key(key, string_vector_at(row, 0), string_vector_at(row, 1))) {
+        error = MF_INVALID_VALUE;
+
+    } else if (string_map_get(&store->index, key, &index)) {
+        StringVector previous;
+        vector_replace_at(&store->rows, index, row, &previous);
+        string_vector_free(&previous);
+
+    } else if (!vector_push(&store->rows, row) ||
+               !string_map_put(&store->index, key, store->rows.size - 1)) {
+        error = MF_OUT_OF_MEMORY;
+    }
+
+    if (error != MF_NO_ERROR) string_vector_free(row);
+
+    return error;
+}
+
+void state_remove(StateStore *store, const char *kind, const char *label)
+{
+    char key[KEY_SIZE];
+    size_t index;
+
+    if (store->cache == NULL && make_state_key(key, kind, label) && string_map_get(&store->index, key, &index)) {
+        clear_row(store, index);
+        string_map_remove(&store->index, key);
+    }
+}
+
+// Writes live rows only, to a temporary file that then replaces the state file.
+MorseFeedError state_commit(StateStore *store)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    StringArray live = vector_create(store->rows.size, sizeof(StringVector));
+    char temp_path[KEY_SIZE];
+    FILE *file = NULL;
+    int fd = -1;
+
+    if (store->lock_fd < 0) error = MF_PROGRAM_ERR;
+
+    for (size_t k = 0; k < store->rows.size && error == MF_NO_ERROR; k++) {
+        StringVector *row = (StringVector *)store->rows.p + k;
+        if (row->size > 0 && !vector_push(&live, row)) error = MF_OUT_OF_MEMORY;
+    }
+
+    if (error == MF_NO_ERROR) {
+        if (snprintf(temp_path, KEY_SIZE, "%s.XXXXXX", store->path) >= KEY_SIZE) error = MF_NO_STATE_PATH;
+    }
+
+    if (error == MF_NO_ERROR) {
+        fd = mkstemp(temp_path);
+        file = fd < 0 ? NULL : fdopen(fd, "w");
+        if (file == NULL) error = MF_POSITION_FILE_OPEN_ERROR;
+    }
+
+    if (error == MF_NO_ERROR) {
+        if (!write_string_array_to_file(file, &live) || fflush(file) != 0 || fsync(fd) != 0) {
+            error = MF_FILE_WRITE_ERROR;
+        }
+    }
+
+    if (file != NULL) {
+        if (fclose(file) != 0) error = MF_FILE_WRITE_ERROR;
+
+    } else if (fd >= 0) {
+        close(fd);
+    }
+
+    if (fd >= 0) {
+        if (error == MF_NO_ERROR && rename(temp_path, store->path) != 0) error = MF_FILE_WRITE_ERROR;
+        if (error != MF_NO_ERROR) remove(temp_path);
+    }
+
+    if (error == MF_NO_ERROR && store->has_journal) {
+        // journal rows are in the state file now
+        char journal_path[KEY_SIZE];
+        snprintf(journal_path, KEY_SIZE, "%s" JOURNAL_SUFFIX, store->path);
+        if (truncate(journal_path, 0) == 0) store->has_journal = false;
+    }
+
+    // rows are still owned by store
+    vector_free(&live);
+
+    return error;
+}
+
+void state_close(StateStore *store)
+{
+    if (store->cache != NULL) {
+        release_state_cache(store->cache);
+        store->cache = NULL;
+        memset(&store->rows, 0, sizeof(store->rows));
+        memset(&store->index, 0, sizeof(store->index));
+
+    } else {
+        string_array_free(&store->rows);
+        string_map_free(&store->index);
+    }
+
+    if (store->lock_fd >= 0) {
+        // closing releases the lock
+        close(store->lock_fd);
+        store->lock_fd = -1;
+    }
+}
+
+MorseFeedError journal_open(StateJournal *journal, const char *state_path)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    char path[KEY_SIZE];
+
+    journal->fd = -1;
+    journal->lock_fd = -1;
+
+    if (state_path == NULL) {
+        error = MF_NO_STATE_PATH;
+
+    } else if (snprintf(path, KEY_SIZE, "%s" JOURNAL_SUFFIX, state_path) >= KEY_SIZE) {
+        error = MF_NO_STATE_PATH;
+
+    } else {
+        journal->fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+        snprintf(path, KEY_SIZE, "%s" LOCK_SUFFIX, state_path);
+        journal->lock_fd = open(path, O_RDWR | O_CREAT, 0600);
+
+        if (journal->fd < 0 || journal->lock_fd < 0) {
+            journal_close(journal);
+            error = MF_POSITION_FILE_OPEN_ERROR;
+        }
+    }
+
+    return error;
+}
+
+// Appends one row with a single write. Never waits: if the state file is being updated,
+// nothing is written and false is returned, and the caller can try again later.
+bool journal_append(StateJournal *journal, const StringVector *row)
+{
+    bool success = journal->fd >= 0 && flock(journal->lock_fd, LOCK_SH | LOCK_NB) == 0;
+
+    if (success) {
+        CString line = cstring_create(LINE_SIZE);
+
+        for (size_t col = 0; col < row->size && success; col++) {
+            if (col > 0) success = cstring_append_char(&line, '\t');
+            success = success && cstring_append_escaped(&line, string_vector_at((StringVector *)row, col));
+        }
+
+        success = success && cstring_append_char(&line, '\n');
+        success = success && write(journal->fd, cstring_p(&line), line.size - 1) == line.size - 1;
+
+        cstring_free(&line);
+        flock(journal->lock_fd, LOCK_UN);
+    }
+
+    return success;
+}
+
+void journal_close(StateJournal *journal)
+{
+    if (journal->fd >= 0) close(journal->fd);
+    if (journal->lock_fd >= 0) close(journal->lock_fd);
+
+    journal->fd = -1;
+    journal->lock_fd = -1;
+}
@@ -0,0 +1,74 @@
+//
+//  state.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef state_h
+#define state_h
+
+#include <stdbool.h>
+
+#include "morsefeed.h"
+#include "vector.h"
+
+// Rows of the state file are tab-separated, with a kind ("state" or "position") and a label
+// in the first two cells. The file is read once into memory and indexed by kind and label.
+// Updates hold an exclusive lock on a separate lock file and replace the state file by
+// renaming a temporary copy, so other morsefeed processes never see a partial file.
+//
+// Rows appended to the journal file while playing override rows of the state file, and
+// are folded into it by the next update. A journal row with a value of 0 deletes the row.
+//
+// Rows read without updating are kept, and shared by stores opened that way, for as long as the
+// state file and the journal are unchanged, so that each lookup does not read and parse them.
+typedef struct StateCache StateCache;
+
+struct StateStore {
+    const char *path;
+    int lock_fd;
+    StringArray rows;       // deleted or replaced rows are left empty until written
+    StringMap index;        // "kind\tlabel" -> row index
+    bool has_journal;
+    StateCache *cache;      // if not NULL, rows and index are its, and are not changed
+};
+typedef struct StateStore StateStore;
+
+struct StateJournal {
+    int fd;
+    int lock_fd;
+};
+typedef struct StateJournal StateJournal;
+
+MorseFeedError state_open(StateStore *store, const char *path, bool for_update);
+StringVector *state_find(StateStore *store, const char *kind, const char *label);
+MorseFeedError state_put(StateStore *store, StringVector *row);
+void state_remove(StateStore *store, const char *kind, const char *label);
+MorseFeedError state_commit(StateStore *store);
+void state_close(StateStore *store);
+
+MorseFeedError journal_open(StateJournal *journal, const char *state_path);
+bool journal_append(StateJournal *journal, const StringVector *row);
+void journal_close(StateJournal *journal);
+
+#endif /* state_h */
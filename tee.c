@@ -0,0 +1,636 @@
+//
+//  tee.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "markers.h"
+#include "tee.h"
+
+void tee_init(Tee *tee)
+{
+    memset(tee, 0, sizeof(Tee));
+}
+
+// Takes what is buffered, up to the end of the buffer or TEE_CHUNK_SIZE bytes. Once the buffer is
+// empty, what was spilled after it is taken instead, setting spill_at to where the caller is to
+// read it from; as spill is only added to, it can be read without the lock.
+size_t tee_take(TeeSink *sink, char chunk[TEE_CHUNK_SIZE], off_t *spill_at);
+size_t tee_take(TeeSink *sink, char chunk[TEE_CHUNK_SIZE], off_t *spill_at)
+{
+    size_t length = sink->count;
+
+    if (length == 0) {
+        length = sink->spill_written - sink->spill_read < TEE_CHUNK_SIZE ?
+            sink->spill_written - sink->spill_read : TEE_CHUNK_SIZE;
+        *spill_at = sink->spill_read;
+        sink->spill_read += length;
+
+        return length;
+    }
+
+    if (length > TEE_BUFFER_SIZE - sink->first) length = TEE_BUFFER_SIZE - sink->first;
+    if (length > TEE_CHUNK_SIZE) length = TEE_CHUNK_SIZE;
+
+    memcpy(chunk, sink->buffer + sink->first, length);
+    sink->first = (sink->first + length) % TEE_BUFFER_SIZE;
+    sink->count -= length;
+
+    return length;
+}
+
+// The echo of a row longer than LINE_SIZE is read in parts
+MorseFeedError tee_read_echo(FILE *pipe_from_mbeep);
+MorseFeedError tee_read_echo(FILE *pipe_from_mbeep)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    char echo_str[LINE_SIZE];
+    bool row_end = false;
+
+    while (error == MF_NO_ERROR && !row_end) {
+        if (fgets(echo_str, LINE_SIZE, pipe_from_mbeep) == NULL) {
+            error = MF_PIPE_ERROR;
+
+        } else {
+            row_end = strchr(echo_str, '\n') != NULL;
+        }
+    }
+
+    return error;
+}
+
+// Rows are written to mbeep one at a time, keeping MBEEP_ROWS_AHEAD of them queued in it, as
+// write_word does.
+MorseFeedError tee_sink_write(TeeSink *sink, const char *chunk, size_t length, int *rows_sent, int *rows_echoed);
+MorseFeedError tee_sink_write(TeeSink *sink, const char *chunk, size_t length, int *rows_sent, int *rows_echoed)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    FILE *pipe_to_mbeep = sink->session.pipe_to_mbeep;
+
+    if (sink->file != NULL) {
+        if (fwrite(chunk, 1, length, sink->file) != length) error = MF_FILE_WRITE_ERROR;
+    }
+
+    while (sink->file == NULL && length > 0 && error == MF_NO_ERROR) {
+        const char *end = memchr(chunk, '\n', length);
+        size_t row_length = end != NULL ? end - chunk + 1 : length;
+
+        if (fwrite(chunk, 1, row_length, pipe_to_mbeep) != row_length) error = MF_PIPE_ERROR;
+
+        if (end != NULL && error == MF_NO_ERROR) {
+            if (fflush(pipe_to_mbeep) != 0) error = MF_PIPE_ERROR;
+            (*rows_sent)++;
+        }
+
+        while (error == MF_NO_ERROR && *rows_sent - *rows_echoed > MBEEP_ROWS_AHEAD) {
+            error = tee_read_echo(sink->session.pipe_from_mbeep);
+            (*rows_echoed)++;
+        }
+
+        chunk += row_length;
+        length -= row_length;
+    }
+
+    return error;
+}
+
+void *tee_sink_thread(void *arg);
+void *tee_sink_thread(void *arg)
+{
+    TeeSink *sink = arg;
+    MorseFeedError error = MF_NO_ERROR;
+    char chunk[TEE_CHUNK_SIZE];
+    int rows_sent = 0;
+    int rows_echoed = 0;
+    bool finished = false;
+    bool stopping = false;
+
+    while (!finished) {
+        size_t length = 0;
+        off_t spill_at = -1;
+
+        pthread_mutex_lock(&sink->mutex);
+
+        // all taken from spill has been written, so it is written over from the start
+        if (sink->spill_read == sink->spill_written) sink->spill_read = sink->spill_written = 0;
+
+        while (sink->count == 0 && sink->spill_read == sink->spill_written && !sink->closing) {
+            pthread_cond_wait(&sink->changed, &sink->mutex);
+        }
+
+        stopping = sink->stopping;
+        finished = stopping || (sink->count == 0 && sink->spill_read == sink->spill_written);
+        if (!finished) length = tee_take(sink, chunk, &spill_at);
+
+        pthread_cond_broadcast(&sink->changed);
+        pthread_mutex_unlock(&sink->mutex);
+
+        if (spill_at >= 0 && pread(fileno(sink->spill), chunk, length, spill_at) != (ssize_t)length) {
+            error = MF_FILE_READ_ERROR;
+        }
+
+        if (length > 0 && error == MF_NO_ERROR) error = tee_sink_write(sink, chunk, length, &rows_sent, &rows_echoed);
+        if (error != MF_NO_ERROR) finished = true;
+    }
+
+    if (error == MF_NO_ERROR && !stopping) {
+        if (sink->file != NULL) {
+            if (fflush(sink->file) != 0) error = MF_FILE_WRITE_ERROR;
+
+        } else if (fflush(sink->session.pipe_to_mbeep) != 0) {
+            error = MF_PIPE_ERROR;
+        }
+    }
+
+    // rows still queued in mbeep are sounded before it is closed, so a WAV file is whole
+    while (error == MF_NO_ERROR && !stopping && sink->file == NULL && rows_echoed < rows_sent) {
+        error = tee_read_echo(sink->session.pipe_from_mbeep);
+        rows_echoed++;
+    }
+
+    // a sink that failed drops what is written to it after
+    pthread_mutex_lock(&sink->mutex);
+    sink->error = error;
+    sink->done = true;
+    sink->count = 0;
+    sink->spill_read = sink->spill_written;
+    pthread_cond_broadcast(&sink->changed);
+    pthread_mutex_unlock(&sink->mutex);
+
+    return NULL;
+}
+
+MorseFeedError tee_start_sink(Tee *tee, TeeSink *sink);
+MorseFeedError tee_start_sink(Tee *tee, TeeSink *sink)
+{
+    MorseFeedError error = MF_NO_ERROR;
+
+    sink->buffer = malloc(TEE_BUFFER_SIZE);
+    if (sink->buffer == NULL) error = MF_OUT_OF_MEMORY;
+
+    if (error == MF_NO_ERROR) {
+        sigset_t all;
+        sigset_t previous;
+        bool started;
+
+        pthread_mutex_init(&sink->mutex, NULL);
+        pthread_cond_init(&sink->changed, NULL);
+
+        // signals are left to the thread writing words, whose reads they are to interrupt
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &previous);
+        started = pthread_create(&sink->thread, NULL, tee_sink_thread, sink) == 0;
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+        if (started) {
+            tee->count++;
+
+        } else {
+            pthread_mutex_destroy(&sink->mutex);
+            pthread_cond_destroy(&sink->changed);
+            error = MF_OUT_OF_MEMORY;
+        }
+    }
+
+    if (error != MF_NO_ERROR) {
+        free(sink->buffer);
+        sink->buffer = NULL;
+    }
+
+    return error;
+}
+
+MorseFeedError tee_add_file(Tee *tee, FILE *file, bool close_file, int words_per_row)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    TeeSink *sink = &tee->sinks[tee->count];
+
+    if (tee->count == TEE_MAX_SINKS) {
+        error = MF_INVALID_VALUE;
+
+    } else {
+        memset(sink, 0, sizeof(TeeSink));
+        init_mbeep_session(&sink->session);
+        sink->file = file;
+        sink->close_file = close_file;
+        sink->words_per_row = words_per_row;
+
+        error = tee_start_sink(tee, sink);
+    }
+
+    if (error != MF_NO_ERROR && close_file) fclose(file);
+
+    return error;
+}
+
+// Started without key control, at the tone of -f
+MorseFeedError tee_add_mbeep(Tee *tee, const MorseFeedParams *mfp, double paris_wpm, const char *wav_file_name,
+                             int words_per_row)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    TeeSink *sink = &tee->sinks[tee->count];
+
+    if (tee->count == TEE_MAX_SINKS) {
+        error = MF_INVALID_VALUE;
+
+    } else {
+        memset(sink, 0, sizeof(TeeSink));
+        init_mbeep_session(&sink->session);
+        sink->words_per_row = words_per_row;
+        sink->spills = true;
+
+        if (wav_file_name != NULL) {
+            sink->wav_file_name = strdup(wav_file_name);
+            if (sink->wav_file_name == NULL) error = MF_OUT_OF_MEMORY;
+        }
+
+        if (error == MF_NO_ERROR) {
+            error = begin_fork_mbeep(&sink->session, mfp->freq, paris_wpm, DEFAULT, DEFAULT, DEFAULT, false,
+                                     sink->wav_file_name, false);
+            if (error == MF_NO_ERROR) error = tee_start_sink(tee, sink);
+            if (error != MF_NO_ERROR) end_fork_mbeep(&sink->session, true);
+        }
+
+        if (error != MF_NO_ERROR) free(sink->wav_file_name);
+    }
+
+    return error;
+}
+
+// Adds the sinks of --tee and --tee-mbeep, and the output file if mbeep is written to instead.
+// Rows are as long as with -c, or else as long as without -m for files and with -m for mbeeps.
+MorseFeedError tee_open(Tee *tee, const MorseFeedParams *mfp)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    int file_words_per_row = mfp->words_per_row != DEFAULT ? mfp->words_per_row : 5;
+    int mbeep_words_per_row = mfp->words_per_row != DEFAULT ? mfp->words_per_row : 1;
+    const char *p = mfp->tee_files;
+
+    tee_init(tee);
+
+    if (mfp->fork_mbeep && mfp->out_file != NULL) error = tee_add_file(tee, mfp->out_file, false, file_words_per_row);
+
+    while (error == MF_NO_ERROR && p != NULL && *p != '\0') {
+        size_t length = strcspn(p, (char[]){ MARKER_SEPARATOR, '\0' });
+        char *name = strndup(p, length);
+
+        if (name == NULL) {
+            error = MF_OUT_OF_MEMORY;
+
+        } else if (strcmp(name, TEE_STDOUT) == 0) {
+            error = tee_add_file(tee, stdout, false, file_words_per_row);
+
+        } else {
+            FILE *file = fopen(name, "w");
+
+            error = file == NULL ? MF_OUTPUT_FILE_OPEN_ERROR : tee_add_file(tee, file, true, file_words_per_row);
+        }
+
+        free(name);
+
+        p += length;
+        if (*p == MARKER_SEPARATOR) p++;
+    }
+
+    p = mfp->tee_mbeeps;
+
+    while (error == MF_NO_ERROR && p != NULL && *p != '\0') {
+        size_t length = strcspn(p, (char[]){ MARKER_SEPARATOR, '\0' });
+        char *entry = strndup(p, length);
+        char *wav_file_name = NULL;
+        double paris_wpm = 0;
+
+        if (entry == NULL) {
+            error = MF_OUT_OF_MEMORY;
+
+        } else {
+            paris_wpm = strtod(entry, &wav_file_name);
+
+            if (*wav_file_name == ' ') {
+                wav_file_name++;
+
+            } else if (*wav_file_name == '\0') {
+                wav_file_name = NULL;
+
+            } else {
+                error = MF_INVALID_VALUE;
+            }
+        }
+
+        if (error == MF_NO_ERROR) error = tee_add_mbeep(tee, mfp, paris_wpm, wav_file_name, mbeep_words_per_row);
+
+        free(entry);
+
+        p += length;
+        if (*p == MARKER_SEPARATOR) p++;
+    }
+
+    return error;
+}
+
+// Adds to spill, started the first time; false if it cannot be written, when the sink waits for
+// room in its buffer from then on.
+bool tee_spill(TeeSink *sink, const char *bytes, size_t length);
+bool tee_spill(TeeSink *sink, const char *bytes, size_t length)
+{
+    if (sink->spill == NULL) sink->spill = tmpfile();
+
+    if (sink->spill == NULL ||
+        pwrite(fileno(sink->spill), bytes, length, (off_t)sink->spill_written) != (ssize_t)length) {
+        sink->spills = false;
+        return false;
+    }
+
+    sink->spill_written += length;
+    sink->spilled += length;
+
+    return true;
+}
+
+void tee_append(TeeSink *sink, const char *bytes, size_t length);
+void tee_append(TeeSink *sink, const char *bytes, size_t length)
+{
+    pthread_mutex_lock(&sink->mutex);
+
+    while (length > 0 && !sink->done) {
+        size_t start = (sink->first + sink->count) % TEE_BUFFER_SIZE;
+        size_t space = TEE_BUFFER_SIZE - sink->count;
+        // once spilling, words go on in spill until all of it is taken, to stay in order
+        bool spilling = sink->spill_read < sink->spill_written;
+
+        if (sink->spills && (space == 0 || spilling) && tee_spill(sink, bytes, length)) {
+            length = 0;
+
+        } else if (space == 0 || spilling) {
+            sink->waits++;
+            while ((sink->count == TEE_BUFFER_SIZE || sink->spill_read < sink->spill_written) && !sink->done) {
+                pthread_cond_wait(&sink->changed, &sink->mutex);
+            }
+
+        } else {
+            if (space > TEE_BUFFER_SIZE - start) space = TEE_BUFFER_SIZE - start;
+            if (space > length) space = length;
+
+            memcpy(sink->buffer + start, bytes, space);
+            sink->count += space;
+            bytes += space;
+            length -= space;
+        }
+    }
+
+    pthread_cond_broadcast(&sink->changed);
+    pthread_mutex_unlock(&sink->mutex);
+}
+
+// Lays the word out in the rows of each sink as write_word does
+void tee_word(Tee *tee, const char *word)
+{
+    for (size_t k = 0; k < tee->count; k++) {
+        TeeSink *sink = &tee->sinks[k];
+
+        if (sink->word_number % sink->words_per_row != 0) tee_append(sink, " ", 1);
+        tee_append(sink, word, strlen(word));
+        if (sink->word_number % sink->words_per_row == sink->words_per_row - 1) tee_append(sink, "\n", 1);
+
+        if (strlen(word) != 0 && strcmp(word, " ") != 0) sink->word_number++;
+    }
+}
+
+// Waits for an mbeep to sound what is buffered for it, unless a signal stops it first
+void tee_wait_mbeep(TeeSink *sink);
+void tee_wait_mbeep(TeeSink *sink)
+{
+    struct pollfd signal_poll = { signals_fd(), POLLIN, 0 };
+    bool done = false;
+
+    while (!done) {
+        pthread_mutex_lock(&sink->mutex);
+
+        done = sink->done;
+
+        if (!done && !sink->stopping && signal_received() != 0) {
+            sink->stopping = true;
+            kill(sink->session.pid, SIGTERM);
+        }
+
+        pthread_mutex_unlock(&sink->mutex);
+
+        if (!done) poll(&signal_poll, 1, TEE_POLL_MILLISECONDS);
+    }
+}
+
+// Files end with a newline, as the output file does. With stop_now, as after 'q', mbeeps stop
+// at once and what is buffered for them is dropped; files are still written.
+MorseFeedError tee_close(Tee *tee, bool stop_now)
+{
+    MorseFeedError error = MF_NO_ERROR;
+
+    for (size_t k = 0; k < tee->count; k++) {
+        TeeSink *sink = &tee->sinks[k];
+
+        if (sink->file != NULL) tee_append(sink, "\n", 1);
+
+        pthread_mutex_lock(&sink->mutex);
+        sink->closing = true;
+        sink->stopping = stop_now && sink->file == NULL;
+        pthread_cond_broadcast(&sink->changed);
+        pthread_mutex_unlock(&sink->mutex);
+
+        // a write to it or a read of its echo returns
+        if (sink->stopping && sink->session.pid > 0) kill(sink->session.pid, SIGTERM);
+    }
+
+    for (size_t k = 0; k < tee->count; k++) {
+        TeeSink *sink = &tee->sinks[k];
+
+        if (sink->file == NULL) tee_wait_mbeep(sink);
+        pthread_join(sink->thread, NULL);
+
+        if (sink->file == NULL) {
+            // one stopped by a signal sent to it too fails
+            if (sink->stopping || signal_received() != 0) sink->error = MF_NO_ERROR;
+            end_fork_mbeep(&sink->session, sink->stopping);
+
+        } else if (sink->close_file && fclose(sink->file) != 0 && sink->error == MF_NO_ERROR) {
+            sink->error = MF_FILE_WRITE_ERROR;
+        }
+
+        if (error == MF_NO_ERROR) error = sink->error;
+
+        pthread_mutex_destroy(&sink->mutex);
+        pthread_cond_destroy(&sink->changed);
+        free(sink->buffer);
+        sink->buffer = NULL;
+        if (sink->spill != NULL) fclose(sink->spill);
+        sink->spill = NULL;
+        free(sink->wav_file_name);
+        sink->wav_file_name = NULL;
+    }
+
+    return error;
+}
+
+void tee_print_stats(const Tee *tee)
+{
+    for (size_t k = 0; k < tee->count; k++) {
+        const TeeSink *sink = &tee->sinks[k];
+
+        fprintf(stderr, "(tee to %s %ld: %ld words, waited %ld times when full, spilled %.1f megabytes)\n",
+                sink->file != NULL ? "file" : "mbeep", (long)k + 1, (long)sink->word_number, (long)sink->waits,
+                sink->spilled / 1e6);
+    }
+}
+
+#if DEBUG
+void tee_tests(void)
+{
+    bool ok = true;
+    Tee tee;
+    MorseFeedParams mfp;
+    FILE *file;
+    char output[64];
+    char *big;
+    size_t size = 0;
+    size_t k;
+    int fds[2];
+    printf("tee_tests()\n");
+
+    memset(&mfp, 0, sizeof(mfp));
+    mfp.words_per_row = DEFAULT;
+
+    // rows of each sink are laid out as write_word does
+    tee_init(&tee);
+    ok &= print_if_fail(tee_add_file(&tee, fopen("tee_a.tmp", "w"), true, 2) == MF_NO_ERROR &&
+                        tee_add_file(&tee, fopen("tee_b.tmp", "w"), true, 3) == MF_NO_ERROR && tee.count == 2,
+                        "FAIL: tee_add_file (1)");
+    tee_word(&tee, "ONE");
+    tee_word(&tee, "TWO");
+    tee_word(&tee, " ");
+    tee_word(&tee, "THREE");
+    tee_word(&tee, "FOUR");
+    ok &= print_if_fail(tee_close(&tee, true) == MF_NO_ERROR && tee.sinks[0].word_number == 4,
+                        "FAIL: tee_close (1)");
+
+    file = fopen("tee_a.tmp", "r");
+    size = file != NULL ? fread(output, 1, sizeof(output) - 1, file) : 0;
+    output[size] = '\0';
+    if (file != NULL) fclose(file);
+    ok &= print_if_fail(strcmp(output, "ONE TWO\n THREE FOUR\n\n") == 0, "FAIL: tee_word (1)");
+
+    file = fopen("tee_b.tmp", "r");
+    size = file != NULL ? fread(output, 1, sizeof(output) - 1, file) : 0;
+    output[size] = '\0';
+    if (file != NULL) fclose(file);
+    ok &= print_if_fail(strcmp(output, "ONE TWO  \n THREE\nFOUR\n") == 0, "FAIL: tee_word (2)");
+
+    // more than the buffer holds, wrapping around it
+    big = malloc(TEE_BUFFER_SIZE / 4);
+    tee_init(&tee);
+    ok &= print_if_fail(big != NULL && tee_add_file(&tee, fopen("tee_a.tmp", "w"), true, 1) == MF_NO_ERROR,
+                        "FAIL: tee_add_file (2)");
+    for (k = 0; big != NULL && k < TEE_BUFFER_SIZE / 4 - 1; k++) big[k] = 'A' + k % 26;
+    if (big != NULL) big[k] = '\0';
+    for (k = 0; big != NULL && k < 9; k++) tee_word(&tee, big);
+    ok &= print_if_fail(tee_close(&tee, false) == MF_NO_ERROR, "FAIL: tee_close (2)");
+
+    file = fopen("tee_a.tmp", "r");
+    size = 0;
+    for (k = 0; file != NULL && big != NULL && k < 9; k++) {
+        size += fread(big, 1, TEE_BUFFER_SIZE / 4, file) == TEE_BUFFER_SIZE / 4 && big[0] == 'A' &&
+                big[TEE_BUFFER_SIZE / 4 - 2] == 'A' + (TEE_BUFFER_SIZE / 4 - 2) % 26 &&
+                big[TEE_BUFFER_SIZE / 4 - 1] == '\n';
+    }
+    ok &= print_if_fail(size == 9 && file != NULL && fgetc(file) == '\n' && fgetc(file) == EOF, "FAIL: tee_word (3)");
+    if (file != NULL) fclose(file);
+    free(big);
+
+    // one that spills never holds up writing; the pipe is only read once all is written
+    big = malloc(TEE_BUFFER_SIZE / 4);
+    tee_init(&tee);
+    file = pipe(fds) == 0 ? fdopen(fds[1], "w") : NULL;
+    if (file != NULL) setvbuf(file, NULL, _IONBF, 0);
+    ok &= print_if_fail(big != NULL && file != NULL && tee_add_file(&tee, file, true, 1) == MF_NO_ERROR,
+                        "FAIL: tee_add_file (4)");
+    tee.sinks[0].spills = true;
+    for (k = 0; big != NULL && k < TEE_BUFFER_SIZE / 4 - 1; k++) big[k] = 'A' + k % 26;
+    if (big != NULL) big[k] = '\0';
+    for (k = 0; big != NULL && k < 9; k++) tee_word(&tee, big);
+    ok &= print_if_fail(tee.sinks[0].waits == 0 && tee.sinks[0].spilled > 0, "FAIL: tee_spill (1)");
+
+    file = fdopen(fds[0], "r");
+    size = 0;
+    for (k = 0; file != NULL && big != NULL && k < 9; k++) {
+        size += fread(big, 1, TEE_BUFFER_SIZE / 4, file) == TEE_BUFFER_SIZE / 4 && big[0] == 'A' &&
+                big[TEE_BUFFER_SIZE / 4 - 2] == 'A' + (TEE_BUFFER_SIZE / 4 - 2) % 26 &&
+                big[TEE_BUFFER_SIZE / 4 - 1] == '\n';
+    }
+    ok &= print_if_fail(tee_close(&tee, false) == MF_NO_ERROR, "FAIL: tee_close (3)");
+    ok &= print_if_fail(size == 9 && file != NULL && fgetc(file) == '\n' && fgetc(file) == EOF, "FAIL: tee_spill (2)");
+    if (file != NULL) fclose(file);
+    free(big);
+
+    // -o with -m, and --tee
+    mfp.fork_mbeep = true;
+    mfp.out_file = fopen("tee_a.tmp", "w");
+    mfp.tee_files = "tee_b.tmp";
+    ok &= print_if_fail(tee_open(&tee, &mfp) == MF_NO_ERROR && tee.count == 2 && tee.sinks[0].words_per_row == 5 &&
+                        !tee.sinks[0].close_file && tee.sinks[1].close_file, "FAIL: tee_open (1)");
+    tee_close(&tee, false);
+    if (mfp.out_file != NULL) fclose(mfp.out_file);
+    mfp.fork_mbeep = false;
+    mfp.out_file = NULL;
+
+    mfp.tee_files = "tee_missing.tmp/a";
+    ok &= print_if_fail(tee_open(&tee, &mfp) == MF_OUTPUT_FILE_OPEN_ERROR && tee.count == 0, "FAIL: tee_open (2)");
+    tee_close(&tee, false);
+    mfp.tee_files = NULL;
+
+    mfp.tee_mbeeps = "20x";
+    ok &= print_if_fail(tee_open(&tee, &mfp) == MF_INVALID_VALUE && tee.count == 0, "FAIL: tee_open (3)");
+    tee_close(&tee, false);
+    mfp.tee_mbeeps = NULL;
+
+    file = fopen("tee_a.tmp", "w");
+    tee_init(&tee);
+    for (k = 0; k < TEE_MAX_SINKS; k++) tee_add_file(&tee, file, false, 1);
+    ok &= print_if_fail(tee_add_file(&tee, file, false, 1) == MF_INVALID_VALUE && tee.count == TEE_MAX_SINKS,
+                        "FAIL: tee_add_file (3)");
+    tee_close(&tee, false);
+    if (file != NULL) fclose(file);
+
+    remove("tee_a.tmp");
+    remove("tee_b.tmp");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,98 @@
+//
+//  tee.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef tee_h
+#define tee_h
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "morsefeed.h"
+
+// With --tee and --tee-mbeep, or -o with -m, the words written are also written to other sinks:
+// files, stdout, and more mbeeps at speeds of their own, from the same conversion. Each sink lays
+// the words out in rows of its own and has a thread and a buffer of TEE_BUFFER_SIZE bytes, so a
+// file that is slow holds up writing only once its buffer is full. An mbeep sounds words far
+// slower than they are converted, so what its buffer has no room for goes on in a temporary file
+// instead, and it holds up neither the conversion nor the other sinks. Words written again after
+// 'b' are written to sinks once.
+#define TEE_BUFFER_SIZE (1 << 20)
+#define TEE_CHUNK_SIZE 4096
+#define TEE_MAX_SINKS 8
+#define TEE_POLL_MILLISECONDS 100      // while waiting for an mbeep, for signals
+
+// Each of tee_files and tee_mbeeps is separated by MARKER_SEPARATOR. A file named "-" is stdout,
+// and an mbeep is its PARIS wpm, then a space and a WAV file name if it writes one.
+#define TEE_STDOUT "-"
+
+struct TeeSink {
+    FILE *file;                     // for a file, or NULL for mbeep
+    bool close_file;
+    MbeepSession session;
+    char *wav_file_name;            // for session, or NULL
+    int words_per_row;
+    int word_number;
+    pthread_t thread;
+    pthread_mutex_t mutex;          // for all below
+    pthread_cond_t changed;
+    char *buffer;                   // TEE_BUFFER_SIZE bytes, count of them from first, wrapping
+    size_t first;
+    size_t count;
+    FILE *spill;                    // if it spills: words after those in buffer, once it was full
+    uint64_t spill_read;            // taken from spill, up to
+    uint64_t spill_written;
+    bool spills;
+    bool closing;                   // no more words; write those buffered, unless stopping
+    bool stopping;
+    bool done;                      // thread has returned, or failed and drops words
+    MorseFeedError error;
+    size_t waits;                   // times the writer found the buffer full
+    uint64_t spilled;               // bytes written to spill
+};
+typedef struct TeeSink TeeSink;
+
+struct Tee {
+    TeeSink sinks[TEE_MAX_SINKS];
+    size_t count;
+};
+typedef struct Tee Tee;
+
+void tee_init(Tee *tee);
+MorseFeedError tee_add_file(Tee *tee, FILE *file, bool close_file, int words_per_row);
+MorseFeedError tee_add_mbeep(Tee *tee, const MorseFeedParams *mfp, double paris_wpm, const char *wav_file_name,
+                             int words_per_row);
+MorseFeedError tee_open(Tee *tee, const MorseFeedParams *mfp);
+void tee_word(Tee *tee, const char *word);
+MorseFeedError tee_close(Tee *tee, bool stop_now);
+void tee_print_stats(const Tee *tee);
+
+#if DEBUG
+void tee_tests(void);
+#endif
+
+#endif /* tee_h */
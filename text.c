@@ -47,26 +47,63 @@ void usage(void)
            "            )\n"
            "            [-s <label>]\n"
            "  morsefeed -r <label>\n"
+           "  morsefeed [options] --batch <output_dir> <input>...\n"
+           "  morsefeed [options] --watch <input_dir> <output_dir>\n"
+           "  morsefeed [options] --sample <dir> [-n <number_of_words>]\n"
+           "  morsefeed --serve <socket_path>\n"
+           "  morsefeed --connect <socket_path> <label_or_URL> [--start <word>] [-p]\n"
            "  morsefeed -h | --help\n"
            "  morsefeed -v | --version\n"
            "  morsefeed --license\n"
            "  morsefeed --man-page\n"
            "\n"
            "Options:\n"
-           "  -i <file_path>         Input file for text to be converted\n"
+           "  -i <file_path>         Input file for text to be converted, which may be compressed\n"
            "  -u <URL>               Input URL for text to be converted\n"
-           "  -a <string>            Use input text after string\n"
-           "  -b <string>            Use input text before string\n"
+           "  --charset <name>       Charset of the input, such as windows-1252 or koi8-r [default: detected]\n"
+           "  -a <string>            Use input text after string (may be repeated)\n"
+           "  -b <string>            Use input text before string (may be repeated)\n"
            "  -L                     Follow links on web page at URL to get text to be converted\n"
-           "  -A <string>            Use linked input text after string\n"
-           "  -B <string>            Use linked input text before string\n"
-           "  -o <file_path>         Output file for converted text\n"
+           "  -A <string>            Use linked input text after string (may be repeated)\n"
+           "  -B <string>            Use linked input text before string (may be repeated)\n"
+           "  --include <regex>      Follow only links with matching title or path (may be repeated)\n"
+           "  --exclude <regex>      Do not follow links with matching title or path (may be repeated)\n"
+           "  --depth <levels>       Levels of links to follow with -L [default: 1]\n"
+           "  --section-after <str>  Use links on section pages after string (may be repeated)\n"
+           "  --section-before <str> Use links on section pages before string (may be repeated)\n"
+           "  --section-level <n>    Following section markers are for this level [default: 1]\n"
+           "  --max-megabytes <MB>   Stop following links after fetching this much\n"
+           "  --strip-common         Remove text found on most linked pages, like menus\n"
+           "  -o <file_path>         Output file for converted text, written with -m too\n"
            "  -m                     Send converted text to mbeep\n"
+           "  --tee <file_path>      Also write converted text to file, or stdout if - (may be repeated)\n"
+           "  --tee-mbeep <wpm> <wav_file>\n"
+           "                         Also send converted text to another mbeep at wpm, writing wav_file\n"
+           "                         unless it is - (may be repeated)\n"
            "  -p                     Remember position in input stream and use when resuming\n"
            "  -s <label>             Save options for reuse with named label\n"
            "  -r <label>             Load options previously saved with named label\n"
            "  -c <words_per_row>     Number of words per row [default: 5]\n"
            "  -n <number_of_words>   Number of words to print\n"
+           "  --progress             Show progress and estimated time remaining\n"
+           "  --minutes <minutes>    Stop after sending for number of minutes\n"
+           "  --stage-stats          Show how full the queues between conversion stages were\n"
+           "  --cache <megabytes>    Keep converted words, up to this size, to reuse for the same text\n"
+           "  --cache-stats          Show cache hits and misses\n"
+           "  --serve <socket_path>  Serve converted text to clients on Unix domain socket\n"
+           "  --connect <socket_path> <label_or_URL>\n"
+           "                         Get converted text from server on Unix domain socket\n"
+           "  --start <word>         Converted word to start at, with --connect, a book or a file [default: 0]\n"
+           "  --percent <percent>    Percentage of a book or file to start at\n"
+           "  --back <paragraphs>    Paragraphs of a file to go back from the start\n"
+           "  --compile <book_file>  Convert input once to a book that plays from any word\n"
+           "  --batch <output_dir> <input>...\n"
+           "                         Convert each input file, directory or pattern to output_dir\n"
+           "  --watch <input_dir> <output_dir>\n"
+           "                         Convert each file written to input_dir to output_dir until stopped\n"
+           "  --catalog <dir>        Update the catalog of files in dir and show it\n"
+           "  --sample <dir>         Input from a word picked at random from the files in dir\n"
+           "  --threads <count>      Threads for --batch, --watch, --catalog and large -i files [default: number of processors]\n"
            "\n"
            "  -h --help     Show this screen.\n"
            "  --version     Show version.\n"
@@ -124,6 +161,11 @@ void man_page_source(void)
            "      (\\fB\\-m\\fR [\\fB\\-p\\fR] [\\fB\\-f\\fR \\fIFREQ\\fR] ([\\fB\\-w\\fR \\fIWPM\\fR] | [\\fB\\--codex-wpm\\fR \\fIWPM\\fR]) [\\fB\\-x\\fR \\fICHAR_SPEED\\fR] [\\fB\\-\\-wss\\fR \\fIWORD_SPEED\\fR] [\\fB\\-\\-fcc\\fR] [\\fB\\-\\-wav\\fR \\fIWAV_FILE_NAME\\fR]) ]\n"
            "    [\\fB\\-s\\fR \\fILABEL\\fR]\n"
            "\\fBmorsefeed\\fR \\fB\\-r\\fR \\fILABEL\\fR\n"
+           "\\fBmorsefeed\\fR [\\fIOPTIONS\\fR] \\fB\\-\\-batch\\fR \\fIOUTPUT_DIR\\fR \\fIINPUT\\fR ...\n"
+           "\\fBmorsefeed\\fR [\\fIOPTIONS\\fR] \\fB\\-\\-watch\\fR \\fIINPUT_DIR\\fR \\fIOUTPUT_DIR\\fR\n"
+           "\\fBmorsefeed\\fR [\\fIOPTIONS\\fR] \\fB\\-\\-sample\\fR \\fIDIR\\fR [\\fB\\-n\\fR \\fIWORD_COUNT\\fR]\n"
+           "\\fBmorsefeed\\fR \\fB\\-\\-serve\\fR \\fISOCKET\\fR\n"
+           "\\fBmorsefeed\\fR \\fB\\-\\-connect\\fR \\fISOCKET\\fR \\fISOURCE\\fR [\\fB\\-\\-start\\fR \\fIWORD\\fR] [\\fB\\-p\\fR]\n"
            "\\fBmorsefeed\\fR \\fB\\-h\\fR | \\fB\\-v\\fR | \\fB\\-\\-license\\fR | \\fB\\-\\-man\\-page\\fR\n"
            ".fi\n"
            "\n"
@@ -133,7 +175,9 @@ void man_page_source(void)
            "Most punctuation and special characters are converted, removed, or spelled\\-out."
            "\n"
            "Text can be output to disk file, standard output, or directly to mbeep tool.\n"
-           "If sent to mbeep, audio can be paused or resumed by typing space bar, or quit by typing the letter q.\n"
+           "If sent to mbeep, audio can be paused or resumed by typing space bar, or quit by typing the letter q. "
+           "Typing the letter b stops what is queued in mbeep and sends again the words not yet heard, "
+           "with the last row or five words before them.\n"
            "There is an option to save the file position when quitting, and resume transmission from that point when starting again."
            "\n"
            "There are options to filter out text at the beginning or end of a file or web page. "
@@ -149,52 +193,139 @@ void man_page_source(void)
            "\n"
            ".TP\n"
            ".BR \\-i \" \" \\fIFILE\\fR\n"
-           "Input file for text to be converted.\n"
+           "Input file for text to be converted. A file compressed with gzip, bzip2 or xz is decompressed as it "
+           "is read, and positions saved with \\fB\\-p\\fR are in the text it holds. While a gzip file is played "
+           "with \\fB\\-p\\fR, places it can be decompressed from are kept next to the state file, so that it "
+           "resumes without decompressing it from the start.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-u \" \" \\fIURL\\fR\n"
            "Input URL for text to be converted.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-charset \" \" \\fINAME\\fR\n"
+           "Charset of the input, instead of the one detected: utf-8, windows-1252 (also given as iso-8859-1 "
+           "or latin1), windows-1250, windows-1251, iso-8859-2, iso-8859-5, iso-8859-7, iso-8859-15, koi8-r or "
+           "koi8-u. Otherwise a byte order mark, the Content-Type of a URL or a meta tag near the start of a web "
+           "page gives the charset, and failing those it is guessed from the first 64 kilobytes: text that is "
+           "valid UTF-8 is taken as UTF-8, Russian text as windows-1251 or koi8-r, and anything else as "
+           "windows-1252. Bytes that are not valid in UTF-8 text are taken as windows-1252.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-a \" \" \\fISTRING\\fR\n"
-           "Use input text after string.\n"
+           "Use input text after string. May be repeated to give alternatives; the earliest found is used.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-b \" \" \\fISTRING\\fR\n"
-           "Use input text before string.\n"
+           "Use input text before string. May be repeated to give alternatives; the earliest found is used.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-L\n"
-           "Follow links on web page at URL to get text to be converted.\n"
+           "Follow links on web page at URL to get text to be converted. "
+           "With \\-p, linked pages that were already played to the end, or skipped, are not played again. "
+           "They are remembered in \\fI~/.morsefeed.seen\\fR until no longer linked for 60 days.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-A \" \" \\fISTRING\\fR\n"
-           "Use linked input text after string.\n"
+           "Use linked input text after string. May be repeated to give alternatives; the earliest found is used.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-B \" \" \\fISTRING\\fR\n"
-           "Use linked input text before string.\n"
+           "Use linked input text before string. May be repeated to give alternatives; the earliest found is used.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-include \" \" \\fIREGEX\\fR\n"
+           "With \\-L, follow only links whose title or URL path matches the extended regular expression, "
+           "ignoring case. May be repeated; links matching any of them are followed.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-exclude \" \" \\fIREGEX\\fR\n"
+           "With \\-L, do not follow links whose title or URL path matches the extended regular expression, "
+           "ignoring case. May be repeated. The number of links left out is shown on standard error.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-depth \" \" \\fILEVELS\\fR\n"
+           "With \\-L, number of levels of links to follow, from 1 to 5. Default is 1. "
+           "With more than one level, pages linked from the web page at URL are section pages, "
+           "and the pages they link to are followed in turn; only pages at the last level are converted. "
+           "Each level is fetched at once, at most 8 pages at a time and 2 from any one host, "
+           "and pages are converted in the order they were linked. A page linked more than once is converted once.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-section\\-after \" \" \\fISTRING\\fR\n"
+           "Use links on section pages after string. May be repeated to give alternatives; the earliest found is used.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-section\\-before \" \" \\fISTRING\\fR\n"
+           "Use links on section pages before string. May be repeated to give alternatives; the earliest found is used.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-section\\-level \" \" \\fILEVEL\\fR\n"
+           "The \\-\\-section\\-after and \\-\\-section\\-before options that follow are for section pages "
+           "at this level, from 1, the pages linked from the web page at URL, to one less than \\-\\-depth. "
+           "Default is 1. Section pages at a level with no markers of their own use those of the level above.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-max\\-megabytes \" \" \\fIMEGABYTES\\fR\n"
+           "With \\-L, stop following links once this many megabytes have been fetched in all. "
+           "Section pages are used in order up to the first that did not fit.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-strip\\-common\n"
+           "With \\-L, fetch all linked pages before playing and remove paragraphs that appear on most of them, "
+           "such as navigation menus, sidebars and footers.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-o \" \" \\fIFILE\\fR\n"
-           "Output file for converted text.\n"
+           "Output file for converted text. With \\-m, the text sent to mbeep is also written to it, in rows "
+           "as long as they would be without \\-m unless \\-c is given.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-m\n"
            "Send converted text to mbeep.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-tee \" \" \\fIFILE\\fR\n"
+           "Also write converted text to \\fIFILE\\fR, or to standard output if it is \\-, from the same "
+           "conversion. May be repeated.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-tee\\-mbeep \" \" \\fIWPM\\fR \" \" \\fIWAV_FILE_NAME\\fR\n"
+           "Also send converted text to another mbeep at \\fIWPM\\fR PARIS words per minute and the "
+           "frequency of \\-f, writing \\fIWAV_FILE_NAME\\fR unless it is \\-. May be repeated. "
+           "Each file and mbeep written to this way has a buffer of its own, so a slow file does not hold up "
+           "the others until a megabyte is waiting for it, and an mbeep, whose words go on in a temporary file "
+           "once a megabyte is waiting, never does. With \\-m, "
+           "the first mbeep sets the pace of conversion for all; to write files at once while an mbeep "
+           "sounds the words, use \\-\\-tee\\-mbeep instead of \\-m. Keys typed and \\-p apply to "
+           "the first mbeep, and words sent again after \\fBb\\fR are sent only to it.\n"
            
            "\n"
            ".TP\n"
            ".BR \\-p\n"
-           "Remember position in input stream and use when resuming.\n"
+           "Remember position in input stream and use when resuming. "
+           "While playing, the position is also saved every few seconds, so it is not lost if morsefeed is interrupted. "
+           "The words following the position are remembered too, so that if the file has since been edited, "
+           "resuming continues from the same words rather than the same byte offset.\n"
 
            "\n"
            ".TP\n"
@@ -214,6 +345,120 @@ void man_page_source(void)
            ".BR \\-n \" \" \\fINUMBER_OF_WORDS\\fR\n"
            "Total number of words to print. Default is all.\n"
            "\n"
+           ".TP\n"
+           ".BR \\-\\-progress\n"
+           "Show percentage sent, elapsed time and estimated time remaining on standard error. "
+           "Times are computed from the Morse code speed options.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-minutes \" \" \\fIMINUTES\\fR\n"
+           "Stop after sending for number of minutes, computed from the Morse code speed options.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-stage\\-stats\n"
+           "Text is read, stripped of HTML, converted and written by four threads, each passing blocks of "
+           "work to the next through a queue. Show on standard error how many blocks went through each queue, "
+           "how full it was, and how often a thread waited because the queue was full or empty.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-cache \" \" \\fIMEGABYTES\\fR\n"
+           "Keep the words converted from a page or file in \\fI~/.morsefeed.cache\\fR, and use "
+           "them instead of converting the same text again with the same options. Once the words kept take "
+           "more than \\fIMEGABYTES\\fR, those least recently used are removed.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-cache\\-stats\n"
+           "Show on standard error whether the words were found in the cache, the hits and misses of all "
+           "runs, and how many entries the cache holds.\n"
+           "\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-serve \" \" \\fISOCKET\\fR\n"
+           "Run as a server on the Unix domain socket, converting each source once for all clients that ask for it "
+           "and keeping web connections open between fetches. "
+           "A client sends one line, the source and the word to start at separated by a tab; the source is a "
+           "label saved with \\fB\\-s\\fR or a URL. The server replies \\fBok\\fR, the start and the number of "
+           "words, or \\fBerror\\fR and an error code, then sends one word per line. "
+           "Sources are converted again after 15 minutes, while clients keep getting the copy they have; a new "
+           "source holds back only the clients that asked for it. Stop the server with control\\-C.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-connect \" \" \\fISOCKET\\fR \" \" \\fISOURCE\\fR\n"
+           "Get a source converted by a server started with \\fB\\-\\-serve\\fR, and write it like converted text. "
+           "Pipe the output to \\fBmorsefeed \\-m\\fR to hear it. "
+           "With \\fB\\-p\\fR, the number of words received is saved and the next connection starts after them.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-start \" \" \\fIWORD\\fR\n"
+           "With \\fB\\-\\-connect\\fR, a book or an input file, the number of words to skip. Default is 0, or "
+           "the saved position with \\fB\\-p\\fR. Words are counted as they are converted, so the same number "
+           "starts at the same word in each; an input file is started at the beginning of the text the word was "
+           "converted from. The place of every 1024th word of an input file is kept in an index next to the "
+           "state file, made again when the file changes.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-percent \" \" \\fIPERCENT\\fR\n"
+           "Start a book or an input file at the first word at or after this percentage of its text.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-back \" \" \\fIPARAGRAPHS\\fR\n"
+           "Start an input file this many paragraphs before where it would start otherwise; 1 is the "
+           "beginning of the paragraph it would start in. Paragraphs are separated by blank lines.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-compile \" \" \\fIBOOK_FILE\\fR\n"
+           "Convert the input file or URL, between the \\fB\\-a\\fR and \\fB\\-b\\fR markers, once and write "
+           "the words to a book file instead of playing them. Each different word is kept once. A book given "
+           "with \\fB\\-i\\fR is played without converting anything, and can start at any word with "
+           "\\fB\\-\\-start\\fR or any percentage with \\fB\\-\\-percent\\fR. With \\fB\\-p\\fR, the "
+           "position saved for a book is the number of words heard.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-batch \" \" \\fIOUTPUT_DIR\\fR \" \" \\fIINPUT\\fR ...\n"
+           "Convert many files at once, each to a file in the output directory with the same name and .out added. "
+           "Every argument after the output directory is an input: a file, a directory whose files are all converted, "
+           "or a quoted pattern such as \\fB'books/*.txt'\\fR. Options such as \\fB\\-c\\fR, \\fB\\-n\\fR, "
+           "\\fB\\-a\\fR and \\fB\\-b\\fR must come before. Large files are split so that all threads are kept busy; "
+           "the output is the same as converting each file alone. Files per second and megabytes per second are "
+           "printed at the end.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-watch \" \" \\fIINPUT_DIR\\fR \" \" \\fIOUTPUT_DIR\\fR\n"
+           "Convert each file in the input directory as \\fB\\-\\-batch\\fR would, then keep watching it and convert "
+           "each file as soon as it is closed after writing or moved in, until stopped with Ctrl-C. Files whose "
+           "names start with . are ignored, and the output directory must be another one. The size and time "
+           "of each file converted are kept in the state file, so that after a restart only "
+           "files that are new or have changed are converted.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-catalog \" \" \\fIDIR\\fR\n"
+           "Update the catalog of the files in a directory and show the number of files and words and how often "
+           "each character occurs. For each file the catalog keeps the number of words, the place of every 1024th "
+           "word and how often each character occurs; it is kept next to the state file, and only files that have "
+           "changed since are read again, on several threads.\n"
+
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-sample \" \" \\fIDIR\\fR\n"
+           "Update the catalog of a directory, pick a word at random from all of its files, and use the file it is "
+           "in as input starting at that word. Only the words played are read, so with \\fB\\-n\\fR a short "
+           "passage of a large library starts at once. With \\fB\\-a\\fR or \\fB\\-b\\fR the file is read "
+           "whole to find them. No position is saved with \\fB\\-p\\fR.\n"
+           "\n"
+           ".TP\n"
+           ".BR \\-\\-threads \" \" \\fICOUNT\\fR\n"
+           "Number of threads for \\fB\\-\\-batch\\fR, \\fB\\-\\-watch\\fR and \\fB\\-\\-catalog\\fR, and for an input file of 2 MB or more given with "
+           "\\fB\\-i\\fR and converted to text, which is split so that its parts are converted at the same time. "
+           "Default is the number of processors.\n"
 
            "\n"
            ".TP\n"
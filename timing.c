@@ -0,0 +1,210 @@
+//
+//  timing.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "morsefeed.h"
+#include "timing.h"
+
+#define DEFAULT_PARIS_WPM 20.0
+
+// PARIS is 50 units: 31 units of elements and element gaps, 4 character gaps, 1 word gap
+#define PARIS_ELEMENT_UNITS 31.0
+#define PARIS_CHAR_GAPS 4.0
+
+// CODEX words are 60 units long instead of 50
+#define CODEX_TO_PARIS (60.0 / 50.0)
+
+void timing_init(MorseTiming *timing, double paris_wpm, double codex_wpm, double farnsworth_wpm,
+                 double word_space_wpm)
+{
+    double wpm = DEFAULT_PARIS_WPM;
+    double char_wpm;
+
+    if (paris_wpm != DEFAULT) {
+        wpm = paris_wpm;
+
+    } else if (codex_wpm != DEFAULT) {
+        wpm = codex_wpm * CODEX_TO_PARIS;
+    }
+
+    char_wpm = farnsworth_wpm != DEFAULT && farnsworth_wpm > wpm ? farnsworth_wpm : wpm;
+
+    timing->dit = 1.2 / char_wpm;
+    timing->char_gap = 3 * timing->dit;
+    timing->word_gap = 7 * timing->dit;
+
+    if (char_wpm > wpm) {
+        // ARRL Farnsworth timing: stretch the 19 units of character and word gaps
+        double delay = (60.0 * char_wpm - 37.2 * wpm) / (char_wpm * wpm);
+        timing->char_gap = 3.0 * delay / 19.0;
+        timing->word_gap = 7.0 * delay / 19.0;
+    }
+
+    if (word_space_wpm != DEFAULT && word_space_wpm < wpm) {
+        // only the word gap grows, so that a PARIS word takes 60 / word_space_wpm seconds
+        double word_gap = 60.0 / word_space_wpm -
+            (PARIS_ELEMENT_UNITS * timing->dit + PARIS_CHAR_GAPS * timing->char_gap);
+        if (word_gap > timing->word_gap) timing->word_gap = word_gap;
+    }
+}
+
+const char *morse_pattern(char c)
+{
+    const char *pattern = NULL;
+
+    switch (toupper((unsigned char)c)) {
+        case 'A':   pattern = ".-";         break;
+        case 'B':   pattern = "-...";       break;
+        case 'C':   pattern = "-.-.";       break;
+        case 'D':   pattern = "-..";        break;
+        case 'E':   pattern = ".";          break;
+        case 'F':   pattern = "..-.";       break;
+        case 'G':   pattern = "--.";        break;
+        case 'H':   pattern = "....";       break;
+        case 'I':   pattern = "..";         break;
+        case 'J':   pattern = ".---";       break;
+        case 'K':   pattern = "-.-";        break;
+        case 'L':   pattern = ".-..";       break;
+        case 'M':   pattern = "--";         break;
+        case 'N':   pattern = "-.";         break;
+        case 'O':   pattern = "---";        break;
+        case 'P':   pattern = ".--.";       break;
+        case 'Q':   pattern = "--.-";       break;
+        case 'R':   pattern = ".-.";        break;
+        case 'S':   pattern = "...";        break;
+        case 'T':   pattern = "-";          break;
+        case 'U':   pattern = "..-";        break;
+        case 'V':   pattern = "...-";       break;
+        case 'W':   pattern = ".--";        break;
+        case 'X':   pattern = "-..-";       break;
+        case 'Y':   pattern = "-.--";       break;
+        case 'Z':   pattern = "--..";       break;
+        case '0':   pattern = "-----";      break;
+        case '1':   pattern = ".----";      break;
+        case '2':   pattern = "..---";      break;
+        case '3':   pattern = "...--";      break;
+        case '4':   pattern = "....-";      break;
+        case '5':   pattern = ".....";      break;
+        case '6':   pattern = "-....";      break;
+        case '7':   pattern = "--...";      break;
+        case '8':   pattern = "---..";      break;
+        case '9':   pattern = "----.";      break;
+        case '.':   pattern = ".-.-.-";     break;
+        case ',':   pattern = "--..--";     break;
+        case '?':   pattern = "..--..";     break;
+        case '/':   pattern = "-..-.";      break;
+        case '=':   pattern = "-...-";      break;  // BT
+        case '|':   pattern = ".-.-";       break;  // AA
+    }
+
+    return pattern;
+}
+
+// Time from the start of the word to the start of the next word.
+double timing_word_seconds(const MorseTiming *timing, const char *word)
+{
+    double units = 0;
+    size_t chars = 0;
+
+    for (const char *p = word; *p != '\0'; p++) {
+        const char *pattern = morse_pattern(*p);
+
+        if (pattern != NULL) {
+            size_t k;
+
+            for (k = 0; pattern[k] != '\0'; k++) {
+                units += pattern[k] == '-' ? 3 : 1;
+            }
+
+            // gaps between elements
+            units += k - 1;
+            chars++;
+        }
+    }
+
+    if (chars == 0) {
+        return 0;
+
+    } else {
+        return units * timing->dit + (chars - 1) * timing->char_gap + timing->word_gap;
+    }
+}
+
+void format_duration(char *str, size_t str_size, double seconds)
+{
+    long total = seconds < 0 ? 0 : (long)(seconds + 0.5);
+
+    if (total >= 3600) {
+        snprintf(str, str_size, "%ld:%02ld:%02ld", total / 3600, (total / 60) % 60, total % 60);
+
+    } else {
+        snprintf(str, str_size, "%ld:%02ld", total / 60, total % 60);
+    }
+}
+
+#if DEBUG
+bool close_to(double a, double b);
+bool close_to(double a, double b)
+{
+    return a - b < 1e-9 && b - a < 1e-9;
+}
+
+void timing_tests(void)
+{
+    bool ok = true;
+    MorseTiming timing;
+    char str[32];
+    printf("timing_tests()\n");
+
+    // PARIS at 20 wpm is 50 dits of 60 ms
+    timing_init(&timing, DEFAULT, DEFAULT, DEFAULT, DEFAULT);
+    ok &= print_if_fail(close_to(timing.dit, 0.060), "FAIL: timing_init (1)");
+    ok &= print_if_fail(close_to(timing_word_seconds(&timing, "PARIS"), 3.0), "FAIL: timing_word_seconds (1)");
+    ok &= print_if_fail(close_to(timing_word_seconds(&timing, "paris"), 3.0), "FAIL: timing_word_seconds (2)");
+    ok &= print_if_fail(timing_word_seconds(&timing, "") == 0, "FAIL: timing_word_seconds (3)");
+
+    timing_init(&timing, DEFAULT, 10.0, DEFAULT, DEFAULT);
+    ok &= print_if_fail(close_to(timing_word_seconds(&timing, "PARIS"), 5.0), "FAIL: timing_init (2)");
+
+    // Farnsworth and word spacing keep the overall PARIS rate
+    timing_init(&timing, 10.0, DEFAULT, 20.0, DEFAULT);
+    ok &= print_if_fail(close_to(timing.dit, 0.060), "FAIL: timing_init (3)");
+    ok &= print_if_fail(close_to(timing_word_seconds(&timing, "PARIS"), 6.0), "FAIL: timing_init (4)");
+
+    timing_init(&timing, 20.0, DEFAULT, DEFAULT, 10.0);
+    ok &= print_if_fail(close_to(timing_word_seconds(&timing, "PARIS"), 6.0), "FAIL: timing_init (5)");
+
+    format_duration(str, sizeof(str), 3725);
+    ok &= print_if_fail(strcmp(str, "1:02:05") == 0, "FAIL: format_duration (1)");
+    format_duration(str, sizeof(str), 65);
+    ok &= print_if_fail(strcmp(str, "1:05") == 0, "FAIL: format_duration (2)");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
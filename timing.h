@@ -0,0 +1,53 @@
+//
+//  timing.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef timing_h
+#define timing_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Durations in seconds, derived from the same speed options that are passed to mbeep.
+struct MorseTiming {
+    double dit;             // one dit, also the gap between elements of a character
+    double char_gap;        // gap between characters of a word
+    double word_gap;        // gap between words
+};
+typedef struct MorseTiming MorseTiming;
+
+void timing_init(MorseTiming *timing, double paris_wpm, double codex_wpm, double farnsworth_wpm,
+                 double word_space_wpm);
+
+const char *morse_pattern(char c);
+double timing_word_seconds(const MorseTiming *timing, const char *word);
+
+void format_duration(char *str, size_t str_size, double seconds);
+
+#if DEBUG
+void timing_tests(void);
+#endif
+
+#endif /* timing_h */
@@ -320,42 +320,50 @@ StringArray read_string_array(const char *path)
 
 void write_string_array(const char *path, const StringArray *array)
 {
-    size_t row;
-    size_t col;
-    size_t k;
     FILE *file = fopen(path, "w");
 
     if (file == NULL) {
         fprintf(stderr, "Unable to open %s for writing.\n", path);
 
     } else {
-        for (row = 0; row < array->size; row++) {
-            StringVector vector;
-            vector_at((Vector *)array, row, &vector);
-
-            for (col = 0; col < vector.size; col++) {
-                const char *str = string_vector_at(&vector, col);
-                for (k = 0; k < strlen(str); k++) {
-                    switch (str[k]) {
-                        case '\t':  fprintf(file, "\\t");   break;
-                        case '\n':  fprintf(file, "\\n");   break;
-                        case '\r':  fprintf(file, "\\r");   break;
-                        case '\\':  fprintf(file, "\\\\");  break;
-                        default:
-                            fprintf(file, "%c", str[k]);
-                            break;
-                    }
-                }
+        write_string_array_to_file(file, array);
+        fclose(file);
+        file = NULL;
+    }
+}
 
-                if (col < vector.size - 1) fprintf(file, "\t");
+bool write_string_array_to_file(FILE *file, const StringArray *array)
+{
+    size_t row;
+    size_t col;
+    size_t k;
+    bool success = true;
+
+    for (row = 0; row < array->size; row++) {
+        StringVector vector;
+        vector_at((Vector *)array, row, &vector);
+
+        for (col = 0; col < vector.size; col++) {
+            const char *str = string_vector_at(&vector, col);
+            for (k = 0; k < strlen(str); k++) {
+                switch (str[k]) {
+                    case '\t':  fprintf(file, "\\t");   break;
+                    case '\n':  fprintf(file, "\\n");   break;
+                    case '\r':  fprintf(file, "\\r");   break;
+                    case '\\':  fprintf(file, "\\\\");  break;
+                    default:
+                        fprintf(file, "%c", str[k]);
+                        break;
+                }
             }
 
-            fprintf(file, "\n");
+            if (col < vector.size - 1) fprintf(file, "\t");
         }
 
-        fclose(file);
-        file = NULL;
+        if (fprintf(file, "\n") < 0) success = false;
     }
+
+    return success;
 }
 
 void string_array_free(StringArray *array)
@@ -364,6 +372,212 @@ void string_array_free(StringArray *array)
     vector_free(array);
 }
 
+// FNV-1a
+uint64_t hash_bytes(const void *p, size_t length, uint64_t seed)
+{
+    const unsigned char *bytes = p;
+    uint64_t hash = 14695981039346656037ULL ^ seed;
+
+    for (size_t k = 0; k < length; k++) {
+        hash ^= bytes[k];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+uint64_t hash_string(const char *str)
+{
+    return hash_bytes(str, strlen(str), 0);
+}
+
+// Unsigned numbers seven bits to a byte, lowest first, with the high bit set on all but the last
+bool write_varint(FILE *file, uint64_t value)
+{
+    while (value >= 0x80) {
+        if (putc((int)(value & 0x7F) | 0x80, file) == EOF) return false;
+        value >>= 7;
+    }
+
+    return putc((int)value, file) != EOF;
+}
+
+// The number at *next, which is moved past it, or false if it does not end before size.
+bool read_varint(const void *p, size_t size, size_t *next, uint64_t *value)
+{
+    const unsigned char *bytes = p;
+
+    *value = 0;
+
+    for (unsigned shift = 0; *next < size && shift < 64; shift += 7) {
+        unsigned char byte = bytes[(*next)++];
+
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+
+    return false;
+}
+
+StringMap string_map_create(size_t capacity)
+{
+    StringMap map = { 0, 0, NULL, NULL };
+    size_t slots = 8;
+
+    while (slots < 2 * capacity) slots *= 2;
+
+    map.keys = calloc(slots, sizeof(char *));
+    map.values = calloc(slots, sizeof(size_t));
+
+    if (map.keys == NULL || map.values == NULL) {
+        free(map.keys);
+        free(map.values);
+        map.keys = NULL;
+        map.values = NULL;
+
+    } else {
+        map.capacity = slots;
+    }
+
+    return map;
+}
+
+size_t string_map_slot(const StringMap *map, const char *key);
+size_t string_map_slot(const StringMap *map, const char *key)
+{
+    size_t slot = hash_string(key) & (map->capacity - 1);
+
+    while (map->keys[slot] != NULL && strcmp(map->keys[slot], key) != 0) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+
+    return slot;
+}
+
+bool string_map_grow(StringMap *map);
+bool string_map_grow(StringMap *map)
+{
+    StringMap bigger = string_map_create(map->capacity);
+
+    if (bigger.capacity == 0) return false;
+
+    for (size_t k = 0; k < map->capacity; k++) {
+        if (map->keys[k] != NULL) {
+            size_t slot = string_map_slot(&bigger, map->keys[k]);
+            bigger.keys[slot] = map->keys[k];
+            bigger.values[slot] = map->values[k];
+            bigger.size++;
+        }
+    }
+
+    free(map->keys);
+    free(map->values);
+    *map = bigger;
+
+    return true;
+}
+
+bool string_map_put(StringMap *map, const char *key, size_t value)
+{
+    bool success = true;
+    size_t slot;
+
+    // keep load factor at or below 1/2
+    if (2 * (map->size + 1) > map->capacity) {
+        if (map->capacity == 0) {
+            *map = string_map_create(0);
+            success = map->capacity > 0;
+
+        } else {
+            success = string_map_grow(map);
+        }
+    }
+
+    if (success) {
+        slot = string_map_slot(map, key);
+
+        if (map->keys[slot] == NULL) {
+            map->keys[slot] = malloc(strlen(key) + 1);
+            if (map->keys[slot] == NULL) {
+                success = false;
+
+            } else {
+                strcpy(map->keys[slot], key);
+                map->size++;
+            }
+        }
+
+        if (success) map->values[slot] = value;
+    }
+
+    return success;
+}
+
+bool string_map_get(const StringMap *map, const char *key, size_t *value)
+{
+    bool found = false;
+
+    if (map->capacity > 0) {
+        size_t slot = string_map_slot(map, key);
+
+        if (map->keys[slot] != NULL) {
+            if (value != NULL) *value = map->values[slot];
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+bool string_map_remove(StringMap *map, const char *key)
+{
+    bool found = false;
+
+    if (map->capacity > 0) {
+        size_t slot = string_map_slot(map, key);
+        size_t mask = map->capacity - 1;
+
+        if (map->keys[slot] != NULL) {
+            size_t next = (slot + 1) & mask;
+
+            found = true;
+            free(map->keys[slot]);
+            map->keys[slot] = NULL;
+            map->size--;
+
+            // shift back any following keys that probed past the removed one
+            while (map->keys[next] != NULL) {
+                size_t home = hash_string(map->keys[next]) & mask;
+
+                if (((next - home) & mask) >= ((next - slot) & mask)) {
+                    map->keys[slot] = map->keys[next];
+                    map->values[slot] = map->values[next];
+                    map->keys[next] = NULL;
+                    slot = next;
+                }
+
+                next = (next + 1) & mask;
+            }
+        }
+    }
+
+    return found;
+}
+
+void string_map_free(StringMap *map)
+{
+    for (size_t k = 0; k < map->capacity; k++) {
+        free(map->keys[k]);
+    }
+
+    free(map->keys);
+    free(map->values);
+    map->keys = NULL;
+    map->values = NULL;
+    map->size = 0;
+    map->capacity = 0;
+}
+
 CString cstring_create(size_t capacity)
 {
     CString cstring = vector_create(capacity == 0 ? 1 : capacity, sizeof(char));
@@ -436,6 +650,26 @@ bool cstring_append_char(CString *cstring, const char c)
     return cstring_append(cstring, cc);
 }
 
+// Same escapes as write_string_array
+bool cstring_append_escaped(CString *cstring, const char *str)
+{
+    bool success = true;
+
+    for (size_t k = 0; str[k] != '\0' && success; k++) {
+        switch (str[k]) {
+            case '\t':  success = cstring_append(cstring, "\\t");   break;
+            case '\n':  success = cstring_append(cstring, "\\n");   break;
+            case '\r':  success = cstring_append(cstring, "\\r");   break;
+            case '\\':  success = cstring_append(cstring, "\\\\");  break;
+            default:
+                success = cstring_append_char(cstring, str[k]);
+                break;
+        }
+    }
+
+    return success;
+}
+
 void cstring_clear(CString *cstring)
 {
     if (cstring->size >= 1) {
@@ -643,6 +877,54 @@ void vector_tests(void)
 
     cstring_free(&cstring);
 
+    // string_map
+    StringMap map = string_map_create(0);
+    char key[16];
+    size_t value = 0;
+    bool map_ok = true;
+
+    for (size_t k = 0; k < 100; k++) {
+        sprintf(key, "key%d", (int)k);
+        map_ok &= string_map_put(&map, key, k);
+    }
+    ok &= print_if_fail(map_ok && map.size == 100, "FAIL: string_map_put (1)");
+    ok &= print_if_fail(string_map_put(&map, "key7", 700) && map.size == 100, "FAIL: string_map_put (2)");
+    ok &= print_if_fail(string_map_get(&map, "key7", &value) && value == 700, "FAIL: string_map_get (1)");
+    ok &= print_if_fail(!string_map_get(&map, "key100", &value), "FAIL: string_map_get (2)");
+
+    for (size_t k = 0; k < 100; k += 2) {
+        sprintf(key, "key%d", (int)k);
+        map_ok &= string_map_remove(&map, key);
+    }
+    ok &= print_if_fail(map_ok && map.size == 50, "FAIL: string_map_remove (1)");
+    ok &= print_if_fail(!string_map_remove(&map, "key0"), "FAIL: string_map_remove (2)");
+
+    for (size_t k = 1; k < 100; k += 2) {
+        sprintf(key, "key%d", (int)k);
+        map_ok &= string_map_get(&map, key, &value) && value == (k == 7 ? 700 : k);
+    }
+    ok &= print_if_fail(map_ok, "FAIL: string_map_get (3)");
+
+    string_map_free(&map);
+
+    // write_varint read_varint
+    char packed[32];
+    FILE *file = tmpfile();
+    size_t next = 0;
+    uint64_t number = 0;
+
+    ok &= print_if_fail(write_varint(file, 0) && write_varint(file, 300) && write_varint(file, UINT64_MAX) &&
+                        ftell(file) == 13, "FAIL: write_varint (1)");
+    rewind(file);
+    ok &= print_if_fail(fread(packed, 1, sizeof(packed), file) == 13 && packed[1] == (char)0xAC, "FAIL: write_varint (2)");
+    fclose(file);
+    ok &= print_if_fail(read_varint(packed, 13, &next, &number) && number == 0 && next == 1 &&
+                        read_varint(packed, 13, &next, &number) && number == 300 && next == 3 &&
+                        read_varint(packed, 13, &next, &number) && number == UINT64_MAX && next == 13,
+                        "FAIL: read_varint (1)");
+    next = 1;
+    ok &= print_if_fail(!read_varint(packed, 2, &next, &number), "FAIL: read_varint (2)");
+
     printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
 }
 #endif
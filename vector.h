@@ -29,6 +29,8 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 struct Vector {
     size_t size;
@@ -65,12 +67,35 @@ void print_string(const char *p);
 
 StringArray read_string_array(const char *path);
 void write_string_array(const char *path, const StringArray *array);
+bool write_string_array_to_file(FILE *file, const StringArray *array);
 void string_array_free(StringArray *array);
 
+// Open-addressing hash table from string keys to indexes; keys are copied
+struct StringMap {
+    size_t size;
+    size_t capacity;    // always 0 or a power of 2
+    char **keys;
+    size_t *values;
+};
+typedef struct StringMap StringMap;
+
+uint64_t hash_bytes(const void *p, size_t length, uint64_t seed);
+uint64_t hash_string(const char *str);
+
+bool write_varint(FILE *file, uint64_t value);
+bool read_varint(const void *p, size_t size, size_t *next, uint64_t *value);
+
+StringMap string_map_create(size_t capacity);
+bool string_map_put(StringMap *map, const char *key, size_t value);
+bool string_map_get(const StringMap *map, const char *key, size_t *value);
+bool string_map_remove(StringMap *map, const char *key);
+void string_map_free(StringMap *map);
+
 CString cstring_create(size_t capacity);
 const char *cstring_p(CString *cstring);
 bool cstring_append(CString *cstring, const char *str);
 bool cstring_append_char(CString *cstring, const char c);
+bool cstring_append_escaped(CString *cstring, const char *str);
 void cstring_clear(CString *cstring);
 void cstring_free(CString *cstring);
 
@@ -0,0 +1,540 @@
+//
+//  watch.c
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef _POSIX_C_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "state.h"
+#include "watch.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+#define FORGET_EVENTS (IN_DELETE | IN_MOVED_FROM)
+#define EVENT_BUFFER_SIZE (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+bool same_record(const WatchRecord *record, const struct stat *info);
+bool same_record(const WatchRecord *record, const struct stat *info)
+{
+    return record->size == (uint64_t)info->st_size && record->modified_seconds == info->st_mtim.tv_sec &&
+           record->modified_nanoseconds == info->st_mtim.tv_nsec;
+}
+
+// Rows are: WATCH_KIND, full path of the input file, size, and seconds and nanoseconds of the
+// time it was modified.
+bool remember_record(Watch *watch, const char *path, const WatchRecord *record);
+bool remember_record(Watch *watch, const char *path, const WatchRecord *record)
+{
+    size_t index;
+
+    if (string_map_get(&watch->recorded, path, &index)) {
+        ((WatchRecord *)watch->records.p)[index] = *record;
+        return true;
+    }
+
+    return vector_push(&watch->records, record) && string_map_put(&watch->recorded, path, watch->records.size - 1);
+}
+
+MorseFeedError watch_open(Watch *watch, const char *input_dir, const char *output_dir, const MorseFeedParams *mfp)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    StateStore store;
+
+    memset(watch, 0, sizeof(*watch));
+    watch->input_dir = realpath(input_dir, NULL);
+    watch->output_dir = output_dir;
+    watch->mfp = mfp;
+    watch->queue = string_vector_create(0);
+    watch->pending = string_map_create(0);
+    watch->recorded = string_map_create(0);
+    watch->records = vector_create(0, sizeof(WatchRecord));
+    pthread_mutex_init(&watch->mutex, NULL);
+    pthread_cond_init(&watch->work, NULL);
+    watch->journal.fd = -1;
+    watch->journal.lock_fd = -1;
+
+    if (watch->input_dir == NULL) error = MF_INPUT_FILE_OPEN_ERROR;
+    if (error == MF_NO_ERROR && mkdir(output_dir, 0777) != 0 && errno != EEXIST) error = MF_OUTPUT_FILE_OPEN_ERROR;
+
+    // written into the input directory, the output would be converted too
+    if (error == MF_NO_ERROR) {
+        char *full_output_dir = realpath(output_dir, NULL);
+
+        if (full_output_dir == NULL || strcmp(full_output_dir, watch->input_dir) == 0) error = MF_INVALID_VALUE;
+        free(full_output_dir);
+    }
+
+    // with no state file, files are only known while watching
+    if (error == MF_NO_ERROR && mfp->state_path != NULL) {
+        StringVector missing = string_vector_create(0);
+
+        error = state_open(&store, mfp->state_path, false);
+
+        for (size_t k = 0; k < store.rows.size && error == MF_NO_ERROR; k++) {
+            StringVector *row = (StringVector *)store.rows.p + k;
+            WatchRecord record;
+            struct stat info;
+
+            if (row->size >= 5 && strcmp(string_vector_at(row, 0), WATCH_KIND) == 0) {
+                record.size = strtoull(string_vector_at(row, 2), NULL, 10);
+                record.modified_seconds = strtoll(string_vector_at(row, 3), NULL, 10);
+                record.modified_nanoseconds = strtoll(string_vector_at(row, 4), NULL, 10);
+
+                if (stat(string_vector_at(row, 1), &info) != 0 && errno == ENOENT) {
+                    if (!string_vector_push(&missing, string_vector_at(row, 1))) error = MF_OUT_OF_MEMORY;
+
+                } else if (!remember_record(watch, string_vector_at(row, 1), &record)) {
+                    error = MF_OUT_OF_MEMORY;
+                }
+            }
+        }
+
+        state_close(&store);
+
+        // rows of files gone since are dropped, so the state file does not grow with every file ever
+        // seen; the journal of the last run is folded in too
+        if (error == MF_NO_ERROR && (missing.size > 0 || store.has_journal) &&
+            state_open(&store, mfp->state_path, true) == MF_NO_ERROR) {
+            for (size_t k = 0; k < missing.size; k++) state_remove(&store, WATCH_KIND, string_vector_at(&missing, k));
+            state_commit(&store);
+            state_close(&store);
+        }
+
+        string_vector_free(&missing);
+    }
+
+    // converted rows are appended to the journal, without waiting for the state file
+    if (error == MF_NO_ERROR && mfp->state_path != NULL) error = journal_open(&watch->journal, mfp->state_path);
+
+    return error;
+}
+
+// Queues a file to be converted, unless it is already; one being converted is converted again after.
+void watch_queue(Watch *watch, const char *path)
+{
+    size_t pending;
+
+    pthread_mutex_lock(&watch->mutex);
+
+    if (!string_map_get(&watch->pending, path, &pending)) {
+        if (string_vector_push(&watch->queue, path)) {
+            string_map_put(&watch->pending, path, WATCH_QUEUED);
+            pthread_cond_signal(&watch->work);
+        }
+
+    } else if (pending == WATCH_RUNNING) {
+        string_map_put(&watch->pending, path, WATCH_AGAIN);
+    }
+
+    pthread_mutex_unlock(&watch->mutex);
+}
+
+// Takes ownership of row. It is appended to the journal, which the next update of the state file
+// folds in; only while that update holds the state file is the row put in it directly. A row of
+// just WATCH_KIND, path and 0 removes the file's row.
+MorseFeedError save_row(Watch *watch, StringVector *row);
+MorseFeedError save_row(Watch *watch, StringVector *row)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    StateStore store;
+
+    if (journal_append(&watch->journal, row)) {
+        string_vector_free(row);
+
+    } else {
+        error = state_open(&store, watch->mfp->state_path, true);
+
+        if (error != MF_NO_ERROR) {
+            string_vector_free(row);
+
+        } else if (row->size == 3) {
+            state_remove(&store, WATCH_KIND, string_vector_at(row, 1));
+            string_vector_free(row);
+
+        } else {
+            error = state_put(&store, row);
+        }
+
+        if (error == MF_NO_ERROR) error = state_commit(&store);
+        state_close(&store);
+    }
+
+    return error;
+}
+
+MorseFeedError save_record(Watch *watch, const char *path, const WatchRecord *record);
+MorseFeedError save_record(Watch *watch, const char *path, const WatchRecord *record)
+{
+    StringVector row = string_vector_create(5);
+    char str[32];
+    bool push_error = false;
+
+    push_error |= !string_vector_push(&row, WATCH_KIND);
+    push_error |= !string_vector_push(&row, path);
+    sprintf(str, "%llu", (unsigned long long)record->size);
+    push_error |= !string_vector_push(&row, str);
+    sprintf(str, "%lld", (long long)record->modified_seconds);
+    push_error |= !string_vector_push(&row, str);
+    sprintf(str, "%lld", (long long)record->modified_nanoseconds);
+    push_error |= !string_vector_push(&row, str);
+
+    if (push_error) {
+        string_vector_free(&row);
+        return MF_OUT_OF_MEMORY;
+    }
+
+    return save_row(watch, &row);
+}
+
+// Forgets a file deleted or moved out of the input directory.
+void watch_forget(Watch *watch, const char *path);
+void watch_forget(Watch *watch, const char *path)
+{
+    StringVector row = string_vector_create(3);
+    bool recorded;
+
+    pthread_mutex_lock(&watch->mutex);
+    recorded = string_map_remove(&watch->recorded, path);
+    pthread_mutex_unlock(&watch->mutex);
+
+    if (recorded && watch->mfp->state_path != NULL && string_vector_push(&row, WATCH_KIND) &&
+        string_vector_push(&row, path) && string_vector_push(&row, "0")) {
+        save_row(watch, &row);
+
+    } else {
+        string_vector_free(&row);
+    }
+}
+
+// Converts a file unless it is as it was when last converted; true if it was converted.
+bool watch_convert(Watch *watch, const char *path)
+{
+    MorseFeedError error = MF_NO_ERROR;
+    struct stat info;
+    WatchRecord record;
+    size_t index;
+    bool done = false;
+    char *out_path;
+    char *temp_path = NULL;
+    int fd = -1;
+
+    if (stat(path, &info) != 0 || !S_ISREG(info.st_mode)) return false;
+
+    pthread_mutex_lock(&watch->mutex);
+    if (string_map_get(&watch->recorded, path, &index)) done = same_record((WatchRecord *)watch->records.p + index, &info);
+    pthread_mutex_unlock(&watch->mutex);
+
+    if (done) return false;
+
+    out_path = output_path(watch->output_dir, path);
+    if (out_path == NULL || asprintf(&temp_path, "%s.XXXXXX", out_path) < 0) temp_path = NULL;
+    if (temp_path != NULL) fd = mkstemp(temp_path);
+
+    if (fd < 0) {
+        error = MF_OUTPUT_FILE_OPEN_ERROR;
+
+    } else {
+        close(fd);
+        error = convert_file(watch->mfp, path, temp_path);
+        if (error == MF_NO_ERROR && rename(temp_path, out_path) != 0) error = MF_FILE_WRITE_ERROR;
+        if (error != MF_NO_ERROR) remove(temp_path);
+    }
+
+    // as it was when read; if written since, it is converted again
+    record.size = info.st_size;
+    record.modified_seconds = info.st_mtim.tv_sec;
+    record.modified_nanoseconds = info.st_mtim.tv_nsec;
+
+    // stopped before done; converted after the next start
+    if (error == MF_EXIT) {
+        free(temp_path);
+        free(out_path);
+        return false;
+    }
+
+    // saved outside the lock, so that other workers do not wait on the state file
+    if (error == MF_NO_ERROR && watch->mfp->state_path != NULL) error = save_record(watch, path, &record);
+
+    pthread_mutex_lock(&watch->mutex);
+
+    if (error == MF_NO_ERROR && !remember_record(watch, path, &record)) error = MF_OUT_OF_MEMORY;
+
+    if (error == MF_NO_ERROR) {
+        watch->converted++;
+        fprintf(stderr, "(converted %s to %s)\n", path, out_path);
+
+    } else {
+        watch->failed++;
+        fprintf(stderr, "(could not convert %s: error %d)\n", path, error);
+    }
+
+    pthread_mutex_unlock(&watch->mutex);
+
+    free(temp_path);
+    free(out_path);
+
+    return error == MF_NO_ERROR;
+}
+
+void *watch_worker(void *arg);
+void *watch_worker(void *arg)
+{
+    Watch *watch = arg;
+
+    pthread_mutex_lock(&watch->mutex);
+
+    while (true) {
+        char *path = NULL;
+        size_t pending = WATCH_QUEUED;
+
+        while (watch->queue.size == 0 && !watch->stopping) pthread_cond_wait(&watch->work, &watch->mutex);
+        if (watch->stopping) break;
+
+        vector_delete_at(&watch->queue, 0, &path);
+        string_map_put(&watch->pending, path, WATCH_RUNNING);
+        pthread_mutex_unlock(&watch->mutex);
+
+        watch_convert(watch, path);
+
+        pthread_mutex_lock(&watch->mutex);
+        string_map_get(&watch->pending, path, &pending);
+        string_map_remove(&watch->pending, path);
+        pthread_mutex_unlock(&watch->mutex);
+
+        if (pending == WATCH_AGAIN) watch_queue(watch, path);
+        free(path);
+
+        pthread_mutex_lock(&watch->mutex);
+    }
+
+    pthread_mutex_unlock(&watch->mutex);
+
+    return NULL;
+}
+
+void watch_close(Watch *watch)
+{
+    string_vector_free(&watch->queue);
+    string_map_free(&watch->pending);
+    string_map_free(&watch->recorded);
+    vector_free(&watch->records);
+    pthread_mutex_destroy(&watch->mutex);
+    pthread_cond_destroy(&watch->work);
+    journal_close(&watch->journal);
+    free(watch->input_dir);
+}
+
+// Every file in the input directory, for those written while not watching, or after events
+// were lost.
+MorseFeedError watch_scan(Watch *watch);
+MorseFeedError watch_scan(Watch *watch)
+{
+    StringVector paths = string_vector_create(0);
+    const char *dir = watch->input_dir;
+    MorseFeedError error = collect_inputs(&dir, 1, watch->output_dir, &paths);
+
+    for (size_t k = 0; k < paths.size && error == MF_NO_ERROR; k++) watch_queue(watch, string_vector_at(&paths, k));
+
+    string_vector_free(&paths);
+
+    return error;
+}
+
+// Watches until stopped by a signal, then finishes the files being converted; those still
+// queued are converted after the next start.
+MorseFeedError watch_dir(const char *input_dir, const char *output_dir, const MorseFeedParams *mfp, int threads)
+{
+    MorseFeedError error;
+    Watch watch;
+    int notify_fd = -1;
+    pthread_t workers[BATCH_MAX_THREADS];
+    int started = 0;
+    bool signals = false;
+
+    error = watch_open(&watch, input_dir, output_dir, mfp);
+
+    if (error == MF_NO_ERROR) {
+        error = signals_open();
+        signals = error == MF_NO_ERROR;
+    }
+
+    // watched before the first scan, so that no file is missed between them
+    if (error == MF_NO_ERROR) {
+        notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notify_fd < 0 || inotify_add_watch(notify_fd, watch.input_dir, WATCH_EVENTS | FORGET_EVENTS) < 0) {
+            error = MF_INPUT_FILE_OPEN_ERROR;
+        }
+    }
+
+    threads = resolve_threads(threads);
+
+    for ( ; error == MF_NO_ERROR && started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, watch_worker, &watch) != 0) break;
+    }
+
+    if (error == MF_NO_ERROR && started == 0) error = MF_PROGRAM_ERR;
+    if (error == MF_NO_ERROR) error = watch_scan(&watch);
+
+    while (error == MF_NO_ERROR && signal_received() == 0) {
+        struct pollfd fds[2] = { { notify_fd, POLLIN, 0 }, { signals_fd(), POLLIN, 0 } };
+        char events[EVENT_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+        ssize_t length;
+
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) error = MF_PROGRAM_ERR;
+
+        while (error == MF_NO_ERROR && (length = read(notify_fd, events, sizeof(events))) > 0) {
+            for (char *p = events; p < events + length; ) {
+                const struct inotify_event *event = (const struct inotify_event *)p;
+                char *path = NULL;
+
+                if ((event->mask & IN_Q_OVERFLOW) != 0) {
+                    error = watch_scan(&watch);
+
+                } else if (event->len > 0 && event->name[0] != '.' && (event->mask & WATCH_EVENTS) != 0 &&
+                           asprintf(&path, "%s/%s", watch.input_dir, event->name) >= 0) {
+                    watch_queue(&watch, path);
+                    free(path);
+
+                } else if (event->len > 0 && (event->mask & FORGET_EVENTS) != 0 &&
+                           asprintf(&path, "%s/%s", watch.input_dir, event->name) >= 0) {
+                    watch_forget(&watch, path);
+                    free(path);
+                }
+
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&watch.mutex);
+    watch.stopping = true;
+    pthread_cond_broadcast(&watch.work);
+    pthread_mutex_unlock(&watch.mutex);
+
+    for (int k = 0; k < started; k++) pthread_join(workers[k], NULL);
+
+    if (watch.converted > 0 || watch.failed > 0) {
+        fprintf(stderr, "(%ld files converted, %ld could not be)\n", (long)watch.converted, (long)watch.failed);
+    }
+
+    if (notify_fd >= 0) close(notify_fd);
+    if (signals) signals_close();
+    watch_close(&watch);
+
+    return error;
+}
+
+#if DEBUG
+void watch_tests(void)
+{
+    bool ok = true;
+    Watch watch;
+    MorseFeedParams mfp;
+    StateStore store;
+    FILE *file;
+    char *path;
+    char *out_path;
+    struct stat info;
+    struct timespec later[2] = { { 0, UTIME_OMIT }, { 1, 0 } };
+    printf("watch_tests()\n");
+
+    memset(&mfp, 0, sizeof(mfp));
+    mfp.words_per_row = 3;
+    mfp.word_count = DEFAULT;
+    mfp.time_limit_minutes = DEFAULT;
+    mfp.max_megabytes = DEFAULT;
+    mfp.crawl_depth = DEFAULT;
+    mfp.state_path = "watch_state.tmp";
+
+    mkdir("watch_in.tmp", 0700);
+    file = fopen("watch_in.tmp/a.txt", "w");
+    fprintf(file, "One two, three.\n");
+    fclose(file);
+
+    ok &= print_if_fail(watch_open(&watch, "watch_in.tmp", "watch_in.tmp", &mfp) == MF_INVALID_VALUE,
+                        "FAIL: watch_open (1)");
+    watch_close(&watch);
+    ok &= print_if_fail(watch_open(&watch, "watch_in.tmp", "watch_out.tmp", &mfp) == MF_NO_ERROR &&
+                        watch.records.size == 0, "FAIL: watch_open (2)");
+
+    path = realpath("watch_in.tmp/a.txt", NULL);
+    out_path = output_path("watch_out.tmp", path);
+    ok &= print_if_fail(watch_convert(&watch, path) && stat(out_path, &info) == 0 && info.st_size > 0,
+                        "FAIL: watch_convert (1)");
+    ok &= print_if_fail(!watch_convert(&watch, path) && watch.converted == 1, "FAIL: watch_convert (2)");
+    ok &= print_if_fail(stat("watch_state.tmp.journal", &info) == 0 && info.st_size > 0 &&
+                        stat("watch_state.tmp", &info) != 0, "FAIL: watch_convert (5)");
+    watch_close(&watch);
+
+    // what was converted is known after a restart
+    ok &= print_if_fail(watch_open(&watch, "watch_in.tmp", "watch_out.tmp", &mfp) == MF_NO_ERROR &&
+                        watch.records.size == 1 && !watch_convert(&watch, path), "FAIL: watch_convert (3)");
+    utimensat(AT_FDCWD, path, later, 0);
+    ok &= print_if_fail(watch_convert(&watch, path) && watch.records.size == 1, "FAIL: watch_convert (4)");
+
+    // queued once while waiting
+    watch_queue(&watch, path);
+    watch_queue(&watch, path);
+    ok &= print_if_fail(watch.queue.size == 1, "FAIL: watch_queue (1)");
+    watch_forget(&watch, path);
+    ok &= print_if_fail(!string_map_get(&watch.recorded, path, NULL), "FAIL: watch_forget (1)");
+    watch_close(&watch);
+
+    // the row of a file deleted while not watching is dropped
+    ok &= print_if_fail(watch_open(&watch, "watch_in.tmp", "watch_out.tmp", &mfp) == MF_NO_ERROR &&
+                        watch.records.size == 0 && watch_convert(&watch, path), "FAIL: watch_open (3)");
+    watch_close(&watch);
+    remove(path);
+    ok &= print_if_fail(watch_open(&watch, "watch_in.tmp", "watch_out.tmp", &mfp) == MF_NO_ERROR &&
+                        watch.records.size == 0, "FAIL: watch_open (4)");
+    watch_close(&watch);
+    ok &= print_if_fail(state_open(&store, "watch_state.tmp", false) == MF_NO_ERROR &&
+                        state_find(&store, WATCH_KIND, path) == NULL, "FAIL: watch_open (5)");
+    state_close(&store);
+
+    remove(out_path);
+    free(out_path);
+    free(path);
+    rmdir("watch_out.tmp");
+    rmdir("watch_in.tmp");
+    remove("watch_state.tmp");
+    remove("watch_state.tmp.lock");
+    remove("watch_state.tmp.journal");
+
+    printf(ok ? "Others OK\n\n" : "Other FAILURE\n\n");
+}
+#endif
@@ -0,0 +1,89 @@
+//
+//  watch.h
+//  morsefeed
+//
+// Copyright (C) 2018-2021 Michael Budiansky. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without modification, are permitted
+// provided that the following conditions are met:
+//
+// Redistributions of source code must retain the above copyright notice, this list of conditions
+// and the following disclaimer.
+//
+// Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+// and the following disclaimer in the documentation and/or other materials provided with the
+// distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+// IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+// FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+// WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY
+// WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+
+#ifndef watch_h
+#define watch_h
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "morsefeed.h"
+#include "state.h"
+#include "vector.h"
+
+// With --watch, each file closed after writing in, or moved into, an input directory is converted
+// to the output directory as --batch would, on a fixed number of threads. The size and time
+// each file was modified are kept in the state file once it has been converted, so that a file
+// is converted again only when it has changed, and after a restart only files that are new or
+// changed since, including those written while not watching, are converted. A file written again
+// while being converted is converted once more after. Output is written to a temporary file and
+// renamed, so it is never seen half written. Rows of files deleted or moved out of the input
+// directory are dropped.
+#define WATCH_KIND "converted"
+
+typedef enum WatchPending {
+    WATCH_QUEUED = 1,
+    WATCH_RUNNING,
+    WATCH_AGAIN                     // written again while running
+} WatchPending;
+
+struct WatchRecord {
+    uint64_t size;
+    int64_t modified_seconds;
+    int64_t modified_nanoseconds;
+};
+typedef struct WatchRecord WatchRecord;
+
+struct Watch {
+    char *input_dir;                // full path
+    const char *output_dir;
+    const MorseFeedParams *mfp;
+    pthread_mutex_t mutex;          // for all below
+    pthread_cond_t work;
+    StringVector queue;             // paths, oldest first
+    StringMap pending;              // path -> WatchPending, while queued or running
+    StringMap recorded;             // path -> index in records
+    Vector records;                 // WatchRecord of files converted
+    bool stopping;
+    size_t converted;
+    size_t failed;
+    StateJournal journal;           // for rows of files converted, if there is a state file
+};
+typedef struct Watch Watch;
+
+MorseFeedError watch_open(Watch *watch, const char *input_dir, const char *output_dir, const MorseFeedParams *mfp);
+void watch_queue(Watch *watch, const char *path);
+bool watch_convert(Watch *watch, const char *path);
+void watch_close(Watch *watch);
+MorseFeedError watch_dir(const char *input_dir, const char *output_dir, const MorseFeedParams *mfp, int threads);
+
+#if DEBUG
+void watch_tests(void);
+#endif
+
+#endif /* watch_h */